@@ -0,0 +1,365 @@
+/**
+ * @file
+ * @brief This file implements the index declared in btree.h.
+ *
+ * Full nodes are split on the way down, before the pair is added, so a
+ * split never has to go back up the tree, and running out of memory
+ * leaves the tree as it was. The separators of inner nodes are copies of
+ * the first pair of their right child, and stay valid after that pair is
+ * removed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "btree.h"
+
+/**
+ * @brief The max number of pairs in a node.
+ */
+#define BTREE_ORDER	64
+
+struct bt_pair {
+	long value;
+	char *key;
+};
+
+struct bt_node {
+	int leaf;
+	int count;
+	/// The pairs of a leaf, or the separators of an inner node.
+	struct bt_pair pairs[BTREE_ORDER];
+	/// The number of times each pair of a leaf was added.
+	int refs[BTREE_ORDER];
+	/// The count + 1 children of an inner node.
+	struct bt_node *children[BTREE_ORDER + 1];
+	/// The next leaf, in order.
+	struct bt_node *next;
+};
+
+struct btree {
+	/// Held for writing while pairs are added or removed.
+	pthread_rwlock_t lock;
+	struct bt_node *root;
+	/// The number of distinct pairs.
+	long count;
+};
+
+/**
+ * @brief Order a pair against the pair of a node.
+ */
+static int compare(long value, const char *key, const struct bt_pair *pair)
+{
+	if (value != pair->value)
+		return value < pair->value ? -1 : 1;
+	return strcmp(key, pair->key);
+}
+
+/**
+ * @brief Return the first pair of a node that is not before the given one.
+ */
+static int lower_bound(struct bt_node *node, long value, const char *key)
+{
+	int low = 0, high = node->count;
+
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (compare(value, key, &node->pairs[mid]) > 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/**
+ * @brief Return the child of an inner node the given pair belongs to.
+ */
+static int child_index(struct bt_node *node, long value, const char *key)
+{
+	int low = 0, high = node->count;
+
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (compare(value, key, &node->pairs[mid]) >= 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/**
+ * @brief Split the full child i of a node that is not full.
+ *
+ * @return Returns 0 on success, and -1 if there is no memory.
+ */
+static int split_child(struct bt_node *parent, int i)
+{
+	struct bt_node *child = parent->children[i];
+	struct bt_node *right = calloc(1, sizeof *right);
+	int mid = child->count / 2;
+	struct bt_pair separator;
+
+	if (right == NULL)
+		return -1;
+
+	right->leaf = child->leaf;
+
+	if (child->leaf) {
+		separator.value = child->pairs[mid].value;
+		separator.key = strdup(child->pairs[mid].key);
+		if (separator.key == NULL) {
+			free(right);
+			return -1;
+		}
+
+		right->count = child->count - mid;
+		memcpy(right->pairs, child->pairs + mid, right->count * sizeof *right->pairs);
+		memcpy(right->refs, child->refs + mid, right->count * sizeof *right->refs);
+		right->next = child->next;
+		child->next = right;
+	} else {
+		// the middle separator moves up
+		separator = child->pairs[mid];
+
+		right->count = child->count - mid - 1;
+		memcpy(right->pairs, child->pairs + mid + 1, right->count * sizeof *right->pairs);
+		memcpy(right->children, child->children + mid + 1,
+			(right->count + 1) * sizeof *right->children);
+	}
+
+	child->count = mid;
+
+	memmove(parent->pairs + i + 1, parent->pairs + i,
+		(parent->count - i) * sizeof *parent->pairs);
+	memmove(parent->children + i + 2, parent->children + i + 1,
+		(parent->count - i) * sizeof *parent->children);
+	parent->pairs[i] = separator;
+	parent->children[i + 1] = right;
+	parent->count++;
+
+	return 0;
+}
+
+struct btree *btree_create(void)
+{
+	struct btree *tree = malloc(sizeof *tree);
+	if (tree == NULL)
+		return NULL;
+
+	tree->root = calloc(1, sizeof *tree->root);
+	if (tree->root == NULL) {
+		free(tree);
+		return NULL;
+	}
+
+	tree->root->leaf = 1;
+	tree->count = 0;
+	pthread_rwlock_init(&tree->lock, NULL);
+
+	return tree;
+}
+
+int btree_add(struct btree *tree, long value, const char *key)
+{
+	int ret = -1;
+
+	pthread_rwlock_wrlock(&tree->lock);
+
+	if (tree->root->count == BTREE_ORDER) {
+		struct bt_node *top = calloc(1, sizeof *top);
+		if (top == NULL)
+			goto out;
+
+		top->children[0] = tree->root;
+		if (split_child(top, 0) != 0) {
+			free(top);
+			goto out;
+		}
+		tree->root = top;
+	}
+
+	struct bt_node *node = tree->root;
+	while (!node->leaf) {
+		int i = child_index(node, value, key);
+
+		if (node->children[i]->count == BTREE_ORDER) {
+			if (split_child(node, i) != 0)
+				goto out;
+			if (compare(value, key, &node->pairs[i]) >= 0)
+				i++;
+		}
+		node = node->children[i];
+	}
+
+	int i = lower_bound(node, value, key);
+
+	if (i < node->count && compare(value, key, &node->pairs[i]) == 0) {
+		node->refs[i]++;
+		ret = 0;
+		goto out;
+	}
+
+	char *copy = strdup(key);
+	if (copy == NULL)
+		goto out;
+
+	memmove(node->pairs + i + 1, node->pairs + i, (node->count - i) * sizeof *node->pairs);
+	memmove(node->refs + i + 1, node->refs + i, (node->count - i) * sizeof *node->refs);
+	node->pairs[i].value = value;
+	node->pairs[i].key = copy;
+	node->refs[i] = 1;
+	node->count++;
+	tree->count++;
+	ret = 0;
+
+out:
+	pthread_rwlock_unlock(&tree->lock);
+	return ret;
+}
+
+void btree_remove(struct btree *tree, long value, const char *key)
+{
+	pthread_rwlock_wrlock(&tree->lock);
+
+	struct bt_node *node = tree->root;
+	while (!node->leaf)
+		node = node->children[child_index(node, value, key)];
+
+	int i = lower_bound(node, value, key);
+
+	if (i < node->count && compare(value, key, &node->pairs[i]) == 0 && --node->refs[i] == 0) {
+		free(node->pairs[i].key);
+		memmove(node->pairs + i, node->pairs + i + 1, (node->count - i - 1) * sizeof *node->pairs);
+		memmove(node->refs + i, node->refs + i + 1, (node->count - i - 1) * sizeof *node->refs);
+		node->count--;
+		tree->count--;
+	}
+
+	pthread_rwlock_unlock(&tree->lock);
+}
+
+void btree_range(struct btree *tree, long low, long high, btree_visit_fn visit, void *arg)
+{
+	pthread_rwlock_rdlock(&tree->lock);
+
+	// no key is empty, so (low, "") comes before every pair with low
+	struct bt_node *node = tree->root;
+	while (!node->leaf)
+		node = node->children[child_index(node, low, "")];
+
+	int i = lower_bound(node, low, "");
+
+	for (; node != NULL; node = node->next, i = 0) {
+		for (; i < node->count; i++) {
+			if (node->pairs[i].value > high ||
+				visit(node->pairs[i].value, node->pairs[i].key, arg) != 0)
+				goto out;
+		}
+	}
+
+out:
+	pthread_rwlock_unlock(&tree->lock);
+}
+
+/**
+ * @brief Visit the pairs of a node before (value, key) in reverse order, or
+ * all of them if key is NULL.
+ *
+ * @return Returns 1 if visit stopped, and 0 otherwise.
+ */
+static int walk_back(struct bt_node *node, long value, const char *key,
+		btree_visit_fn visit, void *arg)
+{
+	int i;
+
+	if (node->leaf) {
+		i = key == NULL ? node->count : lower_bound(node, value, key);
+		while (--i >= 0) {
+			if (visit(node->pairs[i].value, node->pairs[i].key, arg) != 0)
+				return 1;
+		}
+		return 0;
+	}
+
+	// the children left of the one holding the pair are all before it
+	i = key == NULL ? node->count : child_index(node, value, key);
+	for (; i >= 0; i--, key = NULL) {
+		if (walk_back(node->children[i], value, key, visit, arg) != 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+void btree_walk(struct btree *tree, int descending, long value, const char *key,
+		btree_visit_fn visit, void *arg)
+{
+	pthread_rwlock_rdlock(&tree->lock);
+
+	if (descending) {
+		walk_back(tree->root, value, key, visit, arg);
+		goto out;
+	}
+
+	struct bt_node *node = tree->root;
+	while (!node->leaf)
+		node = node->children[key == NULL ? 0 : child_index(node, value, key)];
+
+	int i = 0;
+	if (key != NULL) {
+		i = lower_bound(node, value, key);
+		if (i < node->count && compare(value, key, &node->pairs[i]) == 0)
+			i++;
+	}
+
+	for (; node != NULL; node = node->next, i = 0) {
+		for (; i < node->count; i++) {
+			if (visit(node->pairs[i].value, node->pairs[i].key, arg) != 0)
+				goto out;
+		}
+	}
+
+out:
+	pthread_rwlock_unlock(&tree->lock);
+}
+
+long btree_count(struct btree *tree)
+{
+	pthread_rwlock_rdlock(&tree->lock);
+	long count = tree->count;
+	pthread_rwlock_unlock(&tree->lock);
+
+	return count;
+}
+
+/**
+ * @brief Free a node and the nodes under it.
+ */
+static void free_node(struct bt_node *node)
+{
+	int i;
+
+	for (i = 0; i < node->count; i++)
+		free(node->pairs[i].key);
+
+	if (!node->leaf) {
+		for (i = 0; i <= node->count; i++)
+			free_node(node->children[i]);
+	}
+
+	free(node);
+}
+
+void btree_destroy(struct btree *tree)
+{
+	if (tree == NULL)
+		return;
+
+	free_node(tree->root);
+	pthread_rwlock_destroy(&tree->lock);
+	free(tree);
+}
@@ -0,0 +1,79 @@
+/**
+ * @file
+ * @brief This file declares the ordered index kept on an int column of a
+ * hash table.
+ *
+ * The index is a B+tree of (value, key) pairs, ordered by value and then
+ * by key, with the leaves linked in order, so that the keys whose column
+ * is in a range are found in O(log n + k). The same pair can be added
+ * more than once: it stays in the tree until it is removed as many times.
+ */
+
+#ifndef BTREE_H
+#define BTREE_H
+
+/**
+ * @brief An index. The fields are private to btree.c.
+ */
+struct btree;
+
+/**
+ * @brief Called for every pair in a range, in order.
+ *
+ * @return Return 0 to go on, and anything else to stop.
+ */
+typedef int (*btree_visit_fn)(long value, const char *key, void *arg);
+
+/**
+ * @brief Create an empty index.
+ *
+ * @return Returns the index, or NULL if there is no memory.
+ */
+struct btree *btree_create(void);
+
+/**
+ * @brief Add a pair to the index.
+ *
+ * @return Returns 0 on success, and -1 if there is no memory.
+ */
+int btree_add(struct btree *tree, long value, const char *key);
+
+/**
+ * @brief Remove a pair added before.
+ *
+ * Leaves that become empty are kept, so removing never moves pairs
+ * between leaves.
+ */
+void btree_remove(struct btree *tree, long value, const char *key);
+
+/**
+ * @brief Visit the pairs whose value is between low and high, both
+ * included.
+ *
+ * The index is locked for reading while it is visited, so visit must not
+ * change it.
+ */
+void btree_range(struct btree *tree, long low, long high, btree_visit_fn visit, void *arg);
+
+/**
+ * @brief Visit the pairs after the pair (value, key) in order, or the
+ * pairs before it in reverse order if descending is set.
+ *
+ * The pair need not be in the index. If key is NULL, every pair is
+ * visited, from the first or from the last one. Like btree_range, the
+ * index is locked for reading while it is visited.
+ */
+void btree_walk(struct btree *tree, int descending, long value, const char *key,
+		btree_visit_fn visit, void *arg);
+
+/**
+ * @brief Return the number of distinct pairs in the index.
+ */
+long btree_count(struct btree *tree);
+
+/**
+ * @brief Free the index.
+ */
+void btree_destroy(struct btree *tree);
+
+#endif
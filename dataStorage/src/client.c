@@ -23,17 +23,21 @@
 #include <time.h>
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include "storage.h"
+#include "utils.h"
 
 #define SERVERHOST "localhost"
 #define SERVERPORT 1111
 #define SERVERUSERNAME "admin"
 #define SERVERPASSWORD "dog4sale"
-#define TABLE "marks"
+#define DEFAULT_TABLE "marks"
 #define KEY "ece297"
 #define LENGTH 64
 #define LOGGING 0
 #define LOAD_CENSUS 2
+#define MAX_BENCHMARK_THREADS 64
 
 // LOGGING:
 // 0: no logging
@@ -174,6 +178,322 @@ int readCensus(char* table, char *line)
     return 0;
 }
 
+/**
+ * @brief Holds what a thread of the SET or connection benchmark needs
+ */
+struct benchmarkArgs {
+	char host[MAX_HOST_LEN];
+	int port;
+	char username[MAX_USERNAME_LEN];
+	char password[MAX_USERNAME_LEN];
+	char table[MAX_TABLE_LEN];
+	char value[MAX_VALUE_LEN];
+
+	/// The number of threads in the run, used in the keys.
+	int threads;
+	/// The number of this thread.
+	int thread;
+	/// The number of SETs to send.
+	int sets;
+	/// The number of keys shared by all threads, or 0 if every thread
+	/// sets its own keys.
+	int keys;
+	/// The number of connections to open.
+	int connections;
+	/// How a thread changes a key: 0 to SET it, 1 to GET it and SET it
+	/// back with the version read, 2 to INCR column.
+	int counter;
+	/// The int column increased by the counter benchmark.
+	char column[MAX_COLNAME_LEN];
+	/// The number of SETs or connections that failed, or aborted.
+	int failed;
+};
+
+/* Mutex to let one benchmark thread authenticate at a time */
+pthread_mutex_t benchmarkAuthMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Sends SETs on its own connection
+ */
+void *benchmarkSetThread(void *arg)
+{
+	struct benchmarkArgs* args = arg;
+	struct storage_record record;
+	char key[MAX_KEY_LEN];
+	int i;
+
+	// crypt() in storage_auth keeps its result in static memory
+	pthread_mutex_lock(&benchmarkAuthMutex);
+	void* c = storage_connect(args->host, args->port);
+	int status = (c == NULL) ? -1 : storage_auth(args->username, args->password, c);
+	pthread_mutex_unlock(&benchmarkAuthMutex);
+
+	if(status != 0)
+	{
+		args->failed = args->sets;
+		return NULL;
+	}
+
+	for(i=0; i<args->sets; i++)
+	{
+		if(args->keys > 0)
+			snprintf(key, sizeof key, "c%d", (args->thread * args->keys / args->threads + i) % args->keys);
+		else
+			snprintf(key, sizeof key, "b%dt%dk%d", args->threads, args->thread, i);
+		if(args->counter == 2)
+		{
+			int value;
+			if(storage_apply(args->table, key, args->column, STORAGE_INCR, 1, &value, c) != 0)
+				args->failed++;
+			continue;
+		}
+
+		// a key that is not there yet is inserted
+		if(args->counter == 0 || storage_get(args->table, key, &record, c) != 0)
+		{
+			strncpy(record.value, args->value, sizeof record.value);
+			record.metadata[0] = 0;
+		}
+
+		if(storage_set(args->table, key, &record, c) != 0)
+			args->failed++;
+	}
+
+	// storage_disconnect() would mark every connection of the client as
+	// closed, including those of the threads still running
+	close((int) (intptr_t) c);
+
+	return NULL;
+}
+
+/**
+ * @brief Measures the SET throughput of a table with 1, 2, 4, ... threads
+ *
+ * @param args The server, the table, and the value to set. Every thread
+ *		 gets a copy.
+ * @param maxThreads The number of threads of the last run
+ *
+ * Every thread has its own connection, so the threads only compete inside
+ * the server. With args->keys set, the threads keep setting the same few
+ * keys, which makes them compete for the same locks. The number of times
+ * the server had to wait for a lock of the table is shown for every run.
+ */
+void benchmarkSets(struct benchmarkArgs* args, int maxThreads)
+{
+	pthread_t threads[MAX_BENCHMARK_THREADS];
+	struct benchmarkArgs threadArgs[MAX_BENCHMARK_THREADS];
+	struct storage_stats stats;
+	long lockWaits = 0;
+	int n, i;
+
+	void* statsConn = storage_connect(args->host, args->port);
+	if(statsConn == NULL || storage_auth(args->username, args->password, statsConn) != 0)
+	{
+		printf("Cannot connect to server @ %s:%d. Error code: %d.\n", args->host, args->port, errno);
+		return;
+	}
+
+	if(storage_stats(args->table, &stats, statsConn) == 0)
+		lockWaits = stats.lock_waits;
+
+	printf("threads\tsets\tfailed\tseconds\tsets/second\tlock waits\n");
+
+	for(n=1; n<=maxThreads; n = (n < maxThreads && 2*n > maxThreads) ? maxThreads : 2*n)
+	{
+		struct timeval start_time, end_time;
+		int failed = 0;
+
+		gettimeofday(&start_time, NULL);
+
+		for(i=0; i<n; i++)
+		{
+			threadArgs[i] = *args;
+			threadArgs[i].threads = n;
+			threadArgs[i].thread = i;
+			threadArgs[i].failed = 0;
+			pthread_create(&threads[i], NULL, benchmarkSetThread, &threadArgs[i]);
+		}
+
+		for(i=0; i<n; i++)
+		{
+			pthread_join(threads[i], NULL);
+			failed += threadArgs[i].failed;
+		}
+
+		gettimeofday(&end_time, NULL);
+		double t = (end_time.tv_sec - start_time.tv_sec) +
+			(end_time.tv_usec - start_time.tv_usec) / 1000000.0;
+
+		long waits = 0;
+		if(storage_stats(args->table, &stats, statsConn) == 0)
+		{
+			waits = stats.lock_waits - lockWaits;
+			lockWaits = stats.lock_waits;
+		}
+
+		printf("%d\t%d\t%d\t%.3lf\t%.0lf\t\t%ld\n", n, n * args->sets, failed, t,
+			(n * args->sets - failed) / t, waits);
+	}
+
+	close((int) (intptr_t) statsConn);
+}
+
+/**
+ * @brief Opens connections one after the other, sending one GET on each
+ *
+ * Every connection is closed as soon as the server has answered.
+ */
+void *benchmarkConnectThread(void *arg)
+{
+	struct benchmarkArgs* args = arg;
+	char buf[MAX_CMD_LEN];
+	int i;
+
+	for(i=0; i<args->connections; i++)
+	{
+		void* c = storage_connect(args->host, args->port);
+		if(c == NULL)
+		{
+			args->failed++;
+			continue;
+		}
+
+		snprintf(buf, sizeof buf, "GET;%s;b%dk%d\n", args->table, args->thread, i);
+		if(sendall((int) (intptr_t) c, buf, strlen(buf)) != 0 || recvline((int) (intptr_t) c, buf, sizeof buf) != 0)
+			args->failed++;
+
+		close((int) (intptr_t) c);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Measures how many connections per second the server takes with
+ *		 1, 2, 4, ... threads connecting at once
+ *
+ * @param args The server and the table to send the GETs to. Every thread
+ *		 gets a copy.
+ * @param maxThreads The number of threads of the last run
+ */
+void benchmarkConnections(struct benchmarkArgs* args, int maxThreads)
+{
+	pthread_t threads[MAX_BENCHMARK_THREADS];
+	struct benchmarkArgs threadArgs[MAX_BENCHMARK_THREADS];
+	int n, i;
+
+	printf("threads\tconnections\tfailed\tseconds\tconnections/second\n");
+
+	for(n=1; n<=maxThreads; n = (n < maxThreads && 2*n > maxThreads) ? maxThreads : 2*n)
+	{
+		struct timeval start_time, end_time;
+		int failed = 0;
+
+		gettimeofday(&start_time, NULL);
+
+		for(i=0; i<n; i++)
+		{
+			threadArgs[i] = *args;
+			threadArgs[i].threads = n;
+			threadArgs[i].thread = i;
+			threadArgs[i].failed = 0;
+			pthread_create(&threads[i], NULL, benchmarkConnectThread, &threadArgs[i]);
+		}
+
+		for(i=0; i<n; i++)
+		{
+			pthread_join(threads[i], NULL);
+			failed += threadArgs[i].failed;
+		}
+
+		gettimeofday(&end_time, NULL);
+		double t = (end_time.tv_sec - start_time.tv_sec) +
+			(end_time.tv_usec - start_time.tv_usec) / 1000000.0;
+
+		printf("%d\t%d\t\t%d\t%.3lf\t%.0lf\n", n, n * args->connections, failed, t,
+			(n * args->connections - failed) / t);
+	}
+}
+
+/**
+ * @brief Asks for the server and the table of a connection benchmark
+ *
+ * @return Returns the number of threads of the last run, or 0 if the
+ *		 input is invalid
+ */
+int readConnectBenchmarkArgs(struct benchmarkArgs* args)
+{
+	char temp[MAX_VALUE_LEN];
+
+	printf("Please input the hostname: ");
+	safegets(args->host, MAX_HOST_LEN);
+	printf("Please input the port: ");
+	safegets(temp, MAX_PORT_LEN);
+	args->port = atoi(temp);
+	printf("Please input table: ");
+	safegets(args->table, MAX_TABLE_LEN);
+	printf("Please input the connections per thread: ");
+	safegets(temp, sizeof temp);
+	args->connections = atoi(temp);
+	printf("Please input the max number of threads: ");
+	safegets(temp, sizeof temp);
+	int maxThreads = atoi(temp);
+
+	if(args->connections <= 0 || maxThreads <= 0 || maxThreads > MAX_BENCHMARK_THREADS)
+		return 0;
+
+	return maxThreads;
+}
+
+/**
+ * @brief Asks for the server, the table and the value of a SET benchmark
+ *
+ * @param sharedKeys Whether to ask for the number of keys shared by
+ *		 the threads
+ * @return Returns the number of threads of the last run, or 0 if the
+ *		 input is invalid
+ */
+int readBenchmarkArgs(struct benchmarkArgs* args, int sharedKeys)
+{
+	char temp[MAX_VALUE_LEN];
+
+	printf("Please input the hostname: ");
+	safegets(args->host, MAX_HOST_LEN);
+	printf("Please input the port: ");
+	safegets(temp, MAX_PORT_LEN);
+	args->port = atoi(temp);
+	printf("Please input username: ");
+	safegets(args->username, MAX_USERNAME_LEN);
+	printf("Please input password: ");
+	safegets(args->password, MAX_USERNAME_LEN);
+	printf("Please input table: ");
+	safegets(args->table, MAX_TABLE_LEN);
+	printf("Please input the value to set: ");
+	safegets(args->value, MAX_VALUE_LEN);
+	printf("Please input the SETs per thread: ");
+	safegets(temp, sizeof temp);
+	args->sets = atoi(temp);
+	printf("Please input the max number of threads: ");
+	safegets(temp, sizeof temp);
+	int maxThreads = atoi(temp);
+
+	args->keys = 0;
+	args->counter = 0;
+	if(sharedKeys)
+	{
+		printf("Please input the number of keys shared by the threads: ");
+		safegets(temp, sizeof temp);
+		args->keys = atoi(temp);
+		if(args->keys <= 0)
+			return 0;
+	}
+
+	if(args->sets <= 0 || maxThreads <= 0 || maxThreads > MAX_BENCHMARK_THREADS)
+		return 0;
+
+	return maxThreads;
+}
+
 /**
  * @brief Provides an interface that allows for the interaction
  *		 between the user and the server.
@@ -231,6 +551,25 @@ int main(int argc, char *argv[]) {
 	  printf("8) Bulkload\n");
 	  printf("9) Testing\n");
 	  printf("10) Transaction Abortion\n");
+	  printf("11) Table stats\n");
+	  printf("12) SET throughput benchmark\n");
+	  printf("13) SET contention benchmark\n");
+	  printf("14) Connection rate benchmark\n");
+	  printf("15) Multi-key transaction\n");
+	  printf("16) Counter benchmark\n");
+	  printf("17) Update columns\n");
+	  printf("18) Explain query\n");
+	  printf("19) Query with a cursor\n");
+	  printf("20) Aggregate\n");
+	  printf("21) Aggregate by group\n");
+	  printf("22) Query in order\n");
+	  printf("23) Get some columns\n");
+	  printf("24) Query records\n");
+	  printf("25) Join tables\n");
+	  printf("26) Delete matching records\n");
+	  printf("27) Update matching records\n");
+	  printf("28) Truncate table\n");
+	  printf("29) Drop table\n");
 	  printf("--------------------\n");
 
 	  // Retrieve selection from user
@@ -426,7 +765,12 @@ int main(int argc, char *argv[]) {
 		char table_[MAX_TABLE_LEN];
 		char predicates_[MAX_CONFIG_LINE_LEN];
 		
+		char keyBuffers[max_keys][MAX_KEY_LEN];
 		char *keys_[max_keys];
+		int i;
+
+		for(i=0; i<max_keys; i++)
+			keys_[i] = keyBuffers[i];
 
 
 		printf("Please input table: ");
@@ -438,7 +782,7 @@ int main(int argc, char *argv[]) {
 
 		// Issue storage_query
 		int status = storage_query(table_, predicates_, keys_, max_keys, conn);
-		if(status != 0)
+		if(status < 0)
 		{
 			printf("storage query failed. Error code: %d.\n", errno);
 			if(conn == NULL)
@@ -449,10 +793,9 @@ int main(int argc, char *argv[]) {
 
 		else
 		{
-			printf("storage_query: successful.\n");
-			// int i;
-			// for(i=0; i<max_keys; i++)
-			// 	printf("%s, ", keys_[i][0]);
+			printf("storage_query: successful, %d keys.\n", status);
+			for(i=0; i<status && i<max_keys; i++)
+				printf("%s\n", keys_[i]);
 		}
 
 	}
@@ -731,6 +1074,418 @@ int main(int argc, char *argv[]) {
 
 		}
 
+		else if(strcmp(selection, "11")==0)
+		{
+			char table_[20];
+			struct storage_stats stats;
+
+			printf("Please input table: ");
+			safegets(table_, 20);
+
+			int status = storage_stats(table_, &stats, conn);
+			if(status != 0)
+				printf("storage_stats failed. Error code: %d.\n", errno);
+			else
+				printf("storage_stats: %ld records in memory, %ld records on disk, %ld lock waits, %ld old versions.\n",
+					stats.resident, stats.spilled, stats.lock_waits, stats.versions);
+		}
+
+		else if(strcmp(selection, "12")==0)
+		{
+			struct benchmarkArgs args;
+
+			int maxThreads = readBenchmarkArgs(&args, 0);
+			if(maxThreads == 0)
+				printf("Invalid benchmark parameters.\n");
+			else
+				benchmarkSets(&args, maxThreads);
+		}
+
+		else if(strcmp(selection, "13")==0)
+		{
+			struct benchmarkArgs args;
+
+			int maxThreads = readBenchmarkArgs(&args, 1);
+			if(maxThreads == 0)
+				printf("Invalid benchmark parameters.\n");
+			else
+				benchmarkSets(&args, maxThreads);
+		}
+
+		else if(strcmp(selection, "14")==0)
+		{
+			struct benchmarkArgs args;
+
+			int maxThreads = readConnectBenchmarkArgs(&args);
+			if(maxThreads == 0)
+				printf("Invalid benchmark parameters.\n");
+			else
+				benchmarkConnections(&args, maxThreads);
+		}
+
+		else if(strcmp(selection, "15")==0)
+		{
+			struct storage_txn txn;
+			char table_[20];
+			char key_[20];
+			int status = storage_begin(&txn, conn);
+
+			printf("Please input table: ");
+			safegets(table_, 20);
+
+			// every key is read, then written with its new value at the commit
+			while(status == 0)
+			{
+				printf("Please input key (empty to commit): ");
+				safegets(key_, 20);
+				if(key_[0] == '\0')
+					break;
+
+				if(storage_txn_get(table_, key_, &r, &txn) == 0)
+					printf("storage_txn_get: '%s' is '%s'.\n", key_, r.value);
+				else if(errno != ERR_KEY_NOT_FOUND)
+					status = -1;
+
+				printf("Please input value (empty to delete): ");
+				safegets(r.value, 800);
+				if(status == 0)
+					status = storage_txn_set(table_, key_, r.value[0] != '\0' ? &r : NULL, &txn);
+			}
+
+			if(status == 0)
+				status = storage_commit(&txn);
+
+			if(status != 0)
+				printf("transaction failed. Error code: %d.\n", errno);
+			else
+				printf("transaction committed.\n");
+		}
+
+		else if(strcmp(selection, "16")==0)
+		{
+			struct benchmarkArgs args;
+
+			int maxThreads = readBenchmarkArgs(&args, 1);
+			printf("Please input the int column to increase: ");
+			safegets(args.column, MAX_COLNAME_LEN);
+
+			// the same keys are updated both ways, and the failures of the
+			// first way are aborted SETs
+			if(maxThreads == 0)
+				printf("Invalid benchmark parameters.\n");
+			else
+			{
+				printf("GET then SET with the version read:\n");
+				args.counter = 1;
+				benchmarkSets(&args, maxThreads);
+
+				printf("INCR on the server:\n");
+				args.counter = 2;
+				benchmarkSets(&args, maxThreads);
+			}
+		}
+
+		else if(strcmp(selection, "17")==0)
+		{
+			char table_[20];
+			char key_[20];
+			char columns[800];
+
+			printf("Please input table: ");
+			safegets(table_, 20);
+			printf("Please input key: ");
+			safegets(key_, 20);
+			printf("Please input columns (column value,column value): ");
+			safegets(columns, 800);
+
+			int status = storage_update(table_, key_, columns, 0, conn);
+			if(status != 0)
+				printf("storage_update failed. Error code: %d.\n", errno);
+			else
+				printf("storage_update: successful.\n");
+		}
+
+		else if(strcmp(selection, "18")==0)
+		{
+			char table_[20];
+			char predicates[100];
+			char plan[MAX_CMD_LEN];
+
+			printf("Please input table: ");
+			safegets(table_, 20);
+			printf("Please input predicates (name = bob, year > 1990): ");
+			safegets(predicates, 100);
+
+			int status = storage_explain(table_, predicates, plan, sizeof plan, conn);
+			if(status != 0)
+				printf("storage_explain failed. Error code: %d.\n", errno);
+			else
+				printf("%s\n", plan);
+		}
+
+		else if(strcmp(selection, "19")==0)
+		{
+			char table_[20];
+			char predicates[100];
+			char keyBuffers[5][MAX_KEY_LEN];
+			char *keys_[5];
+			struct storage_record records[5];
+			int i, fetched;
+
+			for(i=0; i<5; i++)
+				keys_[i] = keyBuffers[i];
+
+			printf("Please input table: ");
+			safegets(table_, 20);
+			printf("Please input predicates (name = bob, year > 1990): ");
+			safegets(predicates, 100);
+
+			int cursor = storage_query_open(table_, predicates, 1, conn);
+			if(cursor < 0)
+				printf("storage_query_open failed. Error code: %d.\n", errno);
+
+			// a page of 5 records at a time
+			while(cursor >= 0 && (fetched = storage_query_next(cursor, keys_, records, 5, conn)) > 0)
+			{
+				for(i=0; i<fetched; i++)
+					printf("%s: %s\n", keys_[i], records[i].value);
+			}
+
+			if(cursor >= 0 && fetched < 0)
+				printf("storage_query_next failed. Error code: %d.\n", errno);
+			if(cursor >= 0)
+				storage_query_close(cursor, conn);
+		}
+
+		else if(strcmp(selection, "20")==0)
+		{
+			char table_[20];
+			char aggregates[100];
+			char predicates[100];
+			double results[10];
+			int i;
+
+			printf("Please input table: ");
+			safegets(table_, 20);
+			printf("Please input aggregates (count, sum population, avg year): ");
+			safegets(aggregates, 100);
+			printf("Please input predicates, or nothing for every record: ");
+			safegets(predicates, 100);
+
+			int count = storage_aggregate(table_, aggregates, predicates[0] != '\0' ? predicates : NULL, 
+				results, 10, conn);
+			if(count < 0)
+				printf("storage_aggregate failed. Error code: %d.\n", errno);
+			for(i=0; i<count && i<10; i++)
+				printf("%g\n", results[i]);
+		}
+
+		else if(strcmp(selection, "21")==0)
+		{
+			char table_[20];
+			char columns[100];
+			char aggregates[100];
+			char predicates[100];
+			struct storage_record groups[20];
+			double results[20 * 10];
+			int i, j;
+
+			printf("Please input table: ");
+			safegets(table_, 20);
+			printf("Please input columns to group by (province): ");
+			safegets(columns, 100);
+			printf("Please input aggregates (count, sum population, avg year): ");
+			safegets(aggregates, 100);
+			printf("Please input predicates, or nothing for every record: ");
+			safegets(predicates, 100);
+
+			int count = storage_group(table_, columns, aggregates, predicates[0] != '\0' ? predicates : NULL, 
+				groups, results, 20, 10, conn);
+			if(count < 0)
+				printf("storage_group failed. Error code: %d.\n", errno);
+
+			// one aggregate more than there are commas
+			int naggregates = 1;
+			for(j=0; aggregates[j] != '\0'; j++)
+				naggregates += aggregates[j] == ',';
+
+			for(i=0; i<count && i<20; i++)
+			{
+				printf("%s:", groups[i].value);
+				for(j=0; j<naggregates && j<10; j++)
+					printf(" %g", results[i * 10 + j]);
+				printf("\n");
+			}
+			if(count > 20)
+				printf("... and %d more groups\n", count - 20);
+		}
+
+		else if(strcmp(selection, "22")==0)
+		{
+			char table_[20];
+			char predicates[100];
+			char order[100];
+			char limit_[20];
+			char keyBuffers[100][MAX_KEY_LEN];
+			char *keys[100];
+			int i;
+
+			for(i=0; i<100; i++)
+				keys[i] = keyBuffers[i];
+
+			printf("Please input table: ");
+			safegets(table_, 20);
+			printf("Please input predicates: ");
+			safegets(predicates, 100);
+			printf("Please input order (population desc): ");
+			safegets(order, 100);
+			printf("Please input how many keys (at most 100): ");
+			safegets(limit_, 20);
+
+			int limit = atoi(limit_);
+			if(limit < 0 || limit > 100)
+				limit = 100;
+
+			int count = storage_query_order(table_, predicates, order, keys, limit, conn);
+			if(count < 0)
+				printf("storage_query_order failed. Error code: %d.\n", errno);
+			for(i=0; i<count; i++)
+				printf("%s\n", keys[i]);
+		}
+
+		else if(strcmp(selection, "23")==0)
+		{
+			char table_[20];
+			char key_[20];
+			char columns[100];
+			struct storage_record r;
+
+			printf("Please input table: ");
+			safegets(table_, 20);
+			printf("Please input key: ");
+			safegets(key_, 20);
+			printf("Please input columns (population, province): ");
+			safegets(columns, 100);
+
+			if(storage_get_columns(table_, key_, columns, &r, conn) != 0)
+				printf("storage_get_columns failed. Error code: %d.\n", errno);
+			else
+				printf("%s\n", r.value);
+		}
+
+		else if(strcmp(selection, "24")==0)
+		{
+			char table_[20];
+			char predicates[100];
+			char columns[100];
+			char keyBuffers[20][MAX_KEY_LEN];
+			char *keys[20];
+			struct storage_record records[20];
+			int i;
+
+			for(i=0; i<20; i++)
+				keys[i] = keyBuffers[i];
+
+			printf("Please input table: ");
+			safegets(table_, 20);
+			printf("Please input predicates: ");
+			safegets(predicates, 100);
+			printf("Please input columns, or nothing for the whole records: ");
+			safegets(columns, 100);
+
+			int count = storage_query_records(table_, predicates, columns[0] != '\0' ? columns : NULL,
+				keys, records, 20, conn);
+			if(count < 0)
+				printf("storage_query_records failed. Error code: %d.\n", errno);
+			for(i=0; i<count; i++)
+				printf("%s: %s\n", keys[i], records[i].value);
+		}
+
+		else if(strcmp(selection, "25")==0)
+		{
+			char left[20];
+			char right[20];
+			char on[100];
+			char predicates[100];
+			char columns[100];
+			char leftBuffers[20][MAX_KEY_LEN];
+			char rightBuffers[20][MAX_KEY_LEN];
+			char *leftKeys[20];
+			char *rightKeys[20];
+			struct storage_record records[20];
+			int i;
+
+			for(i=0; i<20; i++)
+			{
+				leftKeys[i] = leftBuffers[i];
+				rightKeys[i] = rightBuffers[i];
+			}
+
+			printf("Please input the first table: ");
+			safegets(left, 20);
+			printf("Please input the second table: ");
+			safegets(right, 20);
+			printf("Please input the joined columns, like name = name: ");
+			safegets(on, 100);
+			printf("Please input predicates, like table.column > 1, or nothing for every record: ");
+			safegets(predicates, 100);
+			printf("Please input columns, like table.column, or nothing for every column: ");
+			safegets(columns, 100);
+
+			int count = storage_join(left, right, on, predicates[0] != '\0' ? predicates : NULL,
+				columns[0] != '\0' ? columns : NULL, leftKeys, rightKeys, records, 20, conn);
+			if(count < 0)
+				printf("storage_join failed. Error code: %d.\n", errno);
+			for(i=0; i<count; i++)
+				printf("%s, %s: %s\n", leftKeys[i], rightKeys[i], records[i].value);
+		}
+
+		else if(strcmp(selection, "26")==0 || strcmp(selection, "27")==0)
+		{
+			char table_[20];
+			char predicates[100];
+			char columns[100];
+			int count;
+
+			printf("Please input table: ");
+			safegets(table_, 20);
+			printf("Please input predicates: ");
+			safegets(predicates, 100);
+
+			if(strcmp(selection, "26")==0)
+				count = storage_delete_where(table_, predicates, conn);
+			else
+			{
+				printf("Please input the new values, like year 2000: ");
+				safegets(columns, 100);
+				count = storage_update_where(table_, predicates, columns, conn);
+			}
+
+			if(count < 0)
+				printf("Changing the records failed. Error code: %d.\n", errno);
+			else
+				printf("%d records changed.\n", count);
+		}
+
+		else if(strcmp(selection, "28")==0 || strcmp(selection, "29")==0)
+		{
+			char table_[20];
+			int status;
+
+			printf("Please input table: ");
+			safegets(table_, 20);
+
+			if(strcmp(selection, "28")==0)
+				status = storage_truncate(table_, conn);
+			else
+				status = storage_drop(table_, conn);
+
+			if(status != 0)
+				printf("Clearing the table failed. Error code: %d.\n", errno);
+			else
+				printf("Table %s cleared.\n", table_);
+		}
+
   }while(cont == 1);
 
 
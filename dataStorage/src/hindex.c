@@ -0,0 +1,282 @@
+/**
+ * @file
+ * @brief This file implements the index declared in hindex.h.
+ *
+ * The buckets hold one entry per distinct value, and every entry the keys
+ * having that value, so a lookup never walks the keys of other values.
+ * The buckets are doubled once there are twice as many values.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "hindex.h"
+
+/**
+ * @brief The number of buckets of a new index.
+ */
+#define HINDEX_BUCKETS	64
+
+struct hx_key {
+	char *key;
+	/// The number of times the pair was added.
+	int refs;
+	struct hx_key *next;
+};
+
+struct hx_value {
+	char *value;
+	unsigned int hash;
+	struct hx_key *keys;
+	struct hx_value *next;
+};
+
+struct hindex {
+	/// Held for writing while pairs are added or removed.
+	pthread_rwlock_t lock;
+	struct hx_value **buckets;
+	int size;
+	/// The number of distinct values.
+	long values;
+	/// The number of distinct pairs.
+	long count;
+};
+
+/**
+ * @brief Hash a value, FNV-1a.
+ */
+static unsigned int hash_value(const char *value)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*value != '\0') {
+		hash ^= (unsigned char) *value++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief Find the entry of a value.
+ *
+ * @return Returns a pointer to the link to the entry, or to the end of
+ *	   its bucket if there is none.
+ */
+static struct hx_value **find_value(struct hindex *index, const char *value, unsigned int hash)
+{
+	struct hx_value **entry = &index->buckets[hash % index->size];
+
+	while (*entry != NULL && ((*entry)->hash != hash || strcmp((*entry)->value, value) != 0))
+		entry = &(*entry)->next;
+
+	return entry;
+}
+
+/**
+ * @brief Double the buckets. The index is left as it was if there is no
+ * memory.
+ */
+static void grow(struct hindex *index)
+{
+	int size = index->size * 2;
+	struct hx_value **buckets = calloc(size, sizeof *buckets);
+	int i;
+
+	if (buckets == NULL)
+		return;
+
+	for (i = 0; i < index->size; i++) {
+		struct hx_value *entry = index->buckets[i];
+
+		while (entry != NULL) {
+			struct hx_value *next = entry->next;
+			entry->next = buckets[entry->hash % size];
+			buckets[entry->hash % size] = entry;
+			entry = next;
+		}
+	}
+
+	free(index->buckets);
+	index->buckets = buckets;
+	index->size = size;
+}
+
+struct hindex *hindex_create(void)
+{
+	struct hindex *index = malloc(sizeof *index);
+	if (index == NULL)
+		return NULL;
+
+	index->buckets = calloc(HINDEX_BUCKETS, sizeof *index->buckets);
+	if (index->buckets == NULL) {
+		free(index);
+		return NULL;
+	}
+
+	index->size = HINDEX_BUCKETS;
+	index->values = 0;
+	index->count = 0;
+	pthread_rwlock_init(&index->lock, NULL);
+
+	return index;
+}
+
+int hindex_add(struct hindex *index, const char *value, const char *key)
+{
+	unsigned int hash = hash_value(value);
+	int ret = -1;
+
+	pthread_rwlock_wrlock(&index->lock);
+
+	struct hx_value **link = find_value(index, value, hash);
+	struct hx_value *entry = *link;
+
+	if (entry == NULL) {
+		entry = malloc(sizeof *entry);
+		if (entry == NULL)
+			goto out;
+
+		entry->value = strdup(value);
+		if (entry->value == NULL) {
+			free(entry);
+			goto out;
+		}
+		entry->hash = hash;
+		entry->keys = NULL;
+		entry->next = NULL;
+		*link = entry;
+		index->values++;
+	}
+
+	struct hx_key *pair;
+	for (pair = entry->keys; pair != NULL; pair = pair->next) {
+		if (strcmp(pair->key, key) == 0)
+			break;
+	}
+
+	if (pair != NULL) {
+		pair->refs++;
+		ret = 0;
+		goto out;
+	}
+
+	pair = malloc(sizeof *pair);
+	if (pair != NULL && (pair->key = strdup(key)) == NULL) {
+		free(pair);
+		pair = NULL;
+	}
+
+	if (pair != NULL) {
+		pair->refs = 1;
+		pair->next = entry->keys;
+		entry->keys = pair;
+		index->count++;
+		ret = 0;
+	}
+
+	// a new value without keys is not kept
+	if (entry->keys == NULL) {
+		*find_value(index, value, hash) = entry->next;
+		free(entry->value);
+		free(entry);
+		index->values--;
+	} else if (index->values > 2L * index->size) {
+		grow(index);
+	}
+
+out:
+	pthread_rwlock_unlock(&index->lock);
+	return ret;
+}
+
+void hindex_remove(struct hindex *index, const char *value, const char *key)
+{
+	unsigned int hash = hash_value(value);
+
+	pthread_rwlock_wrlock(&index->lock);
+
+	struct hx_value **link = find_value(index, value, hash);
+	struct hx_value *entry = *link;
+
+	if (entry != NULL) {
+		struct hx_key **pair = &entry->keys;
+
+		while (*pair != NULL && strcmp((*pair)->key, key) != 0)
+			pair = &(*pair)->next;
+
+		if (*pair != NULL && --(*pair)->refs == 0) {
+			struct hx_key *gone = *pair;
+			*pair = gone->next;
+			free(gone->key);
+			free(gone);
+			index->count--;
+		}
+
+		if (entry->keys == NULL) {
+			*link = entry->next;
+			free(entry->value);
+			free(entry);
+			index->values--;
+		}
+	}
+
+	pthread_rwlock_unlock(&index->lock);
+}
+
+void hindex_lookup(struct hindex *index, const char *value, hindex_visit_fn visit, void *arg)
+{
+	pthread_rwlock_rdlock(&index->lock);
+
+	struct hx_value *entry = *find_value(index, value, hash_value(value));
+
+	if (entry != NULL) {
+		struct hx_key *pair;
+		for (pair = entry->keys; pair != NULL; pair = pair->next) {
+			if (visit(pair->key, arg) != 0)
+				break;
+		}
+	}
+
+	pthread_rwlock_unlock(&index->lock);
+}
+
+long hindex_count(struct hindex *index)
+{
+	pthread_rwlock_rdlock(&index->lock);
+	long count = index->count;
+	pthread_rwlock_unlock(&index->lock);
+
+	return count;
+}
+
+void hindex_destroy(struct hindex *index)
+{
+	int i;
+
+	if (index == NULL)
+		return;
+
+	for (i = 0; i < index->size; i++) {
+		struct hx_value *entry = index->buckets[i];
+
+		while (entry != NULL) {
+			struct hx_value *next = entry->next;
+
+			while (entry->keys != NULL) {
+				struct hx_key *pair = entry->keys;
+				entry->keys = pair->next;
+				free(pair->key);
+				free(pair);
+			}
+
+			free(entry->value);
+			free(entry);
+			entry = next;
+		}
+	}
+
+	free(index->buckets);
+	pthread_rwlock_destroy(&index->lock);
+	free(index);
+}
@@ -0,0 +1,64 @@
+/**
+ * @file
+ * @brief This file declares the hash index kept on a char column of a hash
+ * table.
+ *
+ * The index maps a value of the column to the keys having it, so the keys
+ * equal to a value are found with a single probe. Like the ordered index
+ * of btree.h, the same (value, key) pair can be added more than once, and
+ * stays until it is removed as many times.
+ */
+
+#ifndef HINDEX_H
+#define HINDEX_H
+
+/**
+ * @brief An index. The fields are private to hindex.c.
+ */
+struct hindex;
+
+/**
+ * @brief Called for every key having a value.
+ *
+ * @return Return 0 to go on, and anything else to stop.
+ */
+typedef int (*hindex_visit_fn)(const char *key, void *arg);
+
+/**
+ * @brief Create an empty index.
+ *
+ * @return Returns the index, or NULL if there is no memory.
+ */
+struct hindex *hindex_create(void);
+
+/**
+ * @brief Add a pair to the index.
+ *
+ * @return Returns 0 on success, and -1 if there is no memory.
+ */
+int hindex_add(struct hindex *index, const char *value, const char *key);
+
+/**
+ * @brief Remove a pair added before.
+ */
+void hindex_remove(struct hindex *index, const char *value, const char *key);
+
+/**
+ * @brief Visit the keys having a value.
+ *
+ * The index is locked for reading while it is visited, so visit must not
+ * change it.
+ */
+void hindex_lookup(struct hindex *index, const char *value, hindex_visit_fn visit, void *arg);
+
+/**
+ * @brief Return the number of distinct pairs in the index.
+ */
+long hindex_count(struct hindex *index);
+
+/**
+ * @brief Free the index.
+ */
+void hindex_destroy(struct hindex *index);
+
+#endif
@@ -0,0 +1,647 @@
+/**
+ * @file
+ * @brief This file implements the lock-free hash table declared in lfhash.h.
+ *
+ * Every key is a node in one linked list, sorted by the bit-reversed hash
+ * of the key (its split-order key). Every bucket has a dummy node in the
+ * list, and a bucket points to its dummy node. When the number of buckets
+ * doubles, the keys of bucket b are split between b and b + n, and since
+ * the list is sorted by the reversed hash, the keys of the new bucket are
+ * already next to each other, after the keys that stay in b. The new
+ * bucket only needs its dummy node inserted in the right place, which is
+ * done the first time the bucket is used.
+ *
+ * Nodes are never removed from the list. Deleting a key swaps its value
+ * for a deleted value that keeps the version, so only values are freed.
+ * A replaced value may still be read by another thread, so it is freed
+ * with epoch-based reclamation: every operation publishes the global epoch
+ * it started in, and a value swapped out while the global epoch is e is
+ * freed once the global epoch reaches e + 2, when no operation can still
+ * see it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "lfhash.h"
+
+#define LF_SEGMENT_BITS 10	///< Log2 of the buckets in a segment.
+#define LF_SEGMENT_LEN (1 << LF_SEGMENT_BITS)	///< Buckets in a segment.
+#define LF_MAX_SEGMENTS 1024	///< Max segments of a table.
+#define LF_MAX_BUCKETS ((unsigned long) LF_SEGMENT_LEN * LF_MAX_SEGMENTS)	///< Max buckets of a table.
+#define LF_INITIAL_BUCKETS 16	///< Buckets of a new table.
+#define LF_LOAD_FACTOR 2	///< Keys per bucket that double the buckets.
+#define LF_MAX_SLOTS 256	///< Operations that can run at the same time.
+#define LF_CACHE_LINE 64	///< Bytes in a cache line.
+
+/**
+ * @brief The value of a key. A value is never changed once it is in the
+ * table; a change swaps in a new value.
+ */
+struct lf_value {
+	unsigned int version;
+	int deleted;
+	/// The next value waiting to be freed.
+	struct lf_value *retired_next;
+	char data[];
+};
+
+/**
+ * @brief A key or a bucket in the split-ordered list.
+ */
+struct lf_node {
+	unsigned int so_key;
+	/// The key, or NULL for the dummy node of a bucket.
+	char *key;
+	struct lf_value *value;
+	struct lf_node *next;
+};
+
+/**
+ * @brief The epoch published by a running operation.
+ */
+struct lf_slot {
+	int busy;
+	unsigned long epoch;
+} __attribute__((aligned(LF_CACHE_LINE)));
+
+struct lf_table {
+	/// The buckets, allocated a segment at a time.
+	struct lf_node **segments[LF_MAX_SEGMENTS];
+	/// The number of buckets in use, a power of two.
+	unsigned long buckets;
+	/// The keys in the list, live or deleted.
+	long nodes;
+	/// The live keys.
+	long live;
+
+	unsigned long epoch;
+	struct lf_slot slots[LF_MAX_SLOTS];
+	/// Values replaced in each of the last three epochs.
+	struct lf_value *retired[3];
+};
+
+/// The slot this thread used last, where it starts looking for a free one.
+static __thread int slot_hint;
+
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define CAS(p, expected, desired) \
+	__atomic_compare_exchange_n((p), (expected), (desired), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+/**
+ * @brief FNV-1a hash of a key.
+ */
+static unsigned int hash_key(const char *key)
+{
+	unsigned int h = 2166136261u;
+
+	while (*key != '\0') {
+		h ^= (unsigned char) *key++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static unsigned int reverse_bits(unsigned int x)
+{
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+/**
+ * @brief The split-order key of a key. The lowest bit is set, so a key
+ * sorts after the dummy node of its bucket.
+ */
+static unsigned int regular_key(unsigned int hash)
+{
+	return reverse_bits(hash | 0x80000000u);
+}
+
+/**
+ * @brief The split-order key of the dummy node of a bucket.
+ */
+static unsigned int dummy_key(unsigned long bucket)
+{
+	return reverse_bits((unsigned int) bucket);
+}
+
+/**
+ * @brief Whether a node sorts before the given split-order key and key.
+ */
+static int node_before(const struct lf_node *node, unsigned int so_key, const char *key)
+{
+	if (node->so_key != so_key)
+		return node->so_key < so_key;
+	return key != NULL && node->key != NULL && strcmp(node->key, key) < 0;
+}
+
+static int node_matches(const struct lf_node *node, unsigned int so_key, const char *key)
+{
+	if (node->so_key != so_key)
+		return 0;
+	if (key == NULL || node->key == NULL)
+		return key == node->key;
+	return strcmp(node->key, key) == 0;
+}
+
+/**
+ * @brief Find a node in the list, starting at a node before it.
+ */
+static struct lf_node *list_find(struct lf_node *start, unsigned int so_key, const char *key)
+{
+	struct lf_node *curr = LOAD(&start->next);
+
+	while (curr != NULL && node_before(curr, so_key, key))
+		curr = LOAD(&curr->next);
+
+	if (curr != NULL && node_matches(curr, so_key, key))
+		return curr;
+	return NULL;
+}
+
+/**
+ * @brief Insert a node in the list, starting at a node before it.
+ *
+ * @return Returns the node, or the node that was already in the list
+ * with the same key.
+ */
+static struct lf_node *list_insert(struct lf_node *start, struct lf_node *node)
+{
+	struct lf_node *prev = start;
+	struct lf_node *curr;
+
+	while (1) {
+		curr = LOAD(&prev->next);
+		while (curr != NULL && node_before(curr, node->so_key, node->key)) {
+			prev = curr;
+			curr = LOAD(&curr->next);
+		}
+
+		if (curr != NULL && node_matches(curr, node->so_key, node->key))
+			return curr;
+
+		node->next = curr;
+		if (CAS(&prev->next, &curr, node))
+			return node;
+
+		// another node went in after prev; prev is still in the list,
+		// because nodes are never removed, so carry on from there
+	}
+}
+
+static struct lf_node *get_bucket(struct lf_table *table, unsigned long bucket)
+{
+	struct lf_node **segment = LOAD(&table->segments[bucket >> LF_SEGMENT_BITS]);
+
+	if (segment == NULL)
+		return NULL;
+	return LOAD(&segment[bucket & (LF_SEGMENT_LEN - 1)]);
+}
+
+static int set_bucket(struct lf_table *table, unsigned long bucket, struct lf_node *node)
+{
+	struct lf_node ***slot = &table->segments[bucket >> LF_SEGMENT_BITS];
+	struct lf_node **segment = LOAD(slot);
+
+	if (segment == NULL) {
+		struct lf_node **fresh = calloc(LF_SEGMENT_LEN, sizeof *fresh);
+		if (fresh == NULL)
+			return -1;
+
+		segment = NULL;
+		if (CAS(slot, &segment, fresh))
+			segment = fresh;
+		else
+			free(fresh);
+	}
+
+	// a racing thread stores the same dummy node
+	STORE(&segment[bucket & (LF_SEGMENT_LEN - 1)], node);
+	return 0;
+}
+
+/**
+ * @brief Return the dummy node of a bucket, inserting it if the bucket
+ * was never used.
+ *
+ * The dummy node is inserted starting at the parent bucket, which is the
+ * bucket with the highest bit cleared, since the keys of the bucket were
+ * in the parent before the table grew.
+ */
+static struct lf_node *bucket_node(struct lf_table *table, unsigned long bucket)
+{
+	struct lf_node *node = get_bucket(table, bucket);
+	struct lf_node *start, *dummy;
+	unsigned long parent;
+
+	if (node != NULL)
+		return node;
+
+	parent = bucket & ~(1UL << (63 - __builtin_clzl(bucket)));
+	start = bucket_node(table, parent);
+	if (start == NULL)
+		return NULL;
+
+	dummy = calloc(1, sizeof *dummy);
+	if (dummy == NULL)
+		return NULL;
+	dummy->so_key = dummy_key(bucket);
+
+	node = list_insert(start, dummy);
+	if (node != dummy)
+		free(dummy);
+
+	if (set_bucket(table, bucket, node) != 0)
+		return NULL;
+	return node;
+}
+
+/**
+ * @brief Find the dummy node of the bucket of a hash.
+ */
+static struct lf_node *hash_bucket(struct lf_table *table, unsigned int hash)
+{
+	unsigned long buckets = LOAD(&table->buckets);
+
+	return bucket_node(table, hash & (buckets - 1));
+}
+
+static struct lf_value *value_create(const char *data, unsigned int version, int deleted)
+{
+	size_t len = data == NULL ? 0 : strlen(data);
+	struct lf_value *v = malloc(sizeof *v + len + 1);
+
+	if (v == NULL)
+		return NULL;
+
+	v->version = version;
+	v->deleted = deleted;
+	v->retired_next = NULL;
+	if (len > 0)
+		memcpy(v->data, data, len);
+	v->data[len] = '\0';
+	return v;
+}
+
+static void free_values(struct lf_value *v)
+{
+	while (v != NULL) {
+		struct lf_value *next = v->retired_next;
+		free(v);
+		v = next;
+	}
+}
+
+/**
+ * @brief Publish the global epoch in a free slot.
+ *
+ * @return Returns the slot, which must be passed to epoch_exit().
+ */
+static struct lf_slot *epoch_enter(struct lf_table *table)
+{
+	int i = slot_hint;
+	struct lf_slot *slot;
+	unsigned long e;
+
+	while (1) {
+		int free_slot = 0;
+
+		slot = &table->slots[i];
+		if (LOAD(&slot->busy) == 0 && CAS(&slot->busy, &free_slot, 1))
+			break;
+		i = (i + 1) % LF_MAX_SLOTS;
+	}
+	slot_hint = i;
+
+	// the epoch must not move on between reading and publishing it
+	do {
+		e = __atomic_load_n(&table->epoch, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&slot->epoch, e, __ATOMIC_SEQ_CST);
+	} while (__atomic_load_n(&table->epoch, __ATOMIC_SEQ_CST) != e);
+
+	return slot;
+}
+
+static void epoch_exit(struct lf_slot *slot)
+{
+	__atomic_store_n(&slot->busy, 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Move the global epoch on if every running operation has seen it,
+ * and free the values that can no longer be read.
+ */
+static void epoch_advance(struct lf_table *table)
+{
+	unsigned long e = __atomic_load_n(&table->epoch, __ATOMIC_SEQ_CST);
+	int i;
+
+	for (i = 0; i < LF_MAX_SLOTS; i++) {
+		struct lf_slot *slot = &table->slots[i];
+		if (__atomic_load_n(&slot->busy, __ATOMIC_SEQ_CST) &&
+		    __atomic_load_n(&slot->epoch, __ATOMIC_SEQ_CST) != e)
+			return;
+	}
+
+	if (__atomic_compare_exchange_n(&table->epoch, &e, e + 1, 0,
+	    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		// the values replaced in epoch e - 1
+		free_values(__atomic_exchange_n(&table->retired[(e + 2) % 3], NULL, __ATOMIC_SEQ_CST));
+	}
+}
+
+/**
+ * @brief Free a value once no operation can still be reading it.
+ *
+ * The value must already be swapped out. It goes on the list of the
+ * global epoch read after the swap, not of the epoch the caller started
+ * in: the global epoch may have moved one past that, and a reader that
+ * started in the newer epoch may still hold the value.
+ */
+static void epoch_retire(struct lf_table *table, struct lf_value *v)
+{
+	struct lf_value **list;
+	struct lf_value *head;
+	unsigned long e;
+
+	// a read-modify-write reads the latest epoch, not one from before the swap
+	e = __atomic_fetch_add(&table->epoch, 0, __ATOMIC_SEQ_CST);
+	list = &table->retired[e % 3];
+	head = LOAD(list);
+
+	do {
+		v->retired_next = head;
+	} while (!CAS(list, &head, v));
+
+	epoch_advance(table);
+}
+
+struct lf_table *lf_create(void)
+{
+	struct lf_table *table = calloc(1, sizeof *table);
+	struct lf_node *head;
+
+	if (table == NULL)
+		return NULL;
+
+	head = calloc(1, sizeof *head);
+	if (head == NULL || set_bucket(table, 0, head) != 0) {
+		free(head);
+		free(table);
+		return NULL;
+	}
+
+	table->buckets = LF_INITIAL_BUCKETS;
+	return table;
+}
+
+int lf_get(struct lf_table *table, const char *key, struct storage_record *record)
+{
+	unsigned int hash = hash_key(key);
+	struct lf_slot *slot = epoch_enter(table);
+	struct lf_node *start = hash_bucket(table, hash);
+	struct lf_node *node = NULL;
+	int ret = -1;
+
+	if (start != NULL)
+		node = list_find(start, regular_key(hash), key);
+
+	if (node != NULL) {
+		struct lf_value *v = LOAD(&node->value);
+		if (!v->deleted) {
+			strncpy(record->value, v->data, sizeof record->value);
+			record->metadata[0] = v->version;
+			ret = 0;
+		}
+	}
+
+	epoch_exit(slot);
+	return ret;
+}
+
+/**
+ * @brief Add a new key to the list.
+ *
+ * @return Returns the node of the key, which was already in the list if
+ * *inserted is 0, or NULL if there is no memory.
+ */
+static struct lf_node *insert_key(struct lf_table *table, struct lf_node *start,
+		unsigned int hash, const char *key, const char *data, int *inserted)
+{
+	struct lf_node *node = calloc(1, sizeof *node);
+	struct lf_node *found;
+	unsigned long buckets;
+	long nodes;
+
+	*inserted = 0;
+	if (node == NULL)
+		return NULL;
+
+	node->so_key = regular_key(hash);
+	node->key = strdup(key);
+	node->value = value_create(data, 1, 0);
+	if (node->key == NULL || node->value == NULL) {
+		free(node->key);
+		free(node->value);
+		free(node);
+		return NULL;
+	}
+
+	found = list_insert(start, node);
+	if (found != node) {
+		free(node->key);
+		free(node->value);
+		free(node);
+		return found;
+	}
+
+	*inserted = 1;
+	__atomic_add_fetch(&table->live, 1, __ATOMIC_RELAXED);
+	nodes = __atomic_add_fetch(&table->nodes, 1, __ATOMIC_RELAXED);
+
+	// double the buckets; their dummy nodes are added when they are used
+	buckets = LOAD(&table->buckets);
+	if (nodes > (long) (buckets * LF_LOAD_FACTOR) && buckets * 2 <= LF_MAX_BUCKETS)
+		CAS(&table->buckets, &buckets, buckets * 2);
+
+	return node;
+}
+
+/**
+ * @brief Insert, modify or delete a key, or with modify_only, only modify
+ * a live key.
+ */
+static int set_key(struct lf_table *table, const char *key, struct storage_record *record,
+	int modify_only)
+{
+	unsigned int hash = hash_key(key);
+	struct lf_slot *slot = epoch_enter(table);
+	struct lf_node *start = hash_bucket(table, hash);
+	struct lf_node *node;
+	struct lf_value *cur, *next = NULL;
+	int ret = 1;
+
+	if (start == NULL)
+		goto out;
+
+	node = list_find(start, regular_key(hash), key);
+	if (node == NULL) {
+		int inserted;
+
+		if (record == NULL || modify_only)
+			goto out;
+
+		node = insert_key(table, start, hash, key, record->value, &inserted);
+		if (node == NULL)
+			goto out;
+		if (inserted) {
+			record->metadata[0] = 1;
+			ret = 0;
+			goto out;
+		}
+	}
+
+	next = value_create(record == NULL ? NULL : record->value, 0, record == NULL);
+	if (next == NULL)
+		goto out;
+
+	cur = LOAD(&node->value);
+	while (1) {
+		if (record == NULL) {
+			if (cur->deleted) {
+				ret = 1;
+				break;
+			}
+			next->version = cur->version + 1;
+			ret = 2;
+		} else if (cur->deleted) {
+			if (modify_only) {
+				ret = 1;
+				break;
+			}
+			next->version = cur->version;
+			ret = 0;
+		} else {
+			if (record->metadata[0] != 0 && record->metadata[0] != cur->version) {
+				ret = 4;
+				break;
+			}
+			next->version = cur->version + 1;
+			ret = 3;
+		}
+
+		if (CAS(&node->value, &cur, next))
+			break;
+
+		// another thread changed the key first; check against its value
+	}
+
+	if (ret == 1 || ret == 4) {
+		free(next);
+		goto out;
+	}
+
+	epoch_retire(table, cur);
+	if (ret == 2)
+		__atomic_sub_fetch(&table->live, 1, __ATOMIC_RELAXED);
+	else {
+		if (ret == 0)
+			__atomic_add_fetch(&table->live, 1, __ATOMIC_RELAXED);
+		record->metadata[0] = next->version;
+	}
+
+out:
+	epoch_exit(slot);
+	return ret;
+}
+
+int lf_set(struct lf_table *table, const char *key, struct storage_record *record)
+{
+	return set_key(table, key, record, 0);
+}
+
+int lf_modify(struct lf_table *table, const char *key, struct storage_record *record)
+{
+	return set_key(table, key, record, 1);
+}
+
+int lf_scan(struct lf_table *table, lf_visit_fn visit, void *arg)
+{
+	return lf_scan_from(table, NULL, visit, arg);
+}
+
+int lf_scan_from(struct lf_table *table, const char *after, lf_visit_fn visit, void *arg)
+{
+	struct lf_slot *slot = epoch_enter(table);
+	struct lf_node *node = LOAD(&get_bucket(table, 0)->next);
+	struct storage_record record;
+
+	// the list keeps its order as the table grows, so the scan goes on
+	// from the node of after, found through its bucket
+	if (after != NULL) {
+		unsigned int hash = hash_key(after);
+		unsigned int so_key = regular_key(hash);
+		struct lf_node *start = hash_bucket(table, hash);
+
+		if (start == NULL) {
+			epoch_exit(slot);
+			return -1;
+		}
+
+		node = LOAD(&start->next);
+		while (node != NULL && (node_before(node, so_key, after) || node_matches(node, so_key, after)))
+			node = LOAD(&node->next);
+	}
+
+	for (; node != NULL; node = LOAD(&node->next)) {
+		struct lf_value *v;
+
+		if (node->key == NULL)
+			continue;
+
+		v = LOAD(&node->value);
+		if (v->deleted)
+			continue;
+
+		strncpy(record.value, v->data, sizeof record.value);
+		record.metadata[0] = v->version;
+		if (visit(node->key, &record, arg) != 0)
+			break;
+	}
+
+	epoch_exit(slot);
+	return 0;
+}
+
+long lf_count(struct lf_table *table)
+{
+	return __atomic_load_n(&table->live, __ATOMIC_RELAXED);
+}
+
+void lf_destroy(struct lf_table *table)
+{
+	struct lf_node *node;
+	int i;
+
+	if (table == NULL)
+		return;
+
+	node = get_bucket(table, 0);
+	while (node != NULL) {
+		struct lf_node *next = node->next;
+		free(node->key);
+		free(node->value);
+		free(node);
+		node = next;
+	}
+
+	for (i = 0; i < 3; i++)
+		free_values(table->retired[i]);
+	for (i = 0; i < LF_MAX_SEGMENTS; i++)
+		free(table->segments[i]);
+	free(table);
+}
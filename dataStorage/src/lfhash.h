@@ -0,0 +1,100 @@
+/**
+ * @file
+ * @brief This file declares the lock-free hash table engine, for tables
+ * that are written by many clients at the same time.
+ *
+ * The table is a split-ordered list: all keys are in one sorted linked
+ * list, and the buckets point into it. Keys are only ever added to the
+ * list with compare-and-swap, and every change of a key swaps the pointer
+ * to its value, so no operation takes a lock. The number of buckets doubles
+ * as the table fills up, and a new bucket is set up the first time it is
+ * used, so the table never stops to rehash.
+ */
+
+#ifndef LFHASH_H
+#define LFHASH_H
+
+#include "storage.h"
+
+/**
+ * @brief A lock-free hash table. The fields are private to lfhash.c.
+ */
+struct lf_table;
+
+/**
+ * @brief Called by lf_scan() for every live record.
+ *
+ * The key and record are only valid during the call. Returning a
+ * non-zero value stops the scan.
+ */
+typedef int (*lf_visit_fn)(const char *key, struct storage_record *record, void *arg);
+
+/**
+ * @brief Create an empty table.
+ *
+ * @return Returns the table, or NULL if there is no memory for it.
+ */
+struct lf_table *lf_create(void);
+
+/**
+ * @brief Look up a key.
+ *
+ * @return Returns 0 and fills in the value and version (metadata[0]) of
+ * the record if the key exists, and -1 otherwise.
+ */
+int lf_get(struct lf_table *table, const char *key, struct storage_record *record);
+
+/**
+ * @brief Insert, modify or delete a key.
+ *
+ * @param record The new record, or NULL to delete the key.
+ * @return Returns the same codes as add_string() in server.c: 0 if the
+ * record was inserted, 2 if it was deleted, 3 if it was modified, 4 if
+ * the version in metadata[0] did not match, and 1 otherwise.
+ *
+ * The table copies the record, and sets metadata[0] of the given record
+ * to the new version. A deleted key remembers its version, so inserting
+ * it again continues from the old version.
+ */
+int lf_set(struct lf_table *table, const char *key, struct storage_record *record);
+
+/**
+ * @brief Modify a key only if it exists, and has the version in
+ * metadata[0] of the record, or any version if it is 0.
+ *
+ * @return Returns 3 if the record was modified, 4 if the version did not
+ * match, and 1 if the key does not exist or there is no memory.
+ *
+ * A key deleted since it was read is not inserted again, so a
+ * read-modify-write can not bring it back.
+ */
+int lf_modify(struct lf_table *table, const char *key, struct storage_record *record);
+
+/**
+ * @brief Visit every live record of the table.
+ *
+ * Records changed during the scan may be seen either before or after
+ * the change.
+ */
+int lf_scan(struct lf_table *table, lf_visit_fn visit, void *arg);
+
+/**
+ * @brief Visit the live records of the table that come after a given key
+ * in the order lf_scan() visits them, so a scan that stopped can go on
+ * from its last key.
+ *
+ * @return Returns 0 on success, and -1 if there is no memory.
+ */
+int lf_scan_from(struct lf_table *table, const char *after, lf_visit_fn visit, void *arg);
+
+/**
+ * @brief Count the live records of the table.
+ */
+long lf_count(struct lf_table *table);
+
+/**
+ * @brief Free the table. No other thread may be using it.
+ */
+void lf_destroy(struct lf_table *table);
+
+#endif
@@ -0,0 +1,1507 @@
+/**
+ * @file
+ * @brief This file implements the log-structured merge tree storage
+ * engine declared in lsm.h.
+ *
+ * A run file holds its entries sorted by key, followed by a sparse index
+ * (every LSM_INDEX_INTERVAL-th key and its offset), a bloom filter, and a
+ * footer with the offsets of the index and the filter. Entries are stored
+ * as: key length, key, version, flags, value length, value.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "utils.h"
+#include "lsm.h"
+
+#define LSM_INDEX_INTERVAL 16	///< Entries between two sparse index keys.
+#define LSM_COMPACT_TRIGGER 4	///< Runs of similar size that start a compaction.
+#define LSM_TIER_RATIO 2	///< Max ratio of the sizes of runs merged together.
+#define LSM_BLOOM_BITS_PER_KEY 10	///< Bloom filter bits for each key.
+#define LSM_BLOOM_HASHES 7	///< Bit positions set for each key.
+#define LSM_MAX_LEVEL 16	///< Max height of the memtable skip list.
+#define LSM_RUN_MAGIC 0x4c534d31	///< Marks the end of a complete run file.
+#define LSM_FOOTER_LEN 28	///< Bytes in the footer of a run file.
+#define LSM_FLAG_DELETED 1	///< Entry flag of a deleted key.
+#define LSM_MAX_FILE_LEN (MAX_PATH_LEN + 32)	///< Max characters of a file path.
+
+/**
+ * @brief A key in the memtable skip list.
+ */
+struct mem_node {
+	char key[MAX_KEY_LEN + 1];
+	unsigned int version;
+	int deleted;
+	char *value;
+	int level;
+	struct mem_node *next[];
+};
+
+/**
+ * @brief The sorted in-memory part of the tree and its write-ahead log.
+ */
+struct memtable {
+	unsigned int seq;
+	struct mem_node *head;
+	int level;
+	long bytes;
+	long count;
+	unsigned int random;
+	FILE *wal;
+	char wal_path[LSM_MAX_FILE_LEN];
+};
+
+/**
+ * @brief An immutable sorted run on disk.
+ *
+ * The sparse index and the bloom filter are kept in memory.
+ */
+struct lsm_run {
+	unsigned int seq;
+	unsigned int gen;
+	int fd;
+	char path[LSM_MAX_FILE_LEN];
+	long count;
+	long data_end;
+	int nindex;
+	char (*index_keys)[MAX_KEY_LEN + 1];
+	long *index_offsets;
+	unsigned char *bloom;
+	unsigned int bloom_bits;
+
+	/// Readers using the run. Guarded by the tree lock.
+	int refs;
+	/// Set once a compaction replaced the run.
+	int obsolete;
+};
+
+struct lsm_tree {
+	char directory[MAX_PATH_LEN];
+	long memtable_size;
+
+	/// Guards mem, imm, runs and the run reference counts.
+	pthread_mutex_t lock;
+	/// Makes the read-check-write of lsm_set() atomic.
+	pthread_mutex_t write_lock;
+	/// Signalled when a flush or a compaction finishes.
+	pthread_cond_t changed;
+	/// Wakes up the background thread.
+	pthread_cond_t work;
+
+	struct memtable *mem;
+	struct memtable *imm;
+
+	/// The runs, newest first.
+	struct lsm_run **runs;
+	int nruns;
+	int runs_cap;
+
+	unsigned int next_seq;
+	pthread_t thread;
+	int started;
+	int stopping;
+};
+
+/**
+ * @brief A decoded entry.
+ */
+struct lsm_entry {
+	char key[MAX_KEY_LEN + 1];
+	unsigned int version;
+	int deleted;
+	char value[MAX_VALUE_LEN];
+};
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+
+// FILE FORMAT
+
+/**
+ * @brief Write one entry to a run or a log.
+ *
+ * @return Returns 0 on success, -1 otherwise.
+ */
+static int write_entry(FILE *f, const char *key, unsigned int version, int deleted, const char *value)
+{
+	unsigned short keylen = strlen(key);
+	unsigned short vallen = deleted ? 0 : strlen(value);
+	unsigned char flags = deleted ? LSM_FLAG_DELETED : 0;
+
+	if (fwrite(&keylen, sizeof keylen, 1, f) != 1 ||
+	    fwrite(key, 1, keylen, f) != keylen ||
+	    fwrite(&version, sizeof version, 1, f) != 1 ||
+	    fwrite(&flags, sizeof flags, 1, f) != 1 ||
+	    fwrite(&vallen, sizeof vallen, 1, f) != 1 ||
+	    (vallen > 0 && fwrite(value, 1, vallen, f) != vallen))
+		return -1;
+
+	return 0;
+}
+
+/**
+ * @brief Read the next entry from a file.
+ *
+ * @return Returns 0 on success, 1 at the end of the file, and -1 if the
+ * entry is damaged.
+ */
+static int read_entry(FILE *f, struct lsm_entry *e)
+{
+	unsigned short keylen, vallen;
+	unsigned char flags;
+
+	if (fread(&keylen, sizeof keylen, 1, f) != 1)
+		return 1;
+	if (keylen > MAX_KEY_LEN ||
+	    fread(e->key, 1, keylen, f) != keylen ||
+	    fread(&e->version, sizeof e->version, 1, f) != 1 ||
+	    fread(&flags, sizeof flags, 1, f) != 1 ||
+	    fread(&vallen, sizeof vallen, 1, f) != 1 ||
+	    vallen >= MAX_VALUE_LEN ||
+	    fread(e->value, 1, vallen, f) != vallen)
+		return -1;
+
+	e->key[keylen] = '\0';
+	e->value[vallen] = '\0';
+	e->deleted = flags & LSM_FLAG_DELETED;
+	return 0;
+}
+
+/**
+ * @brief Decode the entry at *pos in a buffer and move *pos past it.
+ *
+ * @return Returns 0 on success, -1 if the entry does not fit in the buffer.
+ */
+static int decode_entry(const char *buf, long len, long *pos, struct lsm_entry *e)
+{
+	unsigned short keylen, vallen;
+	long p = *pos;
+
+	if (p + (long) sizeof keylen > len)
+		return -1;
+	memcpy(&keylen, buf + p, sizeof keylen);
+	p += sizeof keylen;
+	if (keylen > MAX_KEY_LEN || p + keylen + (long) (sizeof e->version + 1 + sizeof vallen) > len)
+		return -1;
+	memcpy(e->key, buf + p, keylen);
+	e->key[keylen] = '\0';
+	p += keylen;
+	memcpy(&e->version, buf + p, sizeof e->version);
+	p += sizeof e->version;
+	e->deleted = buf[p] & LSM_FLAG_DELETED;
+	p += 1;
+	memcpy(&vallen, buf + p, sizeof vallen);
+	p += sizeof vallen;
+	if (vallen >= MAX_VALUE_LEN || p + vallen > len)
+		return -1;
+	memcpy(e->value, buf + p, vallen);
+	e->value[vallen] = '\0';
+	p += vallen;
+
+	*pos = p;
+	return 0;
+}
+
+/**
+ * @brief 64 bit FNV-1a hash of a key, used by the bloom filters.
+ */
+static unsigned long long hash_key(const char *key)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	for (; *key != '\0'; key++) {
+		h ^= (unsigned char) *key;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static void bloom_add(unsigned char *bloom, unsigned int nbits, const char *key)
+{
+	unsigned long long h = hash_key(key);
+	unsigned int h1 = (unsigned int) h;
+	unsigned int h2 = (unsigned int) (h >> 32) | 1;
+	int i;
+	for (i = 0; i < LSM_BLOOM_HASHES; i++) {
+		unsigned int bit = (h1 + i * h2) % nbits;
+		bloom[bit / 8] |= 1 << (bit % 8);
+	}
+}
+
+static int bloom_may_contain(const unsigned char *bloom, unsigned int nbits, const char *key)
+{
+	unsigned long long h = hash_key(key);
+	unsigned int h1 = (unsigned int) h;
+	unsigned int h2 = (unsigned int) (h >> 32) | 1;
+	int i;
+	for (i = 0; i < LSM_BLOOM_HASHES; i++) {
+		unsigned int bit = (h1 + i * h2) % nbits;
+		if ((bloom[bit / 8] & (1 << (bit % 8))) == 0)
+			return 0;
+	}
+	return 1;
+}
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+
+// MEMTABLE
+
+static struct memtable *memtable_create(struct lsm_tree *tree, unsigned int seq)
+{
+	struct memtable *m = calloc(1, sizeof *m);
+	if (m == NULL)
+		return NULL;
+
+	m->head = calloc(1, sizeof(struct mem_node) + LSM_MAX_LEVEL * sizeof(struct mem_node *));
+	if (m->head == NULL) {
+		free(m);
+		return NULL;
+	}
+
+	m->seq = seq;
+	m->level = 1;
+	m->random = seq * 2654435761U + 1;
+	snprintf(m->wal_path, sizeof m->wal_path, "%s/wal-%08u.log", tree->directory, seq);
+	m->wal = fopen(m->wal_path, "ab");
+	if (m->wal == NULL) {
+		free(m->head);
+		free(m);
+		return NULL;
+	}
+
+	return m;
+}
+
+/**
+ * @brief Free a memtable.
+ *
+ * @param remove_wal Delete the log too, once the memtable is in a run.
+ */
+static void memtable_free(struct memtable *m, int remove_wal)
+{
+	struct mem_node *n = m->head->next[0];
+	while (n != NULL) {
+		struct mem_node *next = n->next[0];
+		free(n->value);
+		free(n);
+		n = next;
+	}
+	free(m->head);
+	fclose(m->wal);
+	if (remove_wal)
+		unlink(m->wal_path);
+	free(m);
+}
+
+static struct mem_node *memtable_find(struct memtable *m, const char *key)
+{
+	struct mem_node *x = m->head;
+	int i;
+	for (i = m->level - 1; i >= 0; i--)
+		while (x->next[i] != NULL && strcmp(x->next[i]->key, key) < 0)
+			x = x->next[i];
+
+	x = x->next[0];
+	if (x != NULL && strcmp(x->key, key) == 0)
+		return x;
+	return NULL;
+}
+
+static int random_level(struct memtable *m)
+{
+	int level = 1;
+	while (level < LSM_MAX_LEVEL) {
+		// xorshift, one level up with probability 1/4
+		m->random ^= m->random << 13;
+		m->random ^= m->random >> 17;
+		m->random ^= m->random << 5;
+		if ((m->random & 3) != 0)
+			break;
+		level++;
+	}
+	return level;
+}
+
+/**
+ * @brief Insert or replace a key in the memtable.
+ *
+ * @param log Append the change to the write-ahead log first.
+ * @return Returns 0 on success, -1 otherwise.
+ */
+static int memtable_put(struct memtable *m, const char *key, unsigned int version,
+	int deleted, const char *value, int log)
+{
+	struct mem_node *update[LSM_MAX_LEVEL];
+	struct mem_node *x = m->head;
+	int i;
+
+	if (log) {
+		if (write_entry(m->wal, key, version, deleted, value) != 0 || fflush(m->wal) != 0)
+			return -1;
+	}
+
+	char *copy = NULL;
+	if (!deleted && (copy = strdup(value)) == NULL)
+		return -1;
+
+	for (i = m->level - 1; i >= 0; i--) {
+		while (x->next[i] != NULL && strcmp(x->next[i]->key, key) < 0)
+			x = x->next[i];
+		update[i] = x;
+	}
+
+	x = x->next[0];
+	if (x != NULL && strcmp(x->key, key) == 0) {
+		if (x->value != NULL)
+			m->bytes -= strlen(x->value);
+		free(x->value);
+	} else {
+		int level = random_level(m);
+		x = calloc(1, sizeof(struct mem_node) + level * sizeof(struct mem_node *));
+		if (x == NULL) {
+			free(copy);
+			return -1;
+		}
+		strncpy(x->key, key, MAX_KEY_LEN);
+		x->level = level;
+
+		for (i = m->level; i < level; i++)
+			update[i] = m->head;
+		if (level > m->level)
+			m->level = level;
+
+		for (i = 0; i < level; i++) {
+			x->next[i] = update[i]->next[i];
+			update[i]->next[i] = x;
+		}
+		m->count++;
+		m->bytes += sizeof(struct mem_node) + level * sizeof(struct mem_node *);
+	}
+
+	x->version = version;
+	x->deleted = deleted;
+	x->value = copy;
+	if (copy != NULL)
+		m->bytes += strlen(copy);
+
+	return 0;
+}
+
+/**
+ * @brief Load the entries of a write-ahead log into a memtable.
+ */
+static int memtable_replay(struct memtable *m, const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return -1;
+
+	struct lsm_entry e;
+	int status;
+	while ((status = read_entry(f, &e)) == 0)
+		memtable_put(m, e.key, e.version, e.deleted, e.value, 1);
+
+	fclose(f);
+
+	// A damaged last entry is a write that never finished.
+	return 0;
+}
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+
+// RUNS
+
+/**
+ * @brief Writes a new run file.
+ */
+struct run_writer {
+	struct lsm_run *run;
+	FILE *f;
+	char tmp_path[LSM_MAX_FILE_LEN];
+	int index_cap;
+};
+
+static void run_free(struct lsm_run *run)
+{
+	if (run->fd >= 0)
+		close(run->fd);
+	free(run->index_keys);
+	free(run->index_offsets);
+	free(run->bloom);
+	free(run);
+}
+
+static int run_writer_open(struct lsm_tree *tree, struct run_writer *w,
+	unsigned int seq, unsigned int gen, long expected_count)
+{
+	memset(w, 0, sizeof *w);
+
+	w->run = calloc(1, sizeof *w->run);
+	if (w->run == NULL)
+		return -1;
+
+	struct lsm_run *run = w->run;
+	run->fd = -1;
+	run->seq = seq;
+	run->gen = gen;
+	snprintf(run->path, sizeof run->path, "%s/run-%08u-%04u.sst", tree->directory, seq, gen);
+	snprintf(w->tmp_path, sizeof w->tmp_path, "%s/run-%08u-%04u.tmp", tree->directory, seq, gen);
+
+	if (expected_count < 1)
+		expected_count = 1;
+	run->bloom_bits = expected_count * LSM_BLOOM_BITS_PER_KEY;
+	if (run->bloom_bits < 64)
+		run->bloom_bits = 64;
+	run->bloom = calloc((run->bloom_bits + 7) / 8, 1);
+
+	w->f = fopen(w->tmp_path, "wb");
+	if (run->bloom == NULL || w->f == NULL) {
+		if (w->f != NULL)
+			fclose(w->f);
+		run_free(run);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int run_writer_add(struct run_writer *w, const char *key, unsigned int version,
+	int deleted, const char *value)
+{
+	struct lsm_run *run = w->run;
+
+	if (run->count % LSM_INDEX_INTERVAL == 0) {
+		if (run->nindex == w->index_cap) {
+			int cap = w->index_cap == 0 ? 64 : w->index_cap * 2;
+			void *keys = realloc(run->index_keys, cap * sizeof *run->index_keys);
+			if (keys == NULL)
+				return -1;
+			run->index_keys = keys;
+			void *offsets = realloc(run->index_offsets, cap * sizeof *run->index_offsets);
+			if (offsets == NULL)
+				return -1;
+			run->index_offsets = offsets;
+			w->index_cap = cap;
+		}
+		strncpy(run->index_keys[run->nindex], key, MAX_KEY_LEN + 1);
+		run->index_offsets[run->nindex] = ftell(w->f);
+		run->nindex++;
+	}
+
+	bloom_add(run->bloom, run->bloom_bits, key);
+	run->count++;
+
+	return write_entry(w->f, key, version, deleted, value);
+}
+
+/**
+ * @brief Write the index, filter and footer, and make the run visible
+ * under its final name.
+ *
+ * @return Returns the run, or NULL on error.
+ */
+static struct lsm_run *run_writer_finish(struct run_writer *w)
+{
+	struct lsm_run *run = w->run;
+	int i;
+
+	unsigned long long index_off = ftell(w->f);
+	unsigned int nindex = run->nindex;
+	int error = fwrite(&nindex, sizeof nindex, 1, w->f) != 1;
+	for (i = 0; i < run->nindex && !error; i++) {
+		unsigned short keylen = strlen(run->index_keys[i]);
+		unsigned long long offset = run->index_offsets[i];
+		error = fwrite(&keylen, sizeof keylen, 1, w->f) != 1 ||
+			fwrite(run->index_keys[i], 1, keylen, w->f) != keylen ||
+			fwrite(&offset, sizeof offset, 1, w->f) != 1;
+	}
+
+	unsigned long long bloom_off = ftell(w->f);
+	unsigned long long count = run->count;
+	unsigned int magic = LSM_RUN_MAGIC;
+	if (!error)
+		error = fwrite(&run->bloom_bits, sizeof run->bloom_bits, 1, w->f) != 1 ||
+			fwrite(run->bloom, 1, (run->bloom_bits + 7) / 8, w->f) != (run->bloom_bits + 7) / 8 ||
+			fwrite(&index_off, sizeof index_off, 1, w->f) != 1 ||
+			fwrite(&bloom_off, sizeof bloom_off, 1, w->f) != 1 ||
+			fwrite(&count, sizeof count, 1, w->f) != 1 ||
+			fwrite(&magic, sizeof magic, 1, w->f) != 1;
+
+	if (!error)
+		error = fflush(w->f) != 0 || fsync(fileno(w->f)) != 0;
+	if (fclose(w->f) != 0)
+		error = 1;
+
+	if (!error)
+		error = rename(w->tmp_path, run->path) != 0;
+	if (!error)
+		error = (run->fd = open(run->path, O_RDONLY)) < 0;
+
+	if (error) {
+		unlink(w->tmp_path);
+		run_free(run);
+		return NULL;
+	}
+
+	run->data_end = index_off;
+	return run;
+}
+
+/**
+ * @brief Open a run written by an earlier server.
+ */
+static struct lsm_run *run_load(const char *path, unsigned int seq, unsigned int gen)
+{
+	struct lsm_run *run = calloc(1, sizeof *run);
+	if (run == NULL)
+		return NULL;
+	run->seq = seq;
+	run->gen = gen;
+	strncpy(run->path, path, sizeof run->path - 1);
+	run->fd = open(path, O_RDONLY);
+
+	FILE *f = run->fd < 0 ? NULL : fopen(path, "rb");
+	if (f == NULL) {
+		run_free(run);
+		return NULL;
+	}
+
+	unsigned long long index_off, bloom_off, count;
+	unsigned int magic = 0, nindex = 0;
+	int error = fseek(f, -LSM_FOOTER_LEN, SEEK_END) != 0 ||
+		fread(&index_off, sizeof index_off, 1, f) != 1 ||
+		fread(&bloom_off, sizeof bloom_off, 1, f) != 1 ||
+		fread(&count, sizeof count, 1, f) != 1 ||
+		fread(&magic, sizeof magic, 1, f) != 1 ||
+		magic != LSM_RUN_MAGIC ||
+		fseek(f, index_off, SEEK_SET) != 0 ||
+		fread(&nindex, sizeof nindex, 1, f) != 1;
+
+	if (!error) {
+		run->index_keys = malloc((nindex + 1) * sizeof *run->index_keys);
+		run->index_offsets = malloc((nindex + 1) * sizeof *run->index_offsets);
+		error = run->index_keys == NULL || run->index_offsets == NULL;
+	}
+
+	unsigned int i;
+	for (i = 0; i < nindex && !error; i++) {
+		unsigned short keylen;
+		unsigned long long offset;
+		error = fread(&keylen, sizeof keylen, 1, f) != 1 || keylen > MAX_KEY_LEN ||
+			fread(run->index_keys[i], 1, keylen, f) != keylen ||
+			fread(&offset, sizeof offset, 1, f) != 1;
+		if (!error) {
+			run->index_keys[i][keylen] = '\0';
+			run->index_offsets[i] = offset;
+		}
+	}
+
+	if (!error)
+		error = fseek(f, bloom_off, SEEK_SET) != 0 ||
+			fread(&run->bloom_bits, sizeof run->bloom_bits, 1, f) != 1 ||
+			run->bloom_bits == 0 ||
+			(run->bloom = malloc((run->bloom_bits + 7) / 8)) == NULL ||
+			fread(run->bloom, 1, (run->bloom_bits + 7) / 8, f) != (run->bloom_bits + 7) / 8;
+
+	fclose(f);
+	if (error) {
+		run_free(run);
+		return NULL;
+	}
+
+	run->nindex = nindex;
+	run->count = count;
+	run->data_end = index_off;
+	return run;
+}
+
+/**
+ * @brief Find the block of a run that would hold a key.
+ *
+ * @return Returns the block with the last index key <= key, or -1 if the
+ * key sorts before the whole run.
+ */
+static int run_block(struct lsm_run *run, const char *key)
+{
+	int lo = 0, hi = run->nindex - 1, block = -1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (strcmp(run->index_keys[mid], key) <= 0) {
+			block = mid;
+			lo = mid + 1;
+		} else
+			hi = mid - 1;
+	}
+	return block;
+}
+
+/**
+ * @brief Look up a key in a run.
+ *
+ * @return Returns 1 if the key was found, 0 if not, and -1 on error.
+ */
+static int run_find(struct lsm_run *run, const char *key, struct lsm_entry *e)
+{
+	if (run->nindex == 0 || !bloom_may_contain(run->bloom, run->bloom_bits, key))
+		return 0;
+
+	int block = run_block(run, key);
+	if (block < 0)
+		return 0;
+
+	long start = run->index_offsets[block];
+	long end = block + 1 < run->nindex ? run->index_offsets[block + 1] : run->data_end;
+	char *buf = malloc(end - start);
+	if (buf == NULL || pread(run->fd, buf, end - start, start) != end - start) {
+		free(buf);
+		return -1;
+	}
+
+	int found = 0;
+	long pos = 0;
+	while (pos < end - start) {
+		if (decode_entry(buf, end - start, &pos, e) != 0) {
+			found = -1;
+			break;
+		}
+		int cmp = strcmp(e->key, key);
+		if (cmp == 0)
+			found = 1;
+		if (cmp >= 0)
+			break;
+	}
+
+	free(buf);
+	return found;
+}
+
+/**
+ * @brief Reads the entries of a run in order.
+ */
+struct run_cursor {
+	FILE *f;
+	long end;
+	int valid;
+	struct lsm_entry e;
+};
+
+static int run_cursor_next(struct run_cursor *c)
+{
+	c->valid = 0;
+	if (ftell(c->f) >= c->end)
+		return 0;
+	if (read_entry(c->f, &c->e) != 0)
+		return -1;
+	c->valid = 1;
+	return 0;
+}
+
+/**
+ * @brief Start reading a run at the first entry after a key, or at the
+ * first entry if after is NULL.
+ */
+static int run_cursor_open(struct run_cursor *c, struct lsm_run *run, const char *after)
+{
+	c->valid = 0;
+	c->end = run->data_end;
+	c->f = fopen(run->path, "rb");
+	if (c->f == NULL)
+		return -1;
+
+	// skip the blocks before the one holding after
+	int block = after != NULL ? run_block(run, after) : -1;
+	if (block >= 0 && fseek(c->f, run->index_offsets[block], SEEK_SET) != 0)
+		return -1;
+
+	if (run_cursor_next(c) != 0)
+		return -1;
+	while (after != NULL && c->valid && strcmp(c->e.key, after) <= 0)
+		if (run_cursor_next(c) != 0)
+			return -1;
+	return 0;
+}
+
+static void run_cursor_close(struct run_cursor *c)
+{
+	if (c->f != NULL)
+		fclose(c->f);
+	c->f = NULL;
+}
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+
+// TREE
+
+/**
+ * @brief Drop a reference to a run. Must be called with the tree lock.
+ *
+ * An obsolete run is deleted once its last reader is done.
+ */
+static void run_unref(struct lsm_run *run)
+{
+	run->refs--;
+	if (run->refs == 0 && run->obsolete) {
+		unlink(run->path);
+		run_free(run);
+	}
+}
+
+/**
+ * @brief Take a reference to every run. Must be called with the tree lock.
+ *
+ * @return Returns a copy of the run list, newest first.
+ */
+static struct lsm_run **runs_acquire(struct lsm_tree *tree, int *nruns)
+{
+	struct lsm_run **runs = malloc((tree->nruns + 1) * sizeof *runs);
+	int i;
+
+	*nruns = 0;
+	if (runs == NULL)
+		return NULL;
+
+	for (i = 0; i < tree->nruns; i++) {
+		runs[i] = tree->runs[i];
+		runs[i]->refs++;
+	}
+	*nruns = tree->nruns;
+	return runs;
+}
+
+static void runs_release(struct lsm_tree *tree, struct lsm_run **runs, int nruns)
+{
+	int i;
+	pthread_mutex_lock(&tree->lock);
+	for (i = 0; i < nruns; i++)
+		run_unref(runs[i]);
+	pthread_mutex_unlock(&tree->lock);
+	free(runs);
+}
+
+static int runs_reserve(struct lsm_tree *tree, int n)
+{
+	if (n <= tree->runs_cap)
+		return 0;
+	int cap = tree->runs_cap == 0 ? 8 : tree->runs_cap * 2;
+	if (cap < n)
+		cap = n;
+	struct lsm_run **runs = realloc(tree->runs, cap * sizeof *runs);
+	if (runs == NULL)
+		return -1;
+	tree->runs = runs;
+	tree->runs_cap = cap;
+	return 0;
+}
+
+/**
+ * @brief Find the newest entry of a key, deleted or not.
+ *
+ * @return Returns 1 if the key was found, 0 if not, and -1 on error.
+ */
+static int lsm_lookup(struct lsm_tree *tree, const char *key, struct lsm_entry *e)
+{
+	struct memtable *tables[2];
+	int i;
+
+	pthread_mutex_lock(&tree->lock);
+
+	tables[0] = tree->mem;
+	tables[1] = tree->imm;
+	for (i = 0; i < 2; i++) {
+		struct mem_node *n = tables[i] == NULL ? NULL : memtable_find(tables[i], key);
+		if (n != NULL) {
+			strncpy(e->key, n->key, sizeof e->key);
+			e->version = n->version;
+			e->deleted = n->deleted;
+			e->value[0] = '\0';
+			if (n->value != NULL)
+				strncpy(e->value, n->value, sizeof e->value);
+			pthread_mutex_unlock(&tree->lock);
+			return 1;
+		}
+	}
+
+	int nruns;
+	struct lsm_run **runs = runs_acquire(tree, &nruns);
+	pthread_mutex_unlock(&tree->lock);
+	if (runs == NULL)
+		return -1;
+
+	int found = 0;
+	for (i = 0; i < nruns && found == 0; i++)
+		found = run_find(runs[i], key, e);
+
+	runs_release(tree, runs, nruns);
+	return found;
+}
+
+/**
+ * @brief Add an entry to the memtable, starting a flush when it is full.
+ */
+static int lsm_write(struct lsm_tree *tree, const char *key, unsigned int version,
+	int deleted, const char *value)
+{
+	pthread_mutex_lock(&tree->lock);
+
+	// wait for the last flush if the memtable is already full
+	while (tree->mem->bytes >= tree->memtable_size && tree->imm != NULL)
+		pthread_cond_wait(&tree->changed, &tree->lock);
+
+	int status = memtable_put(tree->mem, key, version, deleted, value, 1);
+
+	if (status == 0 && tree->mem->bytes >= tree->memtable_size && tree->imm == NULL) {
+		struct memtable *m = memtable_create(tree, tree->next_seq);
+		if (m != NULL) {
+			tree->next_seq++;
+			tree->imm = tree->mem;
+			tree->mem = m;
+			pthread_cond_signal(&tree->work);
+		}
+	}
+
+	pthread_mutex_unlock(&tree->lock);
+	return status;
+}
+
+int lsm_get(struct lsm_tree *tree, const char *key, struct storage_record *record)
+{
+	struct lsm_entry e;
+
+	if (lsm_lookup(tree, key, &e) != 1 || e.deleted)
+		return -1;
+
+	strncpy(record->value, e.value, sizeof record->value);
+	record->metadata[0] = e.version;
+	return 0;
+}
+
+/**
+ * @brief Insert, modify or delete a key, or with modify_only, only modify
+ * a live key.
+ */
+static int lsm_change(struct lsm_tree *tree, const char *key, struct storage_record *record,
+	int modify_only)
+{
+	struct lsm_entry e;
+	int status;
+
+	pthread_mutex_lock(&tree->write_lock);
+
+	int found = lsm_lookup(tree, key, &e);
+	int live = found == 1 && !e.deleted;
+
+	if (found < 0 || (modify_only && !live))
+		status = 1;
+
+	// delete
+	else if (record == NULL) {
+		if (!live)
+			status = 1;
+		else
+			status = lsm_write(tree, key, e.version + 1, 1, NULL) == 0 ? 2 : 1;
+	}
+
+	// modify
+	else if (live) {
+		if (record->metadata[0] == e.version || record->metadata[0] == 0) {
+			record->metadata[0] = e.version + 1;
+			status = lsm_write(tree, key, e.version + 1, 0, record->value) == 0 ? 3 : 1;
+		} else
+			status = 4;
+	}
+
+	// insert, continuing from the version of a deleted key
+	else {
+		record->metadata[0] = found == 1 ? e.version : 1;
+		status = lsm_write(tree, key, record->metadata[0], 0, record->value) == 0 ? 0 : 1;
+	}
+
+	pthread_mutex_unlock(&tree->write_lock);
+	return status;
+}
+
+int lsm_set(struct lsm_tree *tree, const char *key, struct storage_record *record)
+{
+	return lsm_change(tree, key, record, 0);
+}
+
+int lsm_modify(struct lsm_tree *tree, const char *key, struct storage_record *record)
+{
+	return lsm_change(tree, key, record, 1);
+}
+
+/**
+ * @brief Write a full memtable to a new run.
+ */
+static struct lsm_run *flush_memtable(struct lsm_tree *tree, struct memtable *m)
+{
+	struct run_writer w;
+	if (run_writer_open(tree, &w, m->seq, 0, m->count) != 0)
+		return NULL;
+
+	struct mem_node *n;
+	for (n = m->head->next[0]; n != NULL; n = n->next[0]) {
+		if (run_writer_add(&w, n->key, n->version, n->deleted, n->value) != 0) {
+			fclose(w.f);
+			unlink(w.tmp_path);
+			run_free(w.run);
+			return NULL;
+		}
+	}
+
+	return run_writer_finish(&w);
+}
+
+/**
+ * @brief Merge runs into one, keeping the newest entry of every key.
+ *
+ * @param runs The runs, newest first.
+ */
+static struct lsm_run *merge_runs(struct lsm_tree *tree, struct lsm_run **runs, int nruns)
+{
+	struct run_cursor *cursors = calloc(nruns, sizeof *cursors);
+	struct run_writer w;
+	long count = 0;
+	unsigned int gen = 0;
+	int i, error = 0;
+
+	if (cursors == NULL)
+		return NULL;
+
+	for (i = 0; i < nruns; i++) {
+		count += runs[i]->count;
+		if (runs[i]->gen >= gen)
+			gen = runs[i]->gen + 1;
+		if (run_cursor_open(&cursors[i], runs[i], NULL) != 0)
+			error = 1;
+	}
+
+	// the merged run takes the place of the newest input
+	if (!error && run_writer_open(tree, &w, runs[0]->seq, gen, count) != 0)
+		error = 1;
+	if (error) {
+		for (i = 0; i < nruns; i++)
+			run_cursor_close(&cursors[i]);
+		free(cursors);
+		return NULL;
+	}
+
+	while (!error) {
+		int newest = -1;
+		for (i = 0; i < nruns; i++)
+			if (cursors[i].valid && (newest < 0 || strcmp(cursors[i].e.key, cursors[newest].e.key) < 0))
+				newest = i;
+		if (newest < 0)
+			break;
+
+		struct lsm_entry *e = &cursors[newest].e;
+		error = run_writer_add(&w, e->key, e->version, e->deleted, e->value) != 0;
+
+		// skip the older entries of the same key
+		char key[MAX_KEY_LEN + 1];
+		strncpy(key, e->key, sizeof key);
+		for (i = 0; i < nruns && !error; i++)
+			while (cursors[i].valid && strcmp(cursors[i].e.key, key) == 0)
+				if (run_cursor_next(&cursors[i]) != 0)
+					error = 1;
+	}
+
+	for (i = 0; i < nruns; i++)
+		run_cursor_close(&cursors[i]);
+	free(cursors);
+
+	if (error) {
+		fclose(w.f);
+		unlink(w.tmp_path);
+		run_free(w.run);
+		return NULL;
+	}
+
+	return run_writer_finish(&w);
+}
+
+/**
+ * @brief Find runs of similar size to merge. Must be called with the tree
+ * lock.
+ *
+ * @param first Receives the index of the newest run to merge.
+ * @return Returns the number of runs to merge, or 0 if no compaction is
+ * needed.
+ *
+ * The runs merged are next to each other in the list, so the merged run
+ * can take their place without hiding a newer entry, and their sizes are
+ * within LSM_TIER_RATIO of each other. Runs smaller than a memtable count
+ * as one memtable. A merged run is about LSM_COMPACT_TRIGGER times larger
+ * than its inputs, so it is only merged again with runs of its new size,
+ * and every entry is rewritten once per tier rather than once per
+ * compaction.
+ */
+static int pick_runs(struct lsm_tree *tree, int *first)
+{
+	int i, j;
+
+	for (i = 0; i + LSM_COMPACT_TRIGGER <= tree->nruns; i++) {
+		long smallest = tree->runs[i]->data_end;
+		long largest = smallest;
+
+		for (j = i + 1; j < tree->nruns; j++) {
+			long size = tree->runs[j]->data_end;
+			long low = size < smallest ? size : smallest;
+			long high = size > largest ? size : largest;
+			if (low < tree->memtable_size)
+				low = tree->memtable_size;
+			if (high > low * LSM_TIER_RATIO)
+				break;
+			smallest = low;
+			largest = high;
+		}
+
+		if (j - i >= LSM_COMPACT_TRIGGER) {
+			*first = i;
+			return j - i;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief The background thread: flushes full memtables and compacts runs.
+ */
+static void *lsm_background(void *arg)
+{
+	struct lsm_tree *tree = arg;
+	int first = 0;
+
+	pthread_mutex_lock(&tree->lock);
+	while (1) {
+		while (!tree->stopping && tree->imm == NULL && pick_runs(tree, &first) == 0)
+			pthread_cond_wait(&tree->work, &tree->lock);
+
+		if (tree->stopping)
+			break;
+
+		if (tree->imm != NULL) {
+			struct memtable *m = tree->imm;
+			pthread_mutex_unlock(&tree->lock);
+
+			struct lsm_run *run = flush_memtable(tree, m);
+
+			pthread_mutex_lock(&tree->lock);
+			if (run == NULL || runs_reserve(tree, tree->nruns + 1) != 0) {
+				printf("lsm: could not flush memtable to %s\n", tree->directory);
+				if (run != NULL) {
+					unlink(run->path);
+					run_free(run);
+				}
+				// try again a bit later, the memtable is still in its log
+				pthread_mutex_unlock(&tree->lock);
+				sleep(1);
+				pthread_mutex_lock(&tree->lock);
+				continue;
+			}
+
+			memmove(tree->runs + 1, tree->runs, tree->nruns * sizeof *tree->runs);
+			tree->runs[0] = run;
+			run->refs = 1;
+			tree->nruns++;
+			tree->imm = NULL;
+			memtable_free(m, 1);
+			pthread_cond_broadcast(&tree->changed);
+			continue;
+		}
+
+		// Compact the runs picked. Runs flushed meanwhile are added in
+		// front, so the inputs stay together, further down the list.
+		int nruns = pick_runs(tree, &first);
+		int i;
+		struct lsm_run **runs = malloc(nruns * sizeof *runs);
+		if (runs != NULL)
+			for (i = 0; i < nruns; i++) {
+				runs[i] = tree->runs[first + i];
+				runs[i]->refs++;
+			}
+		pthread_mutex_unlock(&tree->lock);
+
+		struct lsm_run *merged = runs == NULL ? NULL : merge_runs(tree, runs, nruns);
+
+		pthread_mutex_lock(&tree->lock);
+		if (merged == NULL) {
+			printf("lsm: could not compact runs in %s\n", tree->directory);
+			if (runs != NULL) {
+				for (i = 0; i < nruns; i++)
+					run_unref(runs[i]);
+				free(runs);
+			}
+			pthread_mutex_unlock(&tree->lock);
+			sleep(1);
+			pthread_mutex_lock(&tree->lock);
+			continue;
+		}
+
+		for (first = 0; tree->runs[first] != runs[0]; first++)
+			;
+		for (i = 0; i < nruns; i++) {
+			runs[i]->obsolete = 1;
+			run_unref(runs[i]);	// the list's reference
+			run_unref(runs[i]);	// ours
+		}
+		tree->runs[first] = merged;
+		merged->refs = 1;
+		memmove(tree->runs + first + 1, tree->runs + first + nruns,
+			(tree->nruns - first - nruns) * sizeof *tree->runs);
+		tree->nruns -= nruns - 1;
+		free(runs);
+		pthread_cond_broadcast(&tree->changed);
+	}
+	pthread_mutex_unlock(&tree->lock);
+
+	return NULL;
+}
+
+static int compare_runs(const void *a, const void *b)
+{
+	const struct lsm_run *x = *(struct lsm_run * const *) a;
+	const struct lsm_run *y = *(struct lsm_run * const *) b;
+
+	// newest first
+	if (x->seq != y->seq)
+		return x->seq < y->seq ? 1 : -1;
+	if (x->gen != y->gen)
+		return x->gen < y->gen ? 1 : -1;
+	return 0;
+}
+
+static int compare_seqs(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *) a;
+	unsigned int y = *(const unsigned int *) b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Load the runs and logs left in the directory.
+ */
+static int lsm_recover(struct lsm_tree *tree)
+{
+	DIR *dir = opendir(tree->directory);
+	struct dirent *d;
+	unsigned int *wals = NULL;
+	int nwals = 0, wals_cap = 0;
+	unsigned int max_run_seq = 0;
+	char path[LSM_MAX_FILE_LEN];
+	int i;
+
+	if (dir == NULL)
+		return -1;
+
+	while ((d = readdir(dir)) != NULL) {
+		unsigned int seq, gen;
+		char tail;
+
+		// the names of runs and logs are short, so a longer one is not ours
+		if (snprintf(path, sizeof path, "%s/%s", tree->directory, d->d_name) >= (int) sizeof path)
+			continue;
+
+		if (sscanf(d->d_name, "run-%u-%u.ss%c", &seq, &gen, &tail) == 3 && tail == 't') {
+			struct lsm_run *run = run_load(path, seq, gen);
+			if (run == NULL || runs_reserve(tree, tree->nruns + 1) != 0) {
+				printf("lsm: ignoring damaged run %s\n", path);
+				if (run != NULL)
+					run_free(run);
+				continue;
+			}
+			run->refs = 1;
+			tree->runs[tree->nruns++] = run;
+			if (seq > max_run_seq)
+				max_run_seq = seq;
+			if (seq >= tree->next_seq)
+				tree->next_seq = seq + 1;
+		}
+
+		else if (sscanf(d->d_name, "run-%u-%u.tm%c", &seq, &gen, &tail) == 3 && tail == 'p')
+			unlink(path);	// an unfinished flush or compaction
+
+		else if (sscanf(d->d_name, "wal-%u.lo%c", &seq, &tail) == 2 && tail == 'g') {
+			if (nwals == wals_cap) {
+				wals_cap = wals_cap == 0 ? 8 : wals_cap * 2;
+				unsigned int *w = realloc(wals, wals_cap * sizeof *wals);
+				if (w == NULL)
+					break;
+				wals = w;
+			}
+			wals[nwals++] = seq;
+			if (seq >= tree->next_seq)
+				tree->next_seq = seq + 1;
+		}
+	}
+	closedir(dir);
+
+	if (tree->nruns > 0)
+		qsort(tree->runs, tree->nruns, sizeof *tree->runs, compare_runs);
+	if (nwals > 0)
+		qsort(wals, nwals, sizeof *wals, compare_seqs);
+
+	tree->mem = memtable_create(tree, tree->next_seq++);
+	if (tree->mem == NULL) {
+		free(wals);
+		return -1;
+	}
+
+	// Logs up to the newest run were flushed before the server stopped.
+	for (i = 0; i < nwals; i++) {
+		snprintf(path, sizeof path, "%s/wal-%08u.log", tree->directory, wals[i]);
+		if (wals[i] > max_run_seq)
+			memtable_replay(tree->mem, path);
+		unlink(path);
+	}
+
+	free(wals);
+	return 0;
+}
+
+struct lsm_tree *lsm_open(const char *directory, long memtable_size)
+{
+	struct lsm_tree *tree;
+
+	// the file names are appended to the directory, so it must not be cut off
+	if (strlen(directory) >= sizeof tree->directory)
+		return NULL;
+
+	tree = calloc(1, sizeof *tree);
+	if (tree == NULL)
+		return NULL;
+
+	strncpy(tree->directory, directory, sizeof tree->directory - 1);
+	tree->memtable_size = memtable_size;
+	tree->next_seq = 1;
+	pthread_mutex_init(&tree->lock, NULL);
+	pthread_mutex_init(&tree->write_lock, NULL);
+	pthread_cond_init(&tree->changed, NULL);
+	pthread_cond_init(&tree->work, NULL);
+
+	if (make_directory(directory) != 0 || lsm_recover(tree) != 0) {
+		lsm_close(tree);
+		return NULL;
+	}
+
+	if (pthread_create(&tree->thread, NULL, lsm_background, tree) != 0) {
+		lsm_close(tree);
+		return NULL;
+	}
+	tree->started = 1;
+
+	return tree;
+}
+
+void lsm_stats(struct lsm_tree *tree, long *memory, long *disk)
+{
+	int i;
+
+	pthread_mutex_lock(&tree->lock);
+	*memory = tree->mem->count + (tree->imm == NULL ? 0 : tree->imm->count);
+	*disk = 0;
+	for (i = 0; i < tree->nruns; i++)
+		*disk += tree->runs[i]->count;
+	pthread_mutex_unlock(&tree->lock);
+}
+
+void lsm_close(struct lsm_tree *tree)
+{
+	int i;
+
+	if (tree == NULL)
+		return;
+
+	if (tree->started) {
+		pthread_mutex_lock(&tree->lock);
+		tree->stopping = 1;
+		pthread_cond_signal(&tree->work);
+		pthread_mutex_unlock(&tree->lock);
+		pthread_join(tree->thread, NULL);
+	}
+
+	// the memtables are still in their logs
+	if (tree->mem != NULL)
+		memtable_free(tree->mem, 0);
+	if (tree->imm != NULL)
+		memtable_free(tree->imm, 0);
+	for (i = 0; i < tree->nruns; i++)
+		run_free(tree->runs[i]);
+	free(tree->runs);
+
+	pthread_mutex_destroy(&tree->lock);
+	pthread_mutex_destroy(&tree->write_lock);
+	pthread_cond_destroy(&tree->changed);
+	pthread_cond_destroy(&tree->work);
+	free(tree);
+}
+
+int lsm_destroy(struct lsm_tree *tree)
+{
+	char directory[MAX_PATH_LEN];
+	char path[LSM_MAX_FILE_LEN];
+	struct dirent *d;
+	DIR *dir;
+	int ret = 0;
+
+	if (tree == NULL)
+		return 0;
+
+	strncpy(directory, tree->directory, sizeof directory);
+	lsm_close(tree);
+
+	dir = opendir(directory);
+	if (dir == NULL)
+		return -1;
+
+	// only the runs and logs of the tree; the directory is left if it
+	// holds anything else
+	while ((d = readdir(dir)) != NULL) {
+		unsigned int seq, gen;
+		char tail;
+
+		if (!(sscanf(d->d_name, "run-%u-%u.ss%c", &seq, &gen, &tail) == 3 && tail == 't') &&
+		    !(sscanf(d->d_name, "run-%u-%u.tm%c", &seq, &gen, &tail) == 3 && tail == 'p') &&
+		    !(sscanf(d->d_name, "wal-%u.lo%c", &seq, &tail) == 2 && tail == 'g'))
+			continue;
+
+		if (snprintf(path, sizeof path, "%s/%s", directory, d->d_name) >= (int) sizeof path ||
+		    unlink(path) != 0)
+			ret = -1;
+	}
+	closedir(dir);
+
+	if (rmdir(directory) != 0)
+		ret = -1;
+	return ret;
+}
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+
+// SCAN
+
+/**
+ * @brief A copy of a memtable taken at the start of a scan.
+ */
+struct mem_copy {
+	struct lsm_entry *entries;
+	long count;
+	long pos;
+};
+
+static int mem_copy_take(struct mem_copy *c, struct memtable *m)
+{
+	c->count = 0;
+	c->pos = 0;
+	c->entries = NULL;
+	if (m == NULL || m->count == 0)
+		return 0;
+
+	c->entries = malloc(m->count * sizeof *c->entries);
+	if (c->entries == NULL)
+		return -1;
+
+	struct mem_node *n;
+	for (n = m->head->next[0]; n != NULL; n = n->next[0]) {
+		struct lsm_entry *e = &c->entries[c->count++];
+		strncpy(e->key, n->key, sizeof e->key);
+		e->version = n->version;
+		e->deleted = n->deleted;
+		e->value[0] = '\0';
+		if (n->value != NULL)
+			strncpy(e->value, n->value, sizeof e->value);
+	}
+	return 0;
+}
+
+int lsm_scan(struct lsm_tree *tree, lsm_visit_fn visit, void *arg)
+{
+	return lsm_scan_from(tree, NULL, visit, arg);
+}
+
+int lsm_scan_from(struct lsm_tree *tree, const char *after, lsm_visit_fn visit, void *arg)
+{
+	struct mem_copy mems[2];
+	int nruns, i, error = 0;
+
+	mems[0].entries = NULL;
+	mems[1].entries = NULL;
+
+	pthread_mutex_lock(&tree->lock);
+	if (mem_copy_take(&mems[0], tree->mem) != 0 || mem_copy_take(&mems[1], tree->imm) != 0)
+		error = 1;
+	struct lsm_run **runs = runs_acquire(tree, &nruns);
+	pthread_mutex_unlock(&tree->lock);
+
+	struct run_cursor *cursors = runs == NULL ? NULL : calloc(nruns + 1, sizeof *cursors);
+	if (cursors == NULL)
+		error = 1;
+	for (i = 0; i < nruns && !error; i++)
+		if (run_cursor_open(&cursors[i], runs[i], after) != 0)
+			error = 1;
+	for (i = 0; i < 2 && after != NULL; i++)
+		while (mems[i].pos < mems[i].count && strcmp(mems[i].entries[mems[i].pos].key, after) <= 0)
+			mems[i].pos++;
+
+	// Sources in order of age: the two memtables, then the runs.
+	int nsources = 2 + nruns;
+	struct storage_record record;
+
+	while (!error) {
+		struct lsm_entry *newest = NULL;
+		int s;
+		for (s = 0; s < nsources; s++) {
+			struct lsm_entry *e = NULL;
+			if (s < 2 && mems[s].pos < mems[s].count)
+				e = &mems[s].entries[mems[s].pos];
+			else if (s >= 2 && cursors[s - 2].valid)
+				e = &cursors[s - 2].e;
+			if (e != NULL && (newest == NULL || strcmp(e->key, newest->key) < 0))
+				newest = e;
+		}
+		if (newest == NULL)
+			break;
+
+		char key[MAX_KEY_LEN + 1];
+		strncpy(key, newest->key, sizeof key);
+		int stop = 0;
+		if (!newest->deleted) {
+			strncpy(record.value, newest->value, sizeof record.value);
+			record.metadata[0] = newest->version;
+			stop = visit(key, &record, arg);
+		}
+		if (stop)
+			break;
+
+		for (s = 0; s < 2; s++)
+			while (mems[s].pos < mems[s].count && strcmp(mems[s].entries[mems[s].pos].key, key) == 0)
+				mems[s].pos++;
+		for (s = 0; s < nruns && !error; s++)
+			while (cursors[s].valid && strcmp(cursors[s].e.key, key) == 0)
+				if (run_cursor_next(&cursors[s]) != 0)
+					error = 1;
+	}
+
+	if (cursors != NULL) {
+		for (i = 0; i < nruns; i++)
+			run_cursor_close(&cursors[i]);
+		free(cursors);
+	}
+	if (runs != NULL)
+		runs_release(tree, runs, nruns);
+	free(mems[0].entries);
+	free(mems[1].entries);
+
+	return error ? -1 : 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file
+ * @brief This file declares the log-structured merge tree storage engine
+ * that can be used instead of the in-memory hash table for large tables.
+ *
+ * New writes go to a sorted in-memory memtable, and every write is also
+ * appended to a write-ahead log. When the memtable is full it is written
+ * to disk as an immutable sorted run. A background thread flushes the
+ * memtables and merges runs of similar size together, so that a lookup
+ * only has to check a few runs of each size, and an entry is rewritten
+ * once for each size rather than once per merge. Every run has a bloom
+ * filter, so most runs that do not hold a key are never read.
+ */
+
+#ifndef LSM_H
+#define LSM_H
+
+#include "storage.h"
+
+/**
+ * @brief An LSM tree. The fields are private to lsm.c.
+ */
+struct lsm_tree;
+
+/**
+ * @brief Called by lsm_scan() for every live record.
+ *
+ * The key and record are only valid during the call. Returning a
+ * non-zero value stops the scan.
+ */
+typedef int (*lsm_visit_fn)(const char *key, struct storage_record *record, void *arg);
+
+/**
+ * @brief Open an LSM tree stored in a directory.
+ *
+ * @param directory The directory holding the runs and logs of the tree.
+ * It is created if it does not exist.
+ * @param memtable_size The number of bytes buffered before a run is written.
+ * @return Returns the tree, or NULL if the directory can not be used or
+ * its path is not shorter than MAX_PATH_LEN.
+ *
+ * Runs and logs left in the directory by an earlier server are loaded.
+ */
+struct lsm_tree *lsm_open(const char *directory, long memtable_size);
+
+/**
+ * @brief Look up a key.
+ *
+ * @return Returns 0 and fills in the value and version (metadata[0]) of
+ * the record if the key exists, and -1 otherwise.
+ */
+int lsm_get(struct lsm_tree *tree, const char *key, struct storage_record *record);
+
+/**
+ * @brief Insert, modify or delete a key.
+ *
+ * @param record The new record, or NULL to delete the key.
+ * @return Returns the same codes as add_string() in server.c: 0 if the
+ * record was inserted, 2 if it was deleted, 3 if it was modified, 4 if
+ * the version in metadata[0] did not match, and 1 otherwise.
+ *
+ * A deleted key remembers its version, so inserting it again continues
+ * from the old version.
+ */
+int lsm_set(struct lsm_tree *tree, const char *key, struct storage_record *record);
+
+/**
+ * @brief Modify a key only if it exists, and has the version in
+ * metadata[0] of the record, or any version if it is 0.
+ *
+ * @return Returns 3 if the record was modified, 4 if the version did not
+ * match, and 1 if the key does not exist or could not be written.
+ *
+ * A key deleted since it was read is not inserted again, so a
+ * read-modify-write can not bring it back.
+ */
+int lsm_modify(struct lsm_tree *tree, const char *key, struct storage_record *record);
+
+/**
+ * @brief Visit every live record of the tree in key order.
+ *
+ * @return Returns 0 on success, and -1 if a run could not be read.
+ */
+int lsm_scan(struct lsm_tree *tree, lsm_visit_fn visit, void *arg);
+
+/**
+ * @brief Visit the live records of the tree with keys after a given key,
+ * in key order, so a scan that stopped can go on from its last key.
+ *
+ * @return Returns 0 on success, and -1 if a run could not be read.
+ */
+int lsm_scan_from(struct lsm_tree *tree, const char *after, lsm_visit_fn visit, void *arg);
+
+/**
+ * @brief Count the entries of the tree.
+ *
+ * @param memory Receives the number of entries in the memtables.
+ * @param disk Receives the number of entries in the runs. Keys written
+ * again since the last compaction are counted once per run.
+ */
+void lsm_stats(struct lsm_tree *tree, long *memory, long *disk);
+
+/**
+ * @brief Stop the background thread and release the tree.
+ *
+ * The files are kept, so the tree can be opened again.
+ */
+void lsm_close(struct lsm_tree *tree);
+
+/**
+ * @brief Stop the background thread, release the tree, and delete its
+ * runs, logs and directory.
+ *
+ * @return Returns 0 on success, and -1 if a file or the directory could
+ * not be deleted. The tree is released either way.
+ */
+int lsm_destroy(struct lsm_tree *tree);
+
+#endif
@@ -0,0 +1,270 @@
+/**
+ * @file
+ * @brief This file implements the worker pool declared in pool.h.
+ *
+ * Every worker has a queue guarded by its own mutex. A worker takes the
+ * oldest task of its own queue, so tasks are run in the order they were
+ * submitted, and steals the newest task of another queue, so that the
+ * owner and the thief work on different ends. Idle workers sleep until a
+ * task is submitted.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pool.h"
+
+/**
+ * @brief The initial number of tasks a worker queue has room for. The
+ * queue grows when it is full.
+ */
+#define POOL_QUEUE_LEN	64
+
+struct pool_worker {
+	struct work_pool *pool;
+	int index;
+	pthread_t thread;
+
+	/// Guards the queue.
+	pthread_mutex_t lock;
+	/// A ring of queued tasks.
+	struct pool_task **tasks;
+	int capacity;
+	int head;
+	int count;
+};
+
+struct work_pool {
+	struct pool_worker *workers;
+	int size;
+
+	/// Guards pending and stopping, and is held to sleep on idle.
+	pthread_mutex_t lock;
+	/// Wakes up idle workers.
+	pthread_cond_t idle;
+	/// The number of queued tasks, in all the queues.
+	long pending;
+	int stopping;
+};
+
+/// The worker running on this thread, if any.
+static __thread struct pool_worker *currentWorker;
+
+/**
+ * @brief Add a task at the back of a queue.
+ *
+ * @return Returns 0 on success, -1 if the queue can not grow.
+ */
+static int queue_push(struct pool_worker *worker, struct pool_task *task)
+{
+	pthread_mutex_lock(&worker->lock);
+
+	if (worker->count == worker->capacity) {
+		int capacity = worker->capacity * 2;
+		struct pool_task **tasks = malloc(capacity * sizeof *tasks);
+		if (tasks == NULL) {
+			pthread_mutex_unlock(&worker->lock);
+			return -1;
+		}
+
+		int i;
+		for (i = 0; i < worker->count; i++)
+			tasks[i] = worker->tasks[(worker->head + i) % worker->capacity];
+
+		free(worker->tasks);
+		worker->tasks = tasks;
+		worker->capacity = capacity;
+		worker->head = 0;
+	}
+
+	worker->tasks[(worker->head + worker->count) % worker->capacity] = task;
+	worker->count++;
+
+	pthread_mutex_unlock(&worker->lock);
+	return 0;
+}
+
+/**
+ * @brief Take the task at the front of a queue, or at the back if it is
+ * stolen.
+ *
+ * @return Returns the task, or NULL if the queue is empty.
+ */
+static struct pool_task *queue_pop(struct pool_worker *worker, int steal)
+{
+	struct pool_task *task = NULL;
+
+	pthread_mutex_lock(&worker->lock);
+	if (worker->count > 0) {
+		if (steal) {
+			task = worker->tasks[(worker->head + worker->count - 1) % worker->capacity];
+		} else {
+			task = worker->tasks[worker->head];
+			worker->head = (worker->head + 1) % worker->capacity;
+		}
+		worker->count--;
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	return task;
+}
+
+/**
+ * @brief Find a task for a worker: its own first, then one of the others.
+ */
+static struct pool_task *next_task(struct pool_worker *self)
+{
+	struct work_pool *pool = self->pool;
+	struct pool_task *task = queue_pop(self, 0);
+	int i;
+
+	for (i = 1; task == NULL && i < pool->size; i++)
+		task = queue_pop(&pool->workers[(self->index + i) % pool->size], 1);
+
+	if (task != NULL)
+		__atomic_fetch_sub(&pool->pending, 1, __ATOMIC_RELAXED);
+
+	return task;
+}
+
+/**
+ * @brief Runs tasks until the pool is destroyed and no task is left.
+ */
+static void *pool_worker(void *arg)
+{
+	struct pool_worker *self = arg;
+	struct work_pool *pool = self->pool;
+
+	currentWorker = self;
+
+	while (1) {
+		struct pool_task *task = next_task(self);
+		if (task != NULL) {
+			task->run(task);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		while (__atomic_load_n(&pool->pending, __ATOMIC_RELAXED) <= 0 && !pool->stopping)
+			pthread_cond_wait(&pool->idle, &pool->lock);
+		int done = pool->stopping && __atomic_load_n(&pool->pending, __ATOMIC_RELAXED) <= 0;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (done)
+			break;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Stop the first started workers of a pool, and free the pool.
+ */
+static void stop_workers(struct work_pool *pool, int started)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->idle);
+	pthread_mutex_unlock(&pool->lock);
+
+	int i;
+	for (i = 0; i < started; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	for (i = 0; i < pool->size; i++) {
+		free(pool->workers[i].tasks);
+		pthread_mutex_destroy(&pool->workers[i].lock);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->idle);
+	free(pool->workers);
+	free(pool);
+}
+
+struct work_pool *pool_create(int workers)
+{
+	if (workers <= 0)
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers <= 0)
+		workers = 1;
+
+	struct work_pool *pool = calloc(1, sizeof *pool);
+	if (pool == NULL)
+		return NULL;
+
+	pool->workers = calloc(workers, sizeof *pool->workers);
+	if (pool->workers == NULL) {
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+	pool->size = workers;
+
+	// every queue is set up before a worker can steal from it
+	int i;
+	for (i = 0; i < workers; i++) {
+		struct pool_worker *worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->index = i;
+		worker->capacity = POOL_QUEUE_LEN;
+		worker->tasks = malloc(worker->capacity * sizeof *worker->tasks);
+		pthread_mutex_init(&worker->lock, NULL);
+		if (worker->tasks == NULL)
+			break;
+	}
+
+	int started = 0;
+	if (i == workers) {
+		while (started < workers &&
+			pthread_create(&pool->workers[started].thread, NULL, pool_worker,
+				&pool->workers[started]) == 0)
+			started++;
+	}
+
+	if (started < workers) {
+		stop_workers(pool, started);
+		return NULL;
+	}
+
+	return pool;
+}
+
+int pool_size(struct work_pool *pool)
+{
+	return pool->size;
+}
+
+int pool_current_worker(struct work_pool *pool)
+{
+	if (currentWorker == NULL || currentWorker->pool != pool)
+		return -1;
+	return currentWorker->index;
+}
+
+void pool_submit(struct work_pool *pool, struct pool_task *task, int worker)
+{
+	if (worker < 0)
+		worker = -worker;
+
+	// a task that does not fit in the queue is run right away
+	if (queue_push(&pool->workers[worker % pool->size], task) != 0) {
+		task->run(task);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	__atomic_fetch_add(&pool->pending, 1, __ATOMIC_RELAXED);
+	pthread_cond_signal(&pool->idle);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_destroy(struct work_pool *pool)
+{
+	if (pool == NULL)
+		return;
+
+	stop_workers(pool, pool->size);
+}
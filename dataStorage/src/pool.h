@@ -0,0 +1,63 @@
+/**
+ * @file
+ * @brief This file declares the pool of worker threads that run the
+ * commands of the clients.
+ *
+ * The workers are started once, when the server starts. Every worker has
+ * its own queue of tasks, and a worker whose queue is empty steals tasks
+ * from the others, so that one slow task only holds up its own worker.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+/**
+ * @brief A pool of worker threads. The fields are private to pool.c.
+ */
+struct work_pool;
+
+/**
+ * @brief A unit of work handed to the pool.
+ *
+ * The caller embeds the task in its own struct, and the task must stay
+ * valid until run() is called. A task is run once for every time it is
+ * submitted.
+ */
+struct pool_task {
+	/// Does the work. Called by a worker thread.
+	void (*run)(struct pool_task *task);
+};
+
+/**
+ * @brief Start the worker threads.
+ *
+ * @param workers The number of workers, or 0 for one per core.
+ * @return Returns the pool, or NULL if the threads can not be started.
+ */
+struct work_pool *pool_create(int workers);
+
+/**
+ * @brief Return the number of worker threads of the pool.
+ */
+int pool_size(struct work_pool *pool);
+
+/**
+ * @brief Return the index of the worker running the caller, or -1 if the
+ * caller is not a worker of the pool.
+ */
+int pool_current_worker(struct work_pool *pool);
+
+/**
+ * @brief Queue a task.
+ *
+ * @param worker The worker whose queue gets the task, modulo the number
+ *		 of workers. Any idle worker may still steal it.
+ */
+void pool_submit(struct work_pool *pool, struct pool_task *task, int worker);
+
+/**
+ * @brief Run the queued tasks, then stop the workers and free the pool.
+ */
+void pool_destroy(struct work_pool *pool);
+
+#endif
@@ -0,0 +1,753 @@
+/**
+ * @file
+ * @brief This file implements the bitmaps and the bitmap index declared in
+ * roaring.h.
+ *
+ * A bitmap is a sorted array of containers, one for every chunk of ids
+ * that has any. A container is an array of the low 16 bits of its ids
+ * while it has at most ARRAY_MAX of them, and 1024 words of bits
+ * otherwise. Two word containers are intersected with AVX2 instructions
+ * when the processor has them, four words at a time, and a word at a time
+ * otherwise. The AVX2 code is compiled for that target alone and picked at
+ * run time, so the server needs no extra build flags and still runs on
+ * processors without it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "roaring.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define ROARING_AVX2
+#endif
+
+/**
+ * @brief The max number of ids in an array container.
+ */
+#define ARRAY_MAX	4096
+
+/**
+ * @brief The number of words of a bitmap container.
+ */
+#define CONTAINER_WORDS	(65536 / 64)
+
+/**
+ * @brief The number of buckets of a new bitmap index.
+ */
+#define BITMAP_BUCKETS	64
+
+struct container {
+	/// The high 16 bits of the ids.
+	uint16_t key;
+	int cardinality;
+	/// The sorted low bits of the ids, if words is NULL.
+	uint16_t *array;
+	/// The slots of array.
+	int capacity;
+	/// The bits of the ids, or NULL.
+	uint64_t *words;
+};
+
+struct roaring {
+	/// The containers, sorted by key.
+	struct container *containers;
+	int count;
+	int capacity;
+};
+
+struct bm_value {
+	char *value;
+	unsigned int hash;
+	struct roaring *bitmap;
+	struct bm_value *next;
+};
+
+struct bitmap_index {
+	/// Held for writing while ids are added or removed.
+	pthread_rwlock_t lock;
+	struct bm_value **buckets;
+	int size;
+	/// The number of distinct values.
+	long values;
+};
+
+/**
+ * @brief Return the first slot of a sorted array not below x.
+ */
+static int lower_bound(const uint16_t *array, int count, uint16_t x)
+{
+	int low = 0, high = count;
+
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (array[mid] < x)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/**
+ * @brief Find the container of a key.
+ *
+ * @return Returns its slot, or -1 - the slot it would be inserted at if it
+ *	   is missing.
+ */
+static int find_container(struct roaring *bitmap, uint16_t key)
+{
+	int low = 0, high = bitmap->count;
+
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (bitmap->containers[mid].key < key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low < bitmap->count && bitmap->containers[low].key == key)
+		return low;
+	return -1 - low;
+}
+
+static void free_container(struct container *c)
+{
+	free(c->array);
+	free(c->words);
+}
+
+/**
+ * @brief Turn an array container into a word container.
+ */
+static int to_words(struct container *c)
+{
+	uint64_t *words = calloc(CONTAINER_WORDS, sizeof *words);
+	int i;
+
+	if (words == NULL)
+		return -1;
+
+	for (i = 0; i < c->cardinality; i++)
+		words[c->array[i] >> 6] |= 1ULL << (c->array[i] & 63);
+
+	free(c->array);
+	c->array = NULL;
+	c->capacity = 0;
+	c->words = words;
+	return 0;
+}
+
+/**
+ * @brief Turn a word container into an array container.
+ */
+static int to_array(struct container *c)
+{
+	uint16_t *array = malloc((c->cardinality ? c->cardinality : 1) * sizeof *array);
+	int i, n = 0;
+
+	if (array == NULL)
+		return -1;
+
+	for (i = 0; i < CONTAINER_WORDS; i++) {
+		uint64_t word = c->words[i];
+		while (word != 0) {
+			array[n++] = i * 64 + __builtin_ctzll(word);
+			word &= word - 1;
+		}
+	}
+
+	free(c->words);
+	c->words = NULL;
+	c->array = array;
+	c->capacity = c->cardinality ? c->cardinality : 1;
+	return 0;
+}
+
+static int container_add(struct container *c, uint16_t low)
+{
+	if (c->words != NULL) {
+		uint64_t bit = 1ULL << (low & 63);
+		if ((c->words[low >> 6] & bit) == 0) {
+			c->words[low >> 6] |= bit;
+			c->cardinality++;
+		}
+		return 0;
+	}
+
+	int i = lower_bound(c->array, c->cardinality, low);
+	if (i < c->cardinality && c->array[i] == low)
+		return 0;
+
+	if (c->cardinality == ARRAY_MAX) {
+		if (to_words(c) != 0)
+			return -1;
+		return container_add(c, low);
+	}
+
+	if (c->cardinality == c->capacity) {
+		int capacity = c->capacity ? c->capacity * 2 : 4;
+		if (capacity > ARRAY_MAX)
+			capacity = ARRAY_MAX;
+
+		uint16_t *array = realloc(c->array, capacity * sizeof *array);
+		if (array == NULL)
+			return -1;
+		c->array = array;
+		c->capacity = capacity;
+	}
+
+	memmove(c->array + i + 1, c->array + i, (c->cardinality - i) * sizeof *c->array);
+	c->array[i] = low;
+	c->cardinality++;
+	return 0;
+}
+
+static void container_remove(struct container *c, uint16_t low)
+{
+	if (c->words != NULL) {
+		uint64_t bit = 1ULL << (low & 63);
+		if ((c->words[low >> 6] & bit) != 0) {
+			c->words[low >> 6] &= ~bit;
+			c->cardinality--;
+
+			// a container that stays a little under the limit is not
+			// turned back and forth
+			if (c->cardinality <= ARRAY_MAX / 2)
+				to_array(c);
+		}
+		return;
+	}
+
+	int i = lower_bound(c->array, c->cardinality, low);
+	if (i < c->cardinality && c->array[i] == low) {
+		memmove(c->array + i, c->array + i + 1, (c->cardinality - i - 1) * sizeof *c->array);
+		c->cardinality--;
+	}
+}
+
+/**
+ * @brief AND the words of a container with those of another, a word at a
+ * time, and count the bits left.
+ */
+static long and_words_scalar(uint64_t *words, const uint64_t *other)
+{
+	long cardinality = 0;
+	int i;
+
+	for (i = 0; i < CONTAINER_WORDS; i++) {
+		words[i] &= other[i];
+		cardinality += __builtin_popcountll(words[i]);
+	}
+	return cardinality;
+}
+
+#ifdef ROARING_AVX2
+/**
+ * @brief and_words_scalar() with AVX2, four words at a time.
+ */
+__attribute__((target("avx2,popcnt")))
+static long and_words_avx2(uint64_t *words, const uint64_t *other)
+{
+	long cardinality = 0;
+	int i;
+
+	for (i = 0; i < CONTAINER_WORDS; i += 4) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) (words + i));
+		__m256i b = _mm256_loadu_si256((const __m256i *) (other + i));
+		__m256i r = _mm256_and_si256(a, b);
+
+		_mm256_storeu_si256((__m256i *) (words + i), r);
+		cardinality += _mm_popcnt_u64(_mm256_extract_epi64(r, 0)) +
+			_mm_popcnt_u64(_mm256_extract_epi64(r, 1)) +
+			_mm_popcnt_u64(_mm256_extract_epi64(r, 2)) +
+			_mm_popcnt_u64(_mm256_extract_epi64(r, 3));
+	}
+	return cardinality;
+}
+#endif
+
+/**
+ * @brief AND the words of a container with those of another, and count
+ * the bits left.
+ */
+static long and_words(uint64_t *words, const uint64_t *other)
+{
+#ifdef ROARING_AVX2
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+		return and_words_avx2(words, other);
+#endif
+	return and_words_scalar(words, other);
+}
+
+/**
+ * @brief Keep the ids of a container that are also in another one.
+ *
+ * @return Returns 0 on success, and -1 if there is no memory, in which
+ *	   case the container is left as it was.
+ */
+static int container_and(struct container *c, struct container *other)
+{
+	int i, n = 0;
+
+	if (c->words != NULL && other->words != NULL) {
+		c->cardinality = and_words(c->words, other->words);
+		if (c->cardinality <= ARRAY_MAX)
+			to_array(c);
+		return 0;
+	}
+
+	if (c->words != NULL) {
+		uint16_t *array = malloc((other->cardinality ? other->cardinality : 1) * sizeof *array);
+		if (array == NULL)
+			return -1;
+
+		for (i = 0; i < other->cardinality; i++) {
+			uint16_t low = other->array[i];
+			if (c->words[low >> 6] & (1ULL << (low & 63)))
+				array[n++] = low;
+		}
+
+		free(c->words);
+		c->words = NULL;
+		c->array = array;
+		c->capacity = other->cardinality ? other->cardinality : 1;
+		c->cardinality = n;
+		return 0;
+	}
+
+	if (other->words != NULL) {
+		for (i = 0; i < c->cardinality; i++) {
+			uint16_t low = c->array[i];
+			if (other->words[low >> 6] & (1ULL << (low & 63)))
+				c->array[n++] = low;
+		}
+	} else {
+		int j = 0;
+		for (i = 0; i < c->cardinality && j < other->cardinality; i++) {
+			while (j < other->cardinality && other->array[j] < c->array[i])
+				j++;
+			if (j < other->cardinality && other->array[j] == c->array[i])
+				c->array[n++] = c->array[i];
+		}
+	}
+
+	c->cardinality = n;
+	return 0;
+}
+
+struct roaring *roaring_create(void)
+{
+	return calloc(1, sizeof(struct roaring));
+}
+
+int roaring_add(struct roaring *bitmap, uint32_t id)
+{
+	uint16_t key = id >> 16;
+	int i = find_container(bitmap, key);
+
+	if (i < 0) {
+		i = -1 - i;
+
+		if (bitmap->count == bitmap->capacity) {
+			int capacity = bitmap->capacity ? bitmap->capacity * 2 : 4;
+			struct container *containers = realloc(bitmap->containers,
+				capacity * sizeof *containers);
+			if (containers == NULL)
+				return -1;
+			bitmap->containers = containers;
+			bitmap->capacity = capacity;
+		}
+
+		memmove(bitmap->containers + i + 1, bitmap->containers + i,
+			(bitmap->count - i) * sizeof *bitmap->containers);
+		memset(&bitmap->containers[i], 0, sizeof bitmap->containers[i]);
+		bitmap->containers[i].key = key;
+		bitmap->count++;
+	}
+
+	struct container *c = &bitmap->containers[i];
+	if (container_add(c, id & 0xffff) == 0)
+		return 0;
+
+	if (c->cardinality == 0) {
+		free_container(c);
+		memmove(bitmap->containers + i, bitmap->containers + i + 1,
+			(bitmap->count - i - 1) * sizeof *bitmap->containers);
+		bitmap->count--;
+	}
+	return -1;
+}
+
+void roaring_remove(struct roaring *bitmap, uint32_t id)
+{
+	int i = find_container(bitmap, id >> 16);
+
+	if (i < 0)
+		return;
+
+	struct container *c = &bitmap->containers[i];
+	container_remove(c, id & 0xffff);
+
+	if (c->cardinality == 0) {
+		free_container(c);
+		memmove(bitmap->containers + i, bitmap->containers + i + 1,
+			(bitmap->count - i - 1) * sizeof *bitmap->containers);
+		bitmap->count--;
+	}
+}
+
+long roaring_cardinality(struct roaring *bitmap)
+{
+	long cardinality = 0;
+	int i;
+
+	for (i = 0; i < bitmap->count; i++)
+		cardinality += bitmap->containers[i].cardinality;
+
+	return cardinality;
+}
+
+int roaring_and(struct roaring *bitmap, struct roaring *other)
+{
+	int i, j = 0, n = 0;
+	int ret = 0;
+
+	for (i = 0; i < bitmap->count; i++) {
+		struct container *c = &bitmap->containers[i];
+
+		while (j < other->count && other->containers[j].key < c->key)
+			j++;
+
+		if (j == other->count || other->containers[j].key != c->key) {
+			free_container(c);
+			continue;
+		}
+
+		if (container_and(c, &other->containers[j]) != 0)
+			ret = -1;
+
+		if (c->cardinality == 0) {
+			free_container(c);
+			continue;
+		}
+
+		bitmap->containers[n++] = *c;
+	}
+
+	bitmap->count = n;
+	return ret;
+}
+
+struct or_arg {
+	struct roaring *bitmap;
+	int failed;
+};
+
+/**
+ * @brief Add an id to a bitmap, stopping once an add fails.
+ */
+static int add_id(uint32_t id, void *arg)
+{
+	struct or_arg *to = arg;
+
+	if (roaring_add(to->bitmap, id) != 0)
+		to->failed = 1;
+	return to->failed;
+}
+
+int roaring_or(struct roaring *bitmap, struct roaring *other)
+{
+	struct or_arg to = { bitmap, 0 };
+
+	roaring_iterate(other, add_id, &to);
+
+	return to.failed ? -1 : 0;
+}
+
+void roaring_iterate(struct roaring *bitmap, roaring_visit_fn visit, void *arg)
+{
+	int i, j;
+
+	for (i = 0; i < bitmap->count; i++) {
+		struct container *c = &bitmap->containers[i];
+		uint32_t high = (uint32_t) c->key << 16;
+
+		if (c->words == NULL) {
+			for (j = 0; j < c->cardinality; j++) {
+				if (visit(high | c->array[j], arg) != 0)
+					return;
+			}
+			continue;
+		}
+
+		for (j = 0; j < CONTAINER_WORDS; j++) {
+			uint64_t word = c->words[j];
+			while (word != 0) {
+				if (visit(high | (j * 64 + __builtin_ctzll(word)), arg) != 0)
+					return;
+				word &= word - 1;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Copy a bitmap.
+ *
+ * @return Returns the copy, or NULL if there is no memory.
+ */
+static struct roaring *roaring_copy(struct roaring *bitmap)
+{
+	struct roaring *copy = roaring_create();
+	int i;
+
+	if (copy == NULL)
+		return NULL;
+
+	copy->containers = malloc((bitmap->count ? bitmap->count : 1) * sizeof *copy->containers);
+	if (copy->containers == NULL) {
+		free(copy);
+		return NULL;
+	}
+	copy->capacity = bitmap->count ? bitmap->count : 1;
+
+	for (i = 0; i < bitmap->count; i++) {
+		struct container *from = &bitmap->containers[i];
+		struct container *to = &copy->containers[i];
+
+		*to = *from;
+		to->array = NULL;
+		to->words = NULL;
+
+		if (from->words != NULL) {
+			to->words = malloc(CONTAINER_WORDS * sizeof *to->words);
+			if (to->words != NULL)
+				memcpy(to->words, from->words, CONTAINER_WORDS * sizeof *to->words);
+		} else {
+			to->array = malloc(from->capacity * sizeof *to->array);
+			if (to->array != NULL)
+				memcpy(to->array, from->array, from->cardinality * sizeof *to->array);
+		}
+
+		copy->count = i + 1;
+		if (to->words == NULL && to->array == NULL) {
+			roaring_destroy(copy);
+			return NULL;
+		}
+	}
+
+	return copy;
+}
+
+void roaring_destroy(struct roaring *bitmap)
+{
+	int i;
+
+	if (bitmap == NULL)
+		return;
+
+	for (i = 0; i < bitmap->count; i++)
+		free_container(&bitmap->containers[i]);
+
+	free(bitmap->containers);
+	free(bitmap);
+}
+
+/**
+ * @brief Hash a value, FNV-1a.
+ */
+static unsigned int hash_value(const char *value)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*value != '\0') {
+		hash ^= (unsigned char) *value++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief Find the entry of a value.
+ *
+ * @return Returns a pointer to the link to the entry, or to the end of
+ *	   its bucket if there is none.
+ */
+static struct bm_value **find_value(struct bitmap_index *index, const char *value,
+	unsigned int hash)
+{
+	struct bm_value **entry = &index->buckets[hash % index->size];
+
+	while (*entry != NULL && ((*entry)->hash != hash || strcmp((*entry)->value, value) != 0))
+		entry = &(*entry)->next;
+
+	return entry;
+}
+
+/**
+ * @brief Double the buckets. The index is left as it was if there is no
+ * memory.
+ */
+static void grow(struct bitmap_index *index)
+{
+	int size = index->size * 2;
+	struct bm_value **buckets = calloc(size, sizeof *buckets);
+	int i;
+
+	if (buckets == NULL)
+		return;
+
+	for (i = 0; i < index->size; i++) {
+		struct bm_value *entry = index->buckets[i];
+
+		while (entry != NULL) {
+			struct bm_value *next = entry->next;
+			entry->next = buckets[entry->hash % size];
+			buckets[entry->hash % size] = entry;
+			entry = next;
+		}
+	}
+
+	free(index->buckets);
+	index->buckets = buckets;
+	index->size = size;
+}
+
+static void free_value(struct bm_value *entry)
+{
+	roaring_destroy(entry->bitmap);
+	free(entry->value);
+	free(entry);
+}
+
+struct bitmap_index *bitmap_index_create(void)
+{
+	struct bitmap_index *index = malloc(sizeof *index);
+	if (index == NULL)
+		return NULL;
+
+	index->buckets = calloc(BITMAP_BUCKETS, sizeof *index->buckets);
+	if (index->buckets == NULL) {
+		free(index);
+		return NULL;
+	}
+
+	index->size = BITMAP_BUCKETS;
+	index->values = 0;
+	pthread_rwlock_init(&index->lock, NULL);
+
+	return index;
+}
+
+int bitmap_index_add(struct bitmap_index *index, const char *value, uint32_t id)
+{
+	unsigned int hash = hash_value(value);
+	int ret = -1;
+
+	pthread_rwlock_wrlock(&index->lock);
+
+	struct bm_value **link = find_value(index, value, hash);
+	struct bm_value *entry = *link;
+
+	if (entry == NULL) {
+		entry = calloc(1, sizeof *entry);
+		if (entry == NULL)
+			goto out;
+
+		entry->value = strdup(value);
+		entry->bitmap = roaring_create();
+		if (entry->value == NULL || entry->bitmap == NULL) {
+			free_value(entry);
+			goto out;
+		}
+		entry->hash = hash;
+		*link = entry;
+		index->values++;
+	}
+
+	ret = roaring_add(entry->bitmap, id);
+
+	// a new value without ids is not kept
+	if (roaring_cardinality(entry->bitmap) == 0) {
+		*find_value(index, value, hash) = entry->next;
+		free_value(entry);
+		index->values--;
+	} else if (index->values > 2L * index->size) {
+		grow(index);
+	}
+
+out:
+	pthread_rwlock_unlock(&index->lock);
+	return ret;
+}
+
+void bitmap_index_remove(struct bitmap_index *index, const char *value, uint32_t id)
+{
+	unsigned int hash = hash_value(value);
+
+	pthread_rwlock_wrlock(&index->lock);
+
+	struct bm_value **link = find_value(index, value, hash);
+	struct bm_value *entry = *link;
+
+	if (entry != NULL) {
+		roaring_remove(entry->bitmap, id);
+
+		if (roaring_cardinality(entry->bitmap) == 0) {
+			*link = entry->next;
+			free_value(entry);
+			index->values--;
+		}
+	}
+
+	pthread_rwlock_unlock(&index->lock);
+}
+
+struct roaring *bitmap_index_get(struct bitmap_index *index, const char *value)
+{
+	pthread_rwlock_rdlock(&index->lock);
+
+	struct bm_value *entry = *find_value(index, value, hash_value(value));
+	struct roaring *copy = entry != NULL ? roaring_copy(entry->bitmap) : roaring_create();
+
+	pthread_rwlock_unlock(&index->lock);
+	return copy;
+}
+
+long bitmap_index_count(struct bitmap_index *index, const char *value)
+{
+	pthread_rwlock_rdlock(&index->lock);
+
+	struct bm_value *entry = *find_value(index, value, hash_value(value));
+	long count = entry != NULL ? roaring_cardinality(entry->bitmap) : 0;
+
+	pthread_rwlock_unlock(&index->lock);
+	return count;
+}
+
+void bitmap_index_destroy(struct bitmap_index *index)
+{
+	int i;
+
+	if (index == NULL)
+		return;
+
+	for (i = 0; i < index->size; i++) {
+		struct bm_value *entry = index->buckets[i];
+
+		while (entry != NULL) {
+			struct bm_value *next = entry->next;
+			free_value(entry);
+			entry = next;
+		}
+	}
+
+	free(index->buckets);
+	pthread_rwlock_destroy(&index->lock);
+	free(index);
+}
@@ -0,0 +1,120 @@
+/**
+ * @file
+ * @brief This file declares the compressed bitmaps of record ids, and the
+ * bitmap index kept on a column with few distinct values.
+ *
+ * A bitmap is split in chunks of 65536 ids. A chunk with few ids keeps
+ * them in a sorted array, and a fuller chunk as 65536 bits, so both
+ * sparse and dense bitmaps stay small and are intersected quickly.
+ */
+
+#ifndef ROARING_H
+#define ROARING_H
+
+#include <stdint.h>
+
+/**
+ * @brief A bitmap. The fields are private to roaring.c.
+ */
+struct roaring;
+
+/**
+ * @brief A bitmap index, mapping every value of a column to the bitmap of
+ * the records having it. The fields are private to roaring.c.
+ */
+struct bitmap_index;
+
+/**
+ * @brief Called for every id of a bitmap, in order.
+ *
+ * @return Return 0 to go on, and anything else to stop.
+ */
+typedef int (*roaring_visit_fn)(uint32_t id, void *arg);
+
+/**
+ * @brief Create an empty bitmap.
+ *
+ * @return Returns the bitmap, or NULL if there is no memory.
+ */
+struct roaring *roaring_create(void);
+
+/**
+ * @brief Add an id to a bitmap.
+ *
+ * @return Returns 0 on success, and -1 if there is no memory.
+ */
+int roaring_add(struct roaring *bitmap, uint32_t id);
+
+/**
+ * @brief Remove an id from a bitmap.
+ */
+void roaring_remove(struct roaring *bitmap, uint32_t id);
+
+/**
+ * @brief Return the number of ids in a bitmap.
+ */
+long roaring_cardinality(struct roaring *bitmap);
+
+/**
+ * @brief Keep the ids of a bitmap that are also in another one.
+ *
+ * @return Returns 0 on success, and -1 if there is no memory, in which
+ *	   case the bitmap holds more ids than the intersection.
+ */
+int roaring_and(struct roaring *bitmap, struct roaring *other);
+
+/**
+ * @brief Add the ids of another bitmap to a bitmap.
+ *
+ * @return Returns 0 on success, and -1 if there is no memory.
+ */
+int roaring_or(struct roaring *bitmap, struct roaring *other);
+
+/**
+ * @brief Visit the ids of a bitmap.
+ */
+void roaring_iterate(struct roaring *bitmap, roaring_visit_fn visit, void *arg);
+
+/**
+ * @brief Free a bitmap.
+ */
+void roaring_destroy(struct roaring *bitmap);
+
+/**
+ * @brief Create an empty bitmap index.
+ *
+ * @return Returns the index, or NULL if there is no memory.
+ */
+struct bitmap_index *bitmap_index_create(void);
+
+/**
+ * @brief Add a record id to the bitmap of a value.
+ *
+ * @return Returns 0 on success, and -1 if there is no memory.
+ */
+int bitmap_index_add(struct bitmap_index *index, const char *value, uint32_t id);
+
+/**
+ * @brief Remove a record id from the bitmap of a value.
+ */
+void bitmap_index_remove(struct bitmap_index *index, const char *value, uint32_t id);
+
+/**
+ * @brief Copy the bitmap of a value.
+ *
+ * @return Returns the copy, which the caller frees, or NULL if there is
+ *	   no memory. The copy is empty if no record has the value.
+ */
+struct roaring *bitmap_index_get(struct bitmap_index *index, const char *value);
+
+/**
+ * @brief Return the number of records having a value.
+ */
+long bitmap_index_count(struct bitmap_index *index, const char *value);
+
+/**
+ * @brief Free a bitmap index.
+ */
+void bitmap_index_destroy(struct bitmap_index *index);
+
+#endif
@@ -17,13 +17,25 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include <signal.h>
 #include <time.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/epoll.h>
 #include "utils.h"
 #include "storage.h"
+#include "lsm.h"
+#include "spill.h"
+#include "lfhash.h"
+#include "pool.h"
+#include "shard.h"
+#include "btree.h"
+#include "hindex.h"
+#include "roaring.h"
 
 /* Must include this to have prototype for the thread functions */ 
 #include <pthread.h>
@@ -33,30 +45,62 @@
 #define LOAD_CENSUS 0
 
 
-#define MAX_THREADS 10
+#define MAX_EPOLL_EVENTS 64	///< The max number of socket events handled per wakeup.
+#define CACHE_LINE_SIZE 64	///< Data written by different threads is kept this far apart.
 
-typedef struct _key_Version_ {
 
-    char tableName[MAX_TABLE_LEN];
-    char key[MAX_KEY_LEN];
-    int version;
+/**
+ * @brief A client connection served by the worker pool
+ *
+ * @param task Runs the next command of the connection on a worker
+ * @param sock The socket of the client
+ * @param clientaddr The address of the client
+ * @param buffer The bytes received from the client and not yet handled
+ * @param used The number of bytes in buffer
+ * @param params The server configuration
+ * @param epoll The event loop watching the socket
+ * @param watched Set while the socket is watched, and cleared when a
+ *		 worker gets the connection
+ * @param next The next connection waiting for handleCommandMutex
+ *
+ * The socket is only watched while no worker has a command of the
+ * connection, so the commands of a client run one at a time, in order.
+ */
+typedef struct _connection_t_ {
+    struct pool_task task;
+    int sock;
+    struct sockaddr_in clientaddr;
+    char buffer[MAX_CMD_LEN];
+    int used;
+    struct config_params *params;
+    int epoll;
+    int watched;
+    struct _connection_t_ *next;
+} Connection;
 
-} keyVersion;
+/**
+ * @brief A listening socket with its own event loop
+ *
+ * @param sock The listening socket
+ * @param index The number of the listener, from 0
+ * @param thread The thread running the event loop
+ * @param params The server configuration
+ */
+typedef struct _listener_t_ {
+    int sock;
+    int index;
+    pthread_t thread;
+    struct config_params *params;
+} Listener;
 
+/* The workers running the commands of the clients, with concurrency 1 */
+struct work_pool *workPool;
 
-struct _ThreadInfo { 
-  struct sockaddr_in clientaddr;
-  socklen_t clientaddrlen; 
-  int clientsock; 
-  pthread_t theThread;
-  struct config_params* params;
- 
-}; 
-typedef struct _ThreadInfo *ThreadInfo; 
+/* The threads owning the keys of every table, with concurrency 2 */
+struct shard_set *shards;
 
-/*  Thread buffer, and circular buffer fields */ 
-ThreadInfo runtimeThreads[MAX_THREADS]; 
-unsigned int botRT = 0, topRT = 0;
+/* The number of the listener running on this thread */
+__thread int listenerIndex;
 
 
 /* Mutex to guard print statements */ 
@@ -65,13 +109,11 @@ pthread_mutex_t  printMutex    = PTHREAD_MUTEX_INITIALIZER;
 /* Mutex to guard handle_command statements */ 
 pthread_mutex_t  handleCommandMutex    = PTHREAD_MUTEX_INITIALIZER; 
 
-
-
-
-/* Mutex to guard condition -- used in getting/returning from thread pool*/ 
-pthread_mutex_t conditionMutex = PTHREAD_MUTEX_INITIALIZER;
-/* Condition variable -- used to wait for avaiable threads, and signal when available */ 
-pthread_cond_t  conditionCond  = PTHREAD_COND_INITIALIZER;
+/* The connections whose next command waits for handleCommandMutex,
+ * guarded by lockedQueueMutex */
+Connection *lockedHead;
+Connection *lockedTail;
+pthread_mutex_t  lockedQueueMutex    = PTHREAD_MUTEX_INITIALIZER; 
 
 // LOGGING:
 // 0: no logging
@@ -90,16 +132,193 @@ extern FILE *log;
 * 
 * @param string A given key
 * @param record The pointer to the structure that stores
-* 		 the value of a given key
+* 		 the value of a given key, or NULL while the value is spilled
 * @param next The pointer to the next node structure
+* @param offset Where the value is in the spill file, while it is spilled
+* @param length The bytes of the spilled value
+* @param version The version of the record, while it is spilled
+* @param referenced Set when the record is used, and cleared by the
+* 		 eviction clock
+* @param deleted Set when the key was deleted. The node stays in the
+* 		 list with the next version of the key in version, so that
+* 		 inserting the key again continues from it.
+* @param stamp When the current value or deletion was made, or 0 if no
+* 		 snapshot was open then
+* @param versions The earlier states of the key that open snapshots may
+* 		 still read, newest first
+* @param indexed The values of the indexed columns of the current record,
+* 		 as added to the indexes of the table, or NULL
+* @param id The number of the key in the bitmap indexes of its table, or
+* 		 -1 if it has none
+* @param versionedNext The next node of the list of nodes with earlier
+* 		 states kept in the stripe of the key
+* @param listed Set while the node is in that list
 */
 typedef struct _list_t_ {
     char *string;
     struct storage_record *record;
     struct _list_t_ *next;
+    long offset;
+    int length;
+    int version;
+    int referenced;
+    int deleted;
+    long stamp;
+    struct _version_t_ *versions;
+    struct _index_value_t_ *indexed;
+    int id;
+    struct _list_t_ *versionedNext;
+    int listed;
 } Node;
 
 
+/**
+ * @brief An earlier state of a key, kept for the snapshots that were
+ *	  opened before it was replaced
+ *
+ * @param record The value, or NULL if it is spilled or the key was deleted
+ * @param offset Where the value is in the spill file, if it is spilled
+ * @param length The bytes of the spilled value
+ * @param version The version of the spilled value
+ * @param deleted Set if the key did not exist
+ * @param begin When the state was made, like the stamp of a node
+ * @param end When the state was replaced
+ * @param indexed The values of the indexed columns, which stay in the
+ *		 indexes while the state is kept
+ * @param older The state before it
+ */
+typedef struct _version_t_ {
+    struct storage_record *record;
+    long offset;
+    int length;
+    int version;
+    int deleted;
+    long begin;
+    long end;
+    struct _index_value_t_ *indexed;
+    struct _version_t_ *older;
+} Version;
+
+
+/**
+ * @brief A lock guarding some buckets of a hash table, with the counters
+ *	  of those buckets
+ *
+ * @param lock The lock
+ * @param resident The number of records of the buckets in memory
+ * @param spilled The number of records of the buckets in the spill file
+ * @param lockWaits The number of times a thread had to wait for the lock
+ * @param versions The number of earlier states kept in the buckets
+ * @param changes The number of changes made to the records of the
+ *		 buckets, which tells the planner when to gather statistics
+ *		 again
+ * @param users The number of commands using the storage of a table on
+ *		 the LSM or lock-free engine for keys of the stripe, which
+ *		 DROP and TRUNCATE wait for
+ * @param topVersion The highest version of that storage sent to a client
+ *		 for a key of the stripe, which TRUNCATE raises the version
+ *		 floor by
+ * @param versioned The nodes of the buckets that have earlier states, so
+ *		 that closing a snapshot only visits those. A node stays in
+ *		 the list until they are freed by collect_versions.
+ *
+ * Every stripe has cache lines of its own, so threads working on
+ * different stripes never write to the same cache line.
+ */
+typedef struct _stripe_t_ {
+    pthread_rwlock_t lock;
+    long resident;
+    long spilled;
+    long lockWaits;
+    long versions;
+    long changes;
+    long users;
+    long topVersion;
+    struct _list_t_ *versioned;
+} __attribute__((aligned(CACHE_LINE_SIZE))) Stripe;
+
+
+/**
+ * @brief An index on a column of a hash table
+ *
+ * @param column The column
+ * @param tree Maps the values of an int column to the keys having them,
+ *		 in order, or NULL
+ * @param hash Maps the values of a char column to the keys having them,
+ *		 or NULL
+ * @param bitmap Maps the values of a column to the bitmap of the ids of
+ *		 the keys having them, or NULL
+ * @param numeric Set if the column is an int column
+ * @param failed Set if a key could not be added to the index, which is
+ *		 not used by queries from then on
+ *
+ * Every state of a key that a snapshot may read keeps its values in the
+ * ordered and hash indexes, so a query at a snapshot finds the keys
+ * through them too. A bitmap index only holds the current records.
+ */
+typedef struct _index_t_ {
+    char column[MAX_COLNAME_LEN + 1];
+    struct btree *tree;
+    struct hindex *hash;
+    struct bitmap_index *bitmap;
+    int numeric;
+    int failed;
+} Index;
+
+
+/**
+ * @brief The value of an indexed column, as added to its index
+ *
+ * @param number The value of an int column
+ * @param text The value of a char column, without the spaces around it
+ */
+typedef struct _index_value_t_ {
+    long number;
+    char *text;
+} IndexValue;
+
+
+#define STATS_BUCKETS 16	///< Ranges of the histogram of an int column.
+
+/**
+ * @brief Statistics of a column of a table, used to plan QUERYs
+ *
+ * @param column The column
+ * @param numeric Set if the column is an int column
+ * @param distinct The number of distinct values
+ * @param min The smallest value of an int column
+ * @param max The largest value of an int column
+ * @param width The width of the ranges of the histogram
+ * @param histogram The number of records whose int value is in each range,
+ *		 from min up
+ */
+typedef struct _column_stats_t_ {
+    char column[MAX_COLNAME_LEN + 1];
+    int numeric;
+    long distinct;
+    long min;
+    long max;
+    long width;
+    long histogram[STATS_BUCKETS];
+} ColumnStats;
+
+
+/**
+ * @brief Statistics of the columns of a table
+ *
+ * @param records The number of records
+ * @param changes The changes made to the table before they were gathered
+ * @param ncolumns The number of columns
+ * @param columns The columns, in the order of the schema
+ */
+typedef struct _table_stats_t_ {
+    long records;
+    long changes;
+    int ncolumns;
+    ColumnStats columns[MAX_COLUMNS_PER_TABLE];
+} TableStats;
+
+
 /**
  * @brief Acts as the structure for the hash table
  * 
@@ -107,12 +326,84 @@ typedef struct _list_t_ {
  * @param size The size of the table
  * @param table A pointer that points to the first pointer
  *		 in array of node pointers
+ * @param engine Where the records are kept, one of the ENGINE_* values
+ * @param lsm The on-disk tree holding the records of an ENGINE_LSM table
+ * @param directory The directory of the tree
+ * @param memtableSize The memtable size the tree was opened with
+ * @param lf The lock-free table holding the records of an ENGINE_LOCKFREE
+ *		 table
+ * @param memoryBudget The bytes of records kept in memory, 0 for no limit
+ * @param promoteOnRead Whether reading a spilled record moves it back
+ *		 to memory
+ * @param spill The file holding the spilled values
+ * @param clockHand The bucket the eviction clock looks at next
+ * @param nstripes The number of locks guarding the buckets
+ * @param stripes The locks; bucket i is guarded by stripes[i % nstripes]
+ * @param spillLock Lets one thread at a time spill records
+ * @param nindexes The number of indexed columns
+ * @param indexes The indexes of the columns
+ * @param nodes The nodes of the keys by id, if the table has bitmap indexes
+ * @param nnodes The number of ids given out
+ * @param nodesCapacity The slots of nodes
+ * @param nodesLock Guards nodes
+ * @param versioned The ids of the keys with earlier states kept, or NULL
+ *		 if the table has no bitmap index
+ * @param versionedLock Guards versioned
+ * @param stats The statistics of the columns, or NULL until a QUERY needs
+ *		 them. Only QUERY and EXPLAIN use them, under
+ *		 handleCommandMutex.
+ * @param dropped Set by DROP, after which commands no longer find the
+ *		 table
+ * @param truncating Set by TRUNCATE while it swaps the storage of a table
+ *		 on the LSM or lock-free engine, which commands wait for
+ * @param storageLock Guards the waits for dropped, truncating and the
+ *		 users of the stripes
+ * @param storageChanged Signalled when truncating is cleared, and when
+ *		 the last user of a stripe leaves a table being dropped or
+ *		 truncated
+ * @param truncations The number of TRUNCATEs, which reset the spill file,
+ *		 so a value read from it without the stripe held is known
+ *		 to be from before one
+ * @param versionFloor The version new keys start above. TRUNCATE raises
+ *		 it over every version the table had, so a version read
+ *		 before is never given out again. The versions of the LSM
+ *		 and lock-free engines are sent to the clients raised by it.
+ * @param floorChanges The changes counted in the stripes when the floor
+ *		 was last raised
  */
 typedef struct _hash_table_t_ {
     char* name;
     char* schema;
     int size;
     Node **table;
+    int engine;
+    struct lsm_tree *lsm;
+    char directory[MAX_PATH_LEN];
+    long memtableSize;
+    struct lf_table *lf;
+    long memoryBudget;
+    int promoteOnRead;
+    struct spill_file *spill;
+    int clockHand;
+    int nstripes;
+    Stripe *stripes;
+    pthread_mutex_t spillLock;
+    int nindexes;
+    Index indexes[MAX_TABLE_INDEXES];
+    Node **nodes;
+    int nnodes;
+    int nodesCapacity;
+    pthread_rwlock_t nodesLock;
+    struct roaring *versioned;
+    pthread_mutex_t versionedLock;
+    TableStats *stats;
+    int dropped;
+    int truncating;
+    pthread_mutex_t storageLock;
+    pthread_cond_t storageChanged;
+    int truncations;
+    int versionFloor;
+    long floorChanges;
 } HashTable;
 
 
@@ -123,233 +414,740 @@ typedef struct predicates_ {
 } Predicates;
 
 
-typedef struct keys_ {
-	char key[10];
-	int count;
-} Keys;
-
+#define MAX_QUERY_PREDICATES 10	///< Max predicates of a QUERY.
 
-
-Predicates pred[10];
+Predicates pred[MAX_QUERY_PREDICATES];
 
 
 // HashTable *my_hash_table;
-struct storage_record obj[1000000];
 HashTable *allTables[MAX_TABLES];
 int numberOfTables;
 
-struct storage_record rec1[1000000];
 
-keyVersion arrKeyVersion[100000];
-int count_arrKeyVersion = 0;
+/**
+ * @brief Checks if a table was dropped, which the commands that run
+ * without handleCommandMutex may do while it is
+ */
+bool table_dropped(HashTable *hashtable)
+{
+    return __atomic_load_n(&hashtable->dropped, __ATOMIC_ACQUIRE) != 0;
+}
+
+
+void leave_storage(HashTable *hashtable, int stripe);
+
+/**
+ * @brief Starts using the storage of a table on the LSM or lock-free
+ *	  engine, from a command that runs without handleCommandMutex
+ *
+ * @param stripe The stripe counting the use, the stripe of the key if
+ *		 there is one, so commands on different keys do not write
+ *		 the same cache line
+ * @return Returns false if the table was dropped, and the storage may
+ *	   not be used. Otherwise leave_storage() must be called when done.
+ *
+ * DROP sets dropped, and TRUNCATE sets truncating, then they wait for the
+ * users of every stripe to leave before they free the storage. Either
+ * they see the user, or the user sees the flag. A command that finds the
+ * table being truncated waits for the new storage.
+ */
+bool enter_storage(HashTable *hashtable, int stripe)
+{
+    Stripe *s = &hashtable->stripes[stripe];
 
-int recCt = 0;
+    while(1)
+    {
+        __atomic_add_fetch(&s->users, 1, __ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&hashtable->dropped, __ATOMIC_SEQ_CST) == 0 &&
+            __atomic_load_n(&hashtable->truncating, __ATOMIC_SEQ_CST) == 0)
+            return true;
 
+        leave_storage(hashtable, stripe);
 
-ThreadInfo getThreadInfo(void) { 
-  ThreadInfo currThreadInfo = NULL;
+        pthread_mutex_lock(&hashtable->storageLock);
+        while(__atomic_load_n(&hashtable->truncating, __ATOMIC_SEQ_CST) != 0 &&
+            __atomic_load_n(&hashtable->dropped, __ATOMIC_SEQ_CST) == 0)
+            pthread_cond_wait(&hashtable->storageChanged, &hashtable->storageLock);
+        pthread_mutex_unlock(&hashtable->storageLock);
 
-  /* Wait as long as there are no more threads in the buffer */ 
-  pthread_mutex_lock( &conditionMutex ); 
-  while (((botRT+1)%MAX_THREADS)==topRT)
-    pthread_cond_wait(&conditionCond,&conditionMutex); 
-  
-  /* At this point, there is at least one thread available for us. We
-     take it, and update the circular buffer  */ 
-  currThreadInfo = runtimeThreads[botRT]; 
-  botRT = (botRT + 1)%MAX_THREADS;
+        if(__atomic_load_n(&hashtable->dropped, __ATOMIC_SEQ_CST) != 0)
+            return false;
+    }
+}
 
-  /* Release the mutex, so other clients can add threads back */ 
-  pthread_mutex_unlock( &conditionMutex ); 
-  
-  return currThreadInfo;
+void leave_storage(HashTable *hashtable, int stripe)
+{
+    // the last user of a stripe wakes up a DROP or TRUNCATE waiting for it
+    if(__atomic_sub_fetch(&hashtable->stripes[stripe].users, 1, __ATOMIC_SEQ_CST) == 0 &&
+        (__atomic_load_n(&hashtable->dropped, __ATOMIC_SEQ_CST) != 0 ||
+        __atomic_load_n(&hashtable->truncating, __ATOMIC_SEQ_CST) != 0))
+    {
+        pthread_mutex_lock(&hashtable->storageLock);
+        pthread_cond_broadcast(&hashtable->storageChanged);
+        pthread_mutex_unlock(&hashtable->storageLock);
+    }
 }
 
+/**
+ * @brief Turns the version a client sent into one of the storage of a
+ *	  table on the LSM or lock-free engine
+ *
+ * The versions of the storage start from 1 again after a TRUNCATE, and
+ * are sent to the clients raised by the version floor. A version from
+ * before the floor matches no key.
+ */
+void storage_version(HashTable *hashtable, struct storage_record *record_)
+{
+    if(record_ == NULL || record_->metadata[0] == 0)
+        return;
+
+    if(record_->metadata[0] > hashtable->versionFloor)
+        record_->metadata[0] -= hashtable->versionFloor;
+    else
+        record_->metadata[0] = -1;
+}
 
-/* This function receives a string from clients and echoes it back --
-   the thread is released when the thread is finished */
-void * threadCallFunction(void *arg) 
+/**
+ * @brief Turns the version of a record read or written in the storage of
+ *	  a table on the LSM or lock-free engine into the one sent to the
+ *	  client
+ *
+ * @param stripe The stripe of the key, which keeps the highest version
+ *		 sent
+ */
+void client_version(HashTable *hashtable, int stripe, struct storage_record *record_)
 {
+    long *top = &hashtable->stripes[stripe].topVersion;
+    long version = record_->metadata[0];
+    long seen = __atomic_load_n(top, __ATOMIC_RELAXED);
+
+    while(version > seen &&
+        !__atomic_compare_exchange_n(top, &seen, version, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
 
-    printf("opening new thread\n");
+    record_->metadata[0] += hashtable->versionFloor;
+}
 
-    ThreadInfo tiInfo = (ThreadInfo)arg; 
+/**
+ * @brief Waits until every command using the storage of a table has left
+ *	  it, once dropped or truncating is set
+ */
+void wait_for_users(HashTable *hashtable)
+{
+    int i;
 
-    int wait_for_commands = 1;
-    do
+    pthread_mutex_lock(&hashtable->storageLock);
+    for(i=0; i<hashtable->nstripes; i++)
     {
-        // Read a line from the client
+        while(__atomic_load_n(&hashtable->stripes[i].users, __ATOMIC_SEQ_CST) != 0)
+            pthread_cond_wait(&hashtable->storageChanged, &hashtable->storageLock);
+    }
+    pthread_mutex_unlock(&hashtable->storageLock);
+}
+
 
+/**
+ * @brief A point in time that a QUERY reads the tables at
+ *
+ * @param stamp Changes stamped before it are seen, later ones are not
+ * @param next The next open snapshot
+ */
+typedef struct _snapshot_t_ {
+    long stamp;
+    struct _snapshot_t_ *next;
+} Snapshot;
 
-        char buffer[MAX_CMD_LEN]; 
-        int  length; 
+/* Hands out the stamps of snapshots, and of changes made while one is open */
+long snapshotClock;
 
-        int status = recvline( tiInfo->clientsock, buffer, MAX_CMD_LEN); 
+/* The number of open snapshots, read by every change */
+int openSnapshots;
+
+/* The open snapshots, guarded by snapshotMutex */
+Snapshot *snapshots;
+pthread_mutex_t  snapshotMutex    = PTHREAD_MUTEX_INITIALIZER;
 
-        if(status != 0)
-        {
-            wait_for_commands = 0;
-        }
-        else
-        {
-            // perform operation
 
-            pthread_mutex_lock( &handleCommandMutex ); 
 
-            int commandStatus = handle_command(tiInfo->clientsock, buffer, tiInfo->params);     
+/**
+ * @brief Checks if a command changes every record matching predicates,
+ * like "UPDATE;<table>;where <predicates>;<columns>"
+ */
+bool changesMatches(char *cmd)
+{
+    char *table = strchr(cmd, ';');
+    char *where = table != NULL ? strchr(table + 1, ';') : NULL;
+
+    return where != NULL && strncmp(where + 1, "where ", 6) == 0;
+}
 
 
-            if(commandStatus != 0)
-                wait_for_commands = 0;  // Oops. An error occured.
+/**
+ * @brief Checks if a command changes columns of one record in place:
+ * UPDATE of a key, or an operator on an int column (INCR, DECR, MIN or MAX)
+ */
+bool changesColumns(char *cmd)
+{
+    return strncmp(cmd, "INCR;", 5) == 0 || strncmp(cmd, "DECR;", 5) == 0 ||
+        strncmp(cmd, "MIN;", 4) == 0 || strncmp(cmd, "MAX;", 4) == 0 ||
+        (strncmp(cmd, "UPDATE;", 7) == 0 && !changesMatches(cmd));
+}
 
-            // length = strlen(buffer);
-            // buffer[length] = '\n'; 
-            // buffer[length+1] = 0; 
-            // sendall( tiInfo->clientsock, buffer, strlen(buffer) ); 
 
-            pthread_mutex_unlock( &handleCommandMutex ); 
-   
+/**
+ * @brief Checks if a command can run without handleCommandMutex
+ *
+ * @param cmd The command line received from the client
+ * @return Returns true for AUTH, GET, SET, STATS, COMMIT, UPDATE and
+ *		 the int column operators, which only use the locks of the
+ *		 tables they work on
+ */
+bool runsUnlocked(char *cmd)
+{
+    return strncmp(cmd, "AUTH;", 5) == 0 || strncmp(cmd, "GET;", 4) == 0 ||
+        strncmp(cmd, "SET;", 4) == 0 || strncmp(cmd, "STATS;", 6) == 0 ||
+        strncmp(cmd, "COMMIT;", 7) == 0 || changesColumns(cmd);
+}
 
-            // length = strlen(buffer);
-            // buffer[length] = '\n'; 
-            // buffer[length+1] = 0; 
-            // sendall( tiInfo->clientsock, &buffer[0], length+1 ); 
-        }
 
-    }while(wait_for_commands);
+/**
+ * @brief Finds the first command in the buffer of a connection
+ *
+ * @return Returns the length of the command, or -1 if no whole command
+ *		 was received yet. Like recvline(), a full buffer counts as a
+ *		 command.
+ */
+int commandLength(Connection *conn)
+{
+    char *end = memchr(conn->buffer, '\n', conn->used);
+
+    if(end != NULL)
+        return end - conn->buffer;
+    if(conn->used == MAX_CMD_LEN - 1)
+        return conn->used;
+    return -1;
+}
+
+
+void close_cursors(int sock);
+void expire_idle_cursors(int timeout);
+void runLockedCommands(void);
 
+/**
+ * @brief Closes the connection with a client and frees it
+ */
+void closeConnection(Connection *conn)
+{
+    char out[100];
+    snprintf(out, sizeof out, "[LOG SERVER] Closed connection from %s:%d.\n",
+        inet_ntoa(conn->clientaddr.sin_addr), conn->clientaddr.sin_port);
+    logger(out, LOGGING);
 
-    if (close(tiInfo->clientsock)<0) 
+    close_cursors(conn->sock);
+
+    if (close(conn->sock)<0) 
     { 
         pthread_mutex_lock( &printMutex ); 
         printf("ERROR in closing socket to %s:%d.\n", 
-        inet_ntoa(tiInfo->clientaddr.sin_addr), tiInfo->clientaddr.sin_port);
+        inet_ntoa(conn->clientaddr.sin_addr), conn->clientaddr.sin_port);
         pthread_mutex_unlock( &printMutex ); 
     }
 
-    // close thread
+    free(conn);
+}
 
-    releaseThread( tiInfo ); 
 
-    return NULL; 
+/**
+ * @brief Waits for the next command of an idle connection
+ */
+void watchConnection(Connection *conn)
+{
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = conn;
+    int sock = conn->sock;
+    int epoll = conn->epoll;
+
+    // hands the connection over to the thread waiting for input; it
+    // is not touched again unless the socket can not be watched
+    __atomic_store_n(&conn->watched, 1, __ATOMIC_RELEASE);
+
+    if(epoll_ctl(epoll, EPOLL_CTL_MOD, sock, &event) != 0)
+        closeConnection(conn);
 }
 
 
+unsigned int hash(HashTable *hashtable, char *str);
 
+/**
+ * @brief Picks the shard that runs the first command of a connection
+ *
+ * A GET, SET or int column operator goes to the shard owning the key,
+ * and any other command to a shard picked by the socket.
+ */
+int commandShard(Connection *conn)
+{
+    char cmd[MAX_CMD_LEN];
+    int length = commandLength(conn);
+    memcpy(cmd, conn->buffer, length);
+    cmd[length] = 0;
 
+    if(strncmp(cmd, "GET;", 4) == 0 || strncmp(cmd, "SET;", 4) == 0 || changesColumns(cmd))
+    {
+        char *save;
+        strtok_r(cmd, ";", &save);
+        char *table = strtok_r(NULL, ";", &save);
+        char *key = strtok_r(NULL, ";", &save);
 
-/* Function called when thread is about to finish -- unless it is
-   called, the ThreadInfo assigned to it is lost */ 
-void releaseThread(ThreadInfo me) {
-  pthread_mutex_lock( &conditionMutex ); 
-  assert( botRT!=topRT ); 
- 
-  runtimeThreads[topRT] = me; 
-  topRT = (topRT + 1)%MAX_THREADS; 
+        int i;
+        for(i=0; table != NULL && key != NULL && i<numberOfTables; i++)
+        {
+            if(allTables[i] != NULL && strcmp(allTables[i]->name, table)==0)
+                return hash(allTables[i], key) % shard_count(shards);
+        }
+    }
 
-  /* tell getThreadInfo a new thread is available */ 
-  pthread_cond_signal( &conditionCond ); 
+    return conn->sock % shard_count(shards);
+}
 
-  /* Release the mutex, so other clients can get new threads */ 
-  pthread_mutex_unlock( &conditionMutex ); 
 
-  printf("closing thread\n");
+/**
+ * @brief Queues the first command of a connection on the thread that
+ *	  runs it
+ */
+void dispatchConnection(Connection *conn)
+{
+    if(shards != NULL)
+        shard_submit(shards, listenerIndex, commandShard(conn), &conn->task);
+    else if(pool_current_worker(workPool) >= 0)
+        pool_submit(workPool, &conn->task, pool_current_worker(workPool));
+    else
+        pool_submit(workPool, &conn->task, conn->sock);
 }
 
 
+/**
+ * @brief Copies the first command of a connection
+ *
+ * @param take Whether the command is also taken out of the buffer
+ */
+void firstCommand(Connection *conn, char *cmd, bool take)
+{
+    int length = commandLength(conn);
+    memcpy(cmd, conn->buffer, length);
+    cmd[length] = 0;
 
+    if(take)
+    {
+        int consumed = length < conn->used ? length + 1 : length;
+        memmove(conn->buffer, conn->buffer + consumed, conn->used - consumed);
+        conn->used -= consumed;
+    }
+}
 
-char* substring2(const char* str, size_t begin, size_t len) 
-{ 
-  if (str == 0 || strlen(str) == 0 || strlen(str) < begin || strlen(str) < (begin+len)) 
-    return 0; 
-
-  return strndup(str + begin, len); 
-} 
 
-char* trim2(char* str)
+/**
+ * @brief Hands a connection on after one of its commands ran
+ *
+ * A command that came in behind it is queued right away on the same
+ * worker, otherwise the connection is watched again.
+ */
+void finishCommand(Connection *conn, int commandStatus)
 {
-	int len = strlen(str);
-	int i = 0;
-	int j = len-1;
+    if(commandStatus != 0)
+        closeConnection(conn);  // Oops. An error occured.
+    else if(commandLength(conn) >= 0)
+        dispatchConnection(conn);
+    else
+        watchConnection(conn);
+}
 
-	while(str[i]==' ')
-		i++;
 
-	while(str[j]==' ')
-		j--;
+/**
+ * @brief Runs the queued commands that need handleCommandMutex, if no
+ *	  other thread holds it
+ *
+ * A thread that finds the mutex held leaves its command in the queue
+ * instead of waiting, and the holder runs it after its own. So at most
+ * one worker is busy with these commands, and the others stay free for
+ * GET and SET. Every thread that unlocks the mutex calls this again, so a
+ * command queued while the mutex was held is never left behind.
+ */
+void runLockedCommands(void)
+{
+    char cmd[MAX_CMD_LEN];
 
-	str[j+1]='\0';
-	str=str+i;
+    while(pthread_mutex_trylock( &handleCommandMutex ) == 0)
+    {
+        pthread_mutex_lock( &lockedQueueMutex ); 
+        Connection *conn = lockedHead;
+        if(conn != NULL)
+        {
+            lockedHead = conn->next;
+            if(lockedHead == NULL)
+                lockedTail = NULL;
+        }
+        pthread_mutex_unlock( &lockedQueueMutex ); 
 
-	char* s = str;
-	
-	// printf("%s(%d)\n", s, strlen(s));
-	
-	return s;
-}
+        if(conn == NULL)
+        {
+            pthread_mutex_unlock( &handleCommandMutex ); 
 
-char* tokenize2(char** str, char* tok)
-{
-	int i = 0;
-	bool flag = true;
+            // a command may have been queued before the mutex was unlocked
+            pthread_mutex_lock( &lockedQueueMutex ); 
+            bool empty = lockedHead == NULL;
+            pthread_mutex_unlock( &lockedQueueMutex ); 
+            if(empty)
+                return;
+            continue;
+        }
 
-	*str = trim2(*str);
-	// printf("%s,", *str);
-	strcpy(tok, *str);
+        firstCommand(conn, cmd, true);
+        int commandStatus = handle_command(conn->sock, cmd, conn->params);
+        pthread_mutex_unlock( &handleCommandMutex ); 
 
-	while(*(*str)!=' ' && *(*str)!='\0')
-	{
-		// printf("%c,", **str);
-		(*str)++;
-		i++;
-	}
+        // closing the connection locks the mutex to close its cursors
+        finishCommand(conn, commandStatus);
+    }
+}
 
-	*str = trim2(*str);
-	// *str = "31" which is the value of the col
-	
-	if(**str == '\0')
-	{
-		*str = NULL;
-		// printf("No value\n");
-	}
 
-	// printf("before\n");
-	strcpy(tok, substring2(tok, 0, i));
-	// tok = "kilometres" which is the name of col
+/**
+ * @brief Runs the first command of a connection on a worker
+ *
+ * @param task The task of the connection
+ */
+void runConnection(struct pool_task *task)
+{
+    Connection *conn = (Connection *) task;
+    char cmd[MAX_CMD_LEN];
 
-	char* token = tok;
+    firstCommand(conn, cmd, false);
 
-	return token;
+    // the tables lock the records GET and SET use; the other commands
+    // wait in the queue of handleCommandMutex, not on the worker
+    if(!runsUnlocked(cmd))
+    {
+        conn->next = NULL;
+        pthread_mutex_lock( &lockedQueueMutex ); 
+        if(lockedTail != NULL)
+            lockedTail->next = conn;
+        else
+            lockedHead = conn;
+        lockedTail = conn;
+        pthread_mutex_unlock( &lockedQueueMutex ); 
+
+        runLockedCommands();
+        return;
+    }
 
+    firstCommand(conn, cmd, true);
+    int commandStatus = handle_command(conn->sock, cmd, conn->params);
+    finishCommand(conn, commandStatus);
 }
 
-char* colValue(char* line, char* colName)
+
+/**
+ * @brief Accepts a new client and starts watching its socket
+ *
+ * @param listensock The listening socket
+ * @param epoll The event loop of the listening socket, which also
+ *		 watches the client
+ * @param params The server configuration
+ */
+void acceptConnection(int listensock, int epoll, struct config_params *params)
 {
-	char cpy[1024];
+    Connection *conn = malloc(sizeof(Connection));
+    if(conn == NULL)
+        return;
 
-	strcpy(cpy, line);
+    socklen_t clientaddrlen = sizeof conn->clientaddr;
+    conn->sock = accept(listensock, (struct sockaddr*)&conn->clientaddr, &clientaddrlen);
+    if (conn->sock < 0)
+    {
+        pthread_mutex_lock( &printMutex ); 
+        printf("ERROR in accepting a connection.\n");
+        pthread_mutex_unlock( &printMutex ); 
+        free(conn);
+        return;
+    }
 
-	char* ch = strtok(cpy, ",");
+    conn->task.run = runConnection;
+    conn->used = 0;
+    conn->params = params;
+    conn->epoll = epoll;
+    conn->watched = 1;
 
-	while(ch)
-	{
-		char s4[1024];
-    	strcpy(s4, ch);
-    	// s4 = "  kilometres 26   "
+    char out[100];
+    snprintf(out, sizeof out, "[LOG SERVER] Got a connection from %s:%d.\n",
+        inet_ntoa(conn->clientaddr.sin_addr), conn->clientaddr.sin_port);
+    logger(out, LOGGING);
 
-    	char* s3 = trim2(s4);
-    	// s3 = "kilometres 26"	
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = conn;
 
-	    char token[1024];
+    if(epoll_ctl(epoll, EPOLL_CTL_ADD, conn->sock, &event) != 0)
+        closeConnection(conn);
+}
 
-	    // token: column name, s3: column value
-		strncpy(token, tokenize2(&s3, token), sizeof token);
-		// printf("%s\n", ch);
 
-		if(strcmp(token, colName)==0)
-		{
-			return s3;
+/**
+ * @brief Reads what a client sent, and queues its command once the whole
+ *	  line is in
+ */
+void readConnection(Connection *conn)
+{
+    // takes the connection over from the worker that watched it
+    assert(__atomic_load_n(&conn->watched, __ATOMIC_ACQUIRE));
+
+    ssize_t bytes = recv(conn->sock, conn->buffer + conn->used,
+        MAX_CMD_LEN - 1 - conn->used, 0);
+
+    if(bytes <= 0)
+    {
+        // Either an error occurred or the client closed the connection.
+        closeConnection(conn);
+        return;
+    }
+
+    conn->used += bytes;
+
+    if(commandLength(conn) >= 0)
+    {
+        conn->watched = 0;
+        dispatchConnection(conn);
+    }
+    else
+        watchConnection(conn);
+}
+
+
+/**
+ * @brief Accepts clients, and hands their commands to the worker pool
+ *
+ * @param listensock The listening socket
+ * @param params The server configuration
+ * @return Returns -1 if the sockets can no longer be watched
+ *
+ * The loop also wakes up every cursor timeout to close the idle cursors.
+ */
+int serveConnections(int listensock, struct config_params *params)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    struct epoll_event event;
+    time_t expiry = time(NULL) + params->cursor_timeout;
+
+    int epoll = epoll_create1(0);
+    if(epoll < 0)
+        return -1;
+
+    // the listening socket is the only one without a connection
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if(epoll_ctl(epoll, EPOLL_CTL_ADD, listensock, &event) != 0)
+    {
+        close(epoll);
+        return -1;
+    }
+
+    while(1)
+    {
+        int n = epoll_wait(epoll, events, MAX_EPOLL_EVENTS, params->cursor_timeout * 1000);
+        if(time(NULL) >= expiry)
+        {
+            expire_idle_cursors(params->cursor_timeout);
+            expiry = time(NULL) + params->cursor_timeout;
+        }
+
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            close(epoll);
+            return -1;
+        }
+
+        int i;
+        for(i = 0; i < n; i++)
+        {
+            if(events[i].data.ptr == NULL)
+                acceptConnection(listensock, epoll, params);
+            else
+                readConnection(events[i].data.ptr);
+        }
+    }
+}
+
+
+
+
+/**
+ * @brief Runs the event loop of a listener started by main()
+ */
+void *listenerThread(void *arg)
+{
+    Listener *listener = arg;
+
+    listenerIndex = listener->index;
+
+    if(serveConnections(listener->sock, listener->params) != 0)
+    {
+        pthread_mutex_lock( &printMutex ); 
+        printf("Error waiting for connections.\n");
+        pthread_mutex_unlock( &printMutex ); 
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Creates a socket listening on the port of the server
+ *
+ * @param params The server configuration
+ * @param reusePort Whether other sockets may listen on the same port,
+ *		 with the kernel spreading the new connections over them
+ * @return Returns the socket, or -1 on error
+ */
+int openListener(struct config_params *params, bool reusePort)
+{
+    // Create a socket.
+    int listensock = socket(PF_INET, SOCK_STREAM, 0);
+    if (listensock < 0) {
+        printf("Error creating socket.\n");
+        return -1;
+    }
+
+    // Allow listening port to be reused if defunct.
+    int yes = 1;
+    int status = setsockopt(listensock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+    if (status == 0 && reusePort)
+        status = setsockopt(listensock, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof yes);
+    if (status != 0) {
+        printf("Error configuring socket.\n");
+        close(listensock);
+        return -1;
+    }
+
+    // Bind it to the listening port.
+    struct sockaddr_in listenaddr;
+    memset(&listenaddr, 0, sizeof listenaddr);
+    listenaddr.sin_family = AF_INET;
+    listenaddr.sin_port = htons(params->server_port);
+    inet_pton(AF_INET, params->server_host, &(listenaddr.sin_addr)); // bind to local IP address
+    status = bind(listensock, (struct sockaddr*) &listenaddr, sizeof listenaddr);
+    if (status != 0) {
+        printf("Error binding socket.\n");
+        close(listensock);
+        return -1;
+    }
+
+    // Listen for connections.
+    status = listen(listensock, MAX_LISTENQUEUELEN);
+    if (status != 0) {
+        printf("Error listening on socket.\n");
+        close(listensock);
+        return -1;
+    }
+
+    return listensock;
+}
+
+
+
+
+char* substring2(const char* str, size_t begin, size_t len) 
+{ 
+  if (str == 0 || strlen(str) == 0 || strlen(str) < begin || strlen(str) < (begin+len)) 
+    return 0; 
+
+  return strndup(str + begin, len); 
+} 
+
+char* trim2(char* str)
+{
+	int len = strlen(str);
+	int i = 0;
+	int j = len-1;
+
+	while(str[i]==' ')
+		i++;
+
+	while(j>=i && str[j]==' ')
+		j--;
+
+	str[j+1]='\0';
+	str=str+i;
+
+	char* s = str;
+	
+	// printf("%s(%d)\n", s, strlen(s));
+	
+	return s;
+}
+
+char* tokenize2(char** str, char* tok)
+{
+	int i = 0;
+	bool flag = true;
+
+	*str = trim2(*str);
+	// printf("%s,", *str);
+	strcpy(tok, *str);
+
+	while(*(*str)!=' ' && *(*str)!='\0')
+	{
+		// printf("%c,", **str);
+		(*str)++;
+		i++;
+	}
+
+	*str = trim2(*str);
+	// *str = "31" which is the value of the col
+	
+	if(**str == '\0')
+	{
+		*str = NULL;
+		// printf("No value\n");
+	}
+
+	// printf("before\n");
+	strcpy(tok, substring2(tok, 0, i));
+	// tok = "kilometres" which is the name of col
+
+	char* token = tok;
+
+	return token;
+
+}
+
+char* colValue(char* line, char* colName)
+{
+	char cpy[1024];
+
+	strcpy(cpy, line);
+
+	char* ch = strtok(cpy, ",");
+
+	while(ch)
+	{
+		char s4[1024];
+    	strcpy(s4, ch);
+    	// s4 = "  kilometres 26   "
+
+    	char* s3 = trim2(s4);
+    	// s3 = "kilometres 26"	
+
+	    char token[1024];
+
+	    // token: column name, s3: column value
+		strncpy(token, tokenize2(&s3, token), sizeof token);
+		// printf("%s\n", ch);
+
+		if(strcmp(token, colName)==0)
+		{
+			return s3;
 
 		}
 
@@ -453,15 +1251,16 @@ char* trimXX(char* str)
 
 
 
-char* format(char* str)
+char* format(char* str, char* res)
 {
 	char copy[MAX_CONFIG_LINE_LEN];
 	strncpy(copy, str, sizeof copy);
 	char* p_copy = copy;
+	char* save;
 
-	char res[MAX_CONFIG_LINE_LEN]="";
+	res[0] = '\0';
 
-	char* pp = strtok(p_copy, ",");
+	char* pp = strtok_r(p_copy, ",", &save);
 
 	int i = 0;
 
@@ -483,17 +1282,16 @@ char* format(char* str)
 
 		strcat(res, r);
 		
-		pp = strtok(NULL, ",");
+		pp = strtok_r(NULL, ",", &save);
 	}
 
 	int len = strlen(res);
-	res[len-1] = '\0';
+	if(len > 0)
+		res[len-1] = '\0';
 
 	// printf("%s(%d)\n", res, strlen(res));
 
-	char* p_res = res;
-	
-	return p_res;
+	return res;
 }
 
 char* ntt(char** str)
@@ -539,32 +1337,6 @@ char* ntt(char** str)
 }
 
 
-void tokens(char* string, char** strMod, char** name, char* operator, char** value) {
-    int i = 0, j =0;
-    while(string[i] != '\0') {
-        if(string[i] == '>') {
-            *operator = '>';
-            j = i;
-        } else if(string[i] == '=') {
-            *operator = '=';
-            j = i;
-        } else if(string[i] == '<') {
-            *operator = '<';
-            j = i;
-        } else {
-
-        }
-        i++;
-    }
-
-    *name = substring2(string, 0, j);
-    *name = trimXX(*name);
-    *value = substring2(string, j+1, strlen(string)-j-1);
-    *value = trimXX(*value);
-
-}
-
-
 // >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 // >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 
@@ -575,16 +1347,19 @@ void tokens(char* string, char** strMod, char** name, char* operator, char** val
  *
  * @param name The name of the hash table
  * @param size The size of the hash table
+ * @param nstripes The number of locks guarding the buckets
  * 
  * Allocates memory for a hash table, initalizes its elements,
  * and sets the table's size. It also returns the new hash table.
  */
-HashTable *create_hash_table(char* name_, char* schema_, int size)
+HashTable *create_hash_table(char* name_, char* schema_, int size, int nstripes)
 {
     HashTable *new_table;
     
     if (size<1) return NULL; /* invalid size for table */
 
+    if (nstripes<1 || nstripes>size) return NULL; /* invalid number of locks */
+
     /* Attempt to allocate memory for the table structure */
     // if ((new_table = malloc(sizeof(hash_value_t))) == NULL) {
 	if ((new_table = malloc(sizeof(HashTable))) == NULL) {
@@ -598,10 +1373,51 @@ HashTable *create_hash_table(char* name_, char* schema_, int size)
 
     new_table->name = name_;
     new_table->schema = schema_;
+    new_table->engine = ENGINE_HASH;
+    new_table->lsm = NULL;
+    new_table->lf = NULL;
+    new_table->memoryBudget = 0;
+    new_table->promoteOnRead = 1;
+    new_table->spill = NULL;
+    new_table->clockHand = 0;
+    new_table->nindexes = 0;
+    new_table->nodes = NULL;
+    new_table->nnodes = 0;
+    new_table->nodesCapacity = 0;
+    new_table->versioned = NULL;
+    new_table->stats = NULL;
+    new_table->dropped = 0;
+    new_table->truncating = 0;
+    new_table->truncations = 0;
+    new_table->versionFloor = 0;
+    new_table->floorChanges = 0;
+    pthread_mutex_init(&new_table->spillLock, NULL);
+    pthread_rwlock_init(&new_table->nodesLock, NULL);
+    pthread_mutex_init(&new_table->versionedLock, NULL);
+    pthread_mutex_init(&new_table->storageLock, NULL);
+    pthread_cond_init(&new_table->storageChanged, NULL);
+
+    /* Attempt to allocate memory for the locks */
+    if (posix_memalign((void **) &new_table->stripes, CACHE_LINE_SIZE, sizeof(Stripe) * nstripes) != 0) {
+        return NULL;
+    }
+    new_table->nstripes = nstripes;
 
     /* Initialize the elements of the table */
     int i;
     for(i=0; i<size; i++) new_table->table[i] = NULL;
+    for(i=0; i<nstripes; i++)
+    {
+        pthread_rwlock_init(&new_table->stripes[i].lock, NULL);
+        new_table->stripes[i].resident = 0;
+        new_table->stripes[i].spilled = 0;
+        new_table->stripes[i].lockWaits = 0;
+        new_table->stripes[i].versions = 0;
+        new_table->stripes[i].changes = 0;
+        new_table->stripes[i].users = 0;
+        new_table->stripes[i].topVersion = 0;
+        new_table->stripes[i].versioned = NULL;
+    }
 
     /* Set the table's size */
     new_table->size = size;
@@ -639,6 +1455,39 @@ unsigned int hash(HashTable *hashtable, char *str)
     return hashval % hashtable->size;
 }
 
+/**
+ * @brief Locks the stripe that guards a bucket
+ *
+ * @param hashtable The pointer to the HashTable structure
+ * @param hashval The bucket
+ * @param write Whether the caller changes the bucket. Readers of the
+ *		 same stripe can hold it together.
+ */
+void lock_stripe(HashTable *hashtable, unsigned int hashval, bool write)
+{
+    Stripe *stripe = &hashtable->stripes[hashval % hashtable->nstripes];
+    pthread_rwlock_t *lock = &stripe->lock;
+
+    int busy = write ? pthread_rwlock_trywrlock(lock) : pthread_rwlock_tryrdlock(lock);
+    if(busy == 0)
+        return;
+
+    __atomic_add_fetch(&stripe->lockWaits, 1, __ATOMIC_RELAXED);
+
+    if(write)
+        pthread_rwlock_wrlock(lock);
+    else
+        pthread_rwlock_rdlock(lock);
+}
+
+/**
+ * @brief Unlocks the stripe that guards a bucket
+ */
+void unlock_stripe(HashTable *hashtable, unsigned int hashval)
+{
+    pthread_rwlock_unlock(&hashtable->stripes[hashval % hashtable->nstripes].lock);
+}
+
 /**
  * @brief Finds and returns the list a provided key is in
  * 
@@ -646,6 +1495,9 @@ unsigned int hash(HashTable *hashtable, char *str)
  * @param str The key provided by the user
  * @return Returns the list in which the provided key is in, otherwise it
  * 		   returns NULL
+ *
+ * The caller must hold the stripe of the bucket of the key. The node
+ * of a deleted key is returned too.
  */
 Node *lookup_string(HashTable *hashtable, char *str)
 {
@@ -675,446 +1527,4880 @@ Node *lookup_string(HashTable *hashtable, char *str)
 }
 
 /**
- * @brief Inserts a string into the hash table
- * 
- * @return Returns 0 for success, 2 if it has deleted
- * 		  the record, 3 if it must be modified, and
- * 		  1 otherwise or if it failed to allocate memory
+ * @brief Returns the version of the record of a node, spilled or not
  */
-int add_string(HashTable *hashtable, char *str, struct storage_record* record_)
+int node_version(Node *node)
 {
-    printf("add string call\n");
-    Node *new_list;
-    Node *current_list;
-    Node* temp;
-    unsigned int hashval = hash(hashtable, str);
+    if(node->record != NULL)
+        return node->record->metadata[0];
 
+    return node->version;
+}
 
-    // printf("asdsadlsadlsd\n");
-
+/**
+ * @brief Adds to the number of resident and spilled records of a stripe
+ *
+ * @param stripe The stripe of the records, held by the caller for writing
+ */
+void count_records(HashTable *hashtable, int stripe, long resident, long spilled)
+{
+    // read by other threads without the lock
+    Stripe *s = &hashtable->stripes[stripe];
+    __atomic_store_n(&s->resident, s->resident + resident, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->spilled, s->spilled + spilled, __ATOMIC_RELAXED);
+}
 
-    /* Attempt to allocate memory for list */
-    if ((new_list = malloc(sizeof(Node))) == NULL)
-        return 1;
+/**
+ * @brief Adds up the counters of all the stripes of a table
+ *
+ * @param resident Receives the number of records in memory
+ * @param spilled Receives the number of records in the spill file
+ * @param lockWaits Receives the number of times a thread had to wait
+ *		 for a stripe
+ */
+void table_counts(HashTable *hashtable, long *resident, long *spilled, long *lockWaits)
+{
+    int i;
 
-    /* Does item already exist? */
-    current_list = lookup_string(hashtable, str);
-    
-        /* item already exists, don't insert it again. */
-    if (current_list != NULL)
+    *resident = *spilled = *lockWaits = 0;
+    for(i=0; i<hashtable->nstripes; i++)
     {
-        // delete
-        if(record_ == NULL)
-        {
-            // printf("have to delete.\n");
-            // two options:
-            // 1. first record, 
-            // 2. not the first record in list
-            
-            //    current_list = current_list->next->next;
+        *resident += __atomic_load_n(&hashtable->stripes[i].resident, __ATOMIC_RELAXED);
+        *spilled += __atomic_load_n(&hashtable->stripes[i].spilled, __ATOMIC_RELAXED);
+        *lockWaits += __atomic_load_n(&hashtable->stripes[i].lockWaits, __ATOMIC_RELAXED);
+    }
+}
 
-            Node* head = hashtable->table[hashval];
-            Node* prev = NULL;
-            Node* curr = head;
-            
+/**
+ * @brief Adds up the changes made to the records of all the stripes of
+ *	  a table
+ */
+long table_changes(HashTable *hashtable)
+{
+    long changes = 0;
+    int i;
 
-            // no nodes at the hashVal
-            while(curr!=NULL && strcmp(curr->string, str)!=0)
-            {
-                prev = curr;
-                curr = curr->next;
-            }
+    for(i=0; i<hashtable->nstripes; i++)
+        changes += __atomic_load_n(&hashtable->stripes[i].changes, __ATOMIC_RELAXED);
+    return changes;
+}
 
-            // not the first element in the list
-            if(prev!=NULL)
-                prev->next = curr->next;
-            
+char *find_column(char *value, char *column);
 
-            // first element in the list
-            else
-                hashtable->table[hashval] = curr->next;
+/**
+ * @brief Copies the value of a column of a record, without the spaces
+ * around it, like QUERY compares char columns
+ *
+ * @param text Receives the value, or "" if there is no such column
+ */
+void column_text(char *value, char *column, char *text, size_t size)
+{
+    char *at = find_column(value, column);
+    size_t len;
+
+    if(at == NULL)
+        at = "";
+    at += strspn(at, " ");
+    len = strcspn(at, ",");
+
+    while(len > 0 && at[len-1] == ' ')
+        len--;
+    if(len >= size)
+        len = size - 1;
+    memcpy(text, at, len);
+    text[len] = '\0';
+}
+
+/**
+ * @brief Returns the value of an int column of a record, like QUERY
+ * compares int columns, or 0 if there is no such column
+ */
+long column_number(char *value, char *column)
+{
+    char *at = find_column(value, column);
+
+    return at != NULL ? atoi(at) : 0;
+}
+
+/**
+ * @brief The columns a GET or QUERY sends of each record
+ *
+ * @param columns The columns, in the order they are sent
+ * @param numeric Set for the int columns
+ */
+typedef struct _projection_t_ {
+    int count;
+    char *columns[MAX_COLUMNS_PER_TABLE];
+    int numeric[MAX_COLUMNS_PER_TABLE];
+} Projection;
+
+/**
+ * @brief Parses the columns a GET or QUERY sends
+ *
+ * @param columns The columns, like "population, province", which are
+ *		  split in place
+ * @return Returns 0 on success, and -1 if there are none, too many, or one
+ *	   is not a column of the table
+ */
+int parse_projection(char *columns, char *schema, Projection *projection)
+{
+    char *save;
+    char *tok = strtok_r(columns, ",", &save);
+
+    projection->count = 0;
+
+    for(; tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        char *column = trimXX(tok);
+        int size;
+        const char *type = column_type(schema, column, &size);
+
+        if(type == NULL || projection->count == MAX_COLUMNS_PER_TABLE)
+            return -1;
+
+        projection->numeric[projection->count] = strcmp(type, "int") == 0;
+        projection->columns[projection->count++] = column;
+    }
+
+    return projection->count > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Writes the projected columns of a record, like "population
+ * 2000000,province ontario"
+ *
+ * The columns are written like QUERY compares them, so a missing int
+ * column is 0 and a missing char column is empty.
+ */
+void project_value(Projection *projection, char *value, char *buf, size_t size)
+{
+    char text[MAX_VALUE_LEN + 1];
+    size_t len = 0;
+    int i;
+
+    buf[0] = '\0';
+
+    for(i=0; i<projection->count && len + 1 < size; i++)
+    {
+        const char *comma = i > 0 ? "," : "";
+
+        if(projection->numeric[i])
+            snprintf(buf + len, size - len, "%s%s %ld", comma, projection->columns[i],
+                column_number(value, projection->columns[i]));
+        else
+        {
+            column_text(value, projection->columns[i], text, sizeof text);
+            snprintf(buf + len, size - len, "%s%s %s", comma, projection->columns[i], text);
+        }
+
+        len += strlen(buf + len);
+    }
+}
+
+/**
+ * @brief Returns the text a value is kept under in a bitmap index
+ *
+ * @param buf Holds the text of an int value
+ */
+const char *bitmap_value(Index *index, IndexValue *value, char *buf)
+{
+    if(!index->numeric)
+        return value->text;
+
+    sprintf(buf, "%ld", value->number);
+    return buf;
+}
+
+/**
+ * @brief Gives a new node of a table with bitmap indexes its id
+ *
+ * @return Returns 0 on success, and -1 if there is no memory, in which
+ *		 case the id of the node is -1
+ */
+int number_node(HashTable *hashtable, Node *node)
+{
+    int ret = 0;
+
+    node->id = -1;
+
+    pthread_rwlock_wrlock(&hashtable->nodesLock);
+
+    if(hashtable->nnodes == hashtable->nodesCapacity)
+    {
+        int capacity = hashtable->nodesCapacity ? hashtable->nodesCapacity * 2 : 1024;
+        Node **nodes = realloc(hashtable->nodes, capacity * sizeof *nodes);
+
+        if(nodes == NULL)
+            ret = -1;
+        else
+        {
+            hashtable->nodes = nodes;
+            hashtable->nodesCapacity = capacity;
+        }
+    }
+
+    if(ret == 0)
+    {
+        node->id = hashtable->nnodes;
+        hashtable->nodes[hashtable->nnodes++] = node;
+    }
+
+    pthread_rwlock_unlock(&hashtable->nodesLock);
+    return ret;
+}
+
+/**
+ * @brief Marks the indexes of a table as not to be used
+ */
+void fail_indexes(HashTable *hashtable)
+{
+    int i;
+
+    for(i=0; i<hashtable->nindexes; i++)
+        __atomic_store_n(&hashtable->indexes[i].failed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Adds the current record of a key to the indexes of its table
+ *
+ * Called with the stripe of the key held for writing, once the record is
+ * set and before it can be spilled.
+ */
+void index_node(HashTable *hashtable, Node *node)
+{
+    int i;
+
+    if(hashtable->nindexes == 0 || node->record == NULL)
+        return;
+
+    node->indexed = calloc(hashtable->nindexes, sizeof(IndexValue));
+
+    for(i=0; i<hashtable->nindexes; i++)
+    {
+        Index *index = &hashtable->indexes[i];
+        IndexValue *value = node->indexed ? &node->indexed[i] : NULL;
+        char text[MAX_VALUE_LEN + 1];
+        char buf[32];
+        int ret = -1;
+
+        // compared like QUERY compares int columns
+        if(value != NULL && index->numeric)
+            value->number = column_number(node->record->value, index->column);
+
+        // and char columns
+        else if(value != NULL)
+        {
+            column_text(node->record->value, index->column, text, sizeof text);
+            value->text = strdup(text);
+        }
+
+        if(value == NULL || (!index->numeric && value->text == NULL))
+            ret = -1;
+        else if(index->tree != NULL)
+            ret = btree_add(index->tree, value->number, node->string);
+        else if(index->hash != NULL)
+            ret = hindex_add(index->hash, value->text, node->string);
+        else if(node->id >= 0)
+            ret = bitmap_index_add(index->bitmap, bitmap_value(index, value, buf), node->id);
+
+        if(ret != 0)
+            __atomic_store_n(&index->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Removes the current record of a key from the bitmap indexes of
+ * its table
+ *
+ * Called before the record is given up, while node->indexed still holds
+ * its values.
+ */
+void unindex_bitmaps(HashTable *hashtable, Node *node)
+{
+    int i;
+
+    if(node->indexed == NULL || node->id < 0)
+        return;
+
+    for(i=0; i<hashtable->nindexes; i++)
+    {
+        Index *index = &hashtable->indexes[i];
+        char buf[32];
+
+        if(index->bitmap != NULL && (index->numeric || node->indexed[i].text != NULL))
+            bitmap_index_remove(index->bitmap,
+                bitmap_value(index, &node->indexed[i], buf), node->id);
+    }
+}
+
+/**
+ * @brief Removes a state of a key from the ordered and hash indexes of its
+ * table, and frees its values
+ */
+void unindex(HashTable *hashtable, char *key, IndexValue *indexed)
+{
+    int i;
+
+    if(indexed == NULL)
+        return;
+
+    for(i=0; i<hashtable->nindexes; i++)
+    {
+        Index *index = &hashtable->indexes[i];
+
+        if(index->tree != NULL)
+            btree_remove(index->tree, indexed[i].number, key);
+        else if(index->hash != NULL && indexed[i].text != NULL)
+            hindex_remove(index->hash, indexed[i].text, key);
+
+        free(indexed[i].text);
+    }
+
+    free(indexed);
+}
+
+/**
+ * @brief Frees a list of earlier states of a key
+ *
+ * @param stripe The stripe of the key, held by the caller for writing
+ */
+void free_versions(HashTable *hashtable, int stripe, Node *node, Version *version)
+{
+    Stripe *s = &hashtable->stripes[stripe];
+
+    if(hashtable->versioned != NULL && version != NULL && version == node->versions &&
+        node->id >= 0)
+    {
+        pthread_mutex_lock(&hashtable->versionedLock);
+        roaring_remove(hashtable->versioned, node->id);
+        pthread_mutex_unlock(&hashtable->versionedLock);
+    }
+
+    while(version != NULL)
+    {
+        Version *older = version->older;
+        unindex(hashtable, node->string, version->indexed);
+        free(version->record);
+        free(version);
+        __atomic_store_n(&s->versions, s->versions - 1, __ATOMIC_RELAXED);
+        version = older;
+    }
+}
+
+/**
+ * @brief Returns the stamp of a change about to be made
+ *
+ * @return Returns 0 if no snapshot is open, so that every snapshot opened
+ *		 later sees the change. The snapshot clock is only advanced
+ *		 while a snapshot is open.
+ *
+ * Called with the stripe of the key held for writing, so that a
+ * snapshot that gets a later stamp reads the key after the change.
+ */
+long change_stamp(void)
+{
+    if(__atomic_load_n(&openSnapshots, __ATOMIC_SEQ_CST) == 0)
+        return 0;
+
+    return __atomic_add_fetch(&snapshotClock, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Gives up the current state of a key before it is changed
+ *
+ * @param stripe The stripe of the key, held by the caller for writing
+ * @param stamp The stamp of the change
+ *
+ * The record is kept in the versions of the node if a snapshot may still
+ * read it, and freed otherwise. The record of the node is NULL afterwards.
+ */
+void retire_state(HashTable *hashtable, int stripe, Node *node, long stamp)
+{
+    Version *version = NULL;
+
+    if(stamp == 0)
+    {
+        free_versions(hashtable, stripe, node, node->versions);
+        node->versions = NULL;
+    }
+    else
+        version = malloc(sizeof(Version));
+
+    // a query at a snapshot reads the keys with earlier states after the
+    // bitmaps, so it finds the key in one or the other
+    if(version != NULL && hashtable->versioned != NULL && node->id >= 0)
+    {
+        pthread_mutex_lock(&hashtable->versionedLock);
+        if(roaring_add(hashtable->versioned, node->id) != 0)
+            fail_indexes(hashtable);
+        pthread_mutex_unlock(&hashtable->versionedLock);
+    }
+    unindex_bitmaps(hashtable, node);
+
+    // without memory the snapshots stop seeing the key
+    if(version == NULL)
+    {
+        unindex(hashtable, node->string, node->indexed);
+        node->indexed = NULL;
+        free(node->record);
+        node->record = NULL;
+        return;
+    }
+
+    version->record = node->record;
+    version->offset = node->offset;
+    version->length = node->length;
+    version->version = node->version;
+    version->deleted = node->deleted;
+    version->begin = node->stamp;
+    version->end = stamp;
+    version->indexed = node->indexed;
+    version->older = node->versions;
+    node->versions = version;
+    node->record = NULL;
+    node->indexed = NULL;
+
+    Stripe *s = &hashtable->stripes[stripe];
+    __atomic_store_n(&s->versions, s->versions + 1, __ATOMIC_RELAXED);
+
+    if(!node->listed)
+    {
+        node->versionedNext = s->versioned;
+        s->versioned = node;
+        node->listed = 1;
+    }
+}
+
+/**
+ * @brief Returns the number of earlier states kept by a table
+ */
+long table_versions(HashTable *hashtable)
+{
+    long versions = 0;
+    int i;
+
+    for(i=0; i<hashtable->nstripes; i++)
+        versions += __atomic_load_n(&hashtable->stripes[i].versions, __ATOMIC_RELAXED);
+
+    return versions;
+}
+
+/**
+ * @brief Frees the earlier states of a table that no snapshot reads
+ *
+ * @param oldest The stamp of the oldest open snapshot, or LONG_MAX if
+ *		 none is open. A state replaced before it can not be read,
+ *		 and neither can the states before that one.
+ *
+ * Only the nodes in the versioned lists of the stripes are visited, and
+ * only the stripes keeping earlier states are held, so the cost is in
+ * the states kept rather than in the records of the table.
+ */
+void collect_versions(HashTable *hashtable, long oldest)
+{
+    int i;
+
+    if(hashtable->engine != ENGINE_HASH || table_versions(hashtable) == 0)
+        return;
+
+    for(i=0; i<hashtable->nstripes; i++)
+    {
+        Stripe *s = &hashtable->stripes[i];
+        Node **curr;
+
+        if(__atomic_load_n(&s->versions, __ATOMIC_RELAXED) == 0)
+            continue;
+
+        lock_stripe(hashtable, i, true);
+
+        for(curr = &s->versioned; *curr != NULL; )
+        {
+            Node *node = *curr;
+            Version **version = &node->versions;
+
+            while(*version != NULL && (*version)->end > oldest)
+                version = &(*version)->older;
+
+            free_versions(hashtable, i, node, *version);
+            *version = NULL;
+
+            if(node->versions == NULL)
+            {
+                *curr = node->versionedNext;
+                node->listed = 0;
+            }
+            else
+                curr = &node->versionedNext;
+        }
+
+        unlock_stripe(hashtable, i);
+    }
+}
+
+/**
+ * @brief Opens a snapshot of all the tables
+ *
+ * @param snapshot Receives the stamp, and stays linked to the open
+ *		 snapshots until close_snapshot
+ */
+void open_snapshot(Snapshot *snapshot)
+{
+    pthread_mutex_lock(&snapshotMutex);
+
+    snapshot->next = snapshots;
+    snapshots = snapshot;
+
+    // a change stamped after the snapshot finds it open, and keeps the
+    // state it replaces
+    __atomic_add_fetch(&openSnapshots, 1, __ATOMIC_SEQ_CST);
+    snapshot->stamp = __atomic_add_fetch(&snapshotClock, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_unlock(&snapshotMutex);
+}
+
+/**
+ * @brief Closes a snapshot, and frees the versions no open snapshot reads
+ */
+void close_snapshot(Snapshot *snapshot)
+{
+    Snapshot **s;
+    long oldest = LONG_MAX;
+    int i;
+
+    pthread_mutex_lock(&snapshotMutex);
+
+    for(s = &snapshots; *s != NULL; )
+    {
+        if(*s == snapshot)
+            *s = snapshot->next;
+        else
+        {
+            if((*s)->stamp < oldest)
+                oldest = (*s)->stamp;
+            s = &(*s)->next;
+        }
+    }
+    __atomic_sub_fetch(&openSnapshots, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_unlock(&snapshotMutex);
+
+    for(i=0; i<numberOfTables; i++)
+        if(allTables[i] != NULL)
+            collect_versions(allTables[i], oldest);
+}
+
+/**
+ * @brief Checks if the records of a table take more than its budget
+ */
+bool over_budget(HashTable *hashtable)
+{
+    long resident, spilled, lockWaits;
+    table_counts(hashtable, &resident, &spilled, &lockWaits);
+
+    return resident * (long) sizeof(struct storage_record) > hashtable->memoryBudget;
+}
+
+/**
+ * @brief Moves the value of a node to the spill file, and frees its record
+ *
+ * @param stripe The stripe of the node, held by the caller for writing
+ * @return Returns 0 on success, and -1 if the value could not be written
+ */
+int evict_node(HashTable *hashtable, Node *node, int stripe)
+{
+    int length = strlen(node->record->value) + 1;
+    long offset = spill_append(hashtable->spill, node->record->value, length);
+    if(offset < 0)
+        return -1;
+
+    node->offset = offset;
+    node->length = length;
+    node->version = node->record->metadata[0];
+    free(node->record);
+    node->record = NULL;
+
+    count_records(hashtable, stripe, -1, 1);
+
+    return 0;
+}
+
+/**
+ * @brief Spills records until the table fits in its memory budget
+ *
+ * @param heldStripe The stripe the caller holds for writing
+ *
+ * The hand of a clock goes round the buckets. A record that was used since
+ * the hand last passed it gets a second chance, so the records that are
+ * read and written the most stay in memory.
+ *
+ * Only one thread spills at a time. It skips the buckets whose stripe is
+ * busy, so it never waits for a lock while holding one.
+ */
+void enforce_budget(HashTable *hashtable, int heldStripe)
+{
+    if(hashtable->memoryBudget == 0 || hashtable->spill == NULL || !over_budget(hashtable))
+        return;
+
+    if(pthread_mutex_trylock(&hashtable->spillLock) != 0)
+        return;
+
+    // after two turns every reference bit is cleared
+    long steps = 2L * hashtable->size + 1;
+
+    while(over_budget(hashtable) && steps-- > 0)
+    {
+        int bucket = hashtable->clockHand;
+        int stripe = bucket % hashtable->nstripes;
+        bool failed = false;
+
+        hashtable->clockHand = (bucket + 1) % hashtable->size;
+
+        if(stripe != heldStripe && pthread_rwlock_trywrlock(&hashtable->stripes[stripe].lock) != 0)
+            continue;
+
+        Node* curr = hashtable->table[bucket];
+
+        while(curr != NULL && !failed && over_budget(hashtable))
+        {
+            if(curr->record != NULL)
+            {
+                if(curr->referenced)
+                    curr->referenced = 0;
+                else if(evict_node(hashtable, curr, stripe) != 0)
+                    failed = true;
+            }
+            curr = curr->next;
+        }
+
+        if(stripe != heldStripe)
+            pthread_rwlock_unlock(&hashtable->stripes[stripe].lock);
+
+        if(failed)
+            break;
+    }
+
+    pthread_mutex_unlock(&hashtable->spillLock);
+}
+
+/**
+ * @brief Moves a spilled record back to memory
+ *
+ * @param value The value read from the spill file
+ * @param heldStripe The stripe of the node, held by the caller for writing
+ *
+ * The record stays spilled if there is no memory for it.
+ */
+void promote_node(HashTable *hashtable, Node *node, char *value, int heldStripe)
+{
+    struct storage_record* r = malloc(sizeof(struct storage_record));
+    if(r == NULL)
+        return;
+
+    strncpy(r->value, value, sizeof r->value);
+    r->metadata[0] = node->version;
+    node->record = r;
+    node->referenced = 1;
+
+    count_records(hashtable, heldStripe, 1, -1);
+
+    enforce_budget(hashtable, heldStripe);
+}
+
+/**
+ * @brief Copies the record of a key into the provided record
+ *
+ * @param hashtable The pointer to the HashTable structure
+ * @param str The key provided by the user
+ * @param record_ Receives the value and version of the record
+ * @return Returns 0 if the key was found, and 1 otherwise
+ *
+ * A spilled value is read by the reader thread of the spill file, without
+ * holding the stripe, so the key is looked up again once the value has
+ * been read.
+ */
+int get_record(HashTable *hashtable, char *str, struct storage_record* record_)
+{
+    unsigned int hashval = hash(hashtable, str);
+
+    if(hashtable->engine != ENGINE_HASH)
+    {
+        int stripe = hashval % hashtable->nstripes;
+        int ret = 1;
+
+        if(!enter_storage(hashtable, stripe))
+            return 1;
+
+        if(hashtable->engine == ENGINE_LSM)
+            ret = lsm_get(hashtable->lsm, str, record_) == 0 ? 0 : 1;
+        else
+            ret = lf_get(hashtable->lf, str, record_) == 0 ? 0 : 1;
+        if(ret == 0)
+            client_version(hashtable, stripe, record_);
+
+        leave_storage(hashtable, stripe);
+        return ret;
+    }
+
+    lock_stripe(hashtable, hashval, false);
+
+    while(1)
+    {
+        Node* l = lookup_string(hashtable, str);
+        if(l == NULL || l->deleted)
+        {
+            unlock_stripe(hashtable, hashval);
+            return 1;
+        }
+
+        // other readers may set it too
+        __atomic_store_n(&l->referenced, 1, __ATOMIC_RELAXED);
+
+        if(l->record != NULL)
+        {
+            strncpy(record_->value, l->record->value, sizeof record_->value);
+            record_->metadata[0] = l->record->metadata[0];
+
+            unlock_stripe(hashtable, hashval);
+            return 0;
+        }
+
+        struct spill_read req;
+        long offset = l->offset;
+        int truncations = hashtable->truncations;
+        req.offset = offset;
+        req.length = l->length;
+        req.buf = record_->value;
+
+        unlock_stripe(hashtable, hashval);
+
+        spill_submit(hashtable->spill, &req);
+        if(spill_wait(hashtable->spill, &req) != 0)
+            return 1;
+
+        // the record may be moved back to memory, which changes the node
+        lock_stripe(hashtable, hashval, true);
+
+        // values are only appended until a TRUNCATE empties the file, so
+        // the same offset means the same value
+        l = lookup_string(hashtable, str);
+        if(l == NULL || l->deleted)
+        {
+            unlock_stripe(hashtable, hashval);
+            return 1;
+        }
+        if(l->record != NULL || l->offset != offset || hashtable->truncations != truncations)
+            continue;
+
+        record_->metadata[0] = l->version;
+
+        if(hashtable->promoteOnRead)
+            promote_node(hashtable, l, record_->value, hashval % hashtable->nstripes);
+
+        unlock_stripe(hashtable, hashval);
+        return 0;
+    }
+}
+
+/**
+ * @brief Inserts, modifies or deletes a key in its bucket
+ *
+ * @param hashval The bucket of the key, whose stripe the caller holds
+ *		 for writing
+ * @param stamp The stamp of the change, from change_stamp
+ * @return Returns the same codes as add_string
+ */
+int add_to_bucket(HashTable *hashtable, unsigned int hashval, char *str, 
+    struct storage_record* record_, long stamp)
+{
+    Node *new_list;
+    Node *current_list;
+    int stripe = hashval % hashtable->nstripes;
+
+    // DROP sets dropped while it holds every stripe, so a command that
+    // found the table before does not add records nothing frees
+    if(table_dropped(hashtable))
+        return 1;
+
+    __atomic_add_fetch(&hashtable->stripes[stripe].changes, 1, __ATOMIC_RELAXED);
+
+    /* Does item already exist? */
+    current_list = lookup_string(hashtable, str);
+    
+        /* item already exists, don't insert it again. */
+    if (current_list != NULL && !current_list->deleted)
+    {
+        // delete
+        if(record_ == NULL)
+        {
+            // the node stays in the list, so that inserting the key
+            // again continues from the next version
+            current_list->version = node_version(current_list) + 1;
+
+            if(current_list->record != NULL)
+                count_records(hashtable, stripe, -1, 0);
+            else
+                count_records(hashtable, stripe, 0, -1);
+
+            retire_state(hashtable, stripe, current_list, stamp);
+            current_list->deleted = 1;
+            current_list->stamp = stamp;
+
+            return 2;
+        }
+
+        // modify
+        else
+        {
+            // printf("have to modify\n");
+
+            int version = node_version(current_list);
+
+            if((record_->metadata[0] == version) || record_->metadata[0]==0)
+            {
+                record_->metadata[0] = version + 1;
+
+                if(current_list->record == NULL)
+                    count_records(hashtable, stripe, 1, -1);
+
+                retire_state(hashtable, stripe, current_list, stamp);
+                current_list->record = record_;
+                current_list->stamp = stamp;
+                current_list->referenced = 1;
+                index_node(hashtable, current_list);
+                enforce_budget(hashtable, stripe);
+
+                return 3;
+            }
+            else
+                return 4;
+        }
+    }
+
+    /* Insert into list */
+    if(record_ != NULL)
+    {
+        // a deleted key continues from the version kept in its node
+        if(current_list != NULL)
+        {
+            record_->metadata[0] = current_list->version;
+
+            retire_state(hashtable, stripe, current_list, stamp);
+            current_list->record = record_;
+            current_list->referenced = 1;
+            current_list->deleted = 0;
+            current_list->stamp = stamp;
+            index_node(hashtable, current_list);
+        }
+
+        else
+        {
+            // above every version the key had before a TRUNCATE
+            record_->metadata[0] = hashtable->versionFloor + 1;
+
+            /* Attempt to allocate memory for list */
+            if ((new_list = malloc(sizeof(Node))) == NULL)
+                return 1;
+
+            new_list->string = strdup(str);
+            new_list->record = record_;
+            new_list->referenced = 1;
+            new_list->deleted = 0;
+            new_list->stamp = stamp;
+            new_list->versions = NULL;
+            new_list->indexed = NULL;
+            new_list->id = -1;
+            new_list->listed = 0;
+            if(hashtable->versioned != NULL && number_node(hashtable, new_list) != 0)
+                fail_indexes(hashtable);
+            new_list->next = hashtable->table[hashval];
+            hashtable->table[hashval] = new_list;
+            index_node(hashtable, new_list);
+        }
+
+        count_records(hashtable, stripe, 1, 0);
+        enforce_budget(hashtable, stripe);
+	}
+
+	// the record to be deleted is not in the table
+	else
+	{
+		return 1;		
+	}
+
+
+    return 0;	// record inserted
+}
+
+/**
+ * @brief Inserts a string into the hash table
+ * 
+ * @return Returns 0 for success, 2 if it has deleted
+ * 		  the record, 3 if it must be modified, 4 if the version
+ * 		  did not match, and 1 otherwise or if it failed to
+ * 		  allocate memory
+ *
+ * Only the stripe of the bucket of the key is locked, so keys in
+ * other stripes can be changed at the same time.
+ */
+int add_string(HashTable *hashtable, char *str, struct storage_record* record_)
+{
+    unsigned int hashval = hash(hashtable, str);
+
+    // the tree copies the record, and keeps its own versions, and so does
+    // the lock-free table
+    if(hashtable->engine != ENGINE_HASH)
+    {
+        int stripe = hashval % hashtable->nstripes;
+        int ret = 1;
+
+        if(!enter_storage(hashtable, stripe))
+            return 1;
+
+        // counted in the stripe of the key, so the cores of a partitioned
+        // server do not all write one counter
+        __atomic_add_fetch(&hashtable->stripes[stripe].changes, 1, __ATOMIC_RELAXED);
+
+        storage_version(hashtable, record_);
+        if(hashtable->engine == ENGINE_LSM)
+            ret = lsm_set(hashtable->lsm, str, record_);
+        else
+            ret = lf_set(hashtable->lf, str, record_);
+        if(record_ != NULL && (ret == 0 || ret == 3))
+            client_version(hashtable, stripe, record_);
+
+        leave_storage(hashtable, stripe);
+        return ret;
+    }
+
+    lock_stripe(hashtable, hashval, true);
+    int ret = add_to_bucket(hashtable, hashval, str, record_, change_stamp());
+    unlock_stripe(hashtable, hashval);
+
+    return ret;
+}
+
+
+
+/**
+ * @brief Modifies a key of a table on the LSM or lock-free engine, only if
+ *	  the key exists and has the version in the record
+ *
+ * @return Returns 3 if the record was modified, 4 if the version did not
+ *	   match, and 1 if the key does not exist or the table was dropped
+ */
+int modify_storage(HashTable *hashtable, char *str, struct storage_record* record_)
+{
+    unsigned int hashval = hash(hashtable, str);
+    int stripe = hashval % hashtable->nstripes;
+    int ret;
+
+    if(!enter_storage(hashtable, stripe))
+        return 1;
+
+    __atomic_add_fetch(&hashtable->stripes[stripe].changes, 1, __ATOMIC_RELAXED);
+
+    storage_version(hashtable, record_);
+    if(hashtable->engine == ENGINE_LSM)
+        ret = lsm_modify(hashtable->lsm, str, record_);
+    else
+        ret = lf_modify(hashtable->lf, str, record_);
+    if(ret == 3)
+        client_version(hashtable, stripe, record_);
+
+    leave_storage(hashtable, stripe);
+    return ret;
+}
+
+
+
+/**
+ * @brief A key read or written by a transaction
+ *
+ * @param table The table of the key
+ * @param key The key
+ * @param hashval The bucket of the key
+ * @param version The version the transaction read, 0 if the key did not
+ *		 exist
+ * @param record The record written, or NULL if the key is deleted
+ */
+typedef struct _txn_key_t_ {
+    HashTable *table;
+    char key[MAX_KEY_LEN];
+    unsigned int hashval;
+    int version;
+    struct storage_record *record;
+} TxnKey;
+
+
+/**
+ * @brief A stripe locked by a transaction
+ */
+typedef struct _txn_stripe_t_ {
+    HashTable *table;
+    int stripe;
+} TxnStripe;
+
+
+/**
+ * @brief Orders stripes by table, then by index
+ */
+int compareTxnStripes(const void *a, const void *b)
+{
+    const TxnStripe *x = a, *y = b;
+
+    if(x->table != y->table)
+        return (uintptr_t) x->table < (uintptr_t) y->table ? -1 : 1;
+    return x->stripe - y->stripe;
+}
+
+
+/**
+ * @brief Finds a hash table by name
+ *
+ * @return Returns the table, or NULL if there is none
+ */
+HashTable *find_table(char *name)
+{
+    int i;
+
+    for(i=0; name != NULL && i<numberOfTables; i++)
+        if(allTables[i] != NULL && !table_dropped(allTables[i]) &&
+            strcmp(allTables[i]->name, name)==0)
+            return allTables[i];
+
+    return NULL;
+}
+
+
+/**
+ * @brief Validates the reads of a transaction, and applies its writes
+ *
+ * @param cmdSave The rest of the COMMIT command: the number of reads, the
+ *		 number of writes, then "table;key;version" for every read and
+ *		 "table;key;value" for every write. A value of deleteRecord
+ *		 deletes the key.
+ * @return Returns the reply to the client
+ *
+ * The stripes of all the keys are locked together, in the order of
+ * compareTxnStripes so that two commits never wait for each other. The
+ * commit is aborted if a key read has changed since, and otherwise every
+ * write is applied, with one stamp, before any stripe is unlocked.
+ */
+char *commit_transaction(char **cmdSave)
+{
+    TxnKey keys[2 * MAX_TXN_KEYS];
+    TxnStripe stripes[2 * MAX_TXN_KEYS];
+    char *committed = "transactionCommitted\n";
+    char *reply = committed;
+    int nkeys = 0, nstripes = 0;
+    int i, j;
+
+    char *tok = strtok_r(NULL, ";", cmdSave);
+    int nreads = tok ? atoi(tok) : -1;
+    tok = strtok_r(NULL, ";", cmdSave);
+    int nwrites = tok ? atoi(tok) : -1;
+
+    if(nreads < 0 || nreads > MAX_TXN_KEYS || nwrites < 0 || nwrites > MAX_TXN_KEYS)
+        return "invalidParameter\n";
+
+    for(i=0; i<nreads + nwrites; i++)
+    {
+        TxnKey *k = &keys[i];
+        char *table = strtok_r(NULL, ";", cmdSave);
+        char *key = strtok_r(NULL, ";", cmdSave);
+        char *arg = strtok_r(NULL, ";", cmdSave);
+
+        k->table = find_table(table);
+        k->record = NULL;
+
+        if(key == NULL || arg == NULL || strlen(key) >= MAX_KEY_LEN)
+        {
+            reply = "invalidParameter\n";
+            break;
+        }
+        if(k->table == NULL)
+        {
+            reply = "tableNotFound\n";
+            break;
+        }
+
+        // the other engines can not lock several keys together
+        if(k->table->engine != ENGINE_HASH)
+        {
+            reply = "invalidParameter\n";
+            break;
+        }
+
+        strncpy(k->key, key, sizeof k->key);
+        k->hashval = hash(k->table, key);
+        k->version = atoi(arg);
+        nkeys++;
+
+        if(i < nreads || strcmp(arg, "deleteRecord") == 0)
+            continue;
+
+        char schema[MAX_CONFIG_LINE_LEN];
+        char value[MAX_VALUE_LEN];
+
+        strncpy(schema, k->table->schema, sizeof schema);
+        schema[strlen(schema)-1] = '\0';
+        format(arg, value);
+
+        k->record = malloc(sizeof(struct storage_record));
+        if(parser(schema, arg) == 1 || k->record == NULL)
+        {
+            reply = "invalidParameter\n";
+            break;
+        }
+
+        strncpy(k->record->value, value, sizeof k->record->value);
+        k->record->metadata[0] = 0;
+    }
+
+    // a key is written once, and every stripe is locked once
+    for(i=nreads; i<nkeys; i++)
+        for(j=nreads; j<i; j++)
+            if(keys[i].table == keys[j].table && strcmp(keys[i].key, keys[j].key) == 0)
+                reply = "invalidParameter\n";
+
+    if(nkeys == nreads + nwrites && reply == committed)
+    {
+        for(i=0; i<nkeys; i++)
+        {
+            stripes[nstripes].table = keys[i].table;
+            stripes[nstripes].stripe = keys[i].hashval % keys[i].table->nstripes;
+            nstripes++;
+        }
+        qsort(stripes, nstripes, sizeof stripes[0], compareTxnStripes);
+
+        for(i=0, j=0; i<nstripes; i++)
+            if(i == 0 || compareTxnStripes(&stripes[i], &stripes[j-1]) != 0)
+                stripes[j++] = stripes[i];
+        nstripes = j;
+
+        for(i=0; i<nstripes; i++)
+            lock_stripe(stripes[i].table, stripes[i].stripe, true);
+
+        for(i=0; i<nkeys; i++)
+        {
+            Node *node = lookup_string(keys[i].table, keys[i].key);
+            bool exists = node != NULL && !node->deleted;
+
+            if(i < nreads && keys[i].version != (exists ? node_version(node) : 0))
+                reply = "transactionAborted\n";
+
+            // a write can not fail once the first one is applied
+            if(i >= nreads && keys[i].record == NULL && !exists)
+                reply = "recordNotFound\n";
+        }
+
+        if(reply == committed)
+        {
+            long stamp = change_stamp();
+
+            for(i=nreads; i<nkeys; i++)
+            {
+                int ret = add_to_bucket(keys[i].table, keys[i].hashval, keys[i].key, 
+                    keys[i].record, stamp);
+
+                // the record is kept by the table
+                if(ret == 0 || ret == 3)
+                    keys[i].record = NULL;
+            }
+        }
+
+        for(i=nstripes-1; i>=0; i--)
+            unlock_stripe(stripes[i].table, stripes[i].stripe);
+    }
+
+    for(i=nreads; i<nkeys; i++)
+        free(keys[i].record);
+
+    return reply;
+}
+
+
+/**
+ * @brief Finds a column in a value
+ *
+ * @param value The value, "column value,column value,..."
+ * @return Returns where the value of the column starts, after the space
+ *		 that follows its name, or NULL if there is no such column
+ */
+char *find_column(char *value, char *column)
+{
+    size_t len = strlen(column);
+    char *field = value;
+
+    while(field != NULL)
+    {
+        while(*field == ' ')
+            field++;
+        if(strncmp(field, column, len) == 0 && field[len] == ' ')
+            return field + len + 1;
+
+        field = strchr(field, ',');
+        if(field != NULL)
+            field++;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Replaces the value of a column in a value
+ *
+ * @param at Where the value of the column starts, from find_column
+ * @param text The new value of the column
+ * @return Returns 0 on success, and 1 if the value would be too long
+ */
+int replace_column(char *value, char *at, const char *text)
+{
+    char rest[MAX_VALUE_LEN];
+    char *end = strchr(at, ',');
+
+    strncpy(rest, end != NULL ? end : "", sizeof rest);
+
+    size_t room = MAX_VALUE_LEN - (at - value);
+    return snprintf(at, room, "%s%s", text, rest) >= room;
+}
+
+
+/**
+ * @brief An operator on an int column: INCR, DECR, MIN or MAX
+ *
+ * @param column The column
+ * @param op The command of the operator
+ * @param operand The operand
+ * @param result Receives the new value of the column
+ */
+typedef struct _int_op_t_ {
+    char *column;
+    char *op;
+    long operand;
+    long result;
+} IntOp;
+
+
+/**
+ * @brief Runs an operator on an int column of a value
+ *
+ * @param arg The IntOp
+ * @return Returns 0 on success, and 1 if the column is not an int column
+ *		 of the value or the result does not fit in an int
+ */
+int apply_int_op(char *value, char *schema, void *arg)
+{
+    IntOp *op = arg;
+    int size;
+    const char *type = column_type(schema, op->column, &size);
+    char *at = find_column(value, op->column);
+
+    if(type == NULL || strcmp(type, "int") != 0 || at == NULL)
+        return 1;
+
+    char *end;
+    long current = strtol(at, &end, 10);
+    if(end == at)
+        return 1;
+
+    if(strcmp(op->op, "INCR") == 0)
+        op->result = current + op->operand;
+    else if(strcmp(op->op, "DECR") == 0)
+        op->result = current - op->operand;
+    else if(strcmp(op->op, "MIN") == 0)
+        op->result = current < op->operand ? current : op->operand;
+    else
+        op->result = current > op->operand ? current : op->operand;
+
+    if(op->result < INT_MIN || op->result > INT_MAX)
+        return 1;
+
+    char text[32];
+    snprintf(text, sizeof text, "%ld", op->result);
+    return replace_column(value, at, text);
+}
+
+
+/**
+ * @brief Sets some columns of a value
+ *
+ * @param value The value, or NULL to only check the columns
+ * @param arg The columns to set, "column value,column value,...", in any
+ *		 order
+ * @return Returns 0 on success, and 1 if a column is not in the schema,
+ *		 a new value does not fit its column, or the value would be
+ *		 too long
+ *
+ * Every new value is checked against the schema like the values of SET,
+ * and only the columns given are rewritten.
+ */
+int update_columns(char *value, char *schema, void *arg)
+{
+    char copy[MAX_VALUE_LEN];
+    char *save, *field;
+
+    if(strlen(arg) >= sizeof copy)
+        return 1;
+    strcpy(copy, arg);
+
+    for(field = strtok_r(copy, ",", &save); field != NULL; field = strtok_r(NULL, ",", &save))
+    {
+        if(field[strspn(field, " ")] == '\0')
+            return 1;
+
+        char *column = trimXX(field);
+        char *text = strchr(column, ' ');
+        int size;
+
+        if(text == NULL)
+            return 1;
+        *text++ = '\0';
+        text = trimXX(text);
+
+        const char *type = column_type(schema, column, &size);
+        char *at = value != NULL ? find_column(value, column) : NULL;
+        if(type == NULL || (value != NULL && at == NULL) || *text == '\0')
+            return 1;
+
+        if(strcmp(type, "int") == 0 && isNum(text) != 0)
+            return 1;
+
+        if(strcmp(type, "char") == 0)
+        {
+            char *c;
+            if(strlen(text) > size)
+                return 1;
+            for(c = text; *c != '\0'; c++)
+                if(!isalnum(*c) && *c != ' ')
+                    return 1;
+        }
+
+        if(value != NULL && replace_column(value, at, text) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Changes the value of a record, as one change
+ *
+ * @param change Changes the value given to it, and returns 0 on success
+ * @param arg Passed to change
+ * @param expected The version the record must have, or 0 for any
+ * @param version Receives the new version of the record
+ * @return Returns 0 on success, 1 if the key is not found, 2 if change
+ *		 fails, and 4 if the version did not match
+ *
+ * A record of a hash table is changed under the lock of its stripe, in
+ * place unless a snapshot may read it. The other engines read the record,
+ * and modify it only if it still has the version read, until no other
+ * change comes in between. A key deleted since it was read is not written
+ * again.
+ */
+int change_record(HashTable *hashtable, char *key, int (*change)(char *, char *, void *),
+    void *arg, int expected, int *version)
+{
+    struct storage_record r;
+
+    if(hashtable->engine != ENGINE_HASH)
+    {
+        while(1)
+        {
+            if(get_record(hashtable, key, &r) != 0)
+                return 1;
+
+            if(expected != 0 && r.metadata[0] != expected)
+                return 4;
+
+            if(change(r.value, hashtable->schema, arg) != 0)
+                return 2;
+
+            *version = r.metadata[0] + 1;
+
+            int ret = modify_storage(hashtable, key, &r);
+            if(ret == 3)
+                return 0;
+
+            // the key was deleted since it was read
+            if(ret != 4)
+                return 1;
+        }
+    }
+
+    unsigned int hashval = hash(hashtable, key);
+    int stripe = hashval % hashtable->nstripes;
+    int ret = 2;
+
+    lock_stripe(hashtable, hashval, true);
+
+    Node *node = lookup_string(hashtable, key);
+    if(node == NULL || node->deleted)
+    {
+        unlock_stripe(hashtable, hashval);
+        return 1;
+    }
+
+    if(expected != 0 && node_version(node) != expected)
+    {
+        unlock_stripe(hashtable, hashval);
+        return 4;
+    }
+
+    if(node->record != NULL)
+        r = *node->record;
+    else if(spill_read(hashtable->spill, node->offset, node->length, r.value) == 0)
+        r.metadata[0] = node->version;
+    else
+    {
+        unlock_stripe(hashtable, hashval);
+        return 2;
+    }
+
+    if(change(r.value, hashtable->schema, arg) == 0)
+    {
+        long stamp = change_stamp();
+
+        // no snapshot reads the record or its earlier versions
+        if(stamp == 0 && node->record != NULL)
+        {
+            __atomic_add_fetch(&hashtable->stripes[stripe].changes, 1, __ATOMIC_RELAXED);
+            free_versions(hashtable, stripe, node, node->versions);
+            unindex_bitmaps(hashtable, node);
+            unindex(hashtable, node->string, node->indexed);
+            node->versions = NULL;
+            node->indexed = NULL;
+            node->stamp = 0;
+            node->referenced = 1;
+            strncpy(node->record->value, r.value, sizeof node->record->value);
+            node->record->metadata[0]++;
+            index_node(hashtable, node);
+            ret = 0;
+        }
+        else
+        {
+            struct storage_record *record = malloc(sizeof r);
+            if(record != NULL)
+            {
+                *record = r;
+                if(add_to_bucket(hashtable, hashval, key, record, stamp) == 3)
+                    ret = 0;
+                else
+                    free(record);
+            }
+        }
+
+        *version = r.metadata[0] + 1;
+    }
+
+    unlock_stripe(hashtable, hashval);
+    return ret;
+}
+
+
+/**
+ * @brief Frees the values of a state of a key, as added to the indexes
+ */
+void free_indexed(IndexValue *indexed, int nindexes)
+{
+    int i;
+
+    for(i=0; indexed != NULL && i<nindexes; i++)
+        free(indexed[i].text);
+    free(indexed);
+}
+
+
+/**
+ * @brief Frees every node of a bucket array, with its earlier states
+ *
+ * @param nindexes The number of indexes of the table, whose values the
+ *		 states keep
+ *
+ * Nothing else may use the buckets, so no lock is taken and the indexes
+ * are left as they are.
+ */
+void free_buckets(Node **table, int size, int nindexes)
+{
+    int i;
+
+    for(i=0; i<size; i++)
+    {
+        Node *list = table[i];
+
+        while(list != NULL)
+        {
+            Node *temp = list;
+            Version *version = temp->versions;
+
+            list = list->next;
+
+            while(version != NULL)
+            {
+                Version *older = version->older;
+                free_indexed(version->indexed, nindexes);
+                free(version->record);
+                free(version);
+                version = older;
+            }
+
+            free_indexed(temp->indexed, nindexes);
+            free(temp->string);
+            free(temp->record);
+            free(temp);
+        }
+    }
+}
+
+
+/**
+ * @brief Frees the indexes of a table
+ */
+void free_indexes(Index *indexes, int nindexes)
+{
+    int i;
+
+    for(i=0; i<nindexes; i++)
+    {
+        btree_destroy(indexes[i].tree);
+        hindex_destroy(indexes[i].hash);
+        bitmap_index_destroy(indexes[i].bitmap);
+    }
+}
+
+
+/**
+* @brief Deletes the hash table
+*
+* @param hashtable Is the pointer to the HashTable structure
+*/
+void free_table(HashTable *hashtable)
+{
+    int i;
+
+    if (hashtable==NULL) return;
+
+    lsm_close(hashtable->lsm);
+    lf_destroy(hashtable->lf);
+    spill_close(hashtable->spill);
+
+    /* Free the memory for every item in the table, including the 
+     * strings themselves.
+     */
+    free_buckets(hashtable->table, hashtable->size, hashtable->nindexes);
+    free_indexes(hashtable->indexes, hashtable->nindexes);
+
+    roaring_destroy(hashtable->versioned);
+    free(hashtable->stats);
+    free(hashtable->nodes);
+    pthread_rwlock_destroy(&hashtable->nodesLock);
+    pthread_mutex_destroy(&hashtable->versionedLock);
+
+    for(i=0; i<hashtable->nstripes; i++)
+        pthread_rwlock_destroy(&hashtable->stripes[i].lock);
+    pthread_mutex_destroy(&hashtable->spillLock);
+
+    /* Free the table itself */
+    free(hashtable->stripes);
+    free(hashtable->table);
+    free(hashtable);
+}
+
+
+/**
+ * @brief Helper function that prints the list that the index points to
+ *
+ * @param head Pointer that points to top of the Node list
+ */
+void printList(Node* head)
+{
+    Node* curr = head;
+    int i=0;
+    while(curr!=NULL)
+    {
+        if(curr->deleted)
+            ;
+        else if(curr->record != NULL)
+            printf("%s,%s-->", curr->string, curr->record->value);
+        else
+            printf("%s,(spilled)-->", curr->string);
+        curr = curr->next;
+    }
+    printf("\n");
+}
+
+
+/**
+ * @brief prints all records in the hashtable
+ * 
+ * @param hashTable_ Is a pointer to the Hashtable structure
+ */
+void printAllRecords(HashTable* hashTable_)
+{
+    int len = hashTable_->size;
+    // printf("%d\n", len);
+    int i;
+    
+    Node* head;
+
+    for(i=0; i<len; i++)
+    {
+        head = hashTable_->table[i];
+        // printf("%d: ", i);
+        if(head!=NULL)
+        	printList(head);
+    }
+}
+
+
+/**
+ * @brief Finds the state of a key that a snapshot reads
+ *
+ * @param snapshot The snapshot, or NULL for the current state
+ * @param version Receives the earlier state read by the snapshot, or NULL
+ *		 if it reads the current state of the node
+ * @return Returns false if the key does not exist in the snapshot
+ */
+bool snapshot_state(Node* node, Snapshot* snapshot, Version** version)
+{
+    *version = NULL;
+
+    if(snapshot == NULL || node->stamp < snapshot->stamp)
+        return !node->deleted;
+
+    for(*version = node->versions; *version != NULL; *version = (*version)->older)
+        if((*version)->begin < snapshot->stamp)
+            return !(*version)->deleted;
+
+    // the key was made after the snapshot
+    return false;
+}
+
+
+/**
+ * @brief Reads the record of a state of a key
+ *
+ * @param version The earlier state, or NULL for the current state of the
+ *		 node
+ * @param buf Receives a spilled value
+ * @param record Receives the record, in buf or in the state
+ * @return Returns 0 on success, and -1 if a spilled value could not be
+ *		 read
+ *
+ * Called with the stripe of the key held.
+ */
+int read_state(HashTable* hashtable, Node* node, Version* version, 
+    struct storage_record* buf, struct storage_record** record)
+{
+    *record = version ? version->record : node->record;
+
+    if(*record == NULL)
+    {
+        long offset = version ? version->offset : node->offset;
+        int length = version ? version->length : node->length;
+
+        if(spill_read(hashtable->spill, offset, length, buf->value) != 0)
+            return -1;
+        buf->metadata[0] = version ? version->version : node->version;
+        *record = buf;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Calls visit for the records in some buckets of a hash table
+ *
+ * @param first The first bucket
+ * @param end The bucket after the last one
+ * @return Returns 0 on success, and -1 if a record could not be read
+ */
+int scan_buckets(HashTable* hashtable, Snapshot* snapshot, int first, int end,
+    lsm_visit_fn visit, void* arg)
+{
+    struct storage_record r;
+    int i;
+    int ret = 0;
+    bool stop = false;
+
+    for(i=first; i<end && !stop; i++)
+    {
+        Node* curr;
+
+        lock_stripe(hashtable, i, false);
+
+        for(curr = hashtable->table[i]; curr != NULL && !stop; curr = curr->next)
+        {
+            Version* version;
+
+            struct storage_record* record;
+
+            if(!snapshot_state(curr, snapshot, &version))
+                continue;
+
+            if(read_state(hashtable, curr, version, &r, &record) != 0)
+            {
+                ret = -1;
+                stop = true;
+                break;
+            }
+
+            if(visit(curr->string, record, arg) != 0)
+                stop = true;
+        }
+
+        unlock_stripe(hashtable, i);
+    }
+
+    return ret;
+}
+
+
+/**
+ * @brief Calls visit for every record of a table
+ *
+ * @param snapshot The snapshot the records of a hash table are read at,
+ *		 or NULL for their current values. The LSM and lock-free
+ *		 engines always read the current values.
+ * @return Returns 0 on success, and -1 if a record could not be read
+ *
+ * Spilled values are read back from the spill file, but stay spilled.
+ */
+int scan_table(HashTable* hashtable, Snapshot* snapshot, lsm_visit_fn visit, void* arg)
+{
+    if(hashtable->engine == ENGINE_LSM)
+        return lsm_scan(hashtable->lsm, visit, arg);
+
+    if(hashtable->engine == ENGINE_LOCKFREE)
+        return lf_scan(hashtable->lf, visit, arg);
+
+    return scan_buckets(hashtable, snapshot, 0, hashtable->size, visit, arg);
+}
+
+
+/**
+ * @brief The keys found in an index, in a growing array
+ */
+typedef struct _key_list_t_ {
+    char (*keys)[MAX_KEY_LEN + 1];
+    int count;
+    int capacity;
+    int failed;
+} KeyList;
+
+
+/**
+ * @brief Called by hindex_lookup for every key having the value
+ */
+int collectKey(const char* key, void* arg)
+{
+    KeyList* list = arg;
+
+    if(list->count == list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        void* keys = realloc(list->keys, capacity * sizeof *list->keys);
+        if(keys == NULL)
+        {
+            list->failed = 1;
+            return 1;
+        }
+        list->keys = keys;
+        list->capacity = capacity;
+    }
+
+    strncpy(list->keys[list->count], key, sizeof list->keys[0]);
+    list->keys[list->count][MAX_KEY_LEN] = '\0';
+    list->count++;
+
+    return 0;
+}
+
+
+/**
+ * @brief Called by btree_range for every key in the range
+ */
+int collectRangeKey(long value, const char* key, void* arg)
+{
+    return collectKey(key, arg);
+}
+
+
+int compareKeys(const void* a, const void* b)
+{
+    return strcmp(a, b);
+}
+
+
+/**
+ * @brief Finds an index on a column
+ *
+ * @return Returns the index, or NULL if the column is not indexed or its
+ *		 index can not be used
+ */
+Index* find_index(HashTable* hashtable, char* column)
+{
+    int i;
+
+    for(i=0; i<hashtable->nindexes; i++)
+    {
+        Index* index = &hashtable->indexes[i];
+
+        if(strcmp(index->column, column) == 0)
+            return __atomic_load_n(&index->failed, __ATOMIC_RELAXED) ? NULL : index;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Calls visit for the records of a table whose indexed column may
+ * match a predicate
+ *
+ * @param snapshot The snapshot the records are read at
+ * @param low The smallest value of an int column
+ * @param high The largest value of an int column
+ * @param text The value of a char column
+ * @return Returns 0 on success, and -1 if the keys or a record could not
+ *		 be read
+ *
+ * The index also holds the values of the earlier states kept for the
+ * snapshots, so a record is visited if any of its states matches, and
+ * the caller checks the state the snapshot reads. The keys are gathered
+ * first, so no stripe is locked while the index is.
+ */
+int index_scan(HashTable* hashtable, Snapshot* snapshot, Index* index, long low, long high, 
+    char* text, lsm_visit_fn visit, void* arg)
+{
+    KeyList list = { NULL, 0, 0, 0 };
+    struct storage_record r;
+    int ret = 0;
+    int i;
+
+    if(index->tree != NULL)
+        btree_range(index->tree, low, high, collectRangeKey, &list);
+    else
+        hindex_lookup(index->hash, text, collectKey, &list);
+
+    if(list.failed)
+    {
+        free(list.keys);
+        return -1;
+    }
+
+    // a key is in the index once for every state that matches
+    if(list.count > 1)
+        qsort(list.keys, list.count, sizeof *list.keys, compareKeys);
+
+    for(i=0; i<list.count && ret == 0; i++)
+    {
+        if(i > 0 && strcmp(list.keys[i], list.keys[i-1]) == 0)
+            continue;
+
+        unsigned int hashval = hash(hashtable, list.keys[i]);
+        Version* version;
+        struct storage_record* record;
+
+        lock_stripe(hashtable, hashval, false);
+
+        Node* node = lookup_string(hashtable, list.keys[i]);
+        if(node != NULL && snapshot_state(node, snapshot, &version))
+        {
+            if(read_state(hashtable, node, version, &r, &record) != 0)
+                ret = -1;
+            else if(visit(node->string, record, arg) != 0)
+                ret = 1;
+        }
+
+        unlock_stripe(hashtable, hashval);
+    }
+
+    free(list.keys);
+    return ret < 0 ? -1 : 0;
+}
+
+
+/**
+ * @brief The records checked by a QUERY, and the keys that match
+ *
+ * @param preds The predicates, in the order they are checked
+ * @param numeric Set for the predicates on int columns
+ * @param keys The matching keys, separated by spaces
+ * @param found The number of matching keys
+ * @param limit The most keys kept
+ * @param countAll Set if the keys past the limit are counted, and
+ *		  otherwise the records stop being read at the limit
+ * @param records Set to keep every key with its value, one per line
+ * @param projection The columns of the values kept, or NULL for all of
+ *		     them
+ * @param last The last key kept
+ * @param visit Called for every match instead of keeping its key, if
+ *		set. It returns 0 to go on, 1 to stop, and -1 if it fails.
+ * @param visitArg Passed to visit
+ * @param failed Set if a record or a key could not be read or kept
+ */
+typedef struct _query_match_t_ {
+    HashTable* hashtable;
+    Snapshot* snapshot;
+    Predicates* preds;
+    int count;
+    int* numeric;
+    char* keys;
+    size_t len;
+    size_t capacity;
+    long found;
+    long limit;
+    int countAll;
+    int records;
+    Projection* projection;
+    char last[MAX_KEY_LEN + 1];
+    lsm_visit_fn visit;
+    void* visitArg;
+    int failed;
+} QueryMatch;
+
+
+/**
+ * @brief Checks a predicate of a QUERY against a record
+ *
+ * A missing int column counts as 0, and a missing char column as "", like
+ * the indexes count them.
+ */
+bool match_predicate(char* value, Predicates* pred, int numeric)
+{
+    if(numeric)
+    {
+        char* at = find_column(value, pred->name_);
+        int v = at != NULL ? atoi(at) : 0;
+        int p = atoi(pred->value_);
+
+        return pred->operator_ == '=' ? v == p : pred->operator_ == '<' ? v < p : v > p;
+    }
+
+    char text[MAX_VALUE_LEN + 1];
+    column_text(value, pred->name_, text, sizeof text);
+
+    return strcmp(text, pred->value_) == 0;
+}
+
+
+/**
+ * @brief Adds a key to the matches of a QUERY, with its value if they keep
+ * the records
+ *
+ * @param value The value of the record, which is projected here
+ * @return Returns 0 on success, and -1 if there is no memory
+ */
+int keep_key(QueryMatch* match, const char* key, char* value)
+{
+    char projected[MAX_VALUE_LEN];
+
+    if(match->records && match->projection != NULL)
+    {
+        project_value(match->projection, value, projected, sizeof projected);
+        value = projected;
+    }
+
+    size_t len = strlen(key);
+    size_t valueLen = match->records ? strlen(value) + 1 : 0;
+
+    if(match->len + len + valueLen + 2 > match->capacity)
+    {
+        size_t capacity = (match->len + len + valueLen + 2) * 2;
+        char* keys = realloc(match->keys, capacity);
+
+        if(keys == NULL)
+        {
+            match->failed = 1;
+            return -1;
+        }
+        match->keys = keys;
+        match->capacity = capacity;
+    }
+
+    if(match->len > 0)
+        match->keys[match->len++] = match->records ? '\n' : ' ';
+    memcpy(match->keys + match->len, key, len + 1);
+    match->len += len;
+
+    if(match->records)
+    {
+        match->keys[match->len] = ' ';
+        memcpy(match->keys + match->len + 1, value, valueLen);
+        match->len += valueLen;
+    }
+
+    strncpy(match->last, key, sizeof match->last - 1);
+    return 0;
+}
+
+
+/**
+ * @brief Called for every record a plan reads, which is kept if it matches
+ * every predicate
+ */
+int matchRecord(const char* key, struct storage_record* record, void* arg)
+{
+    QueryMatch* match = arg;
+    int i;
+
+    for(i=0; i<match->count; i++)
+    {
+        if(!match_predicate(record->value, &match->preds[i], match->numeric[i]))
+            return 0;
+    }
+
+    if(match->visit != NULL)
+    {
+        match->found++;
+        int ret = match->visit(key, record, match->visitArg);
+        if(ret < 0)
+            match->failed = 1;
+        return ret != 0;
+    }
+
+    if(match->found >= match->limit)
+    {
+        if(!match->countAll)
+            return 1;
+        match->found++;
+        return 0;
+    }
+
+    if(keep_key(match, key, record->value) != 0)
+        return 1;
+    match->found++;
+
+    return match->found >= match->limit && !match->countAll;
+}
+
+
+/**
+ * @brief Called by roaring_iterate for every id left by the bitmaps
+ */
+int matchBitmapRecord(uint32_t id, void* arg)
+{
+    QueryMatch* match = arg;
+    HashTable* hashtable = match->hashtable;
+    Node* node = NULL;
+
+    pthread_rwlock_rdlock(&hashtable->nodesLock);
+    if(id < (uint32_t) hashtable->nnodes)
+        node = hashtable->nodes[id];
+    pthread_rwlock_unlock(&hashtable->nodesLock);
+
+    if(node == NULL)
+        return 0;
+
+    unsigned int hashval = hash(hashtable, node->string);
+    struct storage_record r;
+    struct storage_record* record;
+    Version* version;
+
+    int stop = 0;
+
+    lock_stripe(hashtable, hashval, false);
+
+    if(snapshot_state(node, match->snapshot, &version))
+    {
+        if(read_state(hashtable, node, version, &r, &record) != 0)
+            match->failed = 1;
+        else
+            stop = matchRecord(node->string, record, match);
+    }
+
+    unlock_stripe(hashtable, hashval);
+    return stop || match->failed;
+}
+
+
+#define STATS_MIN_CHANGES 64	///< Changes to a table before its statistics are gathered again.
+#define INDEX_ROW_COST 4	///< The cost of a record read through an index; a scanned record costs 1.
+
+// The ways a plan reads the records of a table.
+#define PLAN_SCAN	0	///< Every record of the table.
+#define PLAN_INDEX	1	///< The records an ordered or hash index finds for a predicate.
+#define PLAN_BITMAP	2	///< The records left by intersecting bitmap indexes.
+#define PLAN_ORDERED	3	///< Every record, in the order of the ordered index of the ORDER BY column.
+
+
+/**
+ * @brief How a QUERY reads a table, and what it is estimated to cost
+ *
+ * @param preds The predicates, the most selective first, which is the
+ *		 order they are checked in
+ * @param numeric Set for the predicates on int columns
+ * @param rows The number of records each predicate is estimated to match
+ * @param access How the records are read, one of the PLAN_* values
+ * @param driver The predicate whose index is read, for PLAN_INDEX
+ * @param bitmaps The predicates whose bitmaps are intersected, the
+ *		 smallest first, for PLAN_BITMAP
+ * @param records The number of records of the table
+ * @param cost The estimated cost of reading the records
+ * @param estimate The estimated number of matching records
+ * @param orderBy The column the matches are ordered by, or "" if they
+ *		  are not
+ * @param orderNumeric Set if it is an int column
+ * @param descending Set to order the largest values first
+ * @param limit The most matches kept
+ */
+typedef struct _query_plan_t_ {
+    int count;
+    Predicates preds[MAX_QUERY_PREDICATES];
+    int numeric[MAX_QUERY_PREDICATES];
+    double rows[MAX_QUERY_PREDICATES];
+    int access;
+    int driver;
+    int nbitmaps;
+    int bitmaps[MAX_QUERY_PREDICATES];
+    long records;
+    double cost;
+    double estimate;
+    char orderBy[MAX_COLNAME_LEN + 1];
+    int orderNumeric;
+    int descending;
+    long limit;
+} QueryPlan;
+
+
+/**
+ * @brief The values of every column, gathered by analyze_table
+ *
+ * A char value is kept as its hash, which is enough to count the distinct
+ * values.
+ */
+typedef struct _column_values_t_ {
+    TableStats* stats;
+    long* values[MAX_COLUMNS_PER_TABLE];
+    long count;
+    long capacity;
+    int failed;
+} ColumnValues;
+
+
+/**
+ * @brief Called by scan_table for every record analyzed
+ */
+int gatherValues(const char* key, struct storage_record* record, void* arg)
+{
+    ColumnValues* gathered = arg;
+    TableStats* stats = gathered->stats;
+    int i;
+
+    if(gathered->count == gathered->capacity)
+    {
+        long capacity = gathered->capacity ? gathered->capacity * 2 : 1024;
+
+        for(i=0; i<stats->ncolumns; i++)
+        {
+            long* values = realloc(gathered->values[i], capacity * sizeof *values);
+            if(values == NULL)
+            {
+                gathered->failed = 1;
+                return 1;
+            }
+            gathered->values[i] = values;
+        }
+        gathered->capacity = capacity;
+    }
+
+    for(i=0; i<stats->ncolumns; i++)
+    {
+        ColumnStats* column = &stats->columns[i];
+        long value;
+
+        if(column->numeric)
+        {
+            char* at = find_column(record->value, column->column);
+            value = at != NULL ? atoi(at) : 0;
+        }
+        else
+        {
+            char text[MAX_VALUE_LEN + 1];
+            unsigned long h = 14695981039346656037UL;
+            char* c;
+
+            column_text(record->value, column->column, text, sizeof text);
+            for(c = text; *c != '\0'; c++)
+                h = (h ^ (unsigned char) *c) * 1099511628211UL;
+            value = (long) h;
+        }
+
+        gathered->values[i][gathered->count] = value;
+    }
+
+    gathered->count++;
+    return 0;
+}
+
+
+int compareLongs(const void* a, const void* b)
+{
+    long x = *(const long*) a;
+    long y = *(const long*) b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+/**
+ * @brief Gathers the statistics of the columns of a table
+ *
+ * @return Returns 0 on success, and -1 if the table could not be read,
+ *		 in which case the earlier statistics are kept
+ *
+ * The current records are read, so the statistics are the same for every
+ * snapshot.
+ */
+int analyze_table(HashTable* hashtable)
+{
+    TableStats* stats = calloc(1, sizeof(TableStats));
+    ColumnValues gathered;
+    char copy[MAX_CONFIG_LINE_LEN];
+    char *save, *tok;
+    int i;
+
+    if(stats == NULL)
+        return -1;
+
+    memset(&gathered, 0, sizeof gathered);
+    gathered.stats = stats;
+    stats->changes = table_changes(hashtable);
+
+    // the schema is "column type [length] column type [length] ..."
+    strncpy(copy, hashtable->schema, sizeof copy);
+    copy[sizeof copy - 1] = '\0';
+
+    for(tok = strtok_r(copy, " ", &save); tok != NULL && stats->ncolumns < MAX_COLUMNS_PER_TABLE;
+        tok = strtok_r(NULL, " ", &save))
+    {
+        char* type = strtok_r(NULL, " ", &save);
+
+        if(type == NULL)
+            break;
+        if(strcmp(type, "char") == 0 && strtok_r(NULL, " ", &save) == NULL)
+            break;
+
+        strncpy(stats->columns[stats->ncolumns].column, tok, MAX_COLNAME_LEN);
+        stats->columns[stats->ncolumns].numeric = strcmp(type, "int") == 0;
+        stats->ncolumns++;
+    }
+
+    int ret = scan_table(hashtable, NULL, gatherValues, &gathered);
+    if(ret == 0 && gathered.failed)
+        ret = -1;
+
+    stats->records = gathered.count;
+
+    for(i=0; i<stats->ncolumns && ret == 0; i++)
+    {
+        ColumnStats* column = &stats->columns[i];
+        long* values = gathered.values[i];
+        long n = gathered.count;
+        long j;
+
+        if(n == 0)
+            continue;
+
+        qsort(values, n, sizeof *values, compareLongs);
+
+        column->distinct = 1;
+        for(j=1; j<n; j++)
+        {
+            if(values[j] != values[j-1])
+                column->distinct++;
+        }
+
+        if(!column->numeric)
+            continue;
+
+        column->min = values[0];
+        column->max = values[n-1];
+        column->width = (column->max - column->min) / STATS_BUCKETS + 1;
+
+        for(j=0; j<n; j++)
+            column->histogram[(values[j] - column->min) / column->width]++;
+    }
+
+    for(i=0; i<stats->ncolumns; i++)
+        free(gathered.values[i]);
+
+    if(ret != 0)
+    {
+        free(stats);
+        return -1;
+    }
+
+    free(hashtable->stats);
+    hashtable->stats = stats;
+    return 0;
+}
+
+
+/**
+ * @brief Estimates the number of records of a table matching a predicate
+ *
+ * The values of an int column are taken to be spread evenly within each
+ * range of its histogram, and the values of a column to be equally common.
+ */
+double estimate_rows(TableStats* stats, Predicates* pred)
+{
+    ColumnStats* column = NULL;
+    int i;
+
+    for(i=0; i<stats->ncolumns; i++)
+    {
+        if(strcmp(stats->columns[i].column, pred->name_) == 0)
+            column = &stats->columns[i];
+    }
+
+    if(column == NULL || stats->records == 0)
+        return 0;
+
+    long v = atoi(pred->value_);
+
+    if(pred->operator_ == '=')
+    {
+        if(column->numeric && (v < column->min || v > column->max))
+            return 0;
+        return (double) stats->records / column->distinct;
+    }
+
+    double rows = 0;
+
+    for(i=0; i<STATS_BUCKETS; i++)
+    {
+        long low = column->min + i * column->width;
+        long high = low + column->width - 1;
+
+        if(pred->operator_ == '<' && high < v)
+            rows += column->histogram[i];
+        else if(pred->operator_ == '<' && low < v)
+            rows += column->histogram[i] * (double) (v - low) / column->width;
+        else if(pred->operator_ == '>' && low > v)
+            rows += column->histogram[i];
+        else if(pred->operator_ == '>' && high > v)
+            rows += column->histogram[i] * (double) (high - v) / column->width;
+    }
+
+    return rows;
+}
+
+
+/**
+ * @brief Returns the index a predicate can be answered with, or NULL
+ *
+ * Ordered indexes answer every predicate on their int column, and hash
+ * and bitmap indexes the equalities.
+ */
+Index* predicate_index(HashTable* hashtable, Predicates* pred)
+{
+    Index* index = find_index(hashtable, pred->name_);
+
+    if(index == NULL || (index->tree == NULL && pred->operator_ != '='))
+        return NULL;
+
+    return index;
+}
+
+
+/**
+ * @brief Plans a QUERY
+ *
+ * @param preds The predicates, checked by QUERY already
+ * @param count The number of predicates
+ *
+ * The statistics of the table are gathered again once it changed by a
+ * tenth since they were. Reading the records through the index of the
+ * most selective indexed predicate, or through the intersection of the
+ * bitmaps of the equalities on bitmap columns, is chosen over a scan when
+ * it is estimated to cost less. Every record read is checked against the
+ * predicates, the most selective first.
+ */
+void plan_query(HashTable* hashtable, Predicates* preds, int count, QueryPlan* plan)
+{
+    TableStats none;
+    int i, j;
+
+    memset(plan, 0, sizeof *plan);
+    memset(&none, 0, sizeof none);
+
+    long changes = table_changes(hashtable);
+    if(hashtable->stats == NULL ||
+        changes - hashtable->stats->changes > hashtable->stats->records / 10 + STATS_MIN_CHANGES)
+        analyze_table(hashtable);
+
+    TableStats* stats = hashtable->stats != NULL ? hashtable->stats : &none;
+
+    plan->count = count;
+    plan->records = stats->records;
+
+    for(i=0; i<count; i++)
+    {
+        Index* index = predicate_index(hashtable, &preds[i]);
+        Predicates pred = preds[i];
+        int size;
+        double rows;
+
+        // a bitmap knows exactly how many records have its value
+        if(index != NULL && index->bitmap != NULL)
+        {
+            char value[32];
+            snprintf(value, sizeof value, "%d", atoi(pred.value_));
+            rows = bitmap_index_count(index->bitmap, index->numeric ? value : pred.value_);
+        }
+        else
+            rows = estimate_rows(stats, &pred);
+
+        // the most selective first
+        for(j=i; j>0 && plan->rows[j-1] > rows; j--)
+        {
+            plan->preds[j] = plan->preds[j-1];
+            plan->numeric[j] = plan->numeric[j-1];
+            plan->rows[j] = plan->rows[j-1];
+        }
+
+        plan->preds[j] = pred;
+        plan->numeric[j] = strcmp(column_type(hashtable->schema, pred.name_, &size), "int") == 0;
+        plan->rows[j] = rows;
+    }
+
+    plan->access = PLAN_SCAN;
+    plan->cost = stats->records;
+    plan->estimate = stats->records;
+
+    for(i=0; i<count; i++)
+    {
+        Index* index = predicate_index(hashtable, &plan->preds[i]);
+        double cost = plan->rows[i] * INDEX_ROW_COST;
+
+        // the records matching every predicate, if they are independent
+        plan->estimate = stats->records > 0 ?
+            plan->estimate * plan->rows[i] / stats->records : 0;
+
+        if(index != NULL && index->bitmap != NULL)
+            plan->bitmaps[plan->nbitmaps++] = i;
+        else if(index != NULL && cost < plan->cost)
+        {
+            plan->access = PLAN_INDEX;
+            plan->driver = i;
+            plan->cost = cost;
+        }
+    }
+
+    if(plan->nbitmaps > 0)
+    {
+        // the keys with earlier states are read as well
+        double rows = plan->rows[plan->bitmaps[0]];
+
+        for(i=1; i<plan->nbitmaps && stats->records > 0; i++)
+            rows = rows * plan->rows[plan->bitmaps[i]] / stats->records;
+
+        pthread_mutex_lock(&hashtable->versionedLock);
+        rows += roaring_cardinality(hashtable->versioned);
+        pthread_mutex_unlock(&hashtable->versionedLock);
+
+        if(rows * INDEX_ROW_COST < plan->cost)
+        {
+            plan->access = PLAN_BITMAP;
+            plan->cost = rows * INDEX_ROW_COST;
+        }
+    }
+}
+
+
+/**
+ * @brief Orders the matches of a plan, the limit first
+ *
+ * @param column An int or char column of the table
+ * @param limit The most matches kept, or LONG_MAX to keep every one
+ * @param countAll Set if every match is counted, so every record is read
+ *
+ * Walking the ordered index of an int column reads the records in order,
+ * so it stops after the first limit matches. It is estimated to read
+ * limit records for every match it expects among them, and is chosen if
+ * that costs less than the plan. Otherwise the plan keeps the first limit
+ * matches it reads in a heap, in O(n log limit).
+ */
+void plan_order(HashTable* hashtable, QueryPlan* plan, char* column, int descending, long limit,
+    int countAll)
+{
+    Index* index = find_index(hashtable, column);
+    int size;
+
+    strncpy(plan->orderBy, column, MAX_COLNAME_LEN);
+    plan->orderNumeric = strcmp(column_type(hashtable->schema, column, &size), "int") == 0;
+    plan->descending = descending;
+    plan->limit = limit;
+
+    if(index == NULL || index->tree == NULL)
+        return;
+
+    // the fraction of the records that match
+    double selectivity = plan->records > 0 ? plan->estimate / plan->records : 1;
+    double rows = selectivity > 0 && !countAll ? limit / selectivity : plan->records;
+    if(rows > plan->records)
+        rows = plan->records;
+
+    if(rows * INDEX_ROW_COST < plan->cost)
+    {
+        plan->access = PLAN_ORDERED;
+        plan->cost = rows * INDEX_ROW_COST;
+    }
+}
+
+
+/**
+ * @brief Describes a plan, like "index year cost 40 rows 2 of 1000;
+ * year = 1990 rows 10; name = bob rows 200; order by stops desc limit 20"
+ */
+void describe_plan(HashTable* hashtable, QueryPlan* plan, char* buf, size_t size)
+{
+    size_t len;
+    int i;
+
+    if(plan->access == PLAN_INDEX)
+        snprintf(buf, size, "index %s", plan->preds[plan->driver].name_);
+    else if(plan->access == PLAN_BITMAP)
+    {
+        snprintf(buf, size, "bitmap");
+        for(i=0; i<plan->nbitmaps; i++)
+        {
+            len = strlen(buf);
+            snprintf(buf + len, size - len, "%c%s", i == 0 ? ' ' : ',',
+                plan->preds[plan->bitmaps[i]].name_);
+        }
+    }
+    else if(plan->access == PLAN_ORDERED)
+        snprintf(buf, size, "ordered %s", plan->orderBy);
+    else
+        snprintf(buf, size, "scan %s", hashtable->name);
+
+    len = strlen(buf);
+    snprintf(buf + len, size - len, " cost %.0f rows %.0f of %ld", plan->cost,
+        plan->estimate, plan->records);
+
+    for(i=0; i<plan->count; i++)
+    {
+        len = strlen(buf);
+        snprintf(buf + len, size - len, "; %s %c %s rows %.0f", plan->preds[i].name_,
+            plan->preds[i].operator_, plan->preds[i].value_, plan->rows[i]);
+    }
+
+    // without the index, the matches go through a heap
+    if(plan->orderBy[0] != '\0')
+    {
+        len = strlen(buf);
+        snprintf(buf + len, size - len, "; order by %s %s", plan->orderBy,
+            plan->descending ? "desc" : "asc");
+        len = strlen(buf);
+        if(plan->limit != LONG_MAX)
+            snprintf(buf + len, size - len, " limit %ld", plan->limit);
+        len = strlen(buf);
+        if(plan->access != PLAN_ORDERED)
+            snprintf(buf + len, size - len, " heap");
+    }
+}
+
+
+#define ORDER_BATCH 256	///< Pairs of an ordered index read at a time.
+
+/**
+ * @brief The pairs of an ordered index read at once by ordered_scan
+ */
+typedef struct _index_pairs_t_ {
+    int count;
+    long values[ORDER_BATCH];
+    char keys[ORDER_BATCH][MAX_KEY_LEN + 1];
+} IndexPairs;
+
+
+/**
+ * @brief Called by btree_walk for every pair, until ORDER_BATCH are read
+ */
+int collectPair(long value, const char* key, void* arg)
+{
+    IndexPairs* pairs = arg;
+
+    pairs->values[pairs->count] = value;
+    strncpy(pairs->keys[pairs->count], key, MAX_KEY_LEN);
+    pairs->keys[pairs->count][MAX_KEY_LEN] = '\0';
+
+    return ++pairs->count == ORDER_BATCH;
+}
+
+
+/**
+ * @brief Checks the records of a table in the order of an ordered index,
+ * until matchRecord has enough
+ *
+ * @param snapshot The snapshot the records are read at
+ * @return Returns 0 on success, and -1 if a record could not be read
+ *
+ * The index holds a pair for every state of a key a snapshot may read, so
+ * a record is only checked at the pair of the state the snapshot reads,
+ * and every key once. The pairs are read a batch at a time, from where
+ * the last batch ended, so no stripe is locked while the index is.
+ */
+int ordered_scan(HashTable* hashtable, Snapshot* snapshot, Index* index, int descending,
+    QueryMatch* match)
+{
+    IndexPairs pairs;
+    struct storage_record r;
+    int stop = 0;
+    int ret = 0;
+    int i;
+
+    pairs.count = 0;
+    btree_walk(index->tree, descending, 0, NULL, collectPair, &pairs);
+
+    while(pairs.count > 0 && ret == 0 && !stop)
+    {
+        for(i=0; i<pairs.count && ret == 0 && !stop; i++)
+        {
+            unsigned int hashval = hash(hashtable, pairs.keys[i]);
+            Version* version;
+            struct storage_record* record;
+
+            lock_stripe(hashtable, hashval, false);
+
+            Node* node = lookup_string(hashtable, pairs.keys[i]);
+            if(node != NULL && snapshot_state(node, snapshot, &version))
+            {
+                if(read_state(hashtable, node, version, &r, &record) != 0)
+                    ret = -1;
+                else if(column_number(record->value, index->column) == pairs.values[i])
+                    stop = matchRecord(node->string, record, match);
+            }
+
+            unlock_stripe(hashtable, hashval);
+        }
+
+        if(pairs.count < ORDER_BATCH)
+            break;
+
+        // the last pair of the batch is where the next one starts
+        long value = pairs.values[ORDER_BATCH - 1];
+        char key[MAX_KEY_LEN + 1];
+        strcpy(key, pairs.keys[ORDER_BATCH - 1]);
+
+        pairs.count = 0;
+        btree_walk(index->tree, descending, value, key, collectPair, &pairs);
+    }
+
+    return ret;
+}
+
+
+/**
+ * @brief Reads the records of a plan at a snapshot the caller opened, and
+ * checks them against its predicates
+ *
+ * @param match Where the matches go, which gets the predicates of the
+ *		plan and the snapshot
+ * @return Returns 0 on success, and -1 if a record could not be read or
+ *		 there is no memory
+ *
+ * The bitmaps only hold the current records, so the keys whose earlier
+ * states are kept for the snapshots are read as well. Without memory the
+ * intersection keeps more ids, which are checked like the others.
+ */
+int read_plan_at(HashTable* hashtable, QueryPlan* plan, Snapshot* snapshot, QueryMatch* match)
+{
+    int ret = 0;
+    int i;
+
+    match->hashtable = hashtable;
+    match->snapshot = snapshot;
+    match->preds = plan->preds;
+    match->count = plan->count;
+    match->numeric = plan->numeric;
+
+    if(plan->access == PLAN_INDEX)
+    {
+        Predicates* pred = &plan->preds[plan->driver];
+        Index* index = find_index(hashtable, pred->name_);
+        long v = atoi(pred->value_);
+        long low = (pred->operator_ == '>') ? v + 1 : (pred->operator_ == '<') ? LONG_MIN : v;
+        long high = (pred->operator_ == '<') ? v - 1 : (pred->operator_ == '>') ? LONG_MAX : v;
+
+        // an index that failed since the plan was made is not used
+        if(index != NULL)
+            ret = index_scan(hashtable, snapshot, index, low, high, pred->value_,
+                matchRecord, match);
+        else
+            ret = scan_table(hashtable, snapshot, matchRecord, match);
+    }
+
+    else if(plan->access == PLAN_BITMAP)
+    {
+        struct roaring* candidates = NULL;
+
+        for(i=0; i<plan->nbitmaps && ret == 0; i++)
+        {
+            Predicates* pred = &plan->preds[plan->bitmaps[i]];
+            Index* index = find_index(hashtable, pred->name_);
+            char value[32];
+            struct roaring* bitmap;
+
+            // int values are kept like bitmap_value writes them
+            snprintf(value, sizeof value, "%d", atoi(pred->value_));
+
+            if(index == NULL ||
+                (bitmap = bitmap_index_get(index->bitmap, index->numeric ? value : pred->value_)) == NULL)
+                ret = -1;
+            else if(candidates == NULL)
+                candidates = bitmap;
+            else
+            {
+                roaring_and(candidates, bitmap);
+                roaring_destroy(bitmap);
+            }
+        }
+
+        if(ret == 0)
+        {
+            pthread_mutex_lock(&hashtable->versionedLock);
+            ret = roaring_or(candidates, hashtable->versioned);
+            pthread_mutex_unlock(&hashtable->versionedLock);
+        }
+
+        if(ret == 0)
+            roaring_iterate(candidates, matchBitmapRecord, match);
+        roaring_destroy(candidates);
+
+        // a bitmap index that failed is not used again
+        if(ret != 0)
+            ret = scan_table(hashtable, snapshot, matchRecord, match);
+    }
+
+    // run_plan does not use an ordered index that failed, and one that
+    // fails since then fails the QUERY rather than reply out of order
+    else if(plan->access == PLAN_ORDERED)
+    {
+        Index* index = find_index(hashtable, plan->orderBy);
+
+        ret = index != NULL ? ordered_scan(hashtable, snapshot, index, plan->descending, match) : -1;
+    }
+
+    else
+        ret = scan_table(hashtable, snapshot, matchRecord, match);
+
+    return ret != 0 || match->failed ? -1 : 0;
+}
+
+
+/**
+ * @brief Reads the records of a plan at a snapshot of its own, like
+ * read_plan_at
+ */
+int read_plan(HashTable* hashtable, QueryPlan* plan, QueryMatch* match)
+{
+    Snapshot snapshot;
+    int ret;
+
+    open_snapshot(&snapshot);
+    ret = read_plan_at(hashtable, plan, &snapshot, match);
+    close_snapshot(&snapshot);
+
+    return ret;
+}
+
+
+/**
+ * @brief A match kept by the heap of an ordered QUERY
+ *
+ * @param number The value of an int ORDER BY column
+ * @param text The value of a char one
+ * @param value The value of the record, if the QUERY sends the records
+ */
+typedef struct _ranked_t_ {
+    long number;
+    char* text;
+    char* value;
+    char key[MAX_KEY_LEN + 1];
+} Ranked;
+
+/**
+ * @brief The first matches of an ordered QUERY, in a heap whose top is the
+ * last of them in order
+ *
+ * @param plan The plan, with the ORDER BY column and the limit
+ * @param records Set to keep the value of every match
+ */
+typedef struct _top_matches_t_ {
+    QueryPlan* plan;
+    int records;
+    Ranked* heap;
+    long count;
+    long capacity;
+} TopMatches;
+
+
+/**
+ * @brief Orders two matches like an ordered QUERY replies with them, by
+ * value and then by key, reversed for a descending order
+ */
+int compare_ranked(QueryPlan* plan, Ranked* a, Ranked* b)
+{
+    int c;
+
+    if(plan->orderNumeric)
+        c = a->number < b->number ? -1 : a->number > b->number;
+    else
+        c = strcmp(a->text, b->text);
+
+    if(c == 0)
+        c = strcmp(a->key, b->key);
+
+    return plan->descending ? -c : c;
+}
+
+
+/**
+ * @brief Moves a match down the heap of the first count matches until it
+ * is after the matches under it
+ */
+void sift_down(TopMatches* top, long i, long count)
+{
+    for(;;)
+    {
+        long last = i;
+        long child = 2 * i + 1;
+
+        if(child < count && compare_ranked(top->plan, &top->heap[child], &top->heap[last]) > 0)
+            last = child;
+        if(child + 1 < count && compare_ranked(top->plan, &top->heap[child + 1], &top->heap[last]) > 0)
+            last = child + 1;
+        if(last == i)
+            return;
+
+        Ranked swap = top->heap[i];
+        top->heap[i] = top->heap[last];
+        top->heap[last] = swap;
+        i = last;
+    }
+}
+
+
+/**
+ * @brief Copies the text and the value of a match that goes in the heap,
+ * which point into the record read
+ *
+ * @return Returns 0 on success, and -1 if there is no memory
+ */
+int keep_ranked(TopMatches* top, Ranked* ranked, char* value)
+{
+    if(ranked->text != NULL && (ranked->text = strdup(ranked->text)) == NULL)
+        return -1;
+
+    if(top->records && (ranked->value = strdup(value)) == NULL)
+    {
+        free(ranked->text);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Called for every match of an ordered QUERY read without its
+ * ordered index, which is kept if it is among the first limit so far
+ */
+int rankRecord(const char* key, struct storage_record* record, void* arg)
+{
+    TopMatches* top = arg;
+    Ranked ranked;
+    char text[MAX_VALUE_LEN + 1];
+
+    if(top->plan->limit == 0)
+        return 0;
+
+    strncpy(ranked.key, key, MAX_KEY_LEN);
+    ranked.key[MAX_KEY_LEN] = '\0';
+    ranked.text = NULL;
+    ranked.value = NULL;
+    ranked.number = 0;
+
+    if(top->plan->orderNumeric)
+        ranked.number = column_number(record->value, top->plan->orderBy);
+    else
+    {
+        column_text(record->value, top->plan->orderBy, text, sizeof text);
+        ranked.text = text;
+    }
+
+    // a full heap only takes a match that comes before its top
+    if(top->count == top->plan->limit)
+    {
+        if(compare_ranked(top->plan, &ranked, &top->heap[0]) >= 0)
+            return 0;
+
+        if(keep_ranked(top, &ranked, record->value) != 0)
+            return -1;
+
+        free(top->heap[0].text);
+        free(top->heap[0].value);
+        top->heap[0] = ranked;
+        sift_down(top, 0, top->count);
+        return 0;
+    }
+
+    if(top->count == top->capacity)
+    {
+        long capacity = top->capacity ? top->capacity * 2 : 64;
+        if(capacity > top->plan->limit)
+            capacity = top->plan->limit;
+
+        Ranked* heap = realloc(top->heap, capacity * sizeof *heap);
+        if(heap == NULL)
+            return -1;
+        top->heap = heap;
+        top->capacity = capacity;
+    }
+
+    if(keep_ranked(top, &ranked, record->value) != 0)
+        return -1;
+
+    // move it up until it is before its parent
+    long i = top->count++;
+    while(i > 0 && compare_ranked(top->plan, &ranked, &top->heap[(i - 1) / 2]) > 0)
+    {
+        top->heap[i] = top->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    top->heap[i] = ranked;
+
+    return 0;
+}
+
+
+/**
+ * @brief Reads the records of a plan at a snapshot, and finds the keys
+ * matching its predicates
+ *
+ * @param limit The most keys kept
+ * @param countAll Set to count the matching records past the limit, which
+ *		    are otherwise not read
+ * @param records Set to keep every key with its value, one per line
+ * @param projection The columns of the values kept, or NULL for all of
+ *		     them
+ * @param reply Receives the keys, separated by spaces, which the caller
+ *		 frees
+ * @param found Receives the number of matching records, which is only
+ *		 more than the keys with countAll
+ * @return Returns 0 on success, and -1 if a record could not be read or
+ *		 there is no memory
+ *
+ * The keys of an ordered plan are in order. Unless it walks an ordered
+ * index, the first limit matches are kept in a heap while every record is
+ * read, and are sorted by taking its top out until it is empty.
+ */
+int run_plan(HashTable* hashtable, QueryPlan* plan, long limit, int countAll,
+    int records, Projection* projection, char** reply, long* found)
+{
+    QueryMatch match;
+    TopMatches top;
+    long i;
+
+    memset(&match, 0, sizeof match);
+    match.limit = limit;
+    match.countAll = countAll;
+    match.records = records;
+    match.projection = projection;
+    match.keys = strdup("");
+    match.capacity = 1;
+
+    if(match.keys == NULL)
+        return -1;
+
+    if(plan->access == PLAN_ORDERED && find_index(hashtable, plan->orderBy) == NULL)
+        plan->access = PLAN_SCAN;
+
+    memset(&top, 0, sizeof top);
+    top.plan = plan;
+    top.records = records;
+
+    if(plan->orderBy[0] != '\0' && plan->access != PLAN_ORDERED)
+    {
+        match.visit = rankRecord;
+        match.visitArg = &top;
+    }
+
+    int ret = read_plan(hashtable, plan, &match);
+
+    for(i=top.count - 1; i>=0 && ret == 0; i--)
+    {
+        Ranked swap = top.heap[0];
+        top.heap[0] = top.heap[i];
+        top.heap[i] = swap;
+        sift_down(&top, 0, i);
+    }
+
+    // the heap is in order now
+    for(i=0; i<top.count && ret == 0; i++)
+        ret = keep_key(&match, top.heap[i].key, top.heap[i].value);
+
+    for(i=0; i<top.count; i++)
+    {
+        free(top.heap[i].text);
+        free(top.heap[i].value);
+    }
+    free(top.heap);
+
+    if(ret != 0)
+    {
+        free(match.keys);
+        return -1;
+    }
+
+    *reply = match.keys;
+    *found = match.visitArg != NULL && !countAll ? top.count : match.found;
+    return 0;
+}
+
+
+#define MAX_CURSORS 64	///< Max cursors open at once, over all the connections.
+#define MAX_CONNECTION_CURSORS 8	///< Max cursors open at once on one connection.
+
+/**
+ * @brief A QUERY whose matches are read a page at a time
+ *
+ * @param id The number the client names the cursor by, or 0 if the slot
+ *	     is free
+ * @param sock The socket of the connection that opened the cursor, which
+ *	       is the only one that can use it
+ * @param predicates The text the predicates of the plan point into
+ * @param plan The predicates, in the order they are checked
+ * @param snapshot The snapshot a hash table is read at, so no record is
+ *		   missed or read twice when it changes between pages
+ * @param bucket The next bucket of a hash table to read
+ * @param pending The matches read and not fetched yet. The other engines
+ *		  go on after its last key.
+ * @param done Set once the whole table was read
+ * @param used When the cursor was opened or last fetched from
+ */
+typedef struct _cursor_t_ {
+    int id;
+    int sock;
+    HashTable* hashtable;
+    char* predicates;
+    QueryPlan plan;
+    Snapshot snapshot;
+    int bucket;
+    QueryMatch pending;
+    int done;
+    time_t used;
+} Cursor;
+
+/* The open cursors, used under handleCommandMutex */
+Cursor openCursors[MAX_CURSORS];
+
+/* The id of the last cursor opened */
+int lastCursorId;
+
+
+/**
+ * @brief Opens a cursor over the records of a table matching some
+ * predicates
+ *
+ * @param predicates The text of the predicates, parsed into pred, which
+ *		     the cursor frees
+ * @param count The number of predicates
+ * @param records Set to fetch every key with its value
+ * @return Returns the id of the cursor, or -1 if too many are open,
+ *	   over all the connections or on this one, or there is no memory
+ *
+ * The records are always scanned, most selective predicate first, so
+ * the scan can stop at the end of a page and go on from there.
+ */
+int open_cursor(int sock, HashTable* hashtable, char* predicates, int count, int records)
+{
+    Cursor* cursor = NULL;
+    int i, mine = 0;
+
+    for(i=0; i<MAX_CURSORS; i++)
+    {
+        if(openCursors[i].id == 0 && cursor == NULL)
+            cursor = &openCursors[i];
+        else if(openCursors[i].id != 0 && openCursors[i].sock == sock)
+            mine++;
+    }
+
+    char* keys = strdup("");
+    if(cursor == NULL || mine >= MAX_CONNECTION_CURSORS || keys == NULL)
+    {
+        free(keys);
+        free(predicates);
+        return -1;
+    }
+
+    memset(cursor, 0, sizeof *cursor);
+    cursor->sock = sock;
+    cursor->hashtable = hashtable;
+    cursor->predicates = predicates;
+
+    plan_query(hashtable, pred, count, &cursor->plan);
+    cursor->plan.access = PLAN_SCAN;
+
+    QueryMatch* pending = &cursor->pending;
+    pending->hashtable = hashtable;
+    pending->snapshot = &cursor->snapshot;
+    pending->preds = cursor->plan.preds;
+    pending->count = cursor->plan.count;
+    pending->numeric = cursor->plan.numeric;
+    pending->keys = keys;
+    pending->capacity = 1;
+    pending->limit = LONG_MAX;
+    pending->records = records;
+
+    if(hashtable->engine == ENGINE_HASH)
+        open_snapshot(&cursor->snapshot);
+
+    if(++lastCursorId <= 0)
+        lastCursorId = 1;
+    cursor->id = lastCursorId;
+    cursor->used = time(NULL);
+
+    return cursor->id;
+}
+
+
+/**
+ * @brief Finds a cursor opened by a connection
+ *
+ * @param id The id of the cursor, as the client sent it
+ * @return Returns the cursor, or NULL if there is none
+ */
+Cursor* find_cursor(int sock, char* id)
+{
+    int i;
+
+    if(id == NULL || isNum(id) != 0)
+        return NULL;
+
+    for(i=0; i<MAX_CURSORS; i++)
+    {
+        if(openCursors[i].id != 0 && openCursors[i].id == atoi(id) &&
+            openCursors[i].sock == sock)
+            return &openCursors[i];
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Reads the next page of a cursor
+ *
+ * @param count The most matches to fetch
+ * @param page Receives the matches, like the keys of a QUERY, or a key
+ *	       and its value per line, which the caller frees
+ * @param fetched Receives the number of matches, which is only less than
+ *		  count at the end of the table
+ * @return Returns 0 on success, and -1 if a record could not be read or
+ *	   there is no memory
+ *
+ * A hash table is read a bucket at a time, and the matches past the page
+ * are kept for the next one. The other engines stop at the page, and go
+ * on after its last key.
+ */
+int fetch_cursor(Cursor* cursor, long count, char** page, long* fetched)
+{
+    QueryMatch* pending = &cursor->pending;
+    HashTable* hashtable = cursor->hashtable;
+    char separator = pending->records ? '\n' : ' ';
+    int ret = 0;
+
+    cursor->used = time(NULL);
+
+    // the storage of a dropped table may be freed
+    if(table_dropped(hashtable))
+        cursor->done = 1;
+
+    while(!cursor->done && pending->found < count && ret == 0)
+    {
+        if(hashtable->engine == ENGINE_HASH)
+        {
+            ret = scan_buckets(hashtable, &cursor->snapshot, cursor->bucket,
+                cursor->bucket + 1, matchRecord, pending);
+
+            if(++cursor->bucket == hashtable->size)
+                cursor->done = 1;
+        }
+        else
+        {
+            const char* after = pending->last[0] != '\0' ? pending->last : NULL;
+
+            pending->limit = count;
+            if(hashtable->engine == ENGINE_LSM)
+                ret = lsm_scan_from(hashtable->lsm, after, matchRecord, pending);
+            else
+                ret = lf_scan_from(hashtable->lf, after, matchRecord, pending);
+
+            if(pending->found < count)
+                cursor->done = 1;
+        }
+    }
+
+    if(ret != 0 || pending->failed)
+        return -1;
+
+    long n = pending->found < count ? pending->found : count;
+    size_t cut = pending->len;
+    size_t i;
+    long seen = 0;
+
+    // the page ends at the separator after its last match
+    for(i=0; n < pending->found && i < pending->len; i++)
+    {
+        if(pending->keys[i] == separator && ++seen == n)
+        {
+            cut = i;
+            break;
+        }
+    }
+
+    *page = malloc(cut + 1);
+    if(*page == NULL)
+        return -1;
+    memcpy(*page, pending->keys, cut);
+    (*page)[cut] = '\0';
+
+    if(cut < pending->len)
+    {
+        memmove(pending->keys, pending->keys + cut + 1, pending->len - cut);
+        pending->len -= cut + 1;
+    }
+    else
+    {
+        pending->keys[0] = '\0';
+        pending->len = 0;
+    }
+
+    pending->found -= n;
+    *fetched = n;
+    return 0;
+}
+
+
+/**
+ * @brief Closes a cursor, and frees its slot
+ */
+void close_cursor(Cursor* cursor)
+{
+    if(cursor->hashtable->engine == ENGINE_HASH)
+        close_snapshot(&cursor->snapshot);
+
+    free(cursor->pending.keys);
+    free(cursor->predicates);
+    memset(cursor, 0, sizeof *cursor);
+}
+
+
+/**
+ * @brief Closes the cursors a connection left open
+ */
+void close_cursors(int sock)
+{
+    int i;
+
+    pthread_mutex_lock( &handleCommandMutex ); 
+
+    for(i=0; i<MAX_CURSORS; i++)
+    {
+        if(openCursors[i].id != 0 && openCursors[i].sock == sock)
+            close_cursor(&openCursors[i]);
+    }
+
+    pthread_mutex_unlock( &handleCommandMutex ); 
+
+    // commands may have been queued while the cursors were closed
+    runLockedCommands();
+}
+
+
+/**
+ * @brief Closes the cursors not fetched from for a timeout, so a client
+ * that forgets one does not keep its snapshot or its slot
+ *
+ * @param timeout The seconds a cursor may go without a FETCH
+ *
+ * The caller holds handleCommandMutex.
+ */
+void expire_cursors(int timeout)
+{
+    time_t now = time(NULL);
+    int i;
+
+    for(i=0; i<MAX_CURSORS; i++)
+    {
+        if(openCursors[i].id != 0 && now - openCursors[i].used >= timeout)
+            close_cursor(&openCursors[i]);
+    }
+}
+
+
+/**
+ * @brief Closes the idle cursors of all the connections, for the event
+ * loops that find no command to do it
+ */
+void expire_idle_cursors(int timeout)
+{
+    pthread_mutex_lock( &handleCommandMutex ); 
+    expire_cursors(timeout);
+    pthread_mutex_unlock( &handleCommandMutex ); 
+
+    runLockedCommands();
+}
+
+
+#define MAX_AGGREGATES 10	///< Max aggregates of an AGGREGATE.
+
+// The functions an AGGREGATE computes.
+#define AGGREGATE_COUNT	0	///< The number of matching records.
+#define AGGREGATE_SUM	1	///< The sum of an int column.
+#define AGGREGATE_MIN	2	///< The smallest value of an int column.
+#define AGGREGATE_MAX	3	///< The largest value of an int column.
+#define AGGREGATE_AVG	4	///< The mean of an int column.
+
+/**
+ * @brief The aggregates an AGGREGATE computes
+ *
+ * @param functions The function of each aggregate, an AGGREGATE_* value
+ * @param columnOf The column of each aggregate in columns, or -1 for a
+ *		   count
+ * @param columns The int columns the aggregates read, each once
+ */
+typedef struct _aggregate_spec_t_ {
+    int count;
+    int functions[MAX_AGGREGATES];
+    int columnOf[MAX_AGGREGATES];
+    char* columns[MAX_AGGREGATES];
+    int ncolumns;
+} AggregateSpec;
+
+/**
+ * @brief The running sum, min and max of every column an AGGREGATE reads,
+ * over the records counted in rows
+ */
+typedef struct _aggregate_state_t_ {
+    long rows;
+    long long sums[MAX_AGGREGATES];
+    long mins[MAX_AGGREGATES];
+    long maxs[MAX_AGGREGATES];
+} AggregateState;
+
+#define MAX_GROUP_COLUMNS 4	///< Max columns a GROUP groups by.
+
+/**
+ * @brief The aggregates of the records of a group
+ *
+ * @param values The values of the group columns, separated by commas
+ * @param hashval The hash of values
+ */
+typedef struct _group_t_ {
+    char* values;
+    unsigned int hashval;
+    AggregateState state;
+} Group;
+
+/**
+ * @brief The aggregates of the records an AGGREGATE or GROUP matches
+ *
+ * @param groupBy The columns a GROUP groups by, none for an AGGREGATE
+ * @param groupInt Whether each of them is an int column
+ * @param groups The groups, in the order their first record was matched
+ * @param buckets The groups by the hash of their values, open addressed,
+ *		  with -1 for an empty bucket
+ */
+typedef struct _aggregation_t_ {
+    AggregateSpec* spec;
+    AggregateState total;
+    char* groupBy[MAX_GROUP_COLUMNS];
+    int groupInt[MAX_GROUP_COLUMNS];
+    int ngroupBy;
+    Group* groups;
+    int ngroups;
+    int capacity;
+    int* buckets;
+    int nbuckets;
+} Aggregation;
+
+
+/**
+ * @brief Reads some int columns of a record in one pass over its value
+ *
+ * @param columns The names of the columns
+ * @param numbers Receives the value of each column, or 0 if the record
+ *		  does not have it, like QUERY counts it
+ */
+void int_columns(const char* value, char** columns, int count, long* numbers)
+{
+    const char* field = value;
+    int i;
+
+    for(i=0; i<count; i++)
+        numbers[i] = 0;
+
+    while(field != NULL)
+    {
+        field += strspn(field, " ");
+        size_t len = strcspn(field, " ,");
+
+        for(i=0; i<count; i++)
+        {
+            if(strncmp(field, columns[i], len) == 0 && columns[i][len] == '\0')
+            {
+                numbers[i] = strtol(field + len, NULL, 10);
+                break;
+            }
+        }
+
+        field = strchr(field, ',');
+        if(field != NULL)
+            field++;
+    }
+}
+
+
+/**
+ * @brief Adds a record to the aggregates of a group
+ *
+ * @param numbers The values of the columns of the spec
+ */
+void add_aggregates(AggregateSpec* spec, AggregateState* state, long* numbers)
+{
+    int i;
+
+    for(i=0; i<spec->ncolumns; i++)
+    {
+        state->sums[i] += numbers[i];
+        if(state->rows == 0 || numbers[i] < state->mins[i])
+            state->mins[i] = numbers[i];
+        if(state->rows == 0 || numbers[i] > state->maxs[i])
+            state->maxs[i] = numbers[i];
+    }
+
+    state->rows++;
+}
+
+
+/**
+ * @brief Writes the values of the group columns of a record, separated by
+ * commas, in one pass over its value
+ *
+ * An int value is written as a number, so "007" and "7" are one group. A
+ * column the record does not have is empty, or 0 if it is an int.
+ */
+void group_values(Aggregation* aggregation, const char* value, char* buf, size_t size)
+{
+    const char* starts[MAX_GROUP_COLUMNS];
+    size_t lens[MAX_GROUP_COLUMNS];
+    const char* field = value;
+    size_t len = 0;
+    int i;
+
+    for(i=0; i<aggregation->ngroupBy; i++)
+        starts[i] = NULL;
+
+    while(field != NULL)
+    {
+        field += strspn(field, " ");
+        size_t nameLen = strcspn(field, " ,");
+
+        for(i=0; i<aggregation->ngroupBy; i++)
+        {
+            const char* column = aggregation->groupBy[i];
+
+            if(strncmp(field, column, nameLen) == 0 && column[nameLen] == '\0')
+            {
+                starts[i] = field + nameLen + strspn(field + nameLen, " ");
+                lens[i] = strcspn(starts[i], ",");
+                while(lens[i] > 0 && starts[i][lens[i] - 1] == ' ')
+                    lens[i]--;
+            }
+        }
+
+        field = strchr(field, ',');
+        if(field != NULL)
+            field++;
+    }
+
+    buf[0] = '\0';
+
+    for(i=0; i<aggregation->ngroupBy && len + 1 < size; i++)
+    {
+        if(i > 0)
+            buf[len++] = ',';
+
+        if(aggregation->groupInt[i])
+            snprintf(buf + len, size - len, "%ld", starts[i] != NULL ? strtol(starts[i], NULL, 10) : 0L);
+        else if(starts[i] != NULL)
+            snprintf(buf + len, size - len, "%.*s", (int) lens[i], starts[i]);
+        else
+            buf[len] = '\0';
+
+        len += strlen(buf + len);
+    }
+}
+
+
+/**
+ * @brief Finds the group with some values, adding it if there is none
+ *
+ * @return Returns the group, or NULL if it could not be added
+ */
+Group* find_group(Aggregation* aggregation, const char* values)
+{
+    unsigned int hashval = 0;
+    const char* c;
+    int i;
+
+    for(c = values; *c != '\0'; c++)
+        hashval = *c + (hashval << 5) - hashval;
+
+    // keep the buckets at most half full, so probes stay short
+    if((aggregation->ngroups + 1) * 2 > aggregation->nbuckets)
+    {
+        int nbuckets = aggregation->nbuckets ? aggregation->nbuckets * 2 : 64;
+        int* buckets = malloc(nbuckets * sizeof *buckets);
+
+        if(buckets == NULL)
+            return NULL;
+
+        for(i=0; i<nbuckets; i++)
+            buckets[i] = -1;
+
+        for(i=0; i<aggregation->ngroups; i++)
+        {
+            unsigned int b = aggregation->groups[i].hashval & (nbuckets - 1);
+            while(buckets[b] != -1)
+                b = (b + 1) & (nbuckets - 1);
+            buckets[b] = i;
+        }
+
+        free(aggregation->buckets);
+        aggregation->buckets = buckets;
+        aggregation->nbuckets = nbuckets;
+    }
+
+    unsigned int b = hashval & (aggregation->nbuckets - 1);
+
+    for(; aggregation->buckets[b] != -1; b = (b + 1) & (aggregation->nbuckets - 1))
+    {
+        Group* group = &aggregation->groups[aggregation->buckets[b]];
+        if(group->hashval == hashval && strcmp(group->values, values) == 0)
+            return group;
+    }
+
+    if(aggregation->ngroups == aggregation->capacity)
+    {
+        int capacity = aggregation->capacity ? aggregation->capacity * 2 : 64;
+        Group* groups = realloc(aggregation->groups, capacity * sizeof *groups);
+
+        if(groups == NULL)
+            return NULL;
+        aggregation->groups = groups;
+        aggregation->capacity = capacity;
+    }
+
+    Group* group = &aggregation->groups[aggregation->ngroups];
+    memset(group, 0, sizeof *group);
+    group->values = strdup(values);
+    group->hashval = hashval;
+
+    if(group->values == NULL)
+        return NULL;
+
+    aggregation->buckets[b] = aggregation->ngroups++;
+    return group;
+}
+
+
+/**
+ * @brief Frees the groups of a GROUP
+ */
+void free_groups(Aggregation* aggregation)
+{
+    int i;
+
+    for(i=0; i<aggregation->ngroups; i++)
+        free(aggregation->groups[i].values);
+
+    free(aggregation->groups);
+    free(aggregation->buckets);
+}
+
+
+/**
+ * @brief Called for every record an AGGREGATE or GROUP matches
+ */
+int aggregateRecord(const char* key, struct storage_record* record, void* arg)
+{
+    Aggregation* aggregation = arg;
+    AggregateState* state = &aggregation->total;
+    long numbers[MAX_AGGREGATES];
+
+    int_columns(record->value, aggregation->spec->columns, aggregation->spec->ncolumns, numbers);
+
+    if(aggregation->ngroupBy > 0)
+    {
+        char values[MAX_VALUE_LEN];
+        Group* group;
+
+        group_values(aggregation, record->value, values, sizeof values);
+        group = find_group(aggregation, values);
+        if(group == NULL)
+            return -1;
+        state = &group->state;
+    }
+
+    add_aggregates(aggregation->spec, state, numbers);
+
+    return 0;
+}
+
+
+/**
+ * @brief Writes the aggregates of a group, separated by spaces
+ *
+ * The min, max and mean of no records are "nan".
+ */
+void describe_aggregates(AggregateSpec* spec, AggregateState* state, char* buf, size_t size)
+{
+    size_t len = 0;
+    int i;
+
+    buf[0] = '\0';
+
+    for(i=0; i<spec->count && len < size; i++)
+    {
+        int c = spec->columnOf[i];
+        const char* space = i > 0 ? " " : "";
+
+        if(spec->functions[i] == AGGREGATE_COUNT)
+            snprintf(buf + len, size - len, "%s%ld", space, state->rows);
+        else if(spec->functions[i] == AGGREGATE_SUM)
+            snprintf(buf + len, size - len, "%s%lld", space, state->sums[c]);
+        else if(state->rows == 0)
+            snprintf(buf + len, size - len, "%snan", space);
+        else if(spec->functions[i] == AGGREGATE_MIN)
+            snprintf(buf + len, size - len, "%s%ld", space, state->mins[c]);
+        else if(spec->functions[i] == AGGREGATE_MAX)
+            snprintf(buf + len, size - len, "%s%ld", space, state->maxs[c]);
+        else
+            snprintf(buf + len, size - len, "%s%.6f", space, (double) state->sums[c] / state->rows);
+
+        len += strlen(buf + len);
+    }
+}
+
+
+/**
+ * @brief Writes the groups of a GROUP, a line with their number and then a
+ * line of values and aggregates for each, like "ontario,2001;12 345"
+ *
+ * @param len Receives the length of the reply
+ * @return Returns the reply, which the caller frees, or NULL if there is
+ *	   not enough memory
+ */
+char* describe_groups(Aggregation* aggregation, size_t* len)
+{
+    size_t capacity = 64;
+    char* reply = malloc(capacity);
+    char line[MAX_VALUE_LEN + MAX_CMD_LEN];
+    int i;
+
+    if(reply == NULL)
+        return NULL;
+
+    *len = snprintf(reply, capacity, "%d\n", aggregation->ngroups);
+
+    for(i=0; i<aggregation->ngroups; i++)
+    {
+        Group* group = &aggregation->groups[i];
+        size_t n = snprintf(line, sizeof line, "%s;", group->values);
+
+        describe_aggregates(aggregation->spec, &group->state, line + n, sizeof line - n - 1);
+        strcat(line, "\n");
+        n = strlen(line);
+
+        if(*len + n + 1 > capacity)
+        {
+            char* grown = realloc(reply, (*len + n + 1) * 2);
+
+            if(grown == NULL)
+            {
+                free(reply);
+                return NULL;
+            }
+            reply = grown;
+            capacity = (*len + n + 1) * 2;
+        }
+
+        memcpy(reply + *len, line, n + 1);
+        *len += n;
+    }
+
+    return reply;
+}
+
+
+/**
+ * @brief Parses the columns a GROUP groups by
+ *
+ * @param columns The columns, like "province, year", which are split in
+ *		  place
+ * @return Returns 0 on success, and -1 if there are too many, or one is
+ *	   not a column of the table
+ */
+int parse_group_columns(char* columns, char* schema, Aggregation* aggregation)
+{
+    char* save;
+    char* tok = strtok_r(columns, ",", &save);
+
+    for(; tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        char* column = trimXX(tok);
+        const char* type;
+        int size;
+
+        type = column_type(schema, column, &size);
+        if(type == NULL || aggregation->ngroupBy == MAX_GROUP_COLUMNS)
+            return -1;
+
+        aggregation->groupInt[aggregation->ngroupBy] = strcmp(type, "int") == 0;
+        aggregation->groupBy[aggregation->ngroupBy++] = column;
+    }
+
+    return aggregation->ngroupBy > 0 ? 0 : -1;
+}
+
+
+/**
+ * @brief Parses the aggregates of an AGGREGATE
+ *
+ * @param aggregates The aggregates, like "count, sum population, avg year",
+ *		     which are split in place
+ * @param schema The schema of the table
+ * @return Returns 0 on success, and -1 if there are too many, or one is
+ *	   not a known function of an int column
+ */
+int parse_aggregates(char* aggregates, char* schema, AggregateSpec* spec)
+{
+    static const char* functions[] = { "count", "sum", "min", "max", "avg" };
+    char* save;
+    char* tok = strtok_r(aggregates, ",", &save);
+    int i;
+
+    memset(spec, 0, sizeof *spec);
+
+    for(; tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        char* name = trimXX(tok);
+        char* column = strchr(name, ' ');
+        int size;
+
+        if(spec->count == MAX_AGGREGATES)
+            return -1;
+
+        if(column != NULL)
+        {
+            *column = '\0';
+            column = trimXX(column + 1);
+        }
+
+        for(i=0; i<5 && strcasecmp(name, functions[i]) != 0; i++)
+            ;
+
+        // a count has no column, and the others an int one
+        if(i == 5 || (i == AGGREGATE_COUNT) != (column == NULL))
+            return -1;
+        if(column != NULL && (column_type(schema, column, &size) == NULL ||
+            strcmp(column_type(schema, column, &size), "int") != 0))
+            return -1;
+
+        spec->functions[spec->count] = i;
+        spec->columnOf[spec->count] = -1;
+
+        if(column != NULL)
+        {
+            int c;
+            for(c=0; c<spec->ncolumns && strcmp(spec->columns[c], column) != 0; c++)
+                ;
+            if(c == spec->ncolumns)
+                spec->columns[spec->ncolumns++] = column;
+            spec->columnOf[spec->count] = c;
+        }
+
+        spec->count++;
+    }
+
+    return spec->count > 0 ? 0 : -1;
+}
+
+
+/**
+ * @brief Parses the ORDER BY option of a QUERY, "order by <column>
+ * [asc|desc]", in any case
+ *
+ * @param option The option, which is split in place
+ * @param column Receives the column
+ * @param descending Set if the order is descending
+ * @return Returns 0 on success, and -1 if it is not an ORDER BY of a
+ *	   column of the table
+ */
+int parse_order(char* option, char* schema, char** column, int* descending)
+{
+    char* save;
+    char* order = strtok_r(option, " ", &save);
+    char* by = strtok_r(NULL, " ", &save);
+    char* direction;
+    int size;
+
+    *column = strtok_r(NULL, " ", &save);
+    direction = strtok_r(NULL, " ", &save);
+    *descending = direction != NULL && strcasecmp(direction, "desc") == 0;
+
+    if(order == NULL || strcasecmp(order, "order") != 0 || by == NULL ||
+        strcasecmp(by, "by") != 0 || *column == NULL ||
+        column_type(schema, *column, &size) == NULL || strtok_r(NULL, " ", &save) != NULL)
+        return -1;
+
+    return direction == NULL || *descending || strcasecmp(direction, "asc") == 0 ? 0 : -1;
+}
+
+
+/**
+ * @brief Parses the predicates of a QUERY into pred
+ *
+ * @param predicates The predicates, like "name = bloor danforth, stops > 12",
+ *		     which are split in place
+ * @param schema The schema of the table
+ * @return Returns the number of predicates, or -1 if there are too many,
+ *		 or one names a column that is not in the schema or does not
+ *		 fit its type
+ */
+int parse_predicates(char* predicates, char* schema)
+{
+    char* save;
+    char* pp_tok = strtok_r(predicates, ",", &save);
+    int x = 0;
+
+    while(pp_tok)
+    {
+        char* op = strpbrk(pp_tok, "=<>");
+
+        if(x == MAX_QUERY_PREDICATES || op == NULL)
+            return -1;
+
+        // the name and the value are left in the command
+        pred[x].operator_ = *op;
+        *op = '\0';
+        pred[x].name_ = trimXX(pp_tok);
+        pred[x].value_ = trimXX(op + 1);
+
+        pp_tok = strtok_r(NULL, ",", &save);
+        x++;
+    }
+
+    int p;
+    for(p=0; p<x; p++)
+    {
+        int size;
+        const char* ss = column_type(schema, pred[p].name_, &size);
+        char n2 = pred[p].operator_;
+
+        // checking if column is in schema
+        if(ss == NULL)
+            return -1;
+
+        // strings are only compared for equality
+        if(strcmp(ss, "char") == 0)
+        {
+            if(n2 != '=')
+                return -1;
+        }
+        else if((n2 != '=' && n2 != '<' && n2 != '>') || isNum(pred[p].value_) == 1)
+            return -1;
+    }
+
+    return x;
+}
+
+
+#define MAX_JOIN_COLUMNS (2 * MAX_COLUMNS_PER_TABLE)	///< Max columns a JOIN sends.
+
+/**
+ * @brief A table of a JOIN
+ *
+ * @param column The column it is joined on, or NULL for the key
+ * @param numeric Set if it is an int column, whose values are joined as
+ *		  numbers
+ * @param preds The predicates on the table
+ * @param text The predicates of the JOIN on the table, which preds point
+ *	       into
+ * @param schema A copy of the schema, which the columns sent point into
+ *		 when they are all sent
+ */
+typedef struct _join_side_t_ {
+    HashTable* hashtable;
+    char* column;
+    int numeric;
+    Predicates preds[MAX_QUERY_PREDICATES];
+    int count;
+    char text[MAX_CMD_LEN];
+    char schema[MAX_CONFIG_LINE_LEN];
+} JoinSide;
+
+/**
+ * @brief A matching record of the table a JOIN builds its hash from
+ *
+ * @param value The value of the record, if the JOIN sends the records
+ * @param joined The value the record is joined on
+ * @param hash The hash of the joined value
+ * @param next The number of the next row in the same bucket of the hash,
+ *	       or -1
+ */
+typedef struct _join_row_t_ {
+    char key[MAX_KEY_LEN + 1];
+    char* value;
+    char* joined;
+    unsigned int hash;
+    int next;
+} JoinRow;
+
+/**
+ * @brief A JOIN of two tables
+ *
+ * @param build The side the hash is built from, the one estimated to
+ *		match fewer records
+ * @param buckets The hash of the joined values of the build side: the
+ *		  number of the first row of each bucket, or -1. There are
+ *		  at least as many buckets as rows.
+ * @param columnSide The side of every column sent, in order
+ * @param out The joined pairs of keys, and the columns sent of them
+ * @param probeKey The record of the other side being joined
+ */
+typedef struct _join_t_ {
+    JoinSide sides[2];
+    int build;
+    int* buckets;
+    int nbuckets;
+    JoinRow* rows;
+    int nrows;
+    int capacity;
+    int records;
+    int ncolumns;
+    int columnSide[MAX_JOIN_COLUMNS];
+    char* columns[MAX_JOIN_COLUMNS];
+    int columnNumeric[MAX_JOIN_COLUMNS];
+    long limit;
+    QueryMatch out;
+    const char* probeKey;
+    char* probeValue;
+} Join;
+
+
+/**
+ * @brief Writes the value a record is joined on, which is its key, an int
+ * column as a number, or a char column like QUERY compares it
+ */
+void join_value(JoinSide* side, const char* key, char* value, char* buf, size_t size)
+{
+    if(side->column == NULL)
+        snprintf(buf, size, "%s", key);
+    else if(side->numeric)
+        snprintf(buf, size, "%ld", column_number(value, side->column));
+    else
+        column_text(value, side->column, buf, size);
+}
+
+
+/**
+ * @brief Hashes a value a JOIN is on
+ */
+unsigned int join_hash(const char* value)
+{
+    unsigned int hash = 2166136261u;
+
+    while(*value != '\0')
+    {
+        hash ^= (unsigned char) *value++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+/**
+ * @brief Doubles the buckets of the hash of a JOIN, and links its rows
+ * to them again
+ *
+ * @return Returns 0 on success, and -1 if there is no memory
+ */
+int grow_join_hash(Join* join)
+{
+    int nbuckets = join->nbuckets ? join->nbuckets * 2 : 64;
+    int* buckets = realloc(join->buckets, nbuckets * sizeof *buckets);
+    int i;
+
+    if(buckets == NULL)
+        return -1;
+
+    join->buckets = buckets;
+    join->nbuckets = nbuckets;
+    for(i=0; i<nbuckets; i++)
+        buckets[i] = -1;
+
+    for(i=0; i<join->nrows; i++)
+    {
+        JoinRow* row = &join->rows[i];
+
+        row->next = buckets[row->hash % nbuckets];
+        buckets[row->hash % nbuckets] = i;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Called for every matching record of the build side of a JOIN,
+ * which is added to the hash
+ */
+int buildRecord(const char* key, struct storage_record* record, void* arg)
+{
+    Join* join = arg;
+    char value[MAX_VALUE_LEN + 1];
+
+    if(join->nrows == join->nbuckets && grow_join_hash(join) != 0)
+        return -1;
+
+    if(join->nrows == join->capacity)
+    {
+        int capacity = join->capacity ? join->capacity * 2 : 64;
+        JoinRow* rows = realloc(join->rows, capacity * sizeof *rows);
+
+        if(rows == NULL)
+            return -1;
+        join->rows = rows;
+        join->capacity = capacity;
+    }
+
+    JoinRow* row = &join->rows[join->nrows];
+    strncpy(row->key, key, MAX_KEY_LEN);
+    row->key[MAX_KEY_LEN] = '\0';
+    row->value = NULL;
+
+    if(join->records && (row->value = strdup(record->value)) == NULL)
+        return -1;
+
+    join_value(&join->sides[join->build], key, record->value, value, sizeof value);
+    row->joined = strdup(value);
+    if(row->joined == NULL)
+    {
+        free(row->value);
+        return -1;
+    }
+
+    row->hash = join_hash(value);
+    row->next = join->buckets[row->hash % join->nbuckets];
+    join->buckets[row->hash % join->nbuckets] = join->nrows;
+
+    join->nrows++;
+    return 0;
+}
+
+
+/**
+ * @brief Keeps the pair of a row of the build side of a JOIN and the
+ * record being probed
+ *
+ * @return Returns 0 to go on, and 1 at the limit or if there is no memory
+ */
+int probeRow(Join* join, JoinRow* row)
+{
+    char pair[2 * MAX_KEY_LEN + 2];
+    char value[MAX_CMD_LEN];
+    size_t len = 0;
+    int i;
+
+    snprintf(pair, sizeof pair, "%s,%s", join->build == 0 ? row->key : join->probeKey,
+        join->build == 0 ? join->probeKey : row->key);
+
+    // the columns sent, named by their tables
+    value[0] = '\0';
+    for(i=0; i<join->ncolumns && len + 1 < sizeof value; i++)
+    {
+        JoinSide* side = &join->sides[join->columnSide[i]];
+        char* record = join->columnSide[i] == join->build ? row->value : join->probeValue;
+        char text[MAX_VALUE_LEN + 1];
+
+        if(join->columnNumeric[i])
+            snprintf(text, sizeof text, "%ld", column_number(record, join->columns[i]));
+        else
+            column_text(record, join->columns[i], text, sizeof text);
+
+        snprintf(value + len, sizeof value - len, "%s%s.%s %s", i > 0 ? "," : "",
+            side->hashtable->name, join->columns[i], text);
+        len += strlen(value + len);
+    }
+
+    if(keep_key(&join->out, pair, value) != 0)
+        return 1;
+
+    join->out.found++;
+    return join->out.found >= join->limit;
+}
+
+
+/**
+ * @brief Called for every matching record of the other side of a JOIN,
+ * which is joined with the rows of the build side having its value
+ */
+int probeRecord(const char* key, struct storage_record* record, void* arg)
+{
+    Join* join = arg;
+    char value[MAX_VALUE_LEN + 1];
+    unsigned int hash;
+    int i;
+
+    if(join->out.found >= join->limit)
+        return 1;
+
+    join->probeKey = key;
+    join->probeValue = record->value;
+    join_value(&join->sides[1 - join->build], key, record->value, value, sizeof value);
+    hash = join_hash(value);
+
+    for(i = join->buckets[hash % join->nbuckets]; i >= 0; i = join->rows[i].next)
+    {
+        JoinRow* row = &join->rows[i];
+
+        if(row->hash == hash && strcmp(row->joined, value) == 0 && probeRow(join, row) != 0)
+            break;
+    }
+
+    if(join->out.failed)
+        return -1;
+    return join->out.found >= join->limit;
+}
+
+
+/**
+ * @brief Parses the condition of a JOIN, "<left column> = <right column>",
+ * where a column is "key" to join on the keys of its table
+ *
+ * @return Returns 0 on success, and -1 if a column is not in its table
+ */
+int parse_join_on(char* on, Join* join)
+{
+    char* equals = on != NULL ? strchr(on, '=') : NULL;
+    char* columns[2];
+    int i;
+
+    if(equals == NULL)
+        return -1;
+
+    *equals = '\0';
+    columns[0] = trimXX(on);
+    columns[1] = trimXX(equals + 1);
+
+    for(i=0; i<2; i++)
+    {
+        JoinSide* side = &join->sides[i];
+        int size;
+        const char* type = column_type(side->hashtable->schema, columns[i], &size);
+
+        if(strcmp(columns[i], "key") == 0)
+            side->column = NULL;
+        else if(type != NULL)
+        {
+            side->column = columns[i];
+            side->numeric = strcmp(type, "int") == 0;
+        }
+        else
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Finds the side of a JOIN a column like "census.population" is of
+ *
+ * @param column The column, which is split at the dot
+ * @param name Receives the name of the column
+ * @return Returns 0 or 1, or -1 if it is not named by one of the tables
+ */
+int join_side(Join* join, char* column, char** name)
+{
+    char* dot = strchr(column, '.');
+    int i;
+
+    if(dot == NULL)
+        return -1;
+
+    *dot = '\0';
+    *name = dot + 1;
+
+    for(i=0; i<2; i++)
+    {
+        if(strcmp(join->sides[i].hashtable->name, trimXX(column)) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+
+/**
+ * @brief Parses the predicates of a JOIN, like "census.year > 1990,
+ * cities.name = toronto", where every predicate names its table
+ *
+ * @return Returns 0 on success, and -1 if a predicate is not valid
+ */
+int parse_join_predicates(char* predicates, Join* join)
+{
+    char* save;
+    char* tok = strtok_r(predicates, ",", &save);
+    char* name;
+    int i;
+
+    for(; tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        int side = join_side(join, tok, &name);
+
+        if(side < 0)
+            return -1;
+
+        char* text = join->sides[side].text;
+        size_t len = strlen(text);
+
+        if(len + strlen(name) + 2 > sizeof join->sides[side].text)
+            return -1;
+
+        snprintf(text + len, sizeof join->sides[side].text - len, "%s%s", len > 0 ? "," : "", name);
+    }
+
+    // pred holds the predicates of one table at a time
+    for(i=0; i<2; i++)
+    {
+        JoinSide* side = &join->sides[i];
+
+        if(side->text[0] == '\0')
+            continue;
+
+        side->count = parse_predicates(side->text, side->hashtable->schema);
+        if(side->count < 0)
+            return -1;
+        memcpy(side->preds, pred, side->count * sizeof *pred);
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Parses the columns a JOIN sends, like "census.population,
+ * cities.mayor", or takes every column of both tables if there are none
+ *
+ * @return Returns 0 on success, and -1 if there are too many, or one is
+ *	   not a column of its table
+ */
+int parse_join_columns(char* columns, Join* join)
+{
+    char* save;
+    char* tok;
+    char* name;
+    int size;
+    int i;
+
+    join->records = 1;
+
+    if(columns == NULL)
+    {
+        for(i=0; i<2; i++)
+        {
+            JoinSide* side = &join->sides[i];
 
+            strncpy(side->schema, side->hashtable->schema, sizeof side->schema - 1);
 
-            bool key_and_table_match = false;
-            int i;
-            int pos;
-            for(i=0; i<count_arrKeyVersion && !key_and_table_match; i++)
+            // the schema is "<column> <type> [<length>] ..."
+            for(tok = strtok_r(side->schema, " ", &save); tok != NULL && join->ncolumns < MAX_JOIN_COLUMNS;
+                tok = strtok_r(NULL, " ", &save))
             {
-                if(strcmp(arrKeyVersion[i].tableName, hashtable->name)==0 && 
-                    strcmp(arrKeyVersion[i].key, str)==0)
-                {
-                    key_and_table_match = true;
-                    
-                    // copy the table name, key, next version in array
-                    strcpy(arrKeyVersion[i].tableName, hashtable->name);
+                char* type = strtok_r(NULL, " ", &save);
 
-                    strcpy(arrKeyVersion[i].key, str);
-                    arrKeyVersion[i].version = (curr->record->metadata[0])+1;
+                if(type == NULL || (strcmp(type, "char") == 0 && strtok_r(NULL, " ", &save) == NULL))
+                    break;
 
-                    pos = i;
-                }
+                join->columnSide[join->ncolumns] = i;
+                join->columnNumeric[join->ncolumns] = strcmp(type, "int") == 0;
+                join->columns[join->ncolumns++] = tok;
             }
+        }
 
-            if(!key_and_table_match)
-            {
-                // copy the table name, key, next version in array
-                strcpy(arrKeyVersion[count_arrKeyVersion].tableName, hashtable->name);
+        return 0;
+    }
 
-                strcpy(arrKeyVersion[count_arrKeyVersion].key, str);
-                arrKeyVersion[count_arrKeyVersion].version = (curr->record->metadata[0])+1;
+    for(tok = strtok_r(columns, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        int side = join_side(join, tok, &name);
+        const char* type;
 
-                pos = count_arrKeyVersion;
-                count_arrKeyVersion++;
-            }
-            printf("array:\ntable:%s\nkey:%s\nversion:%d\n",
-                arrKeyVersion[pos].tableName, 
-                arrKeyVersion[pos].key,
-                arrKeyVersion[pos].version);
+        name = trimXX(name);
+        if(side < 0 || join->ncolumns == MAX_JOIN_COLUMNS ||
+            (type = column_type(join->sides[side].hashtable->schema, name, &size)) == NULL)
+            return -1;
 
+        join->columnSide[join->ncolumns] = side;
+        join->columnNumeric[join->ncolumns] = strcmp(type, "int") == 0;
+        join->columns[join->ncolumns++] = name;
+    }
 
-            free(curr);
+    return join->ncolumns > 0 ? 0 : -1;
+}
 
-            return 2;
-        }
 
-        // modify
-        else
-        {
-            // printf("have to modify\n");
+/**
+ * @brief Runs a JOIN, whose pairs are then in join->out
+ *
+ * @return Returns 0 on success, and -1 if a record could not be read or
+ *	   there is no memory
+ *
+ * The matching records of the side estimated to match fewer are read
+ * first, into a hash of the values they are joined on. The matching
+ * records of the other side are then read, and each is joined with the
+ * rows of the hash having its value, until the limit. Both tables are
+ * read at the same snapshot, so a change made to both between the two
+ * reads is seen in neither.
+ */
+int run_join(Join* join)
+{
+    QueryPlan plans[2];
+    QueryMatch match;
+    Snapshot snapshot;
+    int ret = 0;
+    int i;
 
-            if((record_->metadata[0] == current_list->record->metadata[0]) || record_->metadata[0]==0)
-            {
-                record_->metadata[0] = (current_list->record->metadata[0]) + 1;
-                current_list->record = record_;
+    for(i=0; i<2; i++)
+        plan_query(join->sides[i].hashtable, join->sides[i].preds, join->sides[i].count, &plans[i]);
 
-                return 3;
-            }
-            else
-            {
-                printf("versions don't match. transaction abort.\n");
+    join->build = plans[1].estimate < plans[0].estimate ? 1 : 0;
+    join->out.records = join->records;
+    join->out.keys = strdup("");
+    join->out.capacity = 1;
 
-                return 4;
-            }
-        }
-    }
+    if(join->out.keys == NULL || grow_join_hash(join) != 0)
+        return -1;
 
-    /* Insert into list */
-    if(record_ != NULL)
-    {
+    open_snapshot(&snapshot);
 
-        int version = 1;
-        bool found = false;
-        int i;
-        for(i=0; i<count_arrKeyVersion && !found; i++)
-        {
-            if(strcmp(arrKeyVersion[i].tableName, hashtable->name)==0 && 
-            strcmp(arrKeyVersion[i].key, str)==0)
-            {
-                version = arrKeyVersion[i].version;
-                found = true;
-            }
-        }
+    memset(&match, 0, sizeof match);
+    match.visit = buildRecord;
+    match.visitArg = join;
 
-        record_->metadata[0] = version;
+    if(join->limit > 0)
+        ret = read_plan_at(join->sides[join->build].hashtable, &plans[join->build], &snapshot, &match);
 
-        new_list->string = strdup(str);
-        new_list->record = record_;
-        new_list->next = hashtable->table[hashval];
-        hashtable->table[hashval] = new_list;
-	}
+    memset(&match, 0, sizeof match);
+    match.visit = probeRecord;
+    match.visitArg = join;
 
-	// the record to be deleted is not in the table
-	else
-	{
-		return 1;		
-	}
+    if(ret == 0 && join->nrows > 0)
+        ret = read_plan_at(join->sides[1 - join->build].hashtable, &plans[1 - join->build],
+            &snapshot, &match);
 
+    close_snapshot(&snapshot);
 
-    return 0;	// record inserted
+    return ret;
 }
 
 
-
 /**
-* @brief Deletes the hash table
-*
-* @param hashtable Is the pointer to the HashTable structure
-*/
-void free_table(HashTable *hashtable)
+ * @brief Frees what a JOIN allocated, and the JOIN
+ */
+void free_join(Join* join)
 {
     int i;
-    Node *list, *temp;
-
-    if (hashtable==NULL) return;
 
-    /* Free the memory for every item in the table, including the 
-     * strings themselves.
-     */
-    for(i=0; i<hashtable->size; i++) {
-        list = hashtable->table[i];
-        while(list!=NULL) {
-            temp = list;
-            list = list->next;
-            free(temp->string);
-            // free(temp->record);
-            free(temp);
-        }
+    for(i=0; i<join->nrows; i++)
+    {
+        free(join->rows[i].value);
+        free(join->rows[i].joined);
     }
 
-    /* Free the table itself */
-    free(hashtable->table);
-    free(hashtable);
+    free(join->rows);
+    free(join->buckets);
+    free(join->out.keys);
+    free(join);
 }
 
 
 /**
- * @brief Helper function that prints the list that the index points to
+ * @brief A DELETE or UPDATE of the records matching predicates
  *
- * @param head Pointer that points to top of the Node list
+ * @param plan How the matching records are read
+ * @param columns The columns an UPDATE sets, or NULL to delete the records
+ * @param keys The keys of the records that matched when they were read
+ * @param changed The number of records changed
  */
-void printList(Node* head)
+typedef struct _bulk_change_t_ {
+    HashTable* hashtable;
+    QueryPlan plan;
+    char* columns;
+    char** keys;
+    int nkeys;
+    int capacity;
+    long changed;
+} BulkChange;
+
+
+/**
+ * @brief Called for every record matching the predicates of a DELETE or
+ * UPDATE, whose key is kept
+ */
+int collectMatch(const char* key, struct storage_record* record, void* arg)
 {
-    Node* curr = head;
-    int i=0;
-    while(curr!=NULL)
+    BulkChange* bulk = arg;
+
+    if(bulk->nkeys == bulk->capacity)
     {
-        printf("%s,%s-->", curr->string, curr->record->value);
-        curr = curr->next;
+        int capacity = bulk->capacity ? bulk->capacity * 2 : 64;
+        char** keys = realloc(bulk->keys, capacity * sizeof *keys);
+
+        if(keys == NULL)
+            return -1;
+        bulk->keys = keys;
+        bulk->capacity = capacity;
     }
-    printf("\n");
+
+    if((bulk->keys[bulk->nkeys] = strdup(key)) == NULL)
+        return -1;
+
+    bulk->nkeys++;
+    return 0;
 }
 
 
 /**
- * @brief prints all records in the hashtable
- * 
- * @param hashTable_ Is a pointer to the Hashtable structure
+ * @brief Checks if a value still matches the predicates of a DELETE or
+ * UPDATE
  */
-void printAllRecords(HashTable* hashTable_)
+bool still_matches(BulkChange* bulk, char* value)
 {
-    int len = hashTable_->size;
-    // printf("%d\n", len);
     int i;
-    
-    Node* head;
 
-    for(i=0; i<len; i++)
+    for(i=0; i<bulk->plan.count; i++)
     {
-        head = hashTable_->table[i];
-        // printf("%d: ", i);
-        if(head!=NULL)
-        	printList(head);
+        if(!match_predicate(value, &bulk->plan.preds[i], bulk->plan.numeric[i]))
+            return false;
     }
+
+    return true;
 }
 
 
 /**
- * @brief Helper function that prints the list that the index points to
+ * @brief Changes the records of a hash table kept by a DELETE or UPDATE
  *
- * @param head Pointer that points to top of the Node list
+ * @return Returns 0 on success, and -1 if a record could not be read or
+ *	   changed, or there is no memory, in which case none is changed
+ *
+ * Every stripe is locked at once, in order like a COMMIT locks them. The
+ * records are checked again, since they may have changed after they were
+ * read, and the new values made, before any is changed. They are all
+ * changed with one stamp, so a snapshot sees all of them or none.
  */
-int searchRecord(Node* head, char* predicate, char** keys, char* schema)
+int change_hash_matches(BulkChange* bulk)
 {
+    HashTable* hashtable = bulk->hashtable;
+    struct storage_record** records = calloc(bulk->nkeys + 1, sizeof *records);
+    char* matched = calloc(bulk->nkeys + 1, 1);
+    int ret = records != NULL && matched != NULL ? 0 : -1;
+    int i;
 
-	char temp[1024];
-	strcpy(temp, predicate);
-	char* t1 = temp;
+    for(i=0; i<hashtable->nstripes && ret == 0; i++)
+        lock_stripe(hashtable, i, true);
 
-    printf("predicate in searchRecord: %s(%d)\n", temp, strlen(temp));
+    for(i=0; i<bulk->nkeys && ret == 0; i++)
+    {
+        Node* node = lookup_string(hashtable, bulk->keys[i]);
+        char value[MAX_VALUE_LEN];
 
-	char* first = ntt(&t1);
-	char colName[100];
-	strcpy(colName, first);
-	
-	// printf("\n");
+        if(node == NULL || node->deleted)
+            continue;
 
-	// printf("pred colName: %s\n", colName);
-	
-	char* second = ntt(&t1);
-	char operator[100];
-	strcpy(operator, second);
-	char op = operator[0];
-	
-	// printf("\n");
+        if(node->record != NULL)
+            strncpy(value, node->record->value, sizeof value);
+        else if(spill_read(hashtable->spill, node->offset, node->length, value) != 0)
+        {
+            ret = -1;
+            break;
+        }
 
-	// printf("pred operator: %c\n", op);
-    
-    // after the second call to ntt, t1 has the remaining string after
-    // the operator
-    // trimming t1
-    t1 = trimXX(t1);
+        if(!still_matches(bulk, value))
+            continue;
 
-    // printf("string : %s(%d)\n", t1, strlen(t1));
+        if(bulk->columns != NULL)
+        {
+            if((records[i] = malloc(sizeof *records[i])) == NULL)
+            {
+                ret = -1;
+                break;
+            }
 
-    // storing the trimmed version of t1 into colVal
-	char colVal[100];
-	strcpy(colVal, t1);
-	
-	// printf("\n");
+            // any version is replaced, since the stripe is held
+            strncpy(records[i]->value, value, sizeof records[i]->value);
+            records[i]->metadata[0] = 0;
 
-	printf("pred value: %s\n", colVal);
+            if(update_columns(records[i]->value, hashtable->schema, bulk->columns) != 0)
+            {
+                ret = -1;
+                break;
+            }
+        }
 
-	char* colType = colType1(schema, colName);
-	// printf("colType: %s\n", colType);
+        matched[i] = 1;
+    }
 
-	int isChar = 1;
-	if(strcmp(colType,"char")==0)
-		isChar = 0;
+    if(ret == 0)
+    {
+        long stamp = change_stamp();
 
+        for(i=0; i<bulk->nkeys; i++)
+        {
+            if(!matched[i])
+                continue;
 
-	int isNumber = isNum(colVal);
-	int pred_v;
+            int changed = add_to_bucket(hashtable, hash(hashtable, bulk->keys[i]), bulk->keys[i],
+                records[i], stamp);
 
-	if(isNumber==0)
-		pred_v = atoi(colVal);
+            // the record is kept by the table
+            if(changed == 3)
+                records[i] = NULL;
+            if(changed == 2 || changed == 3)
+                bulk->changed++;
+        }
+    }
 
-// "name bloor danforth,stops 21,kilometres 76"
+    if(records != NULL && matched != NULL)
+    {
+        for(i=hashtable->nstripes-1; i>=0; i--)
+            unlock_stripe(hashtable, i);
+    }
 
-	if(strcmp(colType,"int")==0 && isNumber!=0)
-		return -1;
+    for(i=0; records != NULL && i<bulk->nkeys; i++)
+        free(records[i]);
+    free(records);
+    free(matched);
 
-	char k[1024]="";
+    return ret;
+}
 
-    Node* curr = head;
-    while(curr!=NULL)
-    {
-    	char* val = colValue(curr->record->value, colName);
 
-    	int v;
-    	if(isChar==1)		// integer
-    	{
-    		v = atoi(val);
-
-    		if(op=='=')
-    		{
-    			if(v == pred_v)
-    			{
-    				char k1[100];
-    				sprintf(k1, "%s ", curr->string);
-    				strcat(k, k1);
-    				// printf("value: \"%s\",",curr->record->value);
-    			}
-    		}
-    		else if(op=='<')
-    		{
-				if(v < pred_v)
-				{
-					char k1[100];
-    				sprintf(k1, "%s ", curr->string);
-    				strcat(k, k1);
-
-    				// printf("value: \"%s\",",curr->record->value);
-    			}
-
-    		}
-    		else if(op=='>')
-    		{
-    			if(v > pred_v)
-    			{
-    				char k1[100];
-    				sprintf(k1, "%s ", curr->string);
-    				strcat(k, k1);
-
-    				// printf("value: \"%s\",",curr->record->value);
-    			}
-    		}
-
-    		else
-    		{
-    			return -1;
-    		}
-
-    		// printf("record val: %d\n", v);
-    		// printf("pred val : %d\n", pred_v);
-    	}
+/**
+ * @brief Runs a DELETE or UPDATE of the records matching pred
+ *
+ * @param count The number of predicates in pred
+ * @return Returns 0 on success, and -1 if a record could not be read or
+ *	   changed, or there is no memory
+ *
+ * The keys of the matching records are found like a QUERY finds them,
+ * and the records are then changed together. Only the tables on the hash
+ * table engine are changed this way.
+ */
+int change_matches(BulkChange* bulk, int count)
+{
+    QueryMatch match;
 
-    	else		// string
-    	{
-    		if(op!='=')
-    		{
-    			return -1;
-    		}
-    		else
-    		{
-    			if(strcmp(val, colVal)==0)
-    			{
-    				char k1[100];
-    				sprintf(k1, "%s ", curr->string);
-    				strcat(k, k1);
-
-    				// printf("value: \"%s\",",curr->record->value);
-    			}
-    		}
+    plan_query(bulk->hashtable, pred, count, &bulk->plan);
 
+    memset(&match, 0, sizeof match);
+    match.visit = collectMatch;
+    match.visitArg = bulk;
 
-    	}
+    if(read_plan(bulk->hashtable, &bulk->plan, &match) != 0)
+        return -1;
 
-    	// printf("val = %s\n", val);
+    return change_hash_matches(bulk);
+}
 
 
+/**
+ * @brief Frees the keys kept by a DELETE or UPDATE
+ */
+void free_bulk_change(BulkChange* bulk)
+{
+    int i;
 
-    	// printf("value: \"%s\",",curr->record->value);
-        
-        curr = curr->next;
-    }
+    for(i=0; i<bulk->nkeys; i++)
+        free(bulk->keys[i]);
+    free(bulk->keys);
+}
 
-    // char* pk = k;
 
-    // char kk[1024];
-    // strcpy(kk, *keys);
-    strcat(*keys, k);
+/**
+ * @brief The records and indexes that TRUNCATE or DROP takes out of a hash
+ * table, for a background thread to free
+ *
+ * @param table The buckets, with every node and its earlier states
+ * @param nodes The nodes by id, if the table has bitmap indexes
+ * @param versioned The ids of the keys with earlier states, or NULL
+ */
+typedef struct _detached_t_ {
+    Node **table;
+    int size;
+    int nindexes;
+    Index indexes[MAX_TABLE_INDEXES];
+    Node **nodes;
+    struct roaring *versioned;
+    TableStats *stats;
+} Detached;
 
-    // printf("keys: %s\n", k);
 
-    printf("\n");
+/**
+ * @brief Runs on a thread of its own to free what TRUNCATE or DROP took
+ * out of a table
+ */
+void *freeDetached(void *arg)
+{
+    Detached *detached = arg;
 
+    free_buckets(detached->table, detached->size, detached->nindexes);
+    free(detached->table);
+    free_indexes(detached->indexes, detached->nindexes);
+    free(detached->nodes);
+    roaring_destroy(detached->versioned);
+    free(detached->stats);
+    free(detached);
 
-    return 0;
+    return NULL;
 }
 
 
 /**
- * @brief prints all records in the hashtable
- * 
- * @param hashTable_ Is a pointer to the Hashtable structure
+ * @brief Drops a table on the LSM or lock-free engine, and frees its
+ *	  storage
+ *
+ * Once dropped is set, no command starts using the storage, and the
+ * commands already using it are waited for. The runs and logs of an LSM
+ * table are deleted, so the table does not come back when the server
+ * is started again.
  */
-void searchAllRecords(HashTable* hashTable_, char* predicate, char** keys, 
-	char* schema)
+void drop_storage(HashTable *hashtable)
 {
-    int len = hashTable_->size;
-    // printf("%d\n", len);
-    int i;
-    
-    Node* head;
+    __atomic_store_n(&hashtable->dropped, 1, __ATOMIC_SEQ_CST);
+    wait_for_users(hashtable);
 
-    char keys1[1024];
-    char* p_keys1 = keys1;
+    if(hashtable->engine == ENGINE_LSM && lsm_destroy(hashtable->lsm) != 0)
+        printf("Error deleting the files of table %s\n", hashtable->name);
+    hashtable->lsm = NULL;
 
-    for(i=0; i<len; i++)
+    lf_destroy(hashtable->lf);
+    hashtable->lf = NULL;
+}
+
+
+/**
+ * @brief Empties a table on the LSM or lock-free engine by swapping its
+ *	  storage for a new one
+ *
+ * @return Returns 0 on success, and -1 if the new storage could not be
+ *	   made. The table is left as it was if a lock-free table could not
+ *	   be made, and dropped if an LSM tree could not be opened again.
+ *
+ * Once truncating is set, the commands that start using the storage wait,
+ * and those already using it are waited for. The files of an LSM tree are
+ * deleted, and the tree opened again in the same directory. The versions
+ * of the new storage start from 1 again, and are sent raised by the
+ * version floor, which goes up by the highest version the old one sent.
+ */
+int truncate_storage(HashTable *hashtable)
+{
+    struct lf_table *lf = NULL;
+    int ret = 0;
+
+    if(hashtable->engine == ENGINE_LOCKFREE && (lf = lf_create()) == NULL)
+        return -1;
+
+    __atomic_store_n(&hashtable->truncating, 1, __ATOMIC_SEQ_CST);
+    wait_for_users(hashtable);
+
+    long top = 0;
+    int i;
+    for(i=0; i<hashtable->nstripes; i++)
     {
-        head = hashTable_->table[i];
-        // printf("%d: ", i);
-        if(head!=NULL)
+        Stripe *s = &hashtable->stripes[i];
+        if(s->topVersion > top)
+            top = s->topVersion;
+        s->topVersion = 0;
+    }
+    hashtable->versionFloor += top;
+
+    if(hashtable->engine == ENGINE_LSM)
+    {
+        if(lsm_destroy(hashtable->lsm) != 0)
+            printf("Error deleting the files of table %s\n", hashtable->name);
+
+        hashtable->lsm = lsm_open(hashtable->directory, hashtable->memtableSize);
+        if(hashtable->lsm == NULL)
         {
-        	int res = searchRecord(head, predicate, &p_keys1, schema);
-        	if(res!=0)
-        	{
-        		printf("error\n");
-        		return;
-        	}
+            printf("Error opening LSM table %s in %s\n", hashtable->name, hashtable->directory);
+            __atomic_store_n(&hashtable->dropped, 1, __ATOMIC_SEQ_CST);
+            ret = -1;
         }
     }
-    // printf("%s\n", p_keys1);
-    char tt[1024];
-    strcpy(tt, p_keys1);
+    else
+    {
+        lf_destroy(hashtable->lf);
+        hashtable->lf = lf;
+    }
+
+    pthread_mutex_lock(&hashtable->storageLock);
+    __atomic_store_n(&hashtable->truncating, 0, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&hashtable->storageChanged);
+    pthread_mutex_unlock(&hashtable->storageLock);
+
+    return ret;
+}
+
+
+/**
+ * @brief Deletes every record of a table, for TRUNCATE, and drops the
+ *	  table as well for DROP
+ *
+ * @param drop Whether the table is dropped
+ * @return Returns 0 on success, and -1 if there is no memory or a record
+ *	   could not be read, in which case a hash table is left as it was,
+ *	   and is not dropped
+ *
+ * The buckets, indexes and bitmaps of a hash table are swapped for empty
+ * ones while every stripe is held, so the stripes are held for the same
+ * short time however many records there are. The old ones are freed on
+ * a thread of its own. The spill file is emptied, and appended to from
+ * the start again. A cursor open on the table reads no more of its
+ * records. The deleted keys take their versions with them, so the version
+ * floor is raised by the changes made since it was last raised, which is
+ * at least the highest version of any key.
+ *
+ * The storage of the other engines is swapped by truncate_storage, and
+ * dropped by drop_storage.
+ */
+int truncate_table(HashTable *hashtable, bool drop)
+{
+    Index indexes[MAX_TABLE_INDEXES];
+    int failed = 0;
+    int i;
+
+    if(hashtable->engine != ENGINE_HASH && drop)
+    {
+        drop_storage(hashtable);
+        return 0;
+    }
+
+    if(hashtable->engine != ENGINE_HASH)
+        return truncate_storage(hashtable);
+
+    Detached *detached = calloc(1, sizeof *detached);
+    Node **table = calloc(hashtable->size, sizeof *table);
+    struct roaring *versioned = hashtable->versioned != NULL ? roaring_create() : NULL;
+
+    // empty indexes of the same kinds, made before any stripe is held
+    for(i=0; i<hashtable->nindexes; i++)
+    {
+        Index *index = &hashtable->indexes[i];
+
+        indexes[i] = *index;
+        indexes[i].failed = 0;
+        indexes[i].tree = index->tree != NULL ? btree_create() : NULL;
+        indexes[i].hash = index->hash != NULL ? hindex_create() : NULL;
+        indexes[i].bitmap = index->bitmap != NULL ? bitmap_index_create() : NULL;
+        if(indexes[i].tree == NULL && indexes[i].hash == NULL && indexes[i].bitmap == NULL)
+            failed = 1;
+    }
+
+    if(failed || detached == NULL || table == NULL || (hashtable->versioned != NULL && versioned == NULL))
+    {
+        free_indexes(indexes, hashtable->nindexes);
+        roaring_destroy(versioned);
+        free(table);
+        free(detached);
+        return -1;
+    }
 
-    // printf("%s\n", tt);
+    for(i=0; i<hashtable->nstripes; i++)
+        lock_stripe(hashtable, i, true);
+    pthread_rwlock_wrlock(&hashtable->nodesLock);
+    pthread_mutex_lock(&hashtable->versionedLock);
+
+    detached->table = hashtable->table;
+    detached->size = hashtable->size;
+    detached->nindexes = hashtable->nindexes;
+    memcpy(detached->indexes, hashtable->indexes, hashtable->nindexes * sizeof *indexes);
+    detached->nodes = hashtable->nodes;
+    detached->versioned = hashtable->versioned;
+    detached->stats = hashtable->stats;
+
+    hashtable->table = table;
+    memcpy(hashtable->indexes, indexes, hashtable->nindexes * sizeof *indexes);
+    hashtable->nodes = NULL;
+    hashtable->nnodes = 0;
+    hashtable->nodesCapacity = 0;
+    hashtable->versioned = versioned;
+    hashtable->stats = NULL;
+    __atomic_add_fetch(&hashtable->stripes[0].changes, 1, __ATOMIC_RELAXED);
+
+    // every change of a version is counted, under the stripe of the key
+    long changes = table_changes(hashtable);
+    hashtable->versionFloor += changes - hashtable->floorChanges;
+    hashtable->floorChanges = changes;
+
+    // the old values are no longer read, and a read of the file started
+    // before finds truncations changed. A file that could not be emptied
+    // is appended to as before.
+    if(hashtable->spill != NULL)
+        spill_reset(hashtable->spill);
+    hashtable->truncations++;
+
+    // a command holding the table from before waits for a stripe, and
+    // then finds it dropped
+    if(drop)
+        __atomic_store_n(&hashtable->dropped, 1, __ATOMIC_RELEASE);
+
+    // read by other threads without the lock
+    for(i=0; i<hashtable->nstripes; i++)
+    {
+        Stripe *s = &hashtable->stripes[i];
+        __atomic_store_n(&s->resident, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->spilled, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->versions, 0, __ATOMIC_RELAXED);
+        s->versioned = NULL;
+    }
 
+    pthread_mutex_unlock(&hashtable->versionedLock);
+    pthread_rwlock_unlock(&hashtable->nodesLock);
+    for(i=hashtable->nstripes-1; i>=0; i--)
+        unlock_stripe(hashtable, i);
 
-    strcpy(*keys, tt);
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, freeDetached, detached) == 0)
+        pthread_detach(thread);
+    else
+        freeDetached(detached);
 
-    // printf("%s\n", *keys);
-  	
+    return 0;
 }
 
 
@@ -1293,9 +6579,9 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
 	char cmdCopy[MAX_CMD_LEN];
 	strncpy(cmdCopy, cmd, sizeof cmdCopy);
 	char *cmd1;
+	char *cmdSave;
 	// storing the command(i.e AUTH/GET/SET) in cmd1
-	cmd1 = strtok(cmdCopy,";");
-	printf("%s\n", cmd1);
+	cmd1 = strtok_r(cmdCopy, ";", &cmdSave);
 
 	char username_[MAX_USERNAME_LEN];
 	char password_[MAX_ENC_PASSWORD_LEN];
@@ -1319,8 +6605,8 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
 	
 	if(strcmp(cmd1, "AUTH") == 0)
 	{
-		strcpy(username_, strtok(NULL, ";"));
-		strcpy(password_, strtok(NULL, ";"));
+		strcpy(username_, strtok_r(NULL, ";", &cmdSave));
+		strcpy(password_, strtok_r(NULL, ";", &cmdSave));
 		// printf("username: %s, password: %s\n", username_, password_);
 
 		char out[50];
@@ -1355,10 +6641,13 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
 
 	}
 
+	// GET;<table>;<key>[;<column>,...] replies with the value, or only
+	// the columns listed, and the version
 	else if(strcmp(cmd1, "GET") == 0)
 	{
-		strcpy(table_, strtok(NULL, ";"));
-		strcpy(key_, strtok(NULL, ";"));
+		strcpy(table_, strtok_r(NULL, ";", &cmdSave));
+		strcpy(key_, strtok_r(NULL, ";", &cmdSave));
+		char* columns = strtok_r(NULL, ";", &cmdSave);
 		// printf("table: %s, key: %s\n", table_, key_);
 
 
@@ -1367,37 +6656,50 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
 		int i;
 		for(i=0; i<numberOfTables; i++)
 		{
-			if(strcmp(allTables[i]->name, table_)==0)
+			if(!table_dropped(allTables[i]) && strcmp(allTables[i]->name, table_)==0)
 			{
 				// table found
 				my_hash_table = allTables[i];
 			}
 		}
 
+		Projection projection;
+
 		if(my_hash_table == NULL)
 		{
 			// printf("table not found.\n");
 			sendall(sock, tableNotFound, strlen(tableNotFound));
 		}
 
+		else if(columns != NULL && parse_projection(columns, my_hash_table->schema, &projection) != 0)
+		{
+			sendall(sock, invalidParameter, strlen(invalidParameter));
+		}
+
 		else
 		{
 
-			Node* l = lookup_string(my_hash_table, key_);
+			struct storage_record r;
+			int notFound = get_record(my_hash_table, key_, &r);
 
 
 			// printAllRecords(my_hash_table);
 
 
-			if(l == NULL)
+			if(notFound)
 			{
         		// printf("Record not Found.\n");
         		sendall(sock, recordNotFound, strlen(recordNotFound));
         	}
 		    else
 		    {
+		        char projected[MAX_VALUE_LEN];
+		        if(columns != NULL)
+		        	project_value(&projection, r.value, projected, sizeof projected);
+
 		        // sprintf(recordDetails, "%s\n",l->record->value);
-		        sprintf(recordDetails, "%s;%d\n",l->record->value, l->record->metadata[0]);
+		        sprintf(recordDetails, "%s;%d\n", columns != NULL ? projected : r.value,
+		        	(int) r.metadata[0]);
                 
 		        // printf("%s\n", recordDetails);
 
@@ -1414,13 +6716,12 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
         char value1[MAX_VALUE_LEN];
         char clientVersion[10];
 
-        strcpy(table_, strtok(NULL, ";"));
-        strcpy(key_, strtok(NULL, ";"));
-        strcpy(value1, strtok(NULL, ";"));
-        strcpy(clientVersion, strtok(NULL, ";"));
+        strcpy(table_, strtok_r(NULL, ";", &cmdSave));
+        strcpy(key_, strtok_r(NULL, ";", &cmdSave));
+        strcpy(value1, strtok_r(NULL, ";", &cmdSave));
+        strcpy(clientVersion, strtok_r(NULL, ";", &cmdSave));
         int clientVersion_int = atoi(clientVersion);
         
-        printf("table: %s, key: %s, value: %s, c_version: %d\n", table_, key_, value1, clientVersion_int);
         // printf("value: %s\n", value_);
 
         HashTable* my_hash_table = NULL;
@@ -1430,7 +6731,7 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
         for(i=0; i<numberOfTables; i++)
         {
             // printf("%s, %s\n", allTables[i], table_);
-            if(strcmp(allTables[i]->name, table_)==0)
+            if(!table_dropped(allTables[i]) && strcmp(allTables[i]->name, table_)==0)
             {
                 // table found
                 my_hash_table = allTables[i];
@@ -1446,7 +6747,6 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
         else
         {
             // printf("table found.\n");
-            char *res[2] = {"successful", "unsuccessful"};
 
             char schema[MAX_CONFIG_LINE_LEN];
             strncpy(schema, my_hash_table->schema, sizeof schema);
@@ -1466,8 +6766,7 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
 
             // printf("%s\n", schema);
 
-            char* x = format(value1);
-            strcpy(value_, x);
+            format(value1, value_);
 
             // printf("value_ = %s\n", value_);
 
@@ -1475,12 +6774,17 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
 
             // printf("result = %d\n", result);
 
-            // printf("%s\n", res[result]);
-
 
 
             struct storage_record* record_p;
 
+            // LSM and lock-free tables copy the record, so it doesn't need
+            // to outlive the command
+            struct storage_record copiedRecord;
+
+            // Hash tables keep the record they are given
+            struct storage_record* newRecord = NULL;
+
             int retVal_addString;
 
 
@@ -1513,12 +6817,23 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
                 }
 
 
-                strncpy(rec1[recCt].value, value_, sizeof rec1[recCt].value);
-                record_p = &(rec1[recCt]);
-                record_p->metadata[0] = clientVersion_int;
-
+                if(my_hash_table->engine != ENGINE_HASH)
+                {
+                    record_p = &copiedRecord;
+                }
+                else
+                {
+                    newRecord = malloc(sizeof(struct storage_record));
+                    if(newRecord == NULL)
+                    {
+                        sendall(sock, invalidParameter, strlen(invalidParameter));
+                        return 0;
+                    }
+                    record_p = newRecord;
+                }
 
-                recCt++;
+                strncpy(record_p->value, value_, sizeof record_p->value);
+                record_p->metadata[0] = clientVersion_int;
             }
 
             // if(my_hash_table == NULL)
@@ -1528,6 +6843,10 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
 
             retVal_addString = add_string(my_hash_table, key_, record_p);
 
+            // the record was not stored in the table
+            if(retVal_addString != 0 && retVal_addString != 3)
+                free(newRecord);
+
             // printf("ret val = %d\n", retVal_addString);
 
 
@@ -1589,22 +6908,16 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
     }
 
 
-	else if(strcmp(cmd1, "QUERY") == 0)
+	else if(strcmp(cmd1, "STATS") == 0)
 	{
+		strcpy(table_, strtok_r(NULL, ";", &cmdSave));
 
-		char predicates[MAX_CONFIG_LINE_LEN];
-
-		strcpy(table_, strtok(NULL, ";"));
-		strcpy(predicates, strtok(NULL, ";"));
-		
 		HashTable* my_hash_table = NULL;
 
 		int i;
-		// printf("%d\n", numberOfTables);
 		for(i=0; i<numberOfTables; i++)
 		{
-			// printf("%s, %s\n", allTables[i], table_);
-			if(strcmp(allTables[i]->name, table_)==0)
+			if(!table_dropped(allTables[i]) && strcmp(allTables[i]->name, table_)==0)
 			{
 				// table found
 				my_hash_table = allTables[i];
@@ -1612,328 +6925,583 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
 		}
 
 		if(my_hash_table == NULL)
-		{
-			// printf("table not found.\n");
-			// printf("%d\n", strlen(tableNotFound));
-			sendall(sock, tableNotFound, strlen(tableNotFound));
-		}
-
-		else
-		{
-
-			char schema[MAX_CONFIG_LINE_LEN];
-			strncpy(schema, my_hash_table->schema, sizeof schema);
-
-			// cshar pred1[MAX_CONFIG_LINE_LEN] = "stops > 24";
-
-			// char keys[MAX_CONFIG_LINE_LEN];
-
-			// char * keys1 = keys;
-
-			// searchAllRecords(my_hash_table, pred1, &keys1, schema);
-
-			// printf("keys: %s\n", keys1);
-
-
-			char predicates_copy[50];
-
-    		// predicates = " name = bloor danforth, stops > 12"
-
-		    strncpy(predicates_copy, predicates, sizeof predicates_copy);
-
-		    // printf("%s(%d)\n", predicates_copy, strlen(predicates_copy));
-		    char* pp = predicates_copy;
-
-		    char* pp_tok = strtok(pp, ",");
-		    //pp = strtok(NULL, '\0');
-
-		    int x = 0;
-
-		    while(pp_tok)
-		    {
+		{
+			sendall(sock, tableNotFound, strlen(tableNotFound));
+		}
 
-		        // printf("%s\n", pp_tok);
-		        char trimmed_pp_tok[50];
-		        strcpy(trimmed_pp_tok, pp_tok);
+		else
+		{
+			long resident, spilled, lockWaits;
+			table_counts(my_hash_table, &resident, &spilled, &lockWaits);
 
-		        char* p_trimmed_pp_tok = trimmed_pp_tok;
-		        p_trimmed_pp_tok = trimXX(trimmed_pp_tok);
-		        // trimmed_pp_tok is not modified
-		        char temp[50];
-		        strcpy(temp, p_trimmed_pp_tok);
+			// the memtables are in memory, the runs are on disk
+			if(my_hash_table->engine != ENGINE_HASH && enter_storage(my_hash_table, 0))
+			{
+				if(my_hash_table->engine == ENGINE_LSM)
+					lsm_stats(my_hash_table->lsm, &resident, &spilled);
+				else
+					resident = lf_count(my_hash_table->lf);
+				leave_storage(my_hash_table, 0);
+			}
 
-		        // printf("%s(%d)\n", p_trimmed_pp_tok, strlen(p_trimmed_pp_tok));
+			sprintf(recordDetails, "resident %ld,spilled %ld,lock_waits %ld,versions %ld\n",
+				resident, spilled, lockWaits, table_versions(my_hash_table));
+			sendall(sock, recordDetails, strlen(recordDetails));
+		}
+	}
 
-		        char* value;
-		        char* name;
-		        char operator;
+	else if(strcmp(cmd1, "INCR") == 0 || strcmp(cmd1, "DECR") == 0 || 
+		strcmp(cmd1, "MIN") == 0 || strcmp(cmd1, "MAX") == 0)
+	{
+		char *table = strtok_r(NULL, ";", &cmdSave);
+		char *key = strtok_r(NULL, ";", &cmdSave);
+		char *column = strtok_r(NULL, ";", &cmdSave);
+		char *operand = strtok_r(NULL, ";", &cmdSave);
+		char *end = NULL;
+		long value = operand ? strtol(operand, &end, 10) : 0;
 
-		        tokens(trimmed_pp_tok, &p_trimmed_pp_tok, &name, &operator, &value);
+		HashTable *my_hash_table = find_table(table);
+		IntOp op = { column, cmd1, value, 0 };
+		int version;
 
-		        // printf("Name: %s\n", name);
-		        // printf("Operator: %c\n", operator);
-		        // printf("Value: %s\n", value);
+		if(my_hash_table == NULL)
+			sendall(sock, tableNotFound, strlen(tableNotFound));
+		else if(key == NULL || column == NULL || end == operand || *end != '\0' ||
+			value < INT_MIN || value > INT_MAX)
+			sendall(sock, invalidParameter, strlen(invalidParameter));
+		else
+		{
+			int ret = change_record(my_hash_table, key, apply_int_op, &op, 0, &version);
 
-		        pred[x].name_ = name;
-		        pred[x].operator_ = operator;
-		        pred[x].value_ = value;
+			if(ret == 1)
+				sendall(sock, recordNotFound, strlen(recordNotFound));
+			else if(ret == 2)
+				sendall(sock, invalidParameter, strlen(invalidParameter));
+			else
+			{
+				sprintf(recordDetails, "%ld;%d\n", op.result, version);
+				sendall(sock, recordDetails, strlen(recordDetails));
+			}
+		}
+	}
 
-		        pp_tok = strtok(NULL, ",");
-		        x++;
-		    }
+	// DELETE;<table>;where <predicates> and UPDATE;<table>;where
+	// <predicates>;<columns> reply with the number of records changed.
+	// The other engines have no lock to change the records under
+	// together, so only hash tables take them.
+	else if(strcmp(cmd1, "DELETE") == 0 || (strcmp(cmd1, "UPDATE") == 0 && changesMatches(cmd)))
+	{
+		char *table = strtok_r(NULL, ";", &cmdSave);
+		char *where = strtok_r(NULL, ";", &cmdSave);
+		char *columns = strcmp(cmd1, "UPDATE") == 0 ? strtok_r(NULL, ";", &cmdSave) : NULL;
+		BulkChange bulk;
+		int x = -1;
+
+		memset(&bulk, 0, sizeof bulk);
+		bulk.hashtable = find_table(table);
+		bulk.columns = columns;
+
+		// the columns are checked before any record is read
+		if(bulk.hashtable != NULL && where != NULL && strncmp(where, "where ", 6) == 0 &&
+			(columns == NULL ? strcmp(cmd1, "DELETE") == 0 :
+			update_columns(NULL, bulk.hashtable->schema, columns) == 0) &&
+			strtok_r(NULL, ";", &cmdSave) == NULL)
+			x = parse_predicates(where + 6, bulk.hashtable->schema);
+
+		if(bulk.hashtable == NULL)
+			sendall(sock, tableNotFound, strlen(tableNotFound));
+		else if(x <= 0 || bulk.hashtable->engine != ENGINE_HASH)
+			sendall(sock, invalidParameter, strlen(invalidParameter));
+		else if(change_matches(&bulk, x) != 0)
+			sendall(sock, "fail\n", 5);
+		else
+		{
+			sprintf(recordDetails, "%ld\n", bulk.changed);
+			sendall(sock, recordDetails, strlen(recordDetails));
+		}
 
-		    int p;
-		    int invalid = 0;
-		    for(p=0;p<x && invalid==0;p++)
-		    {
-		    	char n1[100];
-		        strcpy(n1, pred[p].name_);
-		        printf("n1: %s\n", n1);
+		free_bulk_change(&bulk);
+	}
 
-		       	char n2;
-		        n2 = pred[p].operator_;
-		        printf("n2: %c\n", n2);
+	// TRUNCATE;<table> deletes every record of a table, and DROP;<table>
+	// the table as well, which commands no longer find
+	else if(strcmp(cmd1, "TRUNCATE") == 0 || strcmp(cmd1, "DROP") == 0)
+	{
+		char *table = strtok_r(NULL, ";", &cmdSave);
+		HashTable *my_hash_table = find_table(table);
+		int drop = strcmp(cmd1, "DROP") == 0;
 
-		       	char n3[100];
-		        strcpy(n3, pred[p].value_);
-		        printf("n3: %s\n", n3);
+		if(my_hash_table == NULL)
+			sendall(sock, tableNotFound, strlen(tableNotFound));
+		else if(strtok_r(NULL, ";", &cmdSave) != NULL)
+			sendall(sock, invalidParameter, strlen(invalidParameter));
+		else
+		{
+			if(truncate_table(my_hash_table, drop) != 0)
+				sendall(sock, "fail\n", 5);
+			else if(drop)
+				sendall(sock, "tableDropped\n", 13);
+			else
+				sendall(sock, "tableTruncated\n", 15);
+		}
+	}
 
+	else if(strcmp(cmd1, "UPDATE") == 0)
+	{
+		char *table = strtok_r(NULL, ";", &cmdSave);
+		char *key = strtok_r(NULL, ";", &cmdSave);
+		char *columns = strtok_r(NULL, ";", &cmdSave);
+		char *expected = strtok_r(NULL, ";", &cmdSave);
 
-		        char sch1[100];
-		        strcpy(sch1, schema);
-		        // printf("sch1: %s\n", sch1);
+		HashTable *my_hash_table = find_table(table);
+		int version;
 
-		        // checking if column is in schema
-		        int rr = colInSchema(sch1, n1);
+		if(my_hash_table == NULL)
+			sendall(sock, tableNotFound, strlen(tableNotFound));
+		else if(key == NULL || columns == NULL)
+			sendall(sock, invalidParameter, strlen(invalidParameter));
+		else
+		{
+			int ret = change_record(my_hash_table, key, update_columns, columns,
+				expected ? atoi(expected) : 0, &version);
+
+			if(ret == 1)
+				sendall(sock, recordNotFound, strlen(recordNotFound));
+			else if(ret == 2)
+				sendall(sock, invalidParameter, strlen(invalidParameter));
+			else if(ret == 4)
+				sendall(sock, transactionAborted, strlen(transactionAborted));
+			else
+				sendall(sock, recordModified, strlen(recordModified));
+		}
+	}
 
-		       	if(rr==1)
-		       	{
-		       		invalid = 1;
-		       		continue;
-		       	}
+	else if(strcmp(cmd1, "COMMIT") == 0)
+	{
+		char *reply = commit_transaction(&cmdSave);
+		sendall(sock, reply, strlen(reply));
+	}
 
-		       	char* ss = colType1(schema, n1);
+	else if(strcmp(cmd1, "QUERY") == 0 || strcmp(cmd1, "EXPLAIN") == 0)
+	{
+		char* table = strtok_r(NULL, ";", &cmdSave);
+		char* predicates = strtok_r(NULL, ";", &cmdSave);
+		char* limitText = strtok_r(NULL, ";", &cmdSave);
+		char* options[3];
+
+		options[0] = strtok_r(NULL, ";", &cmdSave);
+		options[1] = options[0] != NULL ? strtok_r(NULL, ";", &cmdSave) : NULL;
+		options[2] = options[1] != NULL ? strtok_r(NULL, ";", &cmdSave) : NULL;
+
+		// QUERY;<table>;<predicates>[;<limit>[;count][;order by <column> [asc|desc]]
+		// [;records [<column>,...]]], with the options in any order
+		long limit = LONG_MAX;
+		int countAll = 0;
+		int badLimit = (limitText != NULL && (isNum(limitText) != 0 || atol(limitText) < 0)) ||
+			strtok_r(NULL, ";", &cmdSave) != NULL;
+		char* orderBy = NULL;
+		int descending = 0;
+		int records = 0;
+		Projection projection;
+		Projection* projected = NULL;
+
+		if(limitText != NULL && !badLimit)
+			limit = atol(limitText);
 
-				int isChar1 = 1;
-				if(strcmp(ss,"char")==0)
-					isChar1 = 0;	// is string
+		HashTable* my_hash_table = NULL;
 
+		int i;
+		for(i=0; i<numberOfTables && table != NULL; i++)
+		{
+			if(!table_dropped(allTables[i]) && strcmp(allTables[i]->name, table)==0)
+			{
+				// table found
+				my_hash_table = allTables[i];
+			}
+		}
 
-				int isNumber1 = isNum(n3);	//0: int, 1: char*
+		for(i=0; i<3 && options[i] != NULL && my_hash_table != NULL; i++)
+		{
+			if(strcmp(options[i], "count") == 0 && !countAll)
+				countAll = 1;
 
-				if(isChar1==0) //0: string, 1: int
-				{
-					if(n2!='=')
-						invalid = 1;
-				}
-				else		// column is int
+			// the records, or only some of their columns
+			else if(strncmp(options[i], "records", 7) == 0 && !records &&
+				(options[i][7] == '\0' || options[i][7] == ' '))
+			{
+				records = 1;
+				if(options[i][7] == ' ')
 				{
-					if(n2!='=' && n2!='<' && n2!='>')
-					{
-						invalid = 1;
-					} 
-
-					else if(isNumber1==1)
-					{
-						invalid = 1;
-					}
+					projected = &projection;
+					if(parse_projection(options[i] + 8, my_hash_table->schema, projected) != 0)
+						badLimit = 1;
 				}
+			}
 
+			else if(orderBy != NULL ||
+				parse_order(options[i], my_hash_table->schema, &orderBy, &descending) != 0)
+				badLimit = 1;
+		}
 
-		    }
-
-
-		    if(invalid==1)
-		    {
-		    	sendall(sock, invalidParameter, strlen(invalidParameter));
-		    }
-
-			else
-			{
-			    Keys arrKeys[10];
-
-			    int a;
-	            char pred_str[1024];
+		int x = -1;
+		if(my_hash_table != NULL && predicates != NULL)
+			x = parse_predicates(predicates, my_hash_table->schema);
 
-	            char keys[MAX_CONFIG_LINE_LEN];
-	            char * keys1 = keys;
+		if(my_hash_table == NULL)
+		{
+			sendall(sock, tableNotFound, strlen(tableNotFound));
+		}
 
-	            char allKeys[x][1024];
-	            char empty[10] ="empty";
+		else if(x < 0 || badLimit)
+		{
+			sendall(sock, invalidParameter, strlen(invalidParameter));
+		}
 
-	            int i;
-	            for(i=0; i<10; i++)
-	            {
-	                strcpy(arrKeys[i].key, empty);
-	                arrKeys[i].count = 0;
+		// the predicates are checked on the records the plan reads
+		else
+		{
+			QueryPlan plan;
+			plan_query(my_hash_table, pred, x, &plan);
 
-	                // printf("%s\n", arrKeys[i].key);
-	            }
+			if(orderBy != NULL)
+				plan_order(my_hash_table, &plan, orderBy, descending, limit, countAll);
 
+			if(strcmp(cmd1, "EXPLAIN") == 0)
+			{
+				char description[MAX_CMD_LEN];
+				describe_plan(my_hash_table, &plan, description, sizeof description - 1);
+				strcat(description, "\n");
+				sendall(sock, description, strlen(description));
+			}
 
+			// the reply is "<count> <key> <key> ...", with the keys up to
+			// the limit, and the count of every match with "count". With
+			// "records" the count is on a line of its own, followed by a
+			// line of "<key> <value>" for every key. It is sent at once,
+			// so it does not wait for the client to acknowledge a part of
+			// it.
+			else
+			{
+				char* keys = NULL;
+				char* reply = NULL;
+				long found;
 
-			    for(a = 0; a < x; a++) 
-	            {
-			        // printf("Struct name: %s\n", pred[a].name_);
-			        // printf("Struct operator: %c\n", pred[a].operator_);
-			        // printf("Struct value: %s\n", pred[a].value_);
-			        
-			        sprintf(pred_str, "%s %c %s",pred[a].name_, pred[a].operator_, pred[a].value_);
-			        // printf("%s\n", pred_str);
+				if(run_plan(my_hash_table, &plan, limit, countAll, records, projected,
+					&keys, &found) == 0 && (reply = malloc(strlen(keys) + 32)) != NULL)
+				{
+					if(*keys == '\0')
+						sprintf(reply, "%ld\n", found);
+					else
+						sprintf(reply, records ? "%ld\n%s\n" : "%ld %s\n", found, keys);
+				}
 
-			        searchAllRecords(my_hash_table, pred_str, &keys1, schema);
+				if(reply != NULL)
+					sendall(sock, reply, strlen(reply));
+				else
+					sendall(sock, "fail\n", 5);
+				free(reply);
+				free(keys);
+			}
+		}
+	}
 
-	                keys1 = keys1;
+	// OPEN;<table>;<predicates>[;records] replies with the id of a cursor
+	else if(strcmp(cmd1, "OPEN") == 0)
+	{
+		char* table = strtok_r(NULL, ";", &cmdSave);
+		char* predicates = strtok_r(NULL, ";", &cmdSave);
+		char* mode = strtok_r(NULL, ";", &cmdSave);
 
-			        // printf("keys: %s\n", keys1);
+		HashTable* my_hash_table = NULL;
 
-	                strncpy(allKeys[a], keys1, sizeof allKeys[a]);
+		int i;
+		for(i=0; i<numberOfTables && table != NULL; i++)
+		{
+			if(!table_dropped(allTables[i]) && strcmp(allTables[i]->name, table)==0)
+				my_hash_table = allTables[i];
+		}
 
-	                // printf("allkeys[%d]: %s\n", a, allKeys[a]);
+		// the cursor keeps the text its predicates point into
+		char* text = predicates != NULL ? strdup(predicates) : NULL;
+		int x = -1;
+		if(my_hash_table != NULL && text != NULL &&
+			(mode == NULL || strcmp(mode, "records") == 0))
+			x = parse_predicates(text, my_hash_table->schema);
 
-			    }
+		if(my_hash_table == NULL)
+		{
+			free(text);
+			sendall(sock, tableNotFound, strlen(tableNotFound));
+		}
 
-	            int ct = 0;
+		else if(x < 0)
+		{
+			free(text);
+			sendall(sock, invalidParameter, strlen(invalidParameter));
+		}
 
-	            char copy[1024];
-	            char* ch;
+		else
+		{
+			expire_cursors(params_->cursor_timeout);
 
-	            for (i = 0; i < 10; i++)
-	            {
+			int id = open_cursor(sock, my_hash_table, text, x, mode != NULL);
+			char reply[32];
 
-	                strncpy(copy, allKeys[i], sizeof copy);
+			if(id < 0)
+				snprintf(reply, sizeof reply, "fail\n");
+			else
+				snprintf(reply, sizeof reply, "%d\n", id);
+			sendall(sock, reply, strlen(reply));
+		}
+	}
 
-	                // printf("copy=%s\n", copy);
+	// FETCH;<cursor>;<count> replies like QUERY, with at most count keys,
+	// or with the count and then a line per record. A count of 0 is the
+	// end of the cursor.
+	else if(strcmp(cmd1, "FETCH") == 0)
+	{
+		Cursor* cursor = find_cursor(sock, strtok_r(NULL, ";", &cmdSave));
+		char* countText = strtok_r(NULL, ";", &cmdSave);
 
-	                ch = strtok(copy, " ");
+		if(cursor == NULL || countText == NULL || isNum(countText) != 0 || atol(countText) <= 0)
+		{
+			sendall(sock, invalidParameter, strlen(invalidParameter));
+		}
 
-	                // printf("ch=%s\n", ch);
+		else
+		{
+			char* page = NULL;
+			char* reply = NULL;
+			long fetched;
 
-	                // ch = strtok(NULL, " ");
-	                // printf("ch=%s\n", ch);
-	                while(ch)
-	                {
-	                    // printf("ch=%s, ", ch);
+			if(fetch_cursor(cursor, atol(countText), &page, &fetched) == 0 &&
+				(reply = malloc(strlen(page) + 32)) != NULL)
+			{
+				if(fetched == 0)
+					sprintf(reply, "0\n");
+				else
+					sprintf(reply, cursor->pending.records ? "%ld\n%s\n" : "%ld %s\n", fetched, page);
+			}
 
+			if(reply != NULL)
+				sendall(sock, reply, strlen(reply));
+			else
+				sendall(sock, "fail\n", 5);
+			free(reply);
+			free(page);
+		}
+	}
 
-	                    char temp[10];
-	                    strcpy(temp, ch);
-	                    // printf("temp=%s\n", temp);
+	else if(strcmp(cmd1, "CLOSE") == 0)
+	{
+		Cursor* cursor = find_cursor(sock, strtok_r(NULL, ";", &cmdSave));
 
+		if(cursor == NULL)
+		{
+			sendall(sock, invalidParameter, strlen(invalidParameter));
+		}
 
-	                    int inserted = 0;
-	                    int j;
-	                    for(j=0; j<10 && inserted==0; j++)
-	                    {
-	                        // printf("temp=%s\n", temp);
+		else
+		{
+			close_cursor(cursor);
+			sendall(sock, "cursorClosed\n", 13);
+		}
+	}
 
-	                        if(strcmp(arrKeys[j].key, "empty")==0)
-	                        {
-	                            strcpy(arrKeys[j].key, temp);
-	                            arrKeys[j].count = 1;
-	                            inserted = 1;
+	// AGGREGATE;<table>;<aggregates>[;<predicates>] replies with the
+	// aggregates of the matching records, separated by spaces, and
+	// GROUP;<table>;<columns>;<aggregates>[;<predicates>] with those of
+	// each group of them (see describe_groups)
+	else if(strcmp(cmd1, "AGGREGATE") == 0 || strcmp(cmd1, "GROUP") == 0)
+	{
+		int grouped = strcmp(cmd1, "GROUP") == 0;
+		char* table = strtok_r(NULL, ";", &cmdSave);
+		char* columns = grouped ? strtok_r(NULL, ";", &cmdSave) : NULL;
+		char* aggregates = strtok_r(NULL, ";", &cmdSave);
+		char* predicates = strtok_r(NULL, ";", &cmdSave);
 
-	                            // printf("%s\n", arrKeys[j].key);
-	                        }
-	                        else
-	                        {
+		HashTable* my_hash_table = NULL;
 
-	                            // printf("not empty\n");
-	                            if(strcmp(arrKeys[j].key, temp)==0)
-	                            {
-	                                // printf("matches\n");
-	                                arrKeys[j].count = arrKeys[j].count + 1;
-	                                inserted = 1;
+		int i;
+		for(i=0; i<numberOfTables && table != NULL; i++)
+		{
+			if(!table_dropped(allTables[i]) && strcmp(allTables[i]->name, table)==0)
+				my_hash_table = allTables[i];
+		}
 
-	                                // printf("%s\n", arrKeys[j].key);
-	                            }
+		AggregateSpec spec;
+		Aggregation aggregation;
+		int x = -1;
 
+		memset(&aggregation, 0, sizeof aggregation);
+		aggregation.spec = &spec;
 
-	                        }
+		if(my_hash_table != NULL && aggregates != NULL &&
+			(!grouped || (columns != NULL &&
+			parse_group_columns(columns, my_hash_table->schema, &aggregation) == 0)) &&
+			parse_aggregates(aggregates, my_hash_table->schema, &spec) == 0)
+			x = predicates != NULL ? parse_predicates(predicates, my_hash_table->schema) : 0;
 
-	                    }
+		if(my_hash_table == NULL)
+		{
+			sendall(sock, tableNotFound, strlen(tableNotFound));
+		}
 
-	                    ch = strtok(NULL, " ");
-	                }
-	                printf("\n");
+		else if(x < 0)
+		{
+			sendall(sock, invalidParameter, strlen(invalidParameter));
+		}
 
-	                // printf("%s\n", copy);
+		// the matching records are aggregated as the plan reads them,
+		// into a hash of the groups for a GROUP
+		else
+		{
+			QueryPlan plan;
+			QueryMatch match;
+			char reply[MAX_CMD_LEN];
+			char* groups = NULL;
+			size_t len = 0;
 
-	                // printf("%s\n", allKeys[i]);
-	   
+			plan_query(my_hash_table, pred, x, &plan);
 
-	            }
+			memset(&match, 0, sizeof match);
+			match.visit = aggregateRecord;
+			match.visitArg = &aggregation;
 
-	            char arr[100]="";
-	            char t1[10];
+			int ret = read_plan(my_hash_table, &plan, &match);
 
-	            for(i=0; i<10; i++)
-	            {
-	                // arrKeys[i].key = "empty";
-	                // arrKeys[i].count = 0;
-	                if(strcmp(arrKeys[i].key, "empty")!=0 && arrKeys[i].count>x)
-	                {
-	                    // printf("key: %s, count: %d\n", arrKeys[i].key, arrKeys[i].count);
-	                    sprintf(t1, "%s ",arrKeys[i].key);
-	                    strcat(arr,t1);
-	                }
-	                else if(strcmp(arrKeys[i].key, "empty")!=0 && x==1)
-	                {
+			if(ret == 0 && grouped)
+				groups = describe_groups(&aggregation, &len);
 
-	                	// printf("key: %s, count: %d\n", arrKeys[i].key, arrKeys[i].count);
-	                    sprintf(t1, "%s ",arrKeys[i].key);
-	                    strcat(arr,t1);
-	                }
-	            }  
-	   			
-	   			char arr1[100];
+			if(groups != NULL)
+				sendall(sock, groups, len);
+			else
+			{
+				if(ret != 0 || grouped)
+					snprintf(reply, sizeof reply, "fail");
+				else
+					describe_aggregates(&spec, &aggregation.total, reply, sizeof reply - 1);
 
-	   			int lk = 0;
+				strcat(reply, "\n");
+				sendall(sock, reply, strlen(reply));
+			}
 
-	            if(x==1)
-	            {
+			free(groups);
+		}
 
-		            strcpy(arr1, arr);
-		            int len = strlen(arr1);
-		            
-		            int i=0;
+		free_groups(&aggregation);
+	}
 
-		            while(arr1[i]!='\0')
-		            {
-		            	if(arr1[i]==' ')
-		            		lk = i;
+	// JOIN;<left>;<right>;<left column> = <right column>[;where <predicates>]
+	// [;limit <n>][;records [<table>.<column>,...]] replies like QUERY,
+	// with "<left key>,<right key>" for the key of every pair
+	else if(strcmp(cmd1, "JOIN") == 0)
+	{
+		char* names[2];
+		char* on;
+		char* options[3];
+
+		names[0] = strtok_r(NULL, ";", &cmdSave);
+		names[1] = strtok_r(NULL, ";", &cmdSave);
+		on = strtok_r(NULL, ";", &cmdSave);
+		options[0] = strtok_r(NULL, ";", &cmdSave);
+		options[1] = options[0] != NULL ? strtok_r(NULL, ";", &cmdSave) : NULL;
+		options[2] = options[1] != NULL ? strtok_r(NULL, ";", &cmdSave) : NULL;
+
+		Join* join = calloc(1, sizeof *join);
+		int found = 0;
+		int bad = strtok_r(NULL, ";", &cmdSave) != NULL;
+		int i, j;
+
+		for(i=0; i<2 && join != NULL; i++)
+		{
+			for(j=0; j<numberOfTables && names[i] != NULL; j++)
+			{
+				if(!table_dropped(allTables[j]) && strcmp(allTables[j]->name, names[i])==0)
+				{
+					join->sides[i].hashtable = allTables[j];
+					found++;
+				}
+			}
+		}
 
-		            	i++;
-		            }
+		// a table joined with itself would name its columns twice
+		if(found == 2)
+		{
+			char* where = NULL;
+			char* columns = NULL;
+			int limited = 0;
 
+			join->limit = LONG_MAX;
+			bad = bad || join->sides[0].hashtable == join->sides[1].hashtable ||
+				parse_join_on(on, join) != 0;
 
-		            // printf("lk=%d\n", lk);
-					arr1[lk-1]='\0';
-					arr[lk-1]='\0';
-					
+			for(i=0; i<3 && options[i] != NULL && !bad; i++)
+			{
+				if(strncmp(options[i], "where ", 6) == 0 && where == NULL)
+					where = options[i] + 6;
+				else if(strncmp(options[i], "limit ", 6) == 0 && !limited &&
+					isNum(options[i] + 6) == 0 && atol(options[i] + 6) >= 0)
+				{
+					join->limit = atol(options[i] + 6);
+					limited = 1;
 				}
+				else if(strcmp(options[i], "records") == 0 && !join->records && columns == NULL)
+					bad = parse_join_columns(NULL, join) != 0;
+				else if(strncmp(options[i], "records ", 8) == 0 && !join->records && columns == NULL)
+					columns = options[i] + 8;
+				else
+					bad = 1;
+			}
 
+			if(!bad && columns != NULL)
+				bad = parse_join_columns(columns, join) != 0;
+			if(!bad && where != NULL)
+				bad = parse_join_predicates(where, join) != 0;
+		}
 
+		if(join == NULL)
+		{
+			sendall(sock, "fail\n", 5);
+		}
 
-				// arr1[10] = '\0';
-
-				// printf("arr1: %s\n", arr1);
+		else if(found < 2)
+		{
+			sendall(sock, tableNotFound, strlen(tableNotFound));
+		}
 
+		else if(bad)
+		{
+			sendall(sock, invalidParameter, strlen(invalidParameter));
+		}
 
-	            printf("final array : %s\n", arr);
+		// the reply is sent at once, like that of a QUERY
+		else
+		{
+			char* reply = NULL;
 
-		        sendall(sock, arr, strlen(arr));
-				sendall(sock, "\n", 1);
+			if(run_join(join) == 0 && (reply = malloc(strlen(join->out.keys) + 32)) != NULL)
+			{
+				if(join->out.keys[0] == '\0')
+					sprintf(reply, "%ld\n", join->out.found);
+				else
+					sprintf(reply, join->records ? "%ld\n%s\n" : "%ld %s\n", join->out.found,
+						join->out.keys);
 			}
-		    // printf("number of predicates = %d\n", x);
 
+			if(reply != NULL)
+				sendall(sock, reply, strlen(reply));
+			else
+				sendall(sock, "fail\n", 5);
+			free(reply);
 		}
 
-
+		if(join != NULL)
+			free_join(join);
 	}
 
-	char out[50];
-	sprintf(out, "[LOG SERVER] Processing command '%s'\n", cmd);
+	char out[MAX_CMD_LEN + 50];
+	snprintf(out, sizeof out, "[LOG SERVER] Processing command '%s'\n", cmd);
 	logger(out, LOGGING);
 
 	// For now, just send back the command to the client.
@@ -1950,10 +7518,7 @@ int handle_command(int sock, char *cmd,  struct config_params *params_)
  *
  * @param table_census Hash table to hold census data.
  * @param line Individual line from census data.
- * @param ct Temporary counter that points to the index in the object
- * 		  array that needs to be inserted into the database. The 
- * 		  input census data is stored in an array of objects, which
- *		  has the members key, record and next.
+ * @param ct The number of the line in the census data.
  */
 int processCensus(HashTable* table_census, char *line, int ct)
 {
@@ -1971,15 +7536,22 @@ int processCensus(HashTable* table_census, char *line, int ct)
     	strncpy(key, name, MAX_KEY_LEN);
     	strncpy(value, val, MAX_VALUE_LEN);
 
-   		strncpy(obj[ct].value, value, MAX_VALUE_LEN);
+   		struct storage_record* record_ = malloc(sizeof(struct storage_record));
+   		if(record_ == NULL)
+   			return -1;
 
-   		int retVal_addString = add_string(table_census, name, &(obj[ct]));
+   		strncpy(record_->value, value, MAX_VALUE_LEN);
+   		record_->metadata[0] = 0;
+
+   		int retVal_addString = add_string(table_census, name, record_);
+   		if(retVal_addString != 0 && retVal_addString != 3)
+   			free(record_);
     }
 
     // printf("%s, %s\n", name, value);
  
 
-    // printf("%s, %s\n", name, obj[ct].value);
+    // printf("%s, %s\n", name, value);
 
 
 
@@ -2051,7 +7623,7 @@ int main(int argc, char *argv[])
         concurrencyVal = params.concurrency;
 
 
-        if(concurrencyVal!=0 && concurrencyVal!=1)
+        if(concurrencyVal!=0 && concurrencyVal!=1 && concurrencyVal!=2)
         {
             printf("concurrency method not implemented\n");
             exit(EXIT_FAILURE);
@@ -2073,6 +7645,13 @@ int main(int argc, char *argv[])
 
     numberOfTables = params.numOfTables;
 
+    // with concurrency 2 every core owns the keys of some stripes
+    int partitions = params.worker_threads;
+    if(partitions == 0)
+        partitions = sysconf(_SC_NPROCESSORS_ONLN);
+    if(partitions < 1)
+        partitions = 1;
+
 
 
 
@@ -2083,16 +7662,125 @@ int main(int argc, char *argv[])
         char* newTableName = params.tableArray[j];
         char* schema = params.tableSchemaArray[j];
 
+        // the stripes are spread evenly over the partitions, so that the
+        // stripe of a key is only ever locked by the core owning the key
+        int nstripes = params.tableOptions[j].lock_stripes;
+        if(concurrencyVal==2)
+        {
+            nstripes = (nstripes + partitions - 1) / partitions * partitions;
+            if(nstripes > MAX_RECORDS_PER_TABLE)
+                nstripes = MAX_RECORDS_PER_TABLE;
+        }
+
         // create a new table with name = newTableName
-        allTables[j] = create_hash_table(newTableName, schema, MAX_RECORDS_PER_TABLE);
+        allTables[j] = create_hash_table(newTableName, schema, MAX_RECORDS_PER_TABLE, nstripes);
 
         if(allTables[j] == NULL)
-            printf("table %s was not allocated\n", allTables[j]->name);
+            printf("table %s was not allocated\n", newTableName);
         else
         {
             printf("table : %s, schema : %s\n", allTables[j]->name, allTables[j]->schema);          
         }
 
+        // tables on the LSM engine are kept in <data_directory>/<table>
+        if(allTables[j] != NULL && params.tableOptions[j].engine == ENGINE_LSM)
+        {
+            char directory[MAX_PATH_LEN];
+            if(snprintf(directory, sizeof directory, "%s/%s", params.data_directory, newTableName) >= (int) sizeof directory)
+            {
+                printf("Error: the directory of LSM table %s is longer than %d characters\n", newTableName, MAX_PATH_LEN - 1);
+                exit(EXIT_FAILURE);
+            }
+
+            strncpy(allTables[j]->directory, directory, sizeof allTables[j]->directory);
+            allTables[j]->memtableSize = params.tableOptions[j].memtable_size;
+            allTables[j]->lsm = lsm_open(directory, params.tableOptions[j].memtable_size);
+            if(allTables[j]->lsm == NULL)
+            {
+                printf("Error opening LSM table %s in %s\n", newTableName, directory);
+                exit(EXIT_FAILURE);
+            }
+            allTables[j]->engine = ENGINE_LSM;
+            printf("table %s is stored in %s\n", newTableName, directory);
+        }
+
+        // lock-free tables are in memory, and need no command lock
+        else if(allTables[j] != NULL && params.tableOptions[j].engine == ENGINE_LOCKFREE)
+        {
+            allTables[j]->lf = lf_create();
+            if(allTables[j]->lf == NULL)
+            {
+                printf("Error creating lock-free table %s\n", newTableName);
+                exit(EXIT_FAILURE);
+            }
+            allTables[j]->engine = ENGINE_LOCKFREE;
+            printf("table %s is lock-free\n", newTableName);
+        }
+
+        // records over the memory budget are spilled to <data_directory>/<table>.values
+        else if(allTables[j] != NULL && params.tableOptions[j].memory_budget > 0)
+        {
+            char path[MAX_PATH_LEN];
+            if(snprintf(path, sizeof path, "%s/%s.values", params.data_directory, newTableName) >= (int) sizeof path)
+            {
+                printf("Error: the spill file of table %s is longer than %d characters\n", newTableName, MAX_PATH_LEN - 1);
+                exit(EXIT_FAILURE);
+            }
+
+            if(make_directory(params.data_directory) != 0 ||
+                (allTables[j]->spill = spill_open(path)) == NULL)
+            {
+                printf("Error opening spill file %s\n", path);
+                exit(EXIT_FAILURE);
+            }
+            allTables[j]->memoryBudget = params.tableOptions[j].memory_budget;
+            allTables[j]->promoteOnRead = params.tableOptions[j].promote_on_read;
+            printf("table %s keeps %ld bytes of records in memory\n", newTableName,
+                allTables[j]->memoryBudget);
+        }
+
+        // the indexes are filled in as records are added
+        if(allTables[j] != NULL)
+        {
+            int k;
+            for(k=0; k<params.tableOptions[j].num_indexes; k++)
+            {
+                Index *index = &allTables[j]->indexes[k];
+
+                int size;
+                bool ordered;
+                bool bitmap;
+
+                strncpy(index->column, params.tableOptions[j].indexes[k], sizeof index->column);
+                index->numeric = strcmp(column_type(schema, index->column, &size), "int") == 0;
+                bitmap = params.tableOptions[j].bitmap_indexes[k];
+                ordered = index->numeric && !bitmap;
+
+                // int columns get an ordered index for ranges, char
+                // columns a hash index for equality, and columns with
+                // few values may get a bitmap index instead
+                index->failed = 0;
+                index->tree = ordered ? btree_create() : NULL;
+                index->hash = !ordered && !bitmap ? hindex_create() : NULL;
+                index->bitmap = bitmap ? bitmap_index_create() : NULL;
+                if(index->tree == NULL && index->hash == NULL && index->bitmap == NULL)
+                {
+                    printf("Error creating the index on %s of table %s\n", index->column, newTableName);
+                    exit(EXIT_FAILURE);
+                }
+
+                if(bitmap && allTables[j]->versioned == NULL &&
+                    (allTables[j]->versioned = roaring_create()) == NULL)
+                {
+                    printf("Error creating the index on %s of table %s\n", index->column, newTableName);
+                    exit(EXIT_FAILURE);
+                }
+                printf("table %s has %s index on %s\n", newTableName,
+                    bitmap ? "a bitmap" : ordered ? "an ordered" : "a hash", index->column);
+            }
+            allTables[j]->nindexes = params.tableOptions[j].num_indexes;
+        }
+
     }
 
     // LOG(("Server on %s:%d\n", params.server_host, params.server_port));
@@ -2100,39 +7788,10 @@ int main(int argc, char *argv[])
     sprintf(out, "[LOG SERVER] Server on %s:%d\n", params.server_host, params.server_port);
     logger(out, LOGGING);
 
-    // Create a socket.
-    int listensock = socket(PF_INET, SOCK_STREAM, 0);
-    if (listensock < 0) {
-        printf("Error creating socket.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    // Allow listening port to be reused if defunct.
-    int yes = 1;
-    status = setsockopt(listensock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
-    if (status != 0) {
-        printf("Error configuring socket.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    // Bind it to the listening port.
-    struct sockaddr_in listenaddr;
-    memset(&listenaddr, 0, sizeof listenaddr);
-    listenaddr.sin_family = AF_INET;
-    listenaddr.sin_port = htons(params.server_port);
-    inet_pton(AF_INET, params.server_host, &(listenaddr.sin_addr)); // bind to local IP address
-    status = bind(listensock, (struct sockaddr*) &listenaddr, sizeof listenaddr);
-    if (status != 0) {
-        printf("Error binding socket.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    // Listen for connections.
-    status = listen(listensock, MAX_LISTENQUEUELEN);
-    if (status != 0) {
-        printf("Error listening on socket.\n");
+    // with several listeners every one of them gets its own socket
+    int listensock = openListener(&params, concurrencyVal!=0 && params.listener_threads > 1);
+    if (listensock < 0)
         exit(EXIT_FAILURE);
-    }
 
 
 
@@ -2182,6 +7841,7 @@ int main(int argc, char *argv[])
             
 
             // Close the connection with the client.
+            close_cursors(clientsock);
             close(clientsock);
 
             // Logging for closing the connection
@@ -2195,46 +7855,58 @@ int main(int argc, char *argv[])
     }
 
 
-    else if(concurrencyVal==1)
+    else if(concurrencyVal==1 || concurrencyVal==2)
     {
 
-        /* First, we allocate the thread pool */ 
-        int i;
-        for (i = 0; i!=MAX_THREADS; ++i)
-            runtimeThreads[i] = malloc( sizeof( struct _ThreadInfo ) ); 
-
-
-        while (1) 
-        { 
-            ThreadInfo tiInfo = getThreadInfo(); 
-            tiInfo->clientaddrlen = sizeof(struct sockaddr_in); 
-            tiInfo->clientsock = accept(listensock, (struct sockaddr*)&tiInfo->clientaddr, &tiInfo->clientaddrlen);
-            tiInfo->params = &params;        
- 
-            if (tiInfo->clientsock <0)
-            {
-                pthread_mutex_lock( &printMutex ); 
-                printf("ERROR in connecting to %s:%d.\n", 
-                inet_ntoa(tiInfo->clientaddr.sin_addr), tiInfo->clientaddr.sin_port);
-                pthread_mutex_unlock( &printMutex ); 
-            } 
-            else 
+        // the commands of all the clients are run by a fixed set of workers
+        if(concurrencyVal==1)
+        {
+            workPool = pool_create(params.worker_threads);
+            if(workPool == NULL)
             {
-                pthread_create( &tiInfo->theThread, NULL, threadCallFunction, tiInfo ); 
+                printf("Error starting the worker threads.\n");
+                exit(EXIT_FAILURE);
             }
+            printf("%d worker threads\n", pool_size(workPool));
         }
 
+        // or by one thread per core, each running the commands on its keys
+        else
+        {
+            shards = shard_create(partitions, params.listener_threads);
+            if(shards == NULL)
+            {
+                printf("Error starting the partition threads.\n");
+                exit(EXIT_FAILURE);
+            }
+            printf("%d partitions\n", shard_count(shards));
+        }
 
-        /* At the end, wait until all connections close */ 
-        for (i=topRT; i!=botRT; i = (i+1)%MAX_THREADS)
-            pthread_join(runtimeThreads[i]->theThread, 0 ); 
-
-
-        /* Deallocate all the resources */ 
-        for (i=0; i!=MAX_THREADS; i++)
-            free( runtimeThreads[i] ); 
+        // the kernel spreads new connections over the sockets of the
+        // listeners, and the main thread runs the loop of the first one
+        Listener listeners[MAX_LISTENER_THREADS];
+        int i;
+        for(i=1; i<params.listener_threads; i++)
+        {
+            listeners[i].sock = openListener(&params, true);
+            listeners[i].index = i;
+            listeners[i].params = &params;
+            if(listeners[i].sock < 0 ||
+                pthread_create(&listeners[i].thread, NULL, listenerThread, &listeners[i]) != 0)
+            {
+                printf("Error starting listener %d.\n", i);
+                exit(EXIT_FAILURE);
+            }
+        }
+        printf("%d listener threads\n", params.listener_threads);
 
+        if(serveConnections(listensock, &params) != 0)
+            printf("Error waiting for connections.\n");
 
+        /* At the end, run the queued commands and stop the workers */
+        pool_destroy(workPool);
+        shard_destroy(shards);
+        close(listensock);
     }
 
 
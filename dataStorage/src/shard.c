@@ -0,0 +1,318 @@
+/**
+ * @file
+ * @brief This file implements the shard threads declared in shard.h.
+ *
+ * Every shard has one queue per producer. A queue is a ring with its head
+ * written only by the shard and its tail written only by the producer,
+ * each on a cache line of its own. A shard with nothing to do sleeps, and
+ * a producer wakes it up after queueing a task.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include "shard.h"
+
+/**
+ * @brief The number of tasks a queue holds. Must be a power of two.
+ */
+#define SHARD_QUEUE_LEN	256
+
+/**
+ * @brief The size of a cache line, used to keep the fields written by
+ * different threads apart.
+ */
+#define CACHE_LINE	64
+
+struct spsc_queue {
+	/// The next task the shard takes.
+	unsigned long head __attribute__((aligned(CACHE_LINE)));
+	/// The next free slot of the producer.
+	unsigned long tail __attribute__((aligned(CACHE_LINE)));
+	struct pool_task *slots[SHARD_QUEUE_LEN] __attribute__((aligned(CACHE_LINE)));
+};
+
+struct shard {
+	struct shard_set *set;
+	int index;
+	pthread_t thread;
+
+	/// The queues into the shard, one per producer.
+	struct spsc_queue *queues;
+	/// The queue looked at first, so that every producer gets its turn.
+	int next;
+
+	/// Set while the shard sleeps, or is about to.
+	int sleeping __attribute__((aligned(CACHE_LINE)));
+	/// Guards the sleep of the shard.
+	pthread_mutex_t lock;
+	/// Wakes up the shard.
+	pthread_cond_t wake;
+	int stopping;
+} __attribute__((aligned(CACHE_LINE)));
+
+struct shard_set {
+	struct shard *shards;
+	int count;
+	/// The number of producers that are not shards.
+	int producers;
+};
+
+/// The shard running on this thread, if any.
+static __thread struct shard *currentShard;
+
+/**
+ * @brief The number of queues into every shard.
+ */
+static int queue_count(struct shard_set *set)
+{
+	return set->producers + set->count;
+}
+
+/**
+ * @brief Add a task to a queue. Called by its producer only.
+ *
+ * @return Returns 0 on success, -1 if the queue is full.
+ */
+static int queue_push(struct spsc_queue *queue, struct pool_task *task)
+{
+	unsigned long tail = queue->tail;
+
+	if (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == SHARD_QUEUE_LEN)
+		return -1;
+
+	queue->slots[tail % SHARD_QUEUE_LEN] = task;
+
+	// ordered against the check of the sleeping flag that follows
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+/**
+ * @brief Take the oldest task of a queue. Called by its shard only.
+ *
+ * @return Returns the task, or NULL if the queue is empty.
+ */
+static struct pool_task *queue_pop(struct spsc_queue *queue)
+{
+	unsigned long head = queue->head;
+
+	if (head == __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST))
+		return NULL;
+
+	struct pool_task *task = queue->slots[head % SHARD_QUEUE_LEN];
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+	return task;
+}
+
+/**
+ * @brief Run one queued task of a shard.
+ *
+ * @return Returns 1 if a task was run, and 0 if the queues are empty.
+ */
+static int run_one(struct shard *self)
+{
+	int n = queue_count(self->set);
+	int i;
+
+	for (i = 0; i < n; i++) {
+		int q = (self->next + i) % n;
+		struct pool_task *task = queue_pop(&self->queues[q]);
+
+		if (task != NULL) {
+			self->next = (q + 1) % n;
+			task->run(task);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Check if any queue of a shard has a task.
+ */
+static int has_tasks(struct shard *self)
+{
+	int n = queue_count(self->set);
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct spsc_queue *queue = &self->queues[i];
+		if (queue->head != __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST))
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Runs the tasks of a shard until the shards are destroyed and no
+ * task is left.
+ */
+static void *shard_thread(void *arg)
+{
+	struct shard *self = arg;
+
+	currentShard = self;
+
+	while (1) {
+		if (run_one(self))
+			continue;
+
+		// a producer that queues a task after this sees the flag
+		__atomic_store_n(&self->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (has_tasks(self)) {
+			__atomic_store_n(&self->sleeping, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		pthread_mutex_lock(&self->lock);
+		while (__atomic_load_n(&self->sleeping, __ATOMIC_RELAXED) && !self->stopping)
+			pthread_cond_wait(&self->wake, &self->lock);
+		int stopping = self->stopping;
+		pthread_mutex_unlock(&self->lock);
+
+		__atomic_store_n(&self->sleeping, 0, __ATOMIC_RELAXED);
+
+		if (stopping && !has_tasks(self))
+			break;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Stop the first started shard threads, and free the shards.
+ */
+static void stop_shards(struct shard_set *set, int started)
+{
+	int i;
+
+	for (i = 0; i < started; i++) {
+		struct shard *shard = &set->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		shard->stopping = 1;
+		pthread_cond_signal(&shard->wake);
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	for (i = 0; i < started; i++)
+		pthread_join(set->shards[i].thread, NULL);
+
+	for (i = 0; i < set->count; i++) {
+		free(set->shards[i].queues);
+		pthread_mutex_destroy(&set->shards[i].lock);
+		pthread_cond_destroy(&set->shards[i].wake);
+	}
+
+	free(set->shards);
+	free(set);
+}
+
+struct shard_set *shard_create(int shards, int producers)
+{
+	if (shards <= 0)
+		shards = sysconf(_SC_NPROCESSORS_ONLN);
+	if (shards <= 0)
+		shards = 1;
+
+	struct shard_set *set = calloc(1, sizeof *set);
+	if (set == NULL)
+		return NULL;
+
+	if (posix_memalign((void **) &set->shards, CACHE_LINE, shards * sizeof *set->shards) != 0) {
+		free(set);
+		return NULL;
+	}
+	memset(set->shards, 0, shards * sizeof *set->shards);
+
+	set->count = shards;
+	set->producers = producers;
+
+	// every queue is set up before a shard can submit to another
+	int i;
+	for (i = 0; i < shards; i++) {
+		struct shard *shard = &set->shards[i];
+		shard->set = set;
+		shard->index = i;
+		shard->next = 0;
+		shard->sleeping = 0;
+		shard->stopping = 0;
+		pthread_mutex_init(&shard->lock, NULL);
+		pthread_cond_init(&shard->wake, NULL);
+
+		size_t size = queue_count(set) * sizeof *shard->queues;
+		if (posix_memalign((void **) &shard->queues, CACHE_LINE, size) != 0) {
+			shard->queues = NULL;
+			break;
+		}
+
+		int q;
+		for (q = 0; q < queue_count(set); q++) {
+			shard->queues[q].head = 0;
+			shard->queues[q].tail = 0;
+		}
+	}
+
+	int started = 0;
+	if (i == shards) {
+		while (started < shards &&
+			pthread_create(&set->shards[started].thread, NULL, shard_thread,
+				&set->shards[started]) == 0)
+			started++;
+	}
+
+	if (started < shards) {
+		stop_shards(set, started);
+		return NULL;
+	}
+
+	return set;
+}
+
+int shard_count(struct shard_set *set)
+{
+	return set->count;
+}
+
+int shard_current(struct shard_set *set)
+{
+	if (currentShard == NULL || currentShard->set != set)
+		return -1;
+	return currentShard->index;
+}
+
+void shard_submit(struct shard_set *set, int producer, int shard, struct pool_task *task)
+{
+	struct shard *self = (currentShard != NULL && currentShard->set == set) ? currentShard : NULL;
+	struct shard *target = &set->shards[shard % set->count];
+
+	if (self != NULL)
+		producer = set->producers + self->index;
+
+	struct spsc_queue *queue = &target->queues[producer];
+
+	while (queue_push(queue, task) != 0) {
+		if (self == NULL || !run_one(self))
+			sched_yield();
+	}
+
+	if (__atomic_load_n(&target->sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&target->lock);
+		__atomic_store_n(&target->sleeping, 0, __ATOMIC_RELAXED);
+		pthread_cond_signal(&target->wake);
+		pthread_mutex_unlock(&target->lock);
+	}
+}
+
+void shard_destroy(struct shard_set *set)
+{
+	if (set == NULL)
+		return;
+
+	stop_shards(set, set->count);
+}
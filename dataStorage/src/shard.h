@@ -0,0 +1,61 @@
+/**
+ * @file
+ * @brief This file declares the shard threads of the thread-per-core mode.
+ *
+ * There is one shard thread per core, and every shard owns a part of the
+ * keys of every table. Tasks are handed to the thread that owns them over
+ * single-producer single-consumer queues: every thread that hands out
+ * tasks has its own queue to every shard, so no two threads ever write to
+ * the same end of a queue, and no queue takes a lock.
+ */
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "pool.h"
+
+/**
+ * @brief The shard threads and their queues. The fields are private to
+ * shard.c.
+ */
+struct shard_set;
+
+/**
+ * @brief Start the shard threads.
+ *
+ * @param shards The number of shards, or 0 for one per core.
+ * @param producers The number of other threads that submit tasks. The
+ *		 shard threads can always submit tasks too.
+ * @return Returns the shards, or NULL if the threads can not be started.
+ */
+struct shard_set *shard_create(int shards, int producers);
+
+/**
+ * @brief Return the number of shards.
+ */
+int shard_count(struct shard_set *set);
+
+/**
+ * @brief Return the index of the shard running the caller, or -1 if the
+ * caller is not a shard thread.
+ */
+int shard_current(struct shard_set *set);
+
+/**
+ * @brief Queue a task for a shard thread.
+ *
+ * @param producer The index of the calling thread among the producers
+ *		 given to shard_create(). Ignored when a shard thread calls.
+ * @param shard The shard that runs the task.
+ *
+ * The caller waits while the queue is full. A shard thread runs its own
+ * tasks while it waits, so two shards can not wait for each other.
+ */
+void shard_submit(struct shard_set *set, int producer, int shard, struct pool_task *task);
+
+/**
+ * @brief Run the queued tasks, then stop the threads and free the shards.
+ */
+void shard_destroy(struct shard_set *set);
+
+#endif
@@ -0,0 +1,189 @@
+/**
+ * @file
+ * @brief This file implements the value file declared in spill.h.
+ *
+ * Every file has one reader thread that serves the queued reads in the
+ * order they were submitted.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "utils.h"
+#include "spill.h"
+
+struct spill_file {
+	char path[MAX_PATH_LEN];
+	int fd;
+
+	/// The end of the file, where the next value is appended.
+	long end;
+
+	/// Guards the queue, and the done flags of the queued requests.
+	pthread_mutex_t lock;
+	/// Wakes up the reader thread.
+	pthread_cond_t work;
+	/// Signalled when a read is done.
+	pthread_cond_t done;
+
+	struct spill_read *head;
+	struct spill_read *tail;
+
+	pthread_t thread;
+	int stopping;
+};
+
+/**
+ * @brief Read a whole range of the file, retrying short reads.
+ */
+static int read_fully(int fd, long offset, int length, char *buf)
+{
+	while (length > 0) {
+		ssize_t n = pread(fd, buf, length, offset);
+		if (n <= 0)
+			return -1;
+		buf += n;
+		offset += n;
+		length -= n;
+	}
+	return 0;
+}
+
+/**
+ * @brief Serves the queued reads until the file is closed.
+ */
+static void *spill_reader(void *arg)
+{
+	struct spill_file *file = arg;
+	struct spill_read *req;
+
+	pthread_mutex_lock(&file->lock);
+	while (1) {
+		while (file->head == NULL && !file->stopping)
+			pthread_cond_wait(&file->work, &file->lock);
+		if (file->head == NULL)
+			break;
+
+		req = file->head;
+		file->head = req->next;
+		if (file->head == NULL)
+			file->tail = NULL;
+
+		// the disk is read without the lock, so more reads can be queued
+		pthread_mutex_unlock(&file->lock);
+		req->status = read_fully(file->fd, req->offset, req->length, req->buf);
+		pthread_mutex_lock(&file->lock);
+
+		req->done = 1;
+		pthread_cond_broadcast(&file->done);
+	}
+	pthread_mutex_unlock(&file->lock);
+
+	return NULL;
+}
+
+struct spill_file *spill_open(const char *path)
+{
+	struct spill_file *file = calloc(1, sizeof *file);
+	if (file == NULL)
+		return NULL;
+
+	strncpy(file->path, path, sizeof file->path - 1);
+	file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (file->fd < 0) {
+		free(file);
+		return NULL;
+	}
+
+	pthread_mutex_init(&file->lock, NULL);
+	pthread_cond_init(&file->work, NULL);
+	pthread_cond_init(&file->done, NULL);
+
+	if (pthread_create(&file->thread, NULL, spill_reader, file) != 0) {
+		close(file->fd);
+		unlink(path);
+		free(file);
+		return NULL;
+	}
+
+	return file;
+}
+
+long spill_append(struct spill_file *file, const char *data, int length)
+{
+	long offset = file->end;
+	int written = 0;
+
+	while (written < length) {
+		ssize_t n = pwrite(file->fd, data + written, length - written, offset + written);
+		if (n <= 0)
+			return -1;
+		written += n;
+	}
+
+	file->end += length;
+	return offset;
+}
+
+int spill_read(struct spill_file *file, long offset, int length, char *buf)
+{
+	return read_fully(file->fd, offset, length, buf);
+}
+
+void spill_submit(struct spill_file *file, struct spill_read *req)
+{
+	req->done = 0;
+	req->status = -1;
+	req->next = NULL;
+
+	pthread_mutex_lock(&file->lock);
+	if (file->tail == NULL)
+		file->head = req;
+	else
+		file->tail->next = req;
+	file->tail = req;
+	pthread_cond_signal(&file->work);
+	pthread_mutex_unlock(&file->lock);
+}
+
+int spill_wait(struct spill_file *file, struct spill_read *req)
+{
+	pthread_mutex_lock(&file->lock);
+	while (!req->done)
+		pthread_cond_wait(&file->done, &file->lock);
+	pthread_mutex_unlock(&file->lock);
+
+	return req->status;
+}
+
+int spill_reset(struct spill_file *file)
+{
+	if (ftruncate(file->fd, 0) != 0)
+		return -1;
+
+	file->end = 0;
+	return 0;
+}
+
+void spill_close(struct spill_file *file)
+{
+	if (file == NULL)
+		return;
+
+	pthread_mutex_lock(&file->lock);
+	file->stopping = 1;
+	pthread_cond_signal(&file->work);
+	pthread_mutex_unlock(&file->lock);
+	pthread_join(file->thread, NULL);
+
+	close(file->fd);
+	unlink(file->path);
+
+	pthread_mutex_destroy(&file->lock);
+	pthread_cond_destroy(&file->work);
+	pthread_cond_destroy(&file->done);
+	free(file);
+}
@@ -0,0 +1,92 @@
+/**
+ * @file
+ * @brief This file declares the value file that holds the cold records of
+ * a hash table with a memory budget.
+ *
+ * Values are only appended to the file. A value that is modified or deleted
+ * after it was written stays in the file until the server restarts, or the
+ * file is emptied when its table is truncated.
+ * Reads can be handed to a reader thread, so that the caller can let other
+ * clients run while the disk is busy.
+ */
+
+#ifndef SPILL_H
+#define SPILL_H
+
+/**
+ * @brief A value file. The fields are private to spill.c.
+ */
+struct spill_file;
+
+/**
+ * @brief A read of the value file handed to the reader thread.
+ *
+ * The caller fills in offset, length and buf before spill_submit(), and
+ * the request must stay valid until spill_wait() returns.
+ */
+struct spill_read {
+	/// Where the value starts in the file.
+	long offset;
+	/// The number of bytes to read.
+	int length;
+	/// Receives the bytes.
+	char *buf;
+
+	/// 0 if the read succeeded, -1 otherwise. Set by the reader thread.
+	int status;
+	/// Set by the reader thread once the read is done.
+	int done;
+	/// The next request in the queue of the file.
+	struct spill_read *next;
+};
+
+/**
+ * @brief Create an empty value file and start its reader thread.
+ *
+ * @param path The file to use. An existing file is truncated.
+ * @return Returns the file, or NULL if it can not be created.
+ */
+struct spill_file *spill_open(const char *path);
+
+/**
+ * @brief Append a value to the file.
+ *
+ * @return Returns the offset of the value, or -1 if it could not be written.
+ */
+long spill_append(struct spill_file *file, const char *data, int length);
+
+/**
+ * @brief Read a value back right away.
+ *
+ * @return Returns 0 on success, -1 otherwise.
+ */
+int spill_read(struct spill_file *file, long offset, int length, char *buf);
+
+/**
+ * @brief Queue a read for the reader thread and return at once.
+ */
+void spill_submit(struct spill_file *file, struct spill_read *req);
+
+/**
+ * @brief Wait until the reader thread has done a queued read.
+ *
+ * @return Returns the status of the read.
+ */
+int spill_wait(struct spill_file *file, struct spill_read *req);
+
+/**
+ * @brief Empty the file, so values are appended from the start again.
+ *
+ * The caller makes sure no value is appended at the same time, and that
+ * no value read from before is taken for one written after.
+ *
+ * @return Returns 0 on success, -1 otherwise.
+ */
+int spill_reset(struct spill_file *file);
+
+/**
+ * @brief Stop the reader thread, and close and remove the file.
+ */
+void spill_close(struct spill_file *file);
+
+#endif
@@ -97,7 +97,9 @@ void* storage_connect(const char *hostname, const int port)
 
 	// Connect to the server.
 	status = connect(sock, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
 	if (status != 0) {
+		close(sock);
 		logger("[LOG CLIENT] Unable to connect to server\n", LOGGING);
 		
 		printf("conn fail in conn3\n");
@@ -178,7 +180,7 @@ int storage_auth(const char *username, const char *passwd, void *conn)
 	}
 
 	// Connection is really just a socket file descriptor.
-	int sock = (int)conn;
+	int sock = (int)(intptr_t)conn;
 
 	// Send some data.
 	char buf[MAX_CMD_LEN];
@@ -217,20 +219,18 @@ int storage_auth(const char *username, const char *passwd, void *conn)
 }
 
 /**
- * @brief This is the function used to obtain information from the records requested 
- * by the user.  
+ * @brief This is the function used to obtain a record, or some of its
+ * columns.
  *
  * @param table The user-entered table name
  * @param key The user-entered key
+ * @param columns The columns to obtain, or NULL for all of them
  * @param record Pointer to the structure that stores the value at the given key
  * @param conn Acts as a file descriptor
  * @return Returns 0 if sucessful, -1 otherwise
- *
- * The functions takes in a table name, key, pointer to a structure which holds the 
- * record, and a valid connection and uses it retrieve the value of the key in the 
- * specified table IF it exists.
  */
-int storage_get(const char *table, const char *key, struct storage_record *record, void *conn)
+static int get_value(const char *table, const char *key, const char *columns,
+	struct storage_record *record, void *conn)
 {
 	
 
@@ -277,12 +277,13 @@ int storage_get(const char *table, const char *key, struct storage_record *recor
 	}
 
 	// Connection is really just a socket file descriptor.
-	int sock = (int)conn;
+	int sock = (int)(intptr_t)conn;
 
 	// Send some data.
 	char buf[MAX_CMD_LEN];
 	memset(buf, 0, sizeof buf);
-	snprintf(buf, sizeof buf, "GET;%s;%s\n", table, key);
+	snprintf(buf, sizeof buf, "GET;%s;%s%s%s\n", table, key, columns != NULL ? ";" : "",
+		columns != NULL ? columns : "");
 	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
 
 
@@ -311,6 +312,13 @@ int storage_get(const char *table, const char *key, struct storage_record *recor
 			return -1;
 		}
 
+		// Check to see if a column is not in the table
+		else if(strcmp(buf, "invalidParameter")==0)
+		{
+			errno = ERR_INVALID_PARAM;			// 1
+			return -1;
+		}
+
 
 		else
 		{
@@ -351,6 +359,49 @@ int storage_get(const char *table, const char *key, struct storage_record *recor
 	return -1;}
 
 
+/**
+ * @brief This is the function used to obtain information from the records requested 
+ * by the user.  
+ *
+ * @param table The user-entered table name
+ * @param key The user-entered key
+ * @param record Pointer to the structure that stores the value at the given key
+ * @param conn Acts as a file descriptor
+ * @return Returns 0 if sucessful, -1 otherwise
+ *
+ * The functions takes in a table name, key, pointer to a structure which holds the 
+ * record, and a valid connection and uses it retrieve the value of the key in the 
+ * specified table IF it exists.
+ */
+int storage_get(const char *table, const char *key, struct storage_record *record, void *conn)
+{
+	return get_value(table, key, NULL, record, conn);
+}
+
+
+/**
+ * @brief This is the function used to obtain some columns of a record.
+ *
+ * @param table The user-entered table name
+ * @param key The user-entered key
+ * @param columns The columns, separated by commas
+ * @param record Pointer to the structure that stores the columns
+ * @param conn Acts as a file descriptor
+ * @return Returns 0 if sucessful, -1 otherwise
+ */
+int storage_get_columns(const char *table, const char *key, const char *columns,
+	struct storage_record *record, void *conn)
+{
+	if(columns == NULL || *columns == '\0' || strpbrk(columns, ";\n") != NULL)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	return get_value(table, key, columns, record, conn);
+}
+
+
 /**
  * @brief This is the function used to create, modify, or delete a record.
  * 
@@ -435,7 +486,7 @@ int storage_set(const char *table, const char *key, struct storage_record *recor
 	// printf("%s, %s\n", key, record->value);
 
 	// Connection is really just a socket file descriptor.
-	int sock = (int)conn;
+	int sock = (int)(intptr_t)conn;
 
 	// Send some data.
 	char buf[MAX_CMD_LEN];
@@ -519,33 +570,24 @@ int storage_set(const char *table, const char *key, struct storage_record *recor
 
 
 /**
- * @brief Query the table for records, and retrieve the matching keys.
+ * @brief This is the function used to send a QUERY and read the keys it
+ * replies with.
  *
- * @param table A table in the database.
- * @param predicates A comma separated list of predicates.
- * @param keys An array of strings where the keys whose records match the 
- * specified predicates will be copied.  The array must have room for at 
- * least max_keys elements.  The caller must allocate memory for this array.
- * @param max_keys The size of the keys array.
- * @param conn A connection to the server.
- * @return Return the number of matching keys (which may be more than
- * max_keys) if successful, and -1 otherwise.
- *
- * On error, errno will be set to one of the following, as appropriate: 
- * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, ERR_TABLE_NOT_FOUND, 
- * ERR_KEY_NOT_FOUND, ERR_NOT_AUTHENTICATED, or ERR_UNKNOWN.
- *
- * Each predicate consists of a column name, an operator, and a value, each
- * separated by optional whitespace. The operator may be a "=" for string
- * types, or one of "<, >, =" for int and float types. An example of query
- * predicates is "name = bob, mark > 90".
+ * @param table The user-entered table name
+ * @param predicates The user-entered predicates
+ * @param options The options after the limit, each after a ';'
+ * @param keys Receives the first max_keys matching keys
+ * @param max_keys The size of keys
+ * @param conn Acts as a file descriptor
+ * @return Returns the number of matches, or -1 on failure
  */
-int storage_query(const char *table, const char *predicates, char **keys, 
-	const int max_keys, void *conn)
+static int query_keys(const char *table, const char *predicates, const char *options,
+	char **keys, const int max_keys, void *conn)
 {
 
 
-	if(table == NULL || predicates == NULL || conn==NULL)
+	if(table == NULL || predicates == NULL || conn==NULL || max_keys < 0 ||
+		(keys == NULL && max_keys > 0) || strpbrk(predicates, ";\n") != NULL)
 	{		
 		errno = ERR_INVALID_PARAM;	//1
 		return -1;
@@ -589,21 +631,26 @@ int storage_query(const char *table, const char *predicates, char **keys,
 	// printf("table=%s, length=%d; predicates=%s, length=%d",table, len1, predicates, len2);
 
 	// Connection is really just a socket file descriptor.
-	int sock = (int)conn;
+	int sock = (int)(intptr_t)conn;
 
 	// Send some data.
 	char buf[MAX_CMD_LEN];
 	memset(buf, 0, sizeof buf);
 
-	snprintf(buf, sizeof buf, "QUERY;%s;%s\n", table, predicates);
+	if(snprintf(buf, sizeof buf, "QUERY;%s;%s;%d%s\n", table, predicates, max_keys,
+		options) >= sizeof buf)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
 
 
 	// printf("%s\n", buf);
-	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0)
+	int end;
+	if (sendall(sock, buf, strlen(buf)) == 0 && recvword(sock, buf, sizeof buf, &end) == 0)
 	{
 
-		// "bloor dundas vc sdf sdf"
-
+		// "<count> <key> <key> ...", with every matching key
 
 
 		char message[MAX_CMD_LEN];
@@ -613,10 +660,7 @@ int storage_query(const char *table, const char *predicates, char **keys,
         // Check to see if the table passed through exists
 		if(strcmp(buf, "tableNotFound")==0)
 		{
-			printf("%s\n", buf);
-
-			
-			snprintf(message, sizeof message, "[LOG CLIENT] Unable to QUERY %s %s %s. Table not found.\n", table, predicates);
+			snprintf(message, sizeof message, "[LOG CLIENT] Unable to QUERY %s %s. Table not found.\n", table, predicates);
 			logger(message, LOGGING);
 			errno = ERR_TABLE_NOT_FOUND;		// 5
 
@@ -638,41 +682,1467 @@ int storage_query(const char *table, const char *predicates, char **keys,
 
 		else
 		{
+			char *rest;
+			long total = strtol(buf, &rest, 10);
+			int found = 0;
+
+			if(*buf == '\0' || *rest != '\0' || total < 0)
+			{
+				errno = ERR_UNKNOWN;
+				return -1;
+			}
 
-			printf("buf = %s\n", buf);
-
-			char temp[MAX_CMD_LEN];
-			strcpy(temp, buf);
-			// printf("%s\n", temp);
-
-			char *str = temp;
-			char *tok = strtok(str, " ");
-			int found = 0, i = 0;
-
-			while(tok){
-
-				keys[found] = tok;
-				strcat(keys[found], "\0");
-				// printf("In function: %s\n", keys[found]);		
-
-				tok = strtok(NULL, " ");
+			while(end == 0)
+			{
+				char key[MAX_KEY_LEN];
+
+				if(recvword(sock, key, sizeof key, &end) != 0)
+				{
+					errno = ERR_CONNECTION_FAIL;
+					return -1;
+				}
+
+				if(found < max_keys)
+				{
+					strncpy(keys[found], key, MAX_KEY_LEN);
+					keys[found][MAX_KEY_LEN - 1] = '\0';
+				}
 				found++;
 			}
 
+			if(found != (total < max_keys ? total : max_keys))
+			{
+				errno = ERR_UNKNOWN;
+				return -1;
+			}
+
 			snprintf(message, sizeof message, "[LOG CLIENT] Successful: QUERY %s %s\n", table, predicates);			
 			logger(message, LOGGING);
 
 			// printf("%d\n", found);
-			return found;
+			return total;
 
 			// printf("%s\n", message);
 		}
+	}
+
+	errno = ERR_CONNECTION_FAIL;
+	return -1;
+}
+
+
+
+/**
+ * @brief This is the function used to query a table for records, stopping
+ * at max_keys matches unless the total is asked for.
+ *
+ * @param table The user-entered table name
+ * @param predicates The user-entered predicates
+ * @param keys Receives the first max_keys matching keys
+ * @param max_keys The size of keys
+ * @param count Whether to count every match
+ * @param conn Acts as a file descriptor
+ * @return Returns the number of matches, or -1 on failure
+ */
+int storage_query_limit(const char *table, const char *predicates, char **keys, 
+	const int max_keys, int count, void *conn)
+{
+	return query_keys(table, predicates, count ? ";count" : "", keys, max_keys, conn);
+}
+
+
+/**
+ * @brief This is the function used to query a table for the first
+ * max_keys records in the order of a column.
+ *
+ * @param table The user-entered table name
+ * @param predicates The user-entered predicates
+ * @param order The column, and "asc" or "desc"
+ * @param keys Receives the first max_keys matching keys, in order
+ * @param max_keys The size of keys
+ * @param conn Acts as a file descriptor
+ * @return Returns the number of keys, or -1 on failure
+ */
+int storage_query_order(const char *table, const char *predicates, const char *order,
+	char **keys, const int max_keys, void *conn)
+{
+	char options[MAX_CMD_LEN];
+
+	if(order == NULL || *order == '\0' || strpbrk(order, ";\n") != NULL ||
+		snprintf(options, sizeof options, ";order by %s", order) >= sizeof options)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	return query_keys(table, predicates, options, keys, max_keys, conn);
+}
+
+
+/**
+ * @brief This is the function used to query a table for records.
+ *
+ * @param table The user-entered table name
+ * @param predicates The user-entered predicates
+ * @param keys Receives the first max_keys matching keys
+ * @param max_keys The size of keys
+ * @param conn Acts as a file descriptor
+ * @return Returns the number of matches, or -1 on failure
+ */
+int storage_query(const char *table, const char *predicates, char **keys, 
+	const int max_keys, void *conn)
+{
+	return storage_query_limit(table, predicates, keys, max_keys, 1, conn);
+}
+
+
+
+
+/**
+ * @brief This is the function used to find out where the records of a
+ * table are kept.
+ *
+ * @param table The user-entered table name
+ * @param stats Pointer to the structure that receives the counts
+ * @param conn Acts as a file descriptor
+ * @return Returns 0 on success, -1 otherwise
+ */
+int storage_stats(const char *table, struct storage_stats *stats, void *conn)
+{
+	if(table == NULL || stats == NULL || conn == NULL)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	// Check to see if the connection passed through is valid
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		logger("[LOG CLIENT] Stats failed. No connection", LOGGING);
+		return -1;
+	}
+
+	// Check to see if the connection has been authenticated
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		logger("[LOG CLIENT] Stats failed. Not authenticated", LOGGING);
+		return -1;
+	}
+
+	// Validate the information being passed in
+	int i = 0, c = 0;
+	for(; i < strlen(table) && c == 0; i++) {
+	    if (!isalnum(table[i])) 
+	        c++;
+	}
+
+	if(c != 0 || *table=='\0'){
+
+		errno = ERR_INVALID_PARAM;	// 1
+		return -1;
+	}
+
+	// Connection is really just a socket file descriptor.
+	int sock = (int)(intptr_t)conn;
+
+	char buf[MAX_CMD_LEN];
+	memset(buf, 0, sizeof buf);
+	snprintf(buf, sizeof buf, "STATS;%s\n", table);
+	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
+
+		if(strcmp(buf, "tableNotFound")==0)
+		{
+			errno = ERR_TABLE_NOT_FOUND;		// 5
+			return -1;
+		}
+
+		// the reply is "resident <count>,spilled <count>,lock_waits <count>,versions <count>"
+		if(sscanf(buf, "resident %ld,spilled %ld,lock_waits %ld,versions %ld", &stats->resident,
+			&stats->spilled, &stats->lock_waits, &stats->versions) != 4)
+		{
+			errno = ERR_UNKNOWN;
+			return -1;
+		}
 
 		return 0;
 	}
 
+	errno = ERR_CONNECTION_FAIL;
+	return -1;
+}
+
+
+/**
+ * @brief Checks that a table is a name the server accepts
+ *
+ * @return Returns 0 if it is, and -1 otherwise.
+ */
+static int valid_table(const char *table)
+{
+	int i;
+
+	if(table == NULL || *table == '\0' || strlen(table) >= MAX_TABLE_LEN)
+		return -1;
+
+	for(i = 0; table[i] != '\0'; i++)
+		if(!isalnum(table[i]))
+			return -1;
+
+	return 0;
+}
+
+
+/**
+ * @brief Checks that a table and a key are names the server accepts
+ *
+ * @return Returns 0 if they are, and -1 otherwise.
+ */
+static int valid_name(const char *table, const char *key)
+{
+	int i;
+
+	if(valid_table(table) != 0 || key == NULL || *key == '\0' ||
+		strlen(key) >= MAX_KEY_LEN)
+		return -1;
+
+	for(i = 0; key[i] != '\0'; i++)
+		if(!isalnum(key[i]))
+			return -1;
+
+	return 0;
+}
+
+
+/**
+ * @brief This is the function used to change an int column of a record
+ * on the server.
+ *
+ * @param table The user-entered table name
+ * @param key The user-entered key
+ * @param column The int column
+ * @param op The operator
+ * @param operand The operand
+ * @param result Receives the new value of the column
+ * @param conn Acts as a file descriptor
+ * @return Returns 0 on success, -1 otherwise
+ */
+int storage_apply(const char *table, const char *key, const char *column, 
+		enum storage_op op, int operand, int *result, void *conn)
+{
+	static const char *commands[] = { "INCR", "DECR", "MIN", "MAX" };
+
+	if(conn == NULL || result == NULL || column == NULL || *column == '\0' ||
+		strpbrk(column, ";\n") != NULL || op < STORAGE_INCR || op > STORAGE_MAX ||
+		valid_name(table, key) != 0)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	int sock = (int)(intptr_t)conn;
+	char buf[MAX_CMD_LEN];
+	snprintf(buf, sizeof buf, "%s;%s;%s;%s;%d\n", commands[op], table, key, column, operand);
+
+	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
+
+		if(strcmp(buf, "tableNotFound") == 0)
+			errno = ERR_TABLE_NOT_FOUND;		// 5
+		else if(strcmp(buf, "recordNotFound") == 0)
+			errno = ERR_KEY_NOT_FOUND;			// 6
+		else if(strcmp(buf, "invalidParameter") == 0)
+			errno = ERR_INVALID_PARAM;			// 1
+
+		// the reply is "<value>;<version>"
+		else if(sscanf(buf, "%d;", result) == 1)
+		{
+			logger("[LOG CLIENT] Successful: operator\n", LOGGING);
+			return 0;
+		}
+		else
+			errno = ERR_UNKNOWN;
+
+		return -1;
+	}
+
+	errno = ERR_CONNECTION_FAIL;
+	return -1;
 }
 
+/**
+ * @brief This is the function used to change some columns of a record
+ * on the server.
+ *
+ * @param table The user-entered table name
+ * @param key The user-entered key
+ * @param columns The new values of the columns
+ * @param version The version the record must have, or 0 for any
+ * @param conn Acts as a file descriptor
+ * @return Returns 0 on success, -1 otherwise
+ */
+int storage_update(const char *table, const char *key, const char *columns, 
+		uintptr_t version, void *conn)
+{
+	if(conn == NULL || columns == NULL || *columns == '\0' ||
+		strpbrk(columns, ";\n") != NULL || valid_name(table, key) != 0)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	int sock = (int)(intptr_t)conn;
+	char buf[MAX_CMD_LEN];
+	if(snprintf(buf, sizeof buf, "UPDATE;%s;%s;%s;%lu\n", table, key, columns,
+		(unsigned long) version) >= sizeof buf)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
+
+		if(strcmp(buf, "recordModified") == 0)
+		{
+			logger("[LOG CLIENT] Successful: update\n", LOGGING);
+			return 0;
+		}
+		else if(strcmp(buf, "tableNotFound") == 0)
+			errno = ERR_TABLE_NOT_FOUND;		// 5
+		else if(strcmp(buf, "recordNotFound") == 0)
+			errno = ERR_KEY_NOT_FOUND;			// 6
+		else if(strcmp(buf, "invalidParameter") == 0)
+			errno = ERR_INVALID_PARAM;			// 1
+		else if(strcmp(buf, "transactionAborted") == 0)
+			errno = ERR_TRANSACTION_ABORT;		// 8
+		else
+			errno = ERR_UNKNOWN;
+
+		return -1;
+	}
+
+	errno = ERR_CONNECTION_FAIL;
+	return -1;
+}
+
+/**
+ * @brief This is the function used to find out how the server would run
+ * a query.
+ *
+ * @param table The user-entered table name
+ * @param predicates The user-entered predicates
+ * @param plan Receives the plan
+ * @param size The size of plan
+ * @param conn Acts as a file descriptor
+ * @return Returns 0 on success, -1 otherwise
+ */
+int storage_explain(const char *table, const char *predicates, char *plan, 
+		size_t size, void *conn)
+{
+	if(conn == NULL || plan == NULL || size == 0 || predicates == NULL ||
+		*predicates == '\0' || strpbrk(predicates, ";\n") != NULL ||
+		valid_table(table) != 0)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	int sock = (int)(intptr_t)conn;
+	char buf[MAX_CMD_LEN];
+	if(snprintf(buf, sizeof buf, "EXPLAIN;%s;%s\n", table, predicates) >= sizeof buf)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
+
+		if(strcmp(buf, "tableNotFound") == 0)
+			errno = ERR_TABLE_NOT_FOUND;		// 5
+		else if(strcmp(buf, "invalidParameter") == 0)
+			errno = ERR_INVALID_PARAM;			// 1
+		else
+		{
+			strncpy(plan, buf, size);
+			plan[size - 1] = '\0';
+			logger("[LOG CLIENT] Successful: explain\n", LOGGING);
+			return 0;
+		}
+
+		return -1;
+	}
+
+	errno = ERR_CONNECTION_FAIL;
+	return -1;
+}
+
+
+/**
+ * @brief This is the function used to open a cursor over the records of
+ * a table that match some predicates.
+ *
+ * @param table The user-entered table name
+ * @param predicates The user-entered predicates
+ * @param records Whether the values are fetched with the keys
+ * @param conn Acts as a file descriptor
+ * @return Returns the cursor, or -1 on failure
+ */
+int storage_query_open(const char *table, const char *predicates, int records, void *conn)
+{
+	if(conn == NULL || predicates == NULL || *predicates == '\0' ||
+		strpbrk(predicates, ";\n") != NULL || valid_table(table) != 0)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	int sock = (int)(intptr_t)conn;
+	char buf[MAX_CMD_LEN];
+	if(snprintf(buf, sizeof buf, "OPEN;%s;%s%s\n", table, predicates,
+		records ? ";records" : "") >= sizeof buf)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
+
+		if(strcmp(buf, "tableNotFound") == 0)
+			errno = ERR_TABLE_NOT_FOUND;		// 5
+		else if(strcmp(buf, "invalidParameter") == 0)
+			errno = ERR_INVALID_PARAM;			// 1
+		else if(isNum(buf) != 0)
+			errno = ERR_UNKNOWN;
+		else
+		{
+			logger("[LOG CLIENT] Successful: open\n", LOGGING);
+			return atoi(buf);
+		}
+
+		return -1;
+	}
+
+	errno = ERR_CONNECTION_FAIL;
+	return -1;
+}
+
+
+/**
+ * @brief This is the function used to fetch the next matches of a cursor.
+ *
+ * @param cursor The cursor, from storage_query_open
+ * @param keys Receives the keys, or NULL
+ * @param records Receives the values, or NULL
+ * @param max_keys The most matches to fetch
+ * @param conn Acts as a file descriptor
+ * @return Returns the number of matches fetched, 0 at the end, or -1 on
+ *	   failure
+ */
+int storage_query_next(int cursor, char **keys, struct storage_record *records,
+	int max_keys, void *conn)
+{
+	if(conn == NULL || cursor <= 0 || max_keys <= 0)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	int sock = (int)(intptr_t)conn;
+	char buf[MAX_CMD_LEN];
+	int end;
+	snprintf(buf, sizeof buf, "FETCH;%d;%d\n", cursor, max_keys);
+
+	if (sendall(sock, buf, strlen(buf)) != 0 || recvword(sock, buf, sizeof buf, &end) != 0)
+	{
+		errno = ERR_CONNECTION_FAIL;
+		return -1;
+	}
+
+	if(strcmp(buf, "invalidParameter") == 0)
+	{
+		errno = ERR_INVALID_PARAM;			// 1
+		return -1;
+	}
+
+	if(isNum(buf) != 0 || atoi(buf) < 0 || atoi(buf) > max_keys)
+	{
+		errno = ERR_UNKNOWN;
+		return -1;
+	}
+
+	int count = atoi(buf);
+	int found;
+
+	// the keys follow the count, or the records are on the next lines
+	for(found = 0; found < count; found++)
+	{
+		char *value = NULL;
+
+		if(end == 0)
+		{
+			if(recvword(sock, buf, MAX_KEY_LEN, &end) != 0)
+				break;
+		}
+		else
+		{
+			if(recvline(sock, buf, sizeof buf) != 0)
+				break;
+			value = strchr(buf, ' ');
+			if(value != NULL)
+				*value++ = '\0';
+		}
+
+		if(keys != NULL)
+		{
+			strncpy(keys[found], buf, MAX_KEY_LEN);
+			keys[found][MAX_KEY_LEN - 1] = '\0';
+		}
+
+		if(records != NULL)
+		{
+			memset(&records[found], 0, sizeof records[found]);
+			strncpy(records[found].value, value != NULL ? value : "",
+				sizeof records[found].value - 1);
+		}
+	}
+
+	if(found < count)
+	{
+		errno = ERR_CONNECTION_FAIL;
+		return -1;
+	}
+
+	return count;
+}
+
+
+/**
+ * @brief This is the function used to close a cursor.
+ *
+ * @param cursor The cursor, from storage_query_open
+ * @param conn Acts as a file descriptor
+ * @return Returns 0 on success, -1 otherwise
+ */
+int storage_query_close(int cursor, void *conn)
+{
+	if(conn == NULL || cursor <= 0)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	int sock = (int)(intptr_t)conn;
+	char buf[MAX_CMD_LEN];
+	snprintf(buf, sizeof buf, "CLOSE;%d\n", cursor);
+
+	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
+
+		if(strcmp(buf, "cursorClosed") == 0)
+			return 0;
+
+		errno = strcmp(buf, "invalidParameter") == 0 ? ERR_INVALID_PARAM : ERR_UNKNOWN;
+		return -1;
+	}
+
+	errno = ERR_CONNECTION_FAIL;
+	return -1;
+}
+
+
+/**
+ * @brief This is the function used to query a table for the first
+ * max_keys records, with their values or some of their columns.
+ *
+ * @param table The user-entered table name
+ * @param predicates The user-entered predicates
+ * @param columns The columns to send, or NULL for all of them
+ * @param keys Receives the first max_keys matching keys, or NULL
+ * @param records Receive the values of the keys, or NULL
+ * @param max_keys The size of keys and records
+ * @param conn Acts as a file descriptor
+ * @return Returns the number of records, or -1 on failure
+ */
+int storage_query_records(const char *table, const char *predicates, const char *columns,
+	char **keys, struct storage_record *records, const int max_keys, void *conn)
+{
+	if(conn == NULL || predicates == NULL || *predicates == '\0' || max_keys < 0 ||
+		strpbrk(predicates, ";\n") != NULL || valid_table(table) != 0 ||
+		(columns != NULL && (*columns == '\0' || strpbrk(columns, ";\n") != NULL)))
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	int sock = (int)(intptr_t)conn;
+	char buf[MAX_CMD_LEN];
+	if(snprintf(buf, sizeof buf, "QUERY;%s;%s;%d;records%s%s\n", table, predicates, max_keys,
+		columns != NULL ? " " : "", columns != NULL ? columns : "") >= sizeof buf)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if (sendall(sock, buf, strlen(buf)) != 0 || recvline(sock, buf, sizeof buf) != 0)
+	{
+		errno = ERR_CONNECTION_FAIL;
+		return -1;
+	}
+
+	if(strcmp(buf, "tableNotFound") == 0)
+	{
+		errno = ERR_TABLE_NOT_FOUND;		// 5
+		return -1;
+	}
+	else if(strcmp(buf, "invalidParameter") == 0)
+	{
+		errno = ERR_INVALID_PARAM;			// 1
+		return -1;
+	}
+	else if(isNum(buf) != 0 || atoi(buf) < 0 || atoi(buf) > max_keys)
+	{
+		errno = ERR_UNKNOWN;
+		return -1;
+	}
+
+	int count = atoi(buf);
+	int found;
+
+	// a line of "<key> <value>" for every record
+	for(found = 0; found < count; found++)
+	{
+		if(recvline(sock, buf, sizeof buf) != 0)
+			break;
+
+		char *value = strchr(buf, ' ');
+		if(value != NULL)
+			*value++ = '\0';
+
+		if(keys != NULL)
+		{
+			strncpy(keys[found], buf, MAX_KEY_LEN);
+			keys[found][MAX_KEY_LEN - 1] = '\0';
+		}
+
+		if(records != NULL)
+		{
+			memset(&records[found], 0, sizeof records[found]);
+			strncpy(records[found].value, value != NULL ? value : "",
+				sizeof records[found].value - 1);
+		}
+	}
+
+	if(found < count)
+	{
+		errno = ERR_CONNECTION_FAIL;
+		return -1;
+	}
+
+	logger("[LOG CLIENT] Successful: query records\n", LOGGING);
+	return count;
+}
+
+
+/**
+ * @brief Copies the keys of a pair "<left key>,<right key>" that a JOIN
+ * replies with.
+ */
+static void split_pair(char *pair, char **left_keys, char **right_keys, int i)
+{
+	char *right = strchr(pair, ',');
+
+	if(right != NULL)
+		*right++ = '\0';
+
+	if(left_keys != NULL)
+	{
+		strncpy(left_keys[i], pair, MAX_KEY_LEN);
+		left_keys[i][MAX_KEY_LEN - 1] = '\0';
+	}
+
+	if(right_keys != NULL)
+	{
+		strncpy(right_keys[i], right != NULL ? right : "", MAX_KEY_LEN);
+		right_keys[i][MAX_KEY_LEN - 1] = '\0';
+	}
+}
+
+
+/**
+ * @brief This is the function used to join two tables on the server.
+ *
+ * @param left The user-entered name of the first table
+ * @param right The user-entered name of the second table
+ * @param on The user-entered condition, "<left column> = <right column>"
+ * @param predicates The user-entered predicates, each naming its table,
+ *	  or NULL
+ * @param columns The user-entered columns, each naming its table, or NULL
+ * @param left_keys Receive the keys of the left table, or NULL
+ * @param right_keys Receive the keys of the right table, or NULL
+ * @param records Receive the columns of the pairs, or NULL
+ * @param max_pairs The size of the arrays
+ * @param conn Acts as a file descriptor
+ * @return Returns the number of pairs, or -1 on failure
+ */
+int storage_join(const char *left, const char *right, const char *on, const char *predicates,
+	const char *columns, char **left_keys, char **right_keys, struct storage_record *records,
+	const int max_pairs, void *conn)
+{
+	if(conn == NULL || on == NULL || strchr(on, '=') == NULL || strpbrk(on, ";\n") != NULL ||
+		max_pairs < 0 || valid_table(left) != 0 || valid_table(right) != 0 ||
+		(predicates != NULL && (*predicates == '\0' || strpbrk(predicates, ";\n") != NULL)) ||
+		(columns != NULL && (*columns == '\0' || strpbrk(columns, ";\n") != NULL)))
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	int sock = (int)(intptr_t)conn;
+	char buf[MAX_CMD_LEN];
+
+	// the columns are only asked for if there is somewhere to put them
+	if(snprintf(buf, sizeof buf, "JOIN;%s;%s;%s;limit %d%s%s%s%s%s\n", left, right, on, max_pairs,
+		predicates != NULL ? ";where " : "", predicates != NULL ? predicates : "",
+		records != NULL ? ";records" : "", records != NULL && columns != NULL ? " " : "",
+		records != NULL && columns != NULL ? columns : "") >= sizeof buf)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	int end;
+	if (sendall(sock, buf, strlen(buf)) != 0 ||
+		(records != NULL ? recvline(sock, buf, sizeof buf) : recvword(sock, buf, sizeof buf, &end)) != 0)
+	{
+		errno = ERR_CONNECTION_FAIL;
+		return -1;
+	}
+
+	if(strcmp(buf, "tableNotFound") == 0)
+	{
+		errno = ERR_TABLE_NOT_FOUND;		// 5
+		return -1;
+	}
+	else if(strcmp(buf, "invalidParameter") == 0)
+	{
+		errno = ERR_INVALID_PARAM;			// 1
+		return -1;
+	}
+	else if(isNum(buf) != 0 || atoi(buf) < 0 || atoi(buf) > max_pairs)
+	{
+		errno = ERR_UNKNOWN;
+		return -1;
+	}
+
+	int count = atoi(buf);
+	int found;
+
+	// "<count> <pair> <pair> ...", or a line of "<pair> <columns>" for
+	// every pair
+	for(found = 0; found < count; found++)
+	{
+		if(records == NULL)
+		{
+			if(end != 0 || recvword(sock, buf, sizeof buf, &end) != 0)
+				break;
+			split_pair(buf, left_keys, right_keys, found);
+			continue;
+		}
+
+		if(recvline(sock, buf, sizeof buf) != 0)
+			break;
+
+		char *value = strchr(buf, ' ');
+		if(value != NULL)
+			*value++ = '\0';
+
+		split_pair(buf, left_keys, right_keys, found);
+		memset(&records[found], 0, sizeof records[found]);
+		strncpy(records[found].value, value != NULL ? value : "", sizeof records[found].value - 1);
+	}
+
+	if(found < count)
+	{
+		errno = ERR_CONNECTION_FAIL;
+		return -1;
+	}
+
+	logger("[LOG CLIENT] Successful: join\n", LOGGING);
+	return count;
+}
+
+
+/**
+ * @brief This is the function used to delete or change every record
+ * matching predicates on the server.
+ *
+ * @param table The user-entered table name
+ * @param predicates The user-entered predicates
+ * @param columns The new values of the columns, or NULL to delete
+ * @param conn Acts as a file descriptor
+ * @return Returns the number of records, or -1 on failure
+ */
+static int change_where(const char *table, const char *predicates, const char *columns, void *conn)
+{
+	if(conn == NULL || predicates == NULL || *predicates == '\0' ||
+		strpbrk(predicates, ";\n") != NULL || valid_table(table) != 0 ||
+		(columns != NULL && (*columns == '\0' || strpbrk(columns, ";\n") != NULL)))
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	int sock = (int)(intptr_t)conn;
+	char buf[MAX_CMD_LEN];
+	if(snprintf(buf, sizeof buf, "%s;%s;where %s%s%s\n", columns != NULL ? "UPDATE" : "DELETE",
+		table, predicates, columns != NULL ? ";" : "", columns != NULL ? columns : "") >= sizeof buf)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if (sendall(sock, buf, strlen(buf)) != 0 || recvline(sock, buf, sizeof buf) != 0)
+	{
+		errno = ERR_CONNECTION_FAIL;
+		return -1;
+	}
+
+	if(strcmp(buf, "tableNotFound") == 0)
+	{
+		errno = ERR_TABLE_NOT_FOUND;		// 5
+		return -1;
+	}
+	else if(strcmp(buf, "invalidParameter") == 0)
+	{
+		errno = ERR_INVALID_PARAM;			// 1
+		return -1;
+	}
+	else if(isNum(buf) != 0 || atoi(buf) < 0)
+	{
+		errno = ERR_UNKNOWN;
+		return -1;
+	}
+
+	logger("[LOG CLIENT] Successful: change where\n", LOGGING);
+	return atoi(buf);
+}
+
+
+/**
+ * @brief This is the function used to delete every record matching
+ * predicates on the server.
+ */
+int storage_delete_where(const char *table, const char *predicates, void *conn)
+{
+	return change_where(table, predicates, NULL, conn);
+}
+
+
+/**
+ * @brief This is the function used to change some columns of every record
+ * matching predicates on the server.
+ */
+int storage_update_where(const char *table, const char *predicates, const char *columns,
+	void *conn)
+{
+	if(columns == NULL)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	return change_where(table, predicates, columns, conn);
+}
+
+
+/**
+ * @brief This is the function used to delete every record of a table, or
+ * the table, on the server.
+ *
+ * @param command TRUNCATE or DROP
+ * @param table The user-entered table name
+ * @param reply The reply of the server on success
+ * @param conn Acts as a file descriptor
+ * @return Returns 0 on success, -1 otherwise
+ */
+static int clear_table(const char *command, const char *table, const char *reply, void *conn)
+{
+	if(conn == NULL || valid_table(table) != 0)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	int sock = (int)(intptr_t)conn;
+	char buf[MAX_CMD_LEN];
+	snprintf(buf, sizeof buf, "%s;%s\n", command, table);
+
+	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
+
+		if(strcmp(buf, reply) == 0)
+		{
+			logger("[LOG CLIENT] Successful: clear table\n", LOGGING);
+			return 0;
+		}
+		else if(strcmp(buf, "tableNotFound") == 0)
+			errno = ERR_TABLE_NOT_FOUND;		// 5
+		else if(strcmp(buf, "invalidParameter") == 0)
+			errno = ERR_INVALID_PARAM;			// 1
+		else
+			errno = ERR_UNKNOWN;
+
+		return -1;
+	}
+
+	errno = ERR_CONNECTION_FAIL;
+	return -1;
+}
+
+
+/**
+ * @brief This is the function used to delete every record of a table on
+ * the server.
+ */
+int storage_truncate(const char *table, void *conn)
+{
+	return clear_table("TRUNCATE", table, "tableTruncated", conn);
+}
+
+
+/**
+ * @brief This is the function used to drop a table on the server.
+ */
+int storage_drop(const char *table, void *conn)
+{
+	return clear_table("DROP", table, "tableDropped", conn);
+}
+
+
+/**
+ * @brief This is the function used to compute aggregates of the records
+ * of a table on the server.
+ *
+ * @param table The user-entered table name
+ * @param aggregates The user-entered aggregates
+ * @param predicates The user-entered predicates, or NULL for every record
+ * @param results Receives the aggregates
+ * @param max_results The size of results
+ * @param conn Acts as a file descriptor
+ * @return Returns the number of aggregates, or -1 on failure
+ */
+int storage_aggregate(const char *table, const char *aggregates, const char *predicates, 
+	double *results, int max_results, void *conn)
+{
+	if(conn == NULL || aggregates == NULL || *aggregates == '\0' || results == NULL ||
+		strpbrk(aggregates, ";\n") != NULL || valid_table(table) != 0 ||
+		(predicates != NULL && (*predicates == '\0' || strpbrk(predicates, ";\n") != NULL)))
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	int sock = (int)(intptr_t)conn;
+	char buf[MAX_CMD_LEN];
+	if(snprintf(buf, sizeof buf, "AGGREGATE;%s;%s%s%s\n", table, aggregates,
+		predicates != NULL ? ";" : "", predicates != NULL ? predicates : "") >= sizeof buf)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
+
+		if(strcmp(buf, "tableNotFound") == 0)
+		{
+			errno = ERR_TABLE_NOT_FOUND;		// 5
+			return -1;
+		}
+		else if(strcmp(buf, "invalidParameter") == 0)
+		{
+			errno = ERR_INVALID_PARAM;			// 1
+			return -1;
+		}
+
+		// the reply is the aggregates, separated by spaces
+		char *save;
+		char *tok = strtok_r(buf, " ", &save);
+		int found = 0;
+
+		for(; tok != NULL; tok = strtok_r(NULL, " ", &save))
+		{
+			char *end;
+			double value = strtod(tok, &end);
+
+			if(*end != '\0')
+			{
+				errno = ERR_UNKNOWN;
+				return -1;
+			}
+
+			if(found < max_results)
+				results[found] = value;
+			found++;
+		}
+
+		logger("[LOG CLIENT] Successful: aggregate\n", LOGGING);
+		return found;
+	}
+
+	errno = ERR_CONNECTION_FAIL;
+	return -1;
+}
+
+/**
+ * @brief This is the function used to compute aggregates of each group of
+ * the records matching some predicates.
+ */
+int storage_group(const char *table, const char *columns, const char *aggregates,
+	const char *predicates, struct storage_record *groups, double *results,
+	int max_groups, int max_results, void *conn)
+{
+	if(conn == NULL || columns == NULL || *columns == '\0' || aggregates == NULL ||
+		*aggregates == '\0' || max_groups < 0 || max_results < 0 ||
+		(max_groups > 0 && (groups == NULL || (max_results > 0 && results == NULL))) ||
+		strpbrk(columns, ";\n") != NULL || strpbrk(aggregates, ";\n") != NULL ||
+		valid_table(table) != 0 ||
+		(predicates != NULL && (*predicates == '\0' || strpbrk(predicates, ";\n") != NULL)))
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	int sock = (int)(intptr_t)conn;
+	char buf[MAX_CMD_LEN];
+	if(snprintf(buf, sizeof buf, "GROUP;%s;%s;%s%s%s\n", table, columns, aggregates,
+		predicates != NULL ? ";" : "", predicates != NULL ? predicates : "") >= sizeof buf)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if (sendall(sock, buf, strlen(buf)) != 0 || recvline(sock, buf, sizeof buf) != 0)
+	{
+		errno = ERR_CONNECTION_FAIL;
+		return -1;
+	}
+
+	if(strcmp(buf, "tableNotFound") == 0)
+	{
+		errno = ERR_TABLE_NOT_FOUND;		// 5
+		return -1;
+	}
+	else if(strcmp(buf, "invalidParameter") == 0)
+	{
+		errno = ERR_INVALID_PARAM;			// 1
+		return -1;
+	}
+	else if(isNum(buf) != 0 || atoi(buf) < 0)
+	{
+		errno = ERR_UNKNOWN;
+		return -1;
+	}
+
+	int count = atoi(buf);
+	int found;
+
+	// every group is on its own line, "values;aggregates", and all of them
+	// are read even if only max_groups are kept
+	for(found = 0; found < count; found++)
+	{
+		if(recvline(sock, buf, sizeof buf) != 0)
+			break;
+
+		char *aggs = strrchr(buf, ';');
+		if(aggs == NULL || found >= max_groups)
+			continue;
+		*aggs++ = '\0';
+
+		memset(&groups[found], 0, sizeof groups[found]);
+		strncpy(groups[found].value, buf, sizeof groups[found].value - 1);
+
+		char *save;
+		char *tok = strtok_r(aggs, " ", &save);
+		int i;
+
+		for(i = 0; tok != NULL && i < max_results; i++, tok = strtok_r(NULL, " ", &save))
+			results[found * max_results + i] = strtod(tok, NULL);
+	}
+
+	if(found < count)
+	{
+		errno = ERR_CONNECTION_FAIL;
+		return -1;
+	}
+
+	logger("[LOG CLIENT] Successful: group\n", LOGGING);
+	return count;
+}
+
+/**
+ * @brief This is the function used to start a transaction.
+ *
+ * @param txn Pointer to the structure that keeps the transaction
+ * @param conn Acts as a file descriptor
+ * @return Returns 0 on success, -1 otherwise
+ */
+int storage_begin(struct storage_txn *txn, void *conn)
+{
+	if(txn == NULL || conn == NULL)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	txn->conn = conn;
+	txn->nreads = 0;
+	txn->nwrites = 0;
+
+	return 0;
+}
+
+
+/**
+ * @brief This is the function used to read a record within a transaction.
+ *
+ * @param table The user-entered table name
+ * @param key The user-entered key
+ * @param record Pointer to the structure that receives the record
+ * @param txn The transaction that keeps the version read
+ * @return Returns 0 on success, -1 otherwise
+ */
+int storage_txn_get(const char *table, const char *key, struct storage_record *record, 
+		struct storage_txn *txn)
+{
+	int i;
+
+	if(txn == NULL || record == NULL || valid_name(table, key) != 0)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	// the transaction reads its own writes
+	for(i = 0; i < txn->nwrites; i++)
+	{
+		if(strcmp(txn->writes[i].table, table) == 0 && strcmp(txn->writes[i].key, key) == 0)
+		{
+			if(txn->writes[i].record.value[0] == '\0')
+			{
+				errno = ERR_KEY_NOT_FOUND;	// 6
+				return -1;
+			}
+
+			*record = txn->writes[i].record;
+			return 0;
+		}
+	}
+
+	int status = storage_get(table, key, record, txn->conn);
+	if(status != 0 && errno != ERR_KEY_NOT_FOUND)
+		return -1;
+
+	int version = status == 0 ? record->metadata[0] : 0;
+
+	// the first read of a key is the one checked at the commit
+	for(i = 0; i < txn->nreads; i++)
+		if(strcmp(txn->reads[i].table, table) == 0 && strcmp(txn->reads[i].key, key) == 0)
+			return status;
+
+	if(txn->nreads == MAX_TXN_KEYS)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	strncpy(txn->reads[i].table, table, sizeof txn->reads[i].table);
+	strncpy(txn->reads[i].key, key, sizeof txn->reads[i].key);
+	txn->reads[i].version = version;
+	txn->nreads++;
+
+	if(status != 0)
+		errno = ERR_KEY_NOT_FOUND;	// 6
+
+	return status;
+}
+
+
+/**
+ * @brief This is the function used to write a record within a transaction.
+ *
+ * @param table The user-entered table name
+ * @param key The user-entered key
+ * @param record Pointer to the new record, or NULL to delete the key
+ * @param txn The transaction that keeps the write until the commit
+ * @return Returns 0 on success, -1 otherwise
+ */
+int storage_txn_set(const char *table, const char *key, struct storage_record *record, 
+		struct storage_txn *txn)
+{
+	int i;
+
+	if(txn == NULL || valid_name(table, key) != 0 ||
+		(record != NULL && (record->value[0] == '\0' || strchr(record->value, ';') != NULL)))
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	for(i = 0; i < txn->nwrites; i++)
+		if(strcmp(txn->writes[i].table, table) == 0 && strcmp(txn->writes[i].key, key) == 0)
+			break;
+
+	if(i == MAX_TXN_KEYS)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	strncpy(txn->writes[i].table, table, sizeof txn->writes[i].table);
+	strncpy(txn->writes[i].key, key, sizeof txn->writes[i].key);
+	if(record != NULL)
+		txn->writes[i].record = *record;
+	else
+		txn->writes[i].record.value[0] = '\0';
+
+	if(i == txn->nwrites)
+		txn->nwrites++;
+
+	return 0;
+}
+
+
+/**
+ * @brief This is the function used to commit a transaction.
+ *
+ * @param txn The transaction
+ * @return Returns 0 on success, -1 otherwise
+ */
+int storage_commit(struct storage_txn *txn)
+{
+	int i;
+
+	if(txn == NULL || txn->conn == NULL)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+
+	if(connected == 0)
+	{
+		errno = ERR_CONNECTION_FAIL;	// 2
+		return -1;
+	}
+
+	if(authenticated == 0)
+	{
+		errno = ERR_NOT_AUTHENTICATED; // 3
+		return -1;
+	}
+
+	// the reads and writes go in one command:
+	// "COMMIT;<reads>;<writes>" then "table;key;version" for every read
+	// and "table;key;value" for every write
+	int sock = (int)(intptr_t)txn->conn;
+	char buf[MAX_CMD_LEN];
+	size_t len = snprintf(buf, sizeof buf, "COMMIT;%d;%d", txn->nreads, txn->nwrites);
+
+	for(i = 0; i < txn->nreads && len < sizeof buf; i++)
+		len += snprintf(buf + len, sizeof buf - len, ";%s;%s;%d", txn->reads[i].table,
+			txn->reads[i].key, txn->reads[i].version);
+
+	for(i = 0; i < txn->nwrites && len < sizeof buf; i++)
+		len += snprintf(buf + len, sizeof buf - len, ";%s;%s;%s", txn->writes[i].table,
+			txn->writes[i].key, txn->writes[i].record.value[0] != '\0' ?
+			txn->writes[i].record.value : "deleteRecord");
+
+	if(len + 1 >= sizeof buf)
+	{
+		errno = ERR_INVALID_PARAM;	//1
+		return -1;
+	}
+	strcat(buf, "\n");
+
+	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
+
+		if(strcmp(buf, "transactionCommitted") == 0)
+		{
+			logger("[LOG CLIENT] Successful: COMMIT\n", LOGGING);
+			return 0;
+		}
+
+		if(strcmp(buf, "transactionAborted") == 0)
+			errno = ERR_TRANSACTION_ABORT;		// 8
+		else if(strcmp(buf, "tableNotFound") == 0)
+			errno = ERR_TABLE_NOT_FOUND;		// 5
+		else if(strcmp(buf, "recordNotFound") == 0)
+			errno = ERR_KEY_NOT_FOUND;			// 6
+		else if(strcmp(buf, "invalidParameter") == 0)
+			errno = ERR_INVALID_PARAM;			// 1
+		else
+			errno = ERR_UNKNOWN;
+
+		logger("[LOG CLIENT] Unable to COMMIT\n", LOGGING);
+		return -1;
+	}
+
+	errno = ERR_CONNECTION_FAIL;
+	return -1;
+}
 
 
 /**
@@ -687,7 +2157,7 @@ int storage_query(const char *table, const char *predicates, char **keys,
 int storage_disconnect(void *conn)
 {
 	// Cleanup
-	int sock = (int)conn;
+	int sock = (int)(intptr_t)conn;
 	
 	if(conn!=NULL)
 	{
@@ -34,6 +34,7 @@
 #define MAX_COLNAME_LEN 20	///< Max characters of a column name.
 #define MAX_STRTYPE_SIZE 40	///< Max SIZE of string types.
 #define MAX_VALUE_LEN 800	///< Max characters of a value.
+#define MAX_TXN_KEYS 8		///< Max keys a transaction reads, and max keys it writes.
 
 // Error codes.
 #define ERR_INVALID_PARAM 1		///< A parameter is not valid.
@@ -105,6 +106,28 @@ int storage_auth(const char *username, const char *passwd, void *conn);
 int storage_get(const char *table, const char *key, struct storage_record 
 		*record, void *conn);
 
+/**
+ * @brief Retrieve some columns of the record associated with a key in a
+ * table.
+ *
+ * @param table A table in the database.
+ * @param key A key in the table.
+ * @param columns A comma separated list of columns, like "population".
+ * @param record A pointer to a record struture.
+ * @param conn A connection to the server.
+ * @return Return 0 if successful, and -1 otherwise.
+ *
+ * On error, errno is set as for storage_get. ERR_INVALID_PARAM is also
+ * returned if a column is not in the table.
+ *
+ * Only the columns are sent by the server, in the order they are listed,
+ * like "population 2000000". The version is set like storage_get sets it,
+ * but the value is not a whole record, so it can not be passed to
+ * storage_set as it is.
+ */
+int storage_get_columns(const char *table, const char *key, const char *columns,
+		struct storage_record *record, void *conn);
+
 /**
  * @brief Store a key/value pair in a table.
  *
@@ -148,10 +171,518 @@ int storage_set(const char *table, const char *key, struct storage_record
  * separated by optional whitespace. The operator may be a "=" for string
  * types, or one of "<, >, =" for int and float types. An example of query
  * predicates is "name = bob, mark > 90".
+ *
+ * The first max_keys matching keys are copied, each to a buffer of
+ * MAX_KEY_LEN characters, and the others are only counted. keys may be
+ * NULL if max_keys is 0.
  */
 int storage_query(const char *table, const char *predicates, char **keys, 
 		const int max_keys, void *conn);
 
+/**
+ * @brief Query the table for records, and stop at max_keys matches.
+ *
+ * @param table A table in the database.
+ * @param predicates A comma separated list of predicates.
+ * @param keys An array of strings where the first max_keys matching keys
+ * will be copied, as for storage_query.
+ * @param max_keys The size of the keys array.
+ * @param count Whether to count every match, like storage_query does.
+ * @param conn A connection to the server.
+ * @return Return the number of matching keys if successful, and -1
+ * otherwise. Without count, it is at most max_keys.
+ *
+ * On error, errno is set as for storage_query.
+ *
+ * Without count the server stops reading the table once it has found
+ * max_keys matches, so asking whether anything matches costs at most one
+ * match. With count only max_keys keys are sent back, but every record
+ * is checked.
+ */
+int storage_query_limit(const char *table, const char *predicates, char **keys, 
+		const int max_keys, int count, void *conn);
+
+/**
+ * @brief Query the table for the first max_keys records in the order of
+ * a column.
+ *
+ * @param table A table in the database.
+ * @param predicates A comma separated list of predicates.
+ * @param order The column to order by, optionally followed by "asc" or
+ * "desc", like "population desc". The default is "asc".
+ * @param keys An array of at least max_keys buffers of MAX_KEY_LEN
+ * characters that receive the keys, in order.
+ * @param max_keys The size of the keys array.
+ * @param conn A connection to the server.
+ * @return Return the number of keys, which is at most max_keys, if
+ * successful, and -1 otherwise.
+ *
+ * On error, errno is set as for storage_query.
+ *
+ * Records with the same value are ordered by key. Only the first
+ * max_keys matches are kept by the server, and if the column has an
+ * ordered index, it reads the records in order and stops there.
+ */
+int storage_query_order(const char *table, const char *predicates, const char *order,
+		char **keys, const int max_keys, void *conn);
+
+/**
+ * @brief Query the table for the first max_keys records, with their
+ * values, instead of a QUERY followed by a GET for every key.
+ *
+ * @param table A table in the database.
+ * @param predicates A comma separated list of predicates.
+ * @param columns A comma separated list of the columns to return, or NULL
+ * to return the whole values.
+ * @param keys An array of at least max_keys buffers of MAX_KEY_LEN
+ * characters that receive the keys, or NULL.
+ * @param records An array of at least max_keys records that receive the
+ * values, or NULL. Their versions are not set.
+ * @param max_keys The size of the keys and records arrays.
+ * @param conn A connection to the server.
+ * @return Return the number of records, which is at most max_keys, if
+ * successful, and -1 otherwise.
+ *
+ * On error, errno is set as for storage_query.
+ */
+int storage_query_records(const char *table, const char *predicates, const char *columns,
+		char **keys, struct storage_record *records, const int max_keys, void *conn);
+
+/**
+ * @brief Join two tables on the server, pairing the records of the left
+ * table with those of the right table whose columns are equal.
+ *
+ * @param left A table in the database.
+ * @param right Another table in the database.
+ * @param on The columns joined on, like "name = city", where "key" is the
+ * key of a table.
+ * @param predicates A comma separated list of predicates, each naming its
+ * table like "census.year > 1990", or NULL for every record.
+ * @param columns A comma separated list of the columns to return, each
+ * naming its table, or NULL to return every column of both.
+ * @param left_keys An array of at least max_pairs buffers of MAX_KEY_LEN
+ * characters that receive the keys of the left table, or NULL.
+ * @param right_keys Like left_keys, for the right table, or NULL.
+ * @param records An array of at least max_pairs records that receive the
+ * columns of every pair, like "census.year 1991,cities.name toronto", or
+ * NULL to return only the keys. Their versions are not set.
+ * @param max_pairs The size of the arrays.
+ * @param conn A connection to the server.
+ * @return Return the number of pairs, which is at most max_pairs, if
+ * successful, and -1 otherwise.
+ *
+ * On error, errno is set as for storage_query.
+ *
+ * The server builds a hash of the joined values of the table expected to
+ * match fewer records, and probes it with the records of the other.
+ */
+int storage_join(const char *left, const char *right, const char *on, const char *predicates,
+		const char *columns, char **left_keys, char **right_keys, struct storage_record *records,
+		const int max_pairs, void *conn);
+
+/**
+ * @brief Where the records of a table are kept.
+ */
+struct storage_stats {
+	/// The number of records held in memory.
+	long resident;
+
+	/// The number of records kept on disk.
+	long spilled;
+
+	/// The number of times a command had to wait for a lock of the table.
+	long lock_waits;
+
+	/// The number of earlier values kept for the snapshots of queries.
+	long versions;
+};
+
+/**
+ * @brief Retrieve how many records of a table are in memory and on disk.
+ *
+ * @param table A table in the database.
+ * @param stats A pointer to a stats structure that receives the counts.
+ * @param conn A connection to the server.
+ * @return Return 0 if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to one of the following, as appropriate: 
+ * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, ERR_TABLE_NOT_FOUND, 
+ * ERR_NOT_AUTHENTICATED, or ERR_UNKNOWN.
+ *
+ * Records of a table with a memory budget are spilled to disk when the
+ * table is over its budget. For a table stored in an LSM tree, the counts
+ * are the entries of its memtables and of its runs.
+ *
+ * A query reads a snapshot of the table, and the values changed while it
+ * runs are kept until no open snapshot reads them.
+ */
+int storage_stats(const char *table, struct storage_stats *stats, void *conn);
+
+/**
+ * @brief The operators storage_apply() runs on an int column.
+ */
+enum storage_op {
+	STORAGE_INCR,	///< Add the operand to the column.
+	STORAGE_DECR,	///< Subtract the operand from the column.
+	STORAGE_MIN,	///< Keep the smaller of the column and the operand.
+	STORAGE_MAX	///< Keep the larger of the column and the operand.
+};
+
+/**
+ * @brief Change an int column of a record on the server.
+ *
+ * @param table A table in the database.
+ * @param key A key in the table.
+ * @param column An int column of the table.
+ * @param op The operator.
+ * @param operand The operand.
+ * @param result A pointer to an int that receives the new value of the
+ * column.
+ * @param conn A connection to the server.
+ * @return Return 0 if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to one of the following, as appropriate: 
+ * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, ERR_TABLE_NOT_FOUND, 
+ * ERR_KEY_NOT_FOUND, ERR_NOT_AUTHENTICATED, or ERR_UNKNOWN.
+ *
+ * The record is read, changed and stored again by the server as one
+ * change, which bumps its version, so concurrent operators on a record
+ * never abort. ERR_INVALID_PARAM is also returned if the new value does
+ * not fit in an int.
+ */
+int storage_apply(const char *table, const char *key, const char *column, 
+		enum storage_op op, int operand, int *result, void *conn);
+
+/**
+ * @brief Change some columns of a record on the server.
+ *
+ * @param table A table in the database.
+ * @param key A key in the table.
+ * @param columns The new values, "column value,column value,...".
+ * @param version The version the record must have, or 0 for any.
+ * @param conn A connection to the server.
+ * @return Return 0 if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to one of the following, as appropriate: 
+ * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, ERR_TABLE_NOT_FOUND, 
+ * ERR_KEY_NOT_FOUND, ERR_NOT_AUTHENTICATED, ERR_TRANSACTION_ABORT, or
+ * ERR_UNKNOWN.
+ *
+ * Only the columns given are rewritten; the others keep their values.
+ * Every new value is checked against the schema, and ERR_INVALID_PARAM
+ * is returned, with no column changed, if any of them does not fit.
+ */
+int storage_update(const char *table, const char *key, const char *columns, 
+		uintptr_t version, void *conn);
+
+/**
+ * @brief Delete every record of a table matching predicates.
+ *
+ * @param table A table in the database.
+ * @param predicates A comma separated list of predicates, as for
+ * storage_query.
+ * @param conn A connection to the server.
+ * @return Return the number of records deleted if successful, and -1
+ * otherwise.
+ *
+ * On error, errno will be set to one of the following, as appropriate: 
+ * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, ERR_TABLE_NOT_FOUND, 
+ * ERR_NOT_AUTHENTICATED, or ERR_UNKNOWN.
+ *
+ * The server deletes the records together, in one pass, and a query sees
+ * all of them deleted or none. Only tables stored in the hash table
+ * engine support it, and the others fail with ERR_INVALID_PARAM.
+ */
+int storage_delete_where(const char *table, const char *predicates, void *conn);
+
+/**
+ * @brief Change some columns of every record of a table matching
+ * predicates.
+ *
+ * @param table A table in the database.
+ * @param predicates A comma separated list of predicates, as for
+ * storage_query.
+ * @param columns The new values, "column value,column value,...".
+ * @param conn A connection to the server.
+ * @return Return the number of records changed if successful, and -1
+ * otherwise.
+ *
+ * On error, errno is set as for storage_delete_where.
+ *
+ * The columns are checked against the schema as for storage_update, and
+ * every record changed gets a new version. Like storage_delete_where, it
+ * is only supported by tables stored in the hash table engine.
+ */
+int storage_update_where(const char *table, const char *predicates, const char *columns,
+		void *conn);
+
+/**
+ * @brief Delete every record of a table.
+ *
+ * @param table A table in the database.
+ * @param conn A connection to the server.
+ * @return Return 0 if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to one of the following, as appropriate: 
+ * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, ERR_TABLE_NOT_FOUND, 
+ * ERR_NOT_AUTHENTICATED, or ERR_UNKNOWN.
+ *
+ * The server empties an in-memory hash table at once, with its spill
+ * file, and frees its records in the background. A table on another
+ * engine is given new, empty storage. Either way, a version read before
+ * matches no record after.
+ */
+int storage_truncate(const char *table, void *conn);
+
+/**
+ * @brief Delete every record of a table, and the table.
+ *
+ * @param table A table in the database.
+ * @param conn A connection to the server.
+ * @return Return 0 if successful, and -1 otherwise.
+ *
+ * On error, errno is set as for storage_truncate. Until the server is
+ * restarted, the table is not found by any command.
+ */
+int storage_drop(const char *table, void *conn);
+
+/**
+ * @brief Find out how the server would run a query.
+ *
+ * @param table A table in the database.
+ * @param predicates The predicates of the query, as for storage_query.
+ * @param plan Receives the plan, like "index year cost 40 rows 2 of 1000;
+ * year = 1990 rows 10; name = bob rows 200".
+ * @param size The size of the plan buffer.
+ * @param conn A connection to the server.
+ * @return Return 0 if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to one of the following, as appropriate: 
+ * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, ERR_TABLE_NOT_FOUND, 
+ * ERR_NOT_AUTHENTICATED, or ERR_UNKNOWN.
+ *
+ * The plan starts with how the records are read: a scan of the table, an
+ * index on the column of one predicate, or the intersection of the bitmap
+ * indexes of some equalities, with its estimated cost and the estimated
+ * number of matching records. The predicates follow in the order they are
+ * checked, the most selective first, with the records each is estimated
+ * to match.
+ */
+int storage_explain(const char *table, const char *predicates, char *plan, 
+		size_t size, void *conn);
+
+/**
+ * @brief Open a cursor over the records of a table matching some
+ * predicates, to read them a page at a time.
+ *
+ * @param table A table in the database.
+ * @param predicates The predicates, as for storage_query.
+ * @param records Whether storage_query_next also returns the values.
+ * @param conn A connection to the server.
+ * @return Return the cursor if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to one of the following, as appropriate: 
+ * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, ERR_TABLE_NOT_FOUND, 
+ * ERR_NOT_AUTHENTICATED, or ERR_UNKNOWN. ERR_UNKNOWN is also returned
+ * when the server, or this connection, has too many cursors open.
+ *
+ * The server keeps where the cursor is in the table, so only a page of
+ * results is ever held by the client. A cursor of an in-memory table
+ * reads it as it was when the cursor was opened, and a cursor of another
+ * engine may see changes made since. The cursor is closed by
+ * storage_query_close, when the connection is, or by the server once it
+ * goes without a storage_query_next for the cursor_timeout of the server
+ * configuration, 60 seconds by default.
+ */
+int storage_query_open(const char *table, const char *predicates, int records, 
+		void *conn);
+
+/**
+ * @brief Fetch the next matches of a cursor.
+ *
+ * @param cursor A cursor from storage_query_open.
+ * @param keys An array of at least max_keys buffers of MAX_KEY_LEN
+ * characters that receive the keys, or NULL.
+ * @param records An array of at least max_keys records that receive the
+ * values, or NULL. The values are empty unless the cursor was opened for
+ * records.
+ * @param max_keys The most matches to fetch.
+ * @param conn A connection to the server.
+ * @return Return the number of matches fetched, which is only less than
+ * max_keys at the end of the cursor, and -1 otherwise.
+ *
+ * On error, errno will be set to one of the following, as appropriate: 
+ * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, ERR_NOT_AUTHENTICATED, or
+ * ERR_UNKNOWN. ERR_INVALID_PARAM is also returned when the server closed
+ * the cursor because it was idle.
+ */
+int storage_query_next(int cursor, char **keys, struct storage_record *records, 
+		int max_keys, void *conn);
+
+/**
+ * @brief Close a cursor.
+ *
+ * @param cursor A cursor from storage_query_open.
+ * @param conn A connection to the server.
+ * @return Return 0 if successful, and -1 otherwise.
+ */
+int storage_query_close(int cursor, void *conn);
+
+/**
+ * @brief Compute aggregates of the records of a table that match some
+ * predicates, on the server.
+ *
+ * @param table A table in the database.
+ * @param aggregates A comma separated list of aggregates.
+ * @param predicates The predicates, as for storage_query, or NULL to
+ * aggregate every record.
+ * @param results An array that receives the aggregates, in order.
+ * @param max_results The size of the results array.
+ * @param conn A connection to the server.
+ * @return Return the number of aggregates (which may be more than
+ * max_results) if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to one of the following, as appropriate: 
+ * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, ERR_TABLE_NOT_FOUND, 
+ * ERR_NOT_AUTHENTICATED, or ERR_UNKNOWN.
+ *
+ * An aggregate is "count", or one of "sum", "min", "max" and "avg"
+ * followed by an int column, like "count, sum population, avg year".
+ * The min, max and avg of no records are NaN.
+ */
+int storage_aggregate(const char *table, const char *aggregates, const char *predicates, 
+		double *results, int max_results, void *conn);
+
+/**
+ * @brief Compute aggregates of each group of the records of a table that
+ * match some predicates, on the server.
+ *
+ * @param table A table in the database.
+ * @param columns A comma separated list of the columns to group by.
+ * @param aggregates The aggregates, as for storage_aggregate.
+ * @param predicates The predicates, as for storage_query, or NULL to
+ * group every record.
+ * @param groups An array of at least max_groups records whose values
+ * receive the values of the group columns of each group, separated by
+ * commas, like "ontario,2001".
+ * @param results An array of max_groups * max_results that receives the
+ * aggregates of each group, max_results apart.
+ * @param max_groups The most groups to return.
+ * @param max_results The most aggregates to return of each group.
+ * @param conn A connection to the server.
+ * @return Return the number of groups (which may be more than max_groups)
+ * if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to one of the following, as appropriate: 
+ * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, ERR_TABLE_NOT_FOUND, 
+ * ERR_NOT_AUTHENTICATED, or ERR_UNKNOWN.
+ *
+ * The groups are in no particular order.
+ */
+int storage_group(const char *table, const char *columns, const char *aggregates,
+		const char *predicates, struct storage_record *groups, double *results,
+		int max_groups, int max_results, void *conn);
+
+/**
+ * @brief A transaction over keys of one or more tables.
+ *
+ * The fields are kept by the storage_txn functions.
+ */
+struct storage_txn {
+	/// The connection the transaction commits on.
+	void *conn;
+
+	/// The number of keys read.
+	int nreads;
+
+	/// The keys read, with the version read, or 0 if the key did not exist.
+	struct {
+		char table[MAX_TABLE_LEN];
+		char key[MAX_KEY_LEN];
+		int version;
+	} reads[MAX_TXN_KEYS];
+
+	/// The number of keys written.
+	int nwrites;
+
+	/// The keys written, with their new records. A deleted key has an
+	/// empty value.
+	struct {
+		char table[MAX_TABLE_LEN];
+		char key[MAX_KEY_LEN];
+		struct storage_record record;
+	} writes[MAX_TXN_KEYS];
+};
+
+/**
+ * @brief Start a transaction.
+ *
+ * @param txn A pointer to a transaction structure.
+ * @param conn A connection to the server.
+ * @return Return 0 if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to one of the following, as appropriate: 
+ * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, or ERR_NOT_AUTHENTICATED.
+ *
+ * Nothing is sent to the server until the transaction is committed.
+ */
+int storage_begin(struct storage_txn *txn, void *conn);
+
+/**
+ * @brief Retrieve the value associated with a key within a transaction.
+ *
+ * @param table A table in the database.
+ * @param key A key in the table.
+ * @param record A pointer to a record structure.
+ * @param txn A transaction started with storage_begin().
+ * @return Return 0 if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to one of the errors of storage_get(), or
+ * to ERR_INVALID_PARAM if the transaction has read too many keys.
+ *
+ * A key written by the transaction reads as written. Otherwise the record
+ * is retrieved from the server, and the commit is aborted if the key
+ * changes before it. A key that is not found is expected not to exist at
+ * the commit either.
+ */
+int storage_txn_get(const char *table, const char *key, struct storage_record 
+		*record, struct storage_txn *txn);
+
+/**
+ * @brief Store a key/value pair in a table when a transaction commits.
+ *
+ * @param table A table in the database.
+ * @param key A key in the table.
+ * @param record A pointer to a record structure, or NULL to delete the key.
+ * @param txn A transaction started with storage_begin().
+ * @return Return 0 if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to ERR_INVALID_PARAM.
+ *
+ * Writing a key again replaces the earlier write. The version of the
+ * record is ignored; the keys read by the transaction are checked instead.
+ */
+int storage_txn_set(const char *table, const char *key, struct storage_record 
+		*record, struct storage_txn *txn);
+
+/**
+ * @brief Commit a transaction.
+ *
+ * @param txn A transaction started with storage_begin().
+ * @return Return 0 if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to one of the following, as appropriate: 
+ * ERR_INVALID_PARAM, ERR_CONNECTION_FAIL, ERR_TABLE_NOT_FOUND, 
+ * ERR_KEY_NOT_FOUND, ERR_NOT_AUTHENTICATED, ERR_TRANSACTION_ABORT, or
+ * ERR_UNKNOWN.
+ *
+ * The versions of the keys read and the writes are sent to the server in
+ * one command. The server applies all the writes if none of the keys read
+ * has changed, and none of them otherwise, with ERR_TRANSACTION_ABORT.
+ * Only tables stored in the hash table engine support transactions.
+ */
+int storage_commit(struct storage_txn *txn);
+
 /**
  * @brief Close the connection to the server.
  *
@@ -12,9 +12,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <crypt.h>
 #include "utils.h"
 
 
@@ -209,12 +212,13 @@ int getNumberOfColsInput(char* str)
 {
 	int cols = 0;
 	char* s = str;
-	char* s1 = strtok(s,",");
+	char* save;
+	char* s1 = strtok_r(s, ",", &save);
 
 	while(s1)
 	{
 		cols++;
-		s1 = strtok(NULL, ",");
+		s1 = strtok_r(NULL, ",", &save);
 	}
 
 	return cols;
@@ -242,6 +246,7 @@ int parser(char* schema, char* str)
 
 	char* ss;
 	char* s1;
+	char* save;
 
 
 
@@ -256,7 +261,7 @@ int parser(char* schema, char* str)
 	else
 	{
 	    ss = str;		// pointer to the string for strtok
-	    s1 = strtok(ss,",");		// getting first comma separated token, i.e "  name    Bloor   Danforth "
+	    s1 = strtok_r(ss, ",", &save);		// getting first comma separated token, i.e "  name    Bloor   Danforth "
 	}
 
     while(s1 && inputIsValid)
@@ -363,7 +368,7 @@ int parser(char* schema, char* str)
 
 
 		// getting next colName,colValue
-		s1 = strtok(NULL,",");		
+		s1 = strtok_r(NULL, ",", &save);
 
 	}
 
@@ -384,6 +389,44 @@ int parser(char* schema, char* str)
 }
 
 
+/**
+ * @brief This function is used to look up the type of a column in the
+ * schema of a table.
+ *
+ * @param schema The schema, "name type [length] name type [length] ..."
+ * @param column The column
+ * @param size Receives the length of a char column
+ * @return Returns "int" or "char", or NULL if there is no such column
+ */
+const char *column_type(char *schema, char *column, int *size)
+{
+	char copy[MAX_CONFIG_LINE_LEN];
+	char *save, *tok;
+
+	strncpy(copy, schema, sizeof copy);
+	copy[sizeof copy - 1] = '\0';
+
+	for(tok = strtok_r(copy, " ", &save); tok != NULL; tok = strtok_r(NULL, " ", &save))
+	{
+		char *type = strtok_r(NULL, " ", &save);
+		char *length = NULL;
+
+		if(type == NULL)
+			break;
+		if(strcmp(type, "char") == 0 && (length = strtok_r(NULL, " ", &save)) == NULL)
+			break;
+
+		if(strcmp(tok, column) == 0)
+		{
+			*size = length != NULL ? atoi(length) : 0;
+			return strcmp(type, "int") == 0 ? "int" : "char";
+		}
+	}
+
+	return NULL;
+}
+
+
 
 int sendall(const int sock, const char *buf, const size_t len)
 {
@@ -442,6 +485,42 @@ int recvline(const int sock, char *buf, const size_t buflen)
 }
 
 
+/**
+ * @brief This function is used to recieve a word of a line from the
+ * socket, so that a long line is read without a buffer as long as it.
+ * 
+ * @param sock Acts as a file descriptor
+ * @param buf Buffer that stores the word
+ * @param buflen Length of the buffer
+ * @param end Set to 1 if the word ends the line, and 0 otherwise
+ *
+ * Words end at a space or at the end of the line. The rest of a word
+ * longer than the buffer is skipped.
+ */
+int recvword(const int sock, char *buf, const size_t buflen, int *end)
+{
+	size_t len = 0;
+	char c;
+
+	*end = 0;
+	for (;;) {
+		// Read one byte from socket.
+		if (recv(sock, &c, 1, 0) <= 0) {
+			buf[len] = 0;
+			return -1;
+		}
+		if (c == '\n' || c == ' ')
+			break;
+		if (len + 1 < buflen)
+			buf[len++] = c;
+	}
+	buf[len] = 0;
+	*end = (c == '\n');
+
+	return 0;
+}
+
+
 /**
  * @brief This function is used to parse and process a line in the 
  * config file.
@@ -675,9 +754,9 @@ char *n1[] = {NULL, "table", "name", "colon", "char_type", "int_type",
 "key_username", "key_password","password"};
 
 
-int tokenizer(char* config_file, struct config_params *params)
+int tokenizer(FILE* config_file, struct config_params *params)
 {
-	yyin = fopen(config_file, "r");
+	yyin = config_file;
 
 	char serverHost[MAX_HOST_LEN];
 	char serverPort[MAX_PORT_LEN];
@@ -1158,6 +1237,321 @@ int tokenizer(char* config_file, struct config_params *params)
 }
 
 
+/**
+ * @brief table_option lines seen so far. They are applied once the
+ * tokenizer has found all the tables.
+ */
+static struct {
+	char table[MAX_CONFIG_LINE_LEN];
+	char name[MAX_CONFIG_LINE_LEN];
+	char value[MAX_CONFIG_LINE_LEN];
+} tableOptionLines[MAX_TABLE_OPTIONS];
+
+static int numOfTableOptionLines = 0;
+
+/**
+ * @brief The index lists cut from table lines. They are applied with the
+ * table_option lines.
+ */
+static struct {
+	char table[MAX_CONFIG_LINE_LEN];
+	char columns[MAX_CONFIG_LINE_LEN];
+} tableIndexLines[MAX_TABLES];
+
+static int numOfTableIndexLines = 0;
+
+/**
+ * @brief This function is used to pick out the config lines that the
+ * lexer does not understand.
+ *
+ * @param line A line of the configuration file
+ * @param params Stores the configuration parameters
+ * @return Returns 1 if the line was consumed, 0 if it should be passed
+ * 		  on to the tokenizer, and -1 if it is invalid
+ *
+ * Handles the "data_directory <path>", "worker_threads <count>",
+ * "listener_threads <count>" and "cursor_timeout <seconds>" lines, and the
+ * "table_option <table> <option> <value>" lines. The
+ * "index <column>,<column>[:bitmap]" list at the end of a table line is cut off,
+ * and the rest of the line is passed on.
+ */
+int process_option_line(char *line, struct config_params *params)
+{
+	char name[MAX_CONFIG_LINE_LEN];
+	char table[MAX_CONFIG_LINE_LEN];
+	char option[MAX_CONFIG_LINE_LEN];
+	char value[MAX_CONFIG_LINE_LEN];
+	char extraArg[MAX_CONFIG_LINE_LEN];
+
+	if(sscanf(line, "%s", name) != 1)
+		return 0;
+
+	if(strcmp(name, "data_directory") == 0)
+	{
+		int items = sscanf(line, "%s %s %s", name, value, extraArg);
+		if(items != 2 || strlen(value) >= MAX_PATH_LEN)
+		{
+			printf("Invalid data directory\n");
+			return -1;
+		}
+
+		strncpy(params->data_directory, value, sizeof params->data_directory);
+		return 1;
+	}
+
+	if(strcmp(name, "worker_threads") == 0)
+	{
+		int items = sscanf(line, "%s %s %s", name, value, extraArg);
+		if(items != 2 || atoi(value) < 0)
+		{
+			printf("Invalid number of worker threads\n");
+			return -1;
+		}
+
+		params->worker_threads = atoi(value);
+		return 1;
+	}
+
+	if(strcmp(name, "listener_threads") == 0)
+	{
+		int items = sscanf(line, "%s %s %s", name, value, extraArg);
+		if(items != 2 || atoi(value) < 1 || atoi(value) > MAX_LISTENER_THREADS)
+		{
+			printf("Invalid number of listener threads\n");
+			return -1;
+		}
+
+		params->listener_threads = atoi(value);
+		return 1;
+	}
+
+	if(strcmp(name, "cursor_timeout") == 0)
+	{
+		int items = sscanf(line, "%s %s %s", name, value, extraArg);
+		if(items != 2 || isNum(value) != 0 || atoi(value) < 1)
+		{
+			printf("Invalid cursor timeout\n");
+			return -1;
+		}
+
+		params->cursor_timeout = atoi(value);
+		return 1;
+	}
+
+	if(strcmp(name, TABLE_OPTION_KEY) == 0)
+	{
+		int items = sscanf(line, "%s %s %s %s %s", name, table, option, value, extraArg);
+		if(items != 4 || numOfTableOptionLines == MAX_TABLE_OPTIONS)
+		{
+			printf("Invalid table option\n");
+			return -1;
+		}
+
+		strncpy(tableOptionLines[numOfTableOptionLines].table, table, MAX_CONFIG_LINE_LEN);
+		strncpy(tableOptionLines[numOfTableOptionLines].name, option, MAX_CONFIG_LINE_LEN);
+		strncpy(tableOptionLines[numOfTableOptionLines].value, value, MAX_CONFIG_LINE_LEN);
+		numOfTableOptionLines++;
+		return 1;
+	}
+
+	char *list = strstr(line, " " TABLE_INDEX_KEY " ");
+	if(strcmp(name, "table") == 0 && list != NULL)
+	{
+		int items = sscanf(line, "%s %s", name, table);
+		if(items != 2 || sscanf(list, "%s %s %s", option, value, extraArg) != 2 ||
+			numOfTableIndexLines == MAX_TABLES)
+		{
+			printf("Invalid index list\n");
+			return -1;
+		}
+
+		strncpy(tableIndexLines[numOfTableIndexLines].table, table, MAX_CONFIG_LINE_LEN);
+		strncpy(tableIndexLines[numOfTableIndexLines].columns, value, MAX_CONFIG_LINE_LEN);
+		numOfTableIndexLines++;
+
+		strcpy(list, "\n");
+		return 0;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief This function is used to apply the table_option lines to the
+ * tables found by the tokenizer.
+ *
+ * @param params Stores the configuration parameters
+ * @return Returns 0 on success, -1 if an option is invalid or names an
+ * 		  unknown table
+ */
+int apply_table_options(struct config_params *params)
+{
+	int i;
+	for(i=0; i<params->numOfTables; i++)
+	{
+		params->tableOptions[i].engine = ENGINE_HASH;
+		params->tableOptions[i].memtable_size = DEFAULT_MEMTABLE_SIZE;
+		params->tableOptions[i].memory_budget = 0;
+		params->tableOptions[i].promote_on_read = 1;
+		params->tableOptions[i].lock_stripes = DEFAULT_LOCK_STRIPES;
+		params->tableOptions[i].num_indexes = 0;
+	}
+
+	for(i=0; i<numOfTableOptionLines; i++)
+	{
+		char* option = tableOptionLines[i].name;
+		char* value = tableOptionLines[i].value;
+
+		int index = -1;
+		int j;
+		for(j=0; j<params->numOfTables; j++)
+		{
+			if(strcmp(params->tableArray[j], tableOptionLines[i].table)==0)
+				index = j;
+		}
+
+		if(index == -1)
+		{
+			printf("table_option for unknown table %s\n", tableOptionLines[i].table);
+			return -1;
+		}
+
+		struct table_options* opts = &params->tableOptions[index];
+
+		if(strcmp(option, "engine") == 0)
+		{
+			if(strcmp(value, "hash") == 0)
+				opts->engine = ENGINE_HASH;
+			else if(strcmp(value, "lsm") == 0)
+				opts->engine = ENGINE_LSM;
+			else if(strcmp(value, "lockfree") == 0)
+				opts->engine = ENGINE_LOCKFREE;
+			else
+			{
+				printf("Unknown storage engine %s\n", value);
+				return -1;
+			}
+		}
+
+		else if(strcmp(option, "memtable_size") == 0)
+		{
+			if(isNum(value) != 0 || atol(value) <= 0)
+			{
+				printf("Invalid memtable size\n");
+				return -1;
+			}
+			opts->memtable_size = atol(value);
+		}
+
+		else if(strcmp(option, "memory_budget") == 0)
+		{
+			if(isNum(value) != 0 || atol(value) < 0)
+			{
+				printf("Invalid memory budget\n");
+				return -1;
+			}
+			opts->memory_budget = atol(value);
+		}
+
+		else if(strcmp(option, "lock_stripes") == 0)
+		{
+			if(isNum(value) != 0 || atoi(value) <= 0 || atoi(value) > MAX_RECORDS_PER_TABLE)
+			{
+				printf("lock_stripes must be between 1 and %d\n", MAX_RECORDS_PER_TABLE);
+				return -1;
+			}
+			opts->lock_stripes = atoi(value);
+		}
+
+		else if(strcmp(option, "promote_on_read") == 0)
+		{
+			if(strcmp(value, "yes") == 0)
+				opts->promote_on_read = 1;
+			else if(strcmp(value, "no") == 0)
+				opts->promote_on_read = 0;
+			else
+			{
+				printf("promote_on_read must be yes or no\n");
+				return -1;
+			}
+		}
+
+		else
+		{
+			printf("Unknown table option %s\n", option);
+			return -1;
+		}
+	}
+
+	for(i=0; i<numOfTableIndexLines; i++)
+	{
+		int index = -1;
+		int j;
+		for(j=0; j<params->numOfTables; j++)
+		{
+			if(strcmp(params->tableArray[j], tableIndexLines[i].table)==0)
+				index = j;
+		}
+
+		if(index == -1)
+			return -1;
+
+		struct table_options* opts = &params->tableOptions[index];
+		char* save;
+		char* column;
+
+		if(opts->engine != ENGINE_HASH)
+		{
+			printf("Indexes are only kept for hash tables\n");
+			return -1;
+		}
+
+		for(column = strtok_r(tableIndexLines[i].columns, ",", &save); column != NULL;
+			column = strtok_r(NULL, ",", &save))
+		{
+			int size;
+			int bitmap = 0;
+			char* suffix = strstr(column, TABLE_BITMAP_SUFFIX);
+
+			if(suffix != NULL && strcmp(suffix, TABLE_BITMAP_SUFFIX) == 0)
+			{
+				*suffix = '\0';
+				bitmap = 1;
+			}
+
+			const char* type = column_type(params->tableSchemaArray[index], column, &size);
+
+			if(type == NULL)
+			{
+				printf("Unknown column to index: %s\n", column);
+				return -1;
+			}
+
+			for(j=0; j<opts->num_indexes; j++)
+			{
+				if(strcmp(opts->indexes[j], column) == 0)
+					break;
+			}
+
+			if(j < opts->num_indexes)
+				continue;
+
+			if(opts->num_indexes == MAX_TABLE_INDEXES)
+			{
+				printf("A table has at most %d indexes\n", MAX_TABLE_INDEXES);
+				return -1;
+			}
+
+			strncpy(opts->indexes[opts->num_indexes], column, sizeof opts->indexes[0]);
+			opts->bitmap_indexes[opts->num_indexes] = bitmap;
+			opts->num_indexes++;
+		}
+	}
+
+	return 0;
+}
+
+
 /**
  * @brief This function is used to read and process the configuration
  * file.
@@ -1171,17 +1565,91 @@ int tokenizer(char* config_file, struct config_params *params)
  * structure that holds the variables listed in the configuration 
  * file. It uses this to read through the configuration file and 
  * store all the information in the structure that was passed through.
+ * Option lines are handled first, and the remaining lines are passed
+ * on to the tokenizer.
  */
 int read_config(const char *config_file, struct config_params *params)
 {
+	FILE* file = fopen(config_file, "r");
+	if(file == NULL)
+		return -1;
 
-	int error_occurred = tokenizer(config_file, params);
+	// the lines the lexer understands are copied here
+	FILE* lexfile = tmpfile();
+	if(lexfile == NULL)
+	{
+		fclose(file);
+		return -1;
+	}
+
+	strncpy(params->data_directory, DEFAULT_DATA_DIRECTORY, sizeof params->data_directory);
+	params->worker_threads = 0;
+	params->listener_threads = 1;
+	params->cursor_timeout = DEFAULT_CURSOR_TIMEOUT;
+	numOfTableOptionLines = 0;
+	numOfTableIndexLines = 0;
+
+	int error_occurred = 0;
+	char line[MAX_CONFIG_LINE_LEN];
+
+	while(fgets(line, sizeof line, file) != NULL)
+	{
+		int status = process_option_line(line, params);
+
+		if(status < 0)
+			error_occurred = -1;
+		else if(status == 0)
+			fputs(line, lexfile);
+	}
+	fclose(file);
+	rewind(lexfile);
+
+	if(error_occurred == 0)
+		error_occurred = tokenizer(lexfile, params);
+
+	if(error_occurred == 0)
+		error_occurred = apply_table_options(params);
+
+	fclose(lexfile);
 
 	// printf("error_occurred = %d\n", error_occurred);
 
 	return error_occurred;
 }
 
+/**
+ * @brief This function is used to create a directory.
+ *
+ * @param path The directory to create
+ * @return Returns 0 if the directory exists afterwards, -1 otherwise
+ *
+ * Any missing parent directories are created too.
+ */
+int make_directory(const char *path)
+{
+	char tmp[MAX_PATH_LEN];
+	char *p;
+
+	strncpy(tmp, path, sizeof tmp - 1);
+	tmp[sizeof tmp - 1] = '\0';
+
+	for(p = tmp + 1; *p != '\0'; p++)
+	{
+		if(*p == '/')
+		{
+			*p = '\0';
+			if(mkdir(tmp, 0755) != 0 && errno != EEXIST)
+				return -1;
+			*p = '/';
+		}
+	}
+
+	if(mkdir(tmp, 0755) != 0 && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
 /**
  * @brief This function is used to log various processes throughout 
  * both the server and client.
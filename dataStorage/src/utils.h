@@ -66,6 +66,98 @@ static const char CONFIG_COMMENT_CHAR = '#';
 #define NEGATIVE		15
 #define CONCURRENCY		16
 
+/**
+ * @brief Config lines starting with this keyword set a per-table option.
+ *
+ * They look like "table_option <table> <option> <value>" and are handled
+ * before the rest of the file is passed to the lexer.
+ */
+#define TABLE_OPTION_KEY	"table_option"
+
+/**
+ * @brief The max number of table_option lines in a config file.
+ */
+#define MAX_TABLE_OPTIONS	(MAX_TABLES * 4)
+
+/**
+ * @brief A table line can end with this keyword and a list of columns to
+ * index, like "table census name:char[20],year:int index year".
+ *
+ * The list is removed from the line before it is passed to the lexer.
+ */
+#define TABLE_INDEX_KEY	"index"
+
+/**
+ * @brief A column of the index list ending with this keeps a bitmap index,
+ * like "index year,name:bitmap", for columns with few distinct values.
+ */
+#define TABLE_BITMAP_SUFFIX	":bitmap"
+
+/**
+ * @brief The max number of indexed columns of a table.
+ */
+#define MAX_TABLE_INDEXES	4
+
+// Storage engines a table can be configured with.
+#define ENGINE_HASH		0	///< In-memory chained hash table (default).
+#define ENGINE_LSM		1	///< Log-structured merge tree on disk.
+#define ENGINE_LOCKFREE		2	///< In-memory lock-free hash table.
+
+/**
+ * @brief Default directory where on-disk tables are stored.
+ */
+#define DEFAULT_DATA_DIRECTORY	"./mydata"
+
+/**
+ * @brief Default memtable size in bytes for LSM tables.
+ */
+#define DEFAULT_MEMTABLE_SIZE	(4 * 1024 * 1024)
+
+/**
+ * @brief Default number of locks guarding the buckets of a hash table.
+ */
+#define DEFAULT_LOCK_STRIPES	16
+
+/**
+ * @brief The max number of listener threads.
+ */
+#define MAX_LISTENER_THREADS	64
+
+/**
+ * @brief Default number of seconds a cursor may go without a FETCH.
+ */
+#define DEFAULT_CURSOR_TIMEOUT	60
+
+/**
+ * @brief Per-table storage settings read from table_option lines.
+ */
+struct table_options {
+	/// The storage engine, one of the ENGINE_* values.
+	int engine;
+
+	/// Bytes buffered in memory before an LSM table flushes a run.
+	long memtable_size;
+
+	/// Bytes of records a hash table keeps in memory, 0 for no limit.
+	/// Colder records are moved to a value file on disk.
+	long memory_budget;
+
+	/// Whether reading a record from the value file moves it back to memory.
+	int promote_on_read;
+
+	/// The number of locks guarding the buckets of a hash table.
+	int lock_stripes;
+
+	/// The indexed columns of a hash table.
+	char indexes[MAX_TABLE_INDEXES][MAX_COLNAME_LEN + 1];
+
+	/// Whether each indexed column keeps a bitmap index.
+	int bitmap_indexes[MAX_TABLE_INDEXES];
+
+	/// The number of indexed columns.
+	int num_indexes;
+};
+
 /**
  * @brief A struct to store config parameters.
  */
@@ -88,11 +180,26 @@ struct config_params {
 
 
 	// Method of concurrency
+	// 0: one client at a time
+	// 1: a pool of threads runs the commands of all clients
+	// 2: every thread owns a partition of the keys of every table
 	int concurrency;
 
+	/// The number of threads running commands with concurrency 1 or 2,
+	/// 0 for one per core.
+	int worker_threads;
+
+	/// The number of sockets, each with its own thread, accepting
+	/// clients with concurrency 1 or 2.
+	int listener_threads;
+
+	/// The number of seconds a cursor may go without a FETCH before the
+	/// server closes it.
+	int cursor_timeout;
+
 	
 	/// The directory where tables are stored.
-	// char data_directory[MAX_PATH_LEN];
+	char data_directory[MAX_PATH_LEN];
 
 	// array of strings
 	// max number of strings = MAX_TABLES
@@ -101,6 +208,9 @@ struct config_params {
 
 	char tableSchemaArray[MAX_TABLES][MAX_CONFIG_LINE_LEN];
 
+	/// Storage settings of each table, indexed like tableArray.
+	struct table_options tableOptions[MAX_TABLES];
+
 
 	int numOfTables;
 
@@ -143,6 +253,19 @@ int sendall(const int sock, const char *buf, const size_t len);
  */
 int recvline(const int sock, char *buf, const size_t buflen);
 
+/**
+ * @brief Receive a word of a line from a socket.
+ * @param end Set to 1 if the word ends the line, and 0 otherwise.
+ * @return Return 0 on success, -1 otherwise.
+ */
+int recvword(const int sock, char *buf, const size_t buflen, int *end);
+
+/**
+ * @brief Create a directory and any missing parent directories.
+ * @return Return 0 on success, -1 otherwise.
+ */
+int make_directory(const char *path);
+
 /**
  * @brief Read and load configuration parameters.
  *
@@ -152,6 +275,39 @@ int recvline(const int sock, char *buf, const size_t buflen);
  */
 int read_config(const char *config_file, struct config_params *params);
 
+/**
+ * @brief Copies len characters of a string, starting at begin.
+ *
+ * @return Returns the new string, or NULL if the string is too short.
+ */
+char* substring(const char* str, size_t begin, size_t len);
+
+/**
+ * @brief Checks if a string is an integer, with an optional sign.
+ *
+ * @return Returns 0 if it is, and 1 otherwise.
+ */
+int isNum(char* str_);
+
+/**
+ * @brief Checks a value against the schema of a table.
+ *
+ * @param schema The schema, "name type [length] ..."
+ * @param str The value, "name value,name value,..." in schema order. It
+ *	      is changed by the check.
+ * @return Returns 0 if the value is valid, and 1 otherwise.
+ */
+int parser(char* schema, char* str);
+
+/**
+ * @brief Looks up the type of a column in the schema of a table.
+ *
+ * @param schema The schema, "name type [length] ..."
+ * @param size Receives the length of a char column.
+ * @return Returns "int" or "char", or NULL if there is no such column.
+ */
+const char *column_type(char *schema, char *column, int *size);
+
 /**
  * @brief Generates a log message.
  * 
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <check.h>
+#include "lfhash.h"
+
+#define TESTTIMEOUT	60		// How long to wait for each test to run.
+#define THREADS		8		// Threads that use the table at the same time.
+#define KEYS		4		// Keys the threads share; few, so they collide.
+#define ROUNDS		20000		// Operations of each thread.
+#define KEY		"somekey"	// A key used in the test cases.
+#define VALUE		"col 22"	// A value used in the test cases.
+
+/**
+ * @brief What each thread of a concurrent test does.
+ */
+struct worker {
+	struct lf_table *table;
+	int id;
+	/// Set if the thread saw a value that was not written whole.
+	int torn;
+};
+
+/**
+ * @brief Fill a record with a value that is one character repeated, so
+ * a reader can tell a value that was freed and reused from a whole one.
+ */
+static void fill_record(struct storage_record *record, char c)
+{
+	size_t len = sizeof record->value - 1;
+
+	memset(record->value, c, len);
+	record->value[len] = '\0';
+	record->metadata[0] = 0;
+}
+
+/**
+ * @brief Whether a value read back is one character repeated to the full length.
+ */
+static int whole_value(const char *value)
+{
+	size_t len = strlen(value);
+	size_t i;
+
+	if (len != MAX_VALUE_LEN - 1)
+		return 0;
+	for (i = 1; i < len; i++) {
+		if (value[i] != value[0])
+			return 0;
+	}
+	return 1;
+}
+
+static int check_visit(const char *key, struct storage_record *record, void *arg)
+{
+	struct worker *w = arg;
+
+	if (!whole_value(record->value))
+		w->torn = 1;
+	return 0;
+}
+
+/**
+ * @brief Replace, delete and read the shared keys in a loop. Every
+ * replaced value is retired, so the epochs keep moving while the other
+ * threads are still copying values out.
+ */
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct storage_record record;
+	char key[MAX_KEY_LEN];
+	int i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		snprintf(key, sizeof key, "key%d", (i + w->id) % KEYS);
+
+		switch (i % 8) {
+		case 0:
+			lf_set(w->table, key, NULL);
+			break;
+		case 1:
+		case 2:
+		case 3:
+			fill_record(&record, 'a' + (w->id + i) % 26);
+			lf_set(w->table, key, &record);
+			break;
+		case 4:
+			lf_scan(w->table, check_visit, w);
+			break;
+		default:
+			if (lf_get(w->table, key, &record) == 0 && !whole_value(record.value))
+				w->torn = 1;
+			break;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * This test makes sure that a key can be inserted, read, changed and deleted.
+ */
+START_TEST (test_lfhash_setget)
+{
+	struct lf_table *table = lf_create();
+	struct storage_record record;
+
+	fail_unless(table != NULL, "Error creating the table.");
+
+	strncpy(record.value, VALUE, sizeof record.value);
+	record.metadata[0] = 0;
+	fail_unless(lf_set(table, KEY, &record) == 0, "Error inserting a key.");
+	fail_unless(record.metadata[0] == 1, "The first version of a key should be 1.");
+
+	fail_unless(lf_get(table, KEY, &record) == 0, "Error getting a key.");
+	fail_unless(strcmp(record.value, VALUE) == 0, "Got the wrong value.");
+
+	record.metadata[0] = 1;
+	fail_unless(lf_set(table, KEY, &record) == 3, "Error changing a key at its version.");
+	record.metadata[0] = 1;
+	fail_unless(lf_set(table, KEY, &record) == 4, "A stale version should be refused.");
+
+	fail_unless(lf_set(table, KEY, NULL) == 2, "Error deleting a key.");
+	fail_unless(lf_get(table, KEY, &record) == -1, "A deleted key should not be found.");
+	fail_unless(lf_count(table) == 0, "A deleted key should not be counted.");
+
+	record.metadata[0] = 0;
+	fail_unless(lf_set(table, KEY, &record) == 0, "Error inserting a deleted key again.");
+	fail_unless(record.metadata[0] == 3, "A key inserted again should go on from its old version.");
+
+	lf_destroy(table);
+}
+END_TEST
+
+/**
+ * This test makes sure that threads that get and set the same keys at the
+ * same time only ever read whole values. Run under the sanitizers, it also
+ * makes sure no value is freed while another thread can still read it.
+ */
+START_TEST (test_lfhash_concurrent)
+{
+	struct lf_table *table = lf_create();
+	struct worker workers[THREADS];
+	pthread_t threads[THREADS];
+	int i;
+
+	fail_unless(table != NULL, "Error creating the table.");
+
+	for (i = 0; i < THREADS; i++) {
+		workers[i].table = table;
+		workers[i].id = i;
+		workers[i].torn = 0;
+		fail_unless(pthread_create(&threads[i], NULL, worker_main, &workers[i]) == 0,
+			"Error starting a thread.");
+	}
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < THREADS; i++)
+		fail_unless(workers[i].torn == 0, "A thread read a value that was not whole.");
+
+	lf_destroy(table);
+}
+END_TEST
+
+/**
+ * @brief This runs the tests of the lock-free hash table.
+ */
+int main(int argc, char *argv[])
+{
+	Suite *s = suite_create("lfhash");
+	TCase *tc;
+	int failed;
+
+	// Single-threaded tests
+	tc = tcase_create("setget");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_test(tc, test_lfhash_setget);
+	suite_add_tcase(s, tc);
+
+	// Tests of threads using the table at the same time
+	tc = tcase_create("concurrent");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_test(tc, test_lfhash_concurrent);
+	suite_add_tcase(s, tc);
+
+	SRunner *sr = srunner_create(s);
+	srunner_set_log(sr, "results.log");
+	srunner_run_all(sr, CK_ENV);
+	failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
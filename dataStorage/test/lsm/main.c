@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <check.h>
+#include "lsm.h"
+
+#define TESTTIMEOUT	60		// How long to wait for each test to run.
+#define LSMDIR		"lsmdata"	// Directory of the tree used by the tests.
+#define MEMTABLE	4096		// Bytes buffered before a run is written.
+#define KEYS		200		// Keys written by the recovery test.
+#define VALUE		"somevalue"	// A value used in the test cases.
+#define WAITLIMIT	200		// Tenths of a second to wait for the background thread.
+
+/**
+ * @brief Set a key to a value.
+ *
+ * @return Returns the code of lsm_set.
+ */
+static int set_value(struct lsm_tree *tree, const char *key, const char *value)
+{
+	struct storage_record record;
+
+	strncpy(record.value, value, sizeof record.value);
+	record.metadata[0] = 0;
+	return lsm_set(tree, key, &record);
+}
+
+/**
+ * @brief Write keys with values long enough that a memtable holds a few
+ * dozen of them.
+ */
+static void write_keys(struct lsm_tree *tree, int first, int count)
+{
+	char key[MAX_KEY_LEN];
+	char value[MAX_VALUE_LEN];
+	int i;
+
+	for (i = first; i < first + count; i++) {
+		snprintf(key, sizeof key, "key%05d", i);
+		snprintf(value, sizeof value, "%0100d", i);
+		fail_unless(set_value(tree, key, value) == 0, "Error inserting a key.");
+	}
+}
+
+/**
+ * @brief Find the runs in the directory of the tree.
+ *
+ * @param largest Receives the name of the largest run, if not NULL.
+ * @return Returns the number of runs.
+ */
+static int count_runs(char *largest, size_t len)
+{
+	DIR *dir = opendir(LSMDIR);
+	struct dirent *d;
+	long size = -1;
+	int n = 0;
+
+	fail_unless(dir != NULL, "Error reading the directory of the tree.");
+	while ((d = readdir(dir)) != NULL) {
+		char path[MAX_PATH_LEN];
+		struct stat st;
+
+		if (strncmp(d->d_name, "run-", 4) != 0 || strstr(d->d_name, ".sst") == NULL)
+			continue;
+		n++;
+		snprintf(path, sizeof path, "%s/%s", LSMDIR, d->d_name);
+		if (largest != NULL && stat(path, &st) == 0 && st.st_size > size) {
+			size = st.st_size;
+			strncpy(largest, path, len);
+		}
+	}
+	closedir(dir);
+
+	return n;
+}
+
+/**
+ * @brief Wait for the background thread to bring the runs down to a number.
+ *
+ * @return Returns the number of runs.
+ */
+static int wait_runs(int most)
+{
+	int n = count_runs(NULL, 0);
+	int i;
+
+	for (i = 0; i < WAITLIMIT && n > most; i++) {
+		usleep(100000);
+		n = count_runs(NULL, 0);
+	}
+	return n;
+}
+
+/**
+ * @brief Text fixture setup. Start with no tree on disk.
+ */
+void test_setup()
+{
+	fail_unless(system("rm -rf " LSMDIR) == 0, "Error removing an old tree.");
+}
+
+/**
+ * @brief Text fixture teardown. Remove the tree.
+ */
+void test_teardown()
+{
+	system("rm -rf " LSMDIR);
+}
+
+/**
+ * This test makes sure that a tree opened again has every record written
+ * before it was closed, both the ones in runs and the ones still in the
+ * log of the memtable, with their versions.
+ */
+START_TEST (test_lsm_recover)
+{
+	struct lsm_tree *tree = lsm_open(LSMDIR, MEMTABLE);
+	struct storage_record record;
+	char key[MAX_KEY_LEN];
+	int i;
+
+	fail_unless(tree != NULL, "Error opening the tree.");
+
+	write_keys(tree, 0, KEYS);
+	fail_unless(set_value(tree, "key00000", VALUE) == 3, "Error changing a key.");
+	fail_unless(lsm_set(tree, "key00001", NULL) == 2, "Error deleting a key.");
+	lsm_close(tree);
+
+	tree = lsm_open(LSMDIR, MEMTABLE);
+	fail_unless(tree != NULL, "Error opening the tree again.");
+
+	fail_unless(lsm_get(tree, "key00000", &record) == 0, "Error getting a changed key.");
+	fail_unless(strcmp(record.value, VALUE) == 0, "A changed key has the wrong value.");
+	fail_unless(record.metadata[0] == 2, "A changed key has the wrong version.");
+	fail_unless(lsm_get(tree, "key00001", &record) == -1, "A deleted key came back.");
+
+	for (i = 2; i < KEYS; i++) {
+		snprintf(key, sizeof key, "key%05d", i);
+		fail_unless(lsm_get(tree, key, &record) == 0, "A key was lost.");
+		fail_unless(atoi(record.value) == i, "A key has the wrong value.");
+		fail_unless(record.metadata[0] == 1, "A key has the wrong version.");
+	}
+
+	fail_unless(set_value(tree, "key00001", VALUE) == 0, "Error inserting a deleted key again.");
+	fail_unless(lsm_get(tree, "key00001", &record) == 0, "Error getting a key inserted again.");
+	fail_unless(record.metadata[0] > 1, "A key inserted again should go on from its old version.");
+
+	lsm_close(tree);
+}
+END_TEST
+
+/**
+ * This test makes sure that the runs are merged, and that a large run is
+ * not rewritten when the runs flushed after it are merged.
+ */
+START_TEST (test_lsm_compact)
+{
+	struct lsm_tree *tree = lsm_open(LSMDIR, MEMTABLE);
+	struct storage_record record;
+	char largest[MAX_PATH_LEN];
+	char key[MAX_KEY_LEN];
+	struct stat st;
+	long memory, disk;
+	int i;
+
+	fail_unless(tree != NULL, "Error opening the tree.");
+
+	// enough for sixteen memtables, which are merged into one large run
+	write_keys(tree, 0, 450);
+	fail_unless(wait_runs(4) <= 4, "The runs were not merged.");
+	count_runs(largest, sizeof largest);
+
+	// a few more memtables, which are merged with each other only
+	write_keys(tree, 450, 130);
+	fail_unless(wait_runs(3) <= 3, "The new runs were not merged.");
+	fail_unless(stat(largest, &st) == 0, "The large run was rewritten.");
+
+	for (i = 0; i < 580; i++) {
+		snprintf(key, sizeof key, "key%05d", i);
+		fail_unless(lsm_get(tree, key, &record) == 0, "A key was lost.");
+		fail_unless(atoi(record.value) == i, "A key has the wrong value.");
+	}
+
+	lsm_stats(tree, &memory, &disk);
+	fail_unless(memory + disk == 580, "Every key should be counted once.");
+
+	lsm_close(tree);
+}
+END_TEST
+
+/**
+ * @brief This runs the tests of the LSM tree.
+ */
+int main(int argc, char *argv[])
+{
+	Suite *s = suite_create("lsm");
+	TCase *tc;
+	int failed;
+
+	// Tests of a tree closed and opened again
+	tc = tcase_create("recover");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_checked_fixture(tc, test_setup, test_teardown);
+	tcase_add_test(tc, test_lsm_recover);
+	suite_add_tcase(s, tc);
+
+	// Tests of the background merges
+	tc = tcase_create("compact");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_checked_fixture(tc, test_setup, test_teardown);
+	tcase_add_test(tc, test_lsm_compact);
+	suite_add_tcase(s, tc);
+
+	SRunner *sr = srunner_create(s);
+	srunner_set_log(sr, "results.log");
+	srunner_run_all(sr, CK_ENV);
+	failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,1176 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <check.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include "storage.h"
+
+#define TESTTIMEOUT	60		// How long to wait for each test to run.
+#define SERVEREXEC	"./server"	// Server executable file.
+#define SERVEROUT	"default.serverout"	// File where the server's output is stored.
+#define SERVEROUT_MODE	0666		// Permissions of the server ouptut file.
+#define TABLES_CONF	"conf-tables.conf"	// Server configuration file with the tables below.
+#define DATADIR		"serverdata"	// The data directory of the configuration file.
+
+// These settings should correspond to what's in the config file.
+#define SERVERHOST	"localhost"	// The hostname where the server is running.
+#define SERVERPORT	4848		// The port where the server is running.
+#define SERVERUSERNAME	"admin"		// The server username
+#define SERVERPASSWORD	"dog4sale"	// The server password
+#define COLDTABLE	"cold"		// A table with a memory budget, whose records are not promoted.
+#define COLDRECORDS	200		// Records written to the cold table; many more than fit its budget.
+#define LSMTABLE	"disk"		// A table on the LSM engine.
+#define LOCKFREETABLE	"fast"		// A table on the lock-free engine.
+#define THREADS		4		// Clients changing a table at the same time.
+#define ROUNDS		200		// Commands sent by each of those clients.
+#define KEY		"somekey"	// A key used in the test cases.
+#define INDEXTABLE	"census"	// A table with an ordered, a hash and two bitmap indexes.
+#define INDEXRECORDS	100		// Records written to the indexed table.
+#define JOINTABLE	"regions"	// A table joined with the indexed table on its provinces.
+#define JOINRECORDS	100		// Records written to the joined table.
+#define MAXPAIRS	4000		// Pairs a JOIN in the tests may return.
+#define COLDFILE	DATADIR "/cold.values"	// The spill file of the cold table.
+#define LSMDIR		DATADIR "/disk"	// The directory of the LSM table.
+#define TRUNCATES	20		// TRUNCATEs run while clients change a table.
+#define CURSORTIMEOUT	1		// Seconds a cursor may go without a FETCH.
+#define CONNCURSORS	8		// Cursors a connection may have open.
+#define PAGE		7		// Matches fetched from a cursor at a time.
+
+/* Server port used by test */
+int server_port;
+
+/**
+ * @brief Start the storage server.
+ *
+ * @param config_file The configuration file the server should use.
+ * @param serverout_file File where server output is stored.
+ * @return Return server process id on success, or -1 otherwise.
+ */
+int start_server(char *config_file, const char *serverout_file)
+{
+	pid_t childpid = fork();
+	if (childpid < 0) {
+		// Failed to create child.
+		return -1;
+	} else if (childpid == 0) {
+		// The child.
+
+		// Redirect stdout and stderr to a file.
+		const char *outfile = serverout_file == NULL ? SERVEROUT : serverout_file;
+		int outfd = creat(outfile, SERVEROUT_MODE);
+		close(STDOUT_FILENO);
+		close(STDERR_FILENO);
+		if (dup2(outfd, STDOUT_FILENO) < 0 || dup2(outfd, STDERR_FILENO) < 0) {
+			perror("dup2 error");
+			return -1;
+		}
+
+		// Start the server
+		execl(SERVEREXEC, SERVEREXEC, config_file, NULL);
+
+		// Should never get here.
+		perror("Couldn't start server");
+		exit(EXIT_FAILURE);
+	} else {
+		// The parent.
+
+		// If the child terminates quickly, then there was probably a
+		// problem running the server (e.g., config file not found).
+		sleep(1);
+		int pid = waitpid(childpid, NULL, WNOHANG);
+		if (pid == childpid)
+			return -1; // Probably a problem starting the server.
+		else
+			return childpid; // Probably ok.
+	}
+}
+
+/**
+ * @brief Connect to the server, and authenticate.
+ * @return A connection to the server if successful, or NULL.
+ */
+void* connect_auth()
+{
+	void *conn = storage_connect(SERVERHOST, server_port);
+	if (conn == NULL)
+		return NULL;
+
+	if (storage_auth(SERVERUSERNAME, SERVERPASSWORD, conn) != 0) {
+		storage_disconnect(conn);
+		return NULL;
+	}
+
+	return conn;
+}
+
+
+/// Process id of the server started by the test fixture.
+int test_serverpid = -1;
+
+/// Connection used by test fixture.
+void *test_conn = NULL;
+
+/**
+ * @brief Text fixture setup. Start the server with empty tables, and
+ * connect to it.
+ */
+void test_setup()
+{
+	fail_unless(system("rm -rf " DATADIR) == 0, "Couldn't remove the old data directory.");
+
+	test_serverpid = start_server(TABLES_CONF, NULL);
+	fail_unless(test_serverpid > 0, "Server didn't run properly.");
+
+	test_conn = connect_auth();
+	fail_unless(test_conn != NULL, "Couldn't connect to server.");
+}
+
+/**
+ * @brief Text fixture teardown. Disconnect from the server, and stop it.
+ */
+void test_teardown()
+{
+	if (test_conn != NULL)
+		storage_disconnect(test_conn);
+	if (test_serverpid > 0) {
+		kill(test_serverpid, SIGKILL);
+		waitpid(test_serverpid, NULL, 0);
+	}
+}
+
+/**
+ * @brief Set a key of a table to a value.
+ *
+ * @return Returns the status of storage_set.
+ */
+int set_value(const char *table, const char *key, const char *value)
+{
+	struct storage_record r;
+
+	strncpy(r.value, value, sizeof r.value);
+	r.metadata[0] = 0;
+	return storage_set(table, key, &r, test_conn);
+}
+
+
+/*
+ * Spill tests:
+ * 	records over the memory budget are kept on disk (pass)
+ * 	spilled records are read back with their values (pass)
+ * 	spilled records are changed and read back (pass)
+ */
+
+START_TEST (test_spill_readback)
+{
+	struct storage_stats stats;
+	struct storage_record r;
+	char key[MAX_KEY_LEN], value[MAX_VALUE_LEN];
+	int i;
+
+	for (i = 0; i < COLDRECORDS; i++) {
+		snprintf(key, sizeof key, "k%d", i);
+		snprintf(value, sizeof value, "name c%d,year %d", i, i);
+		fail_unless(set_value(COLDTABLE, key, value) == 0, "Error setting a record.");
+	}
+
+	fail_unless(storage_stats(COLDTABLE, &stats, test_conn) == 0, "Error getting the stats.");
+	fail_unless(stats.spilled > 0, "No record was spilled.");
+	fail_unless(stats.resident + stats.spilled == COLDRECORDS, "Records were lost.");
+
+	for (i = 0; i < COLDRECORDS; i++) {
+		snprintf(key, sizeof key, "k%d", i);
+		snprintf(value, sizeof value, "name c%d,year %d", i, i);
+		fail_unless(storage_get(COLDTABLE, key, &r, test_conn) == 0, "Error getting a record.");
+		fail_unless(strcmp(r.value, value) == 0, "Got the wrong value.");
+		fail_unless(r.metadata[0] == 1, "Got the wrong version.");
+	}
+
+	// the cold table does not move records back to memory when they are read
+	fail_unless(storage_stats(COLDTABLE, &stats, test_conn) == 0, "Error getting the stats.");
+	fail_unless(stats.spilled > 0, "The records read were all moved back to memory.");
+}
+END_TEST
+
+START_TEST (test_spill_change)
+{
+	struct storage_record r;
+	char key[MAX_KEY_LEN], value[MAX_VALUE_LEN];
+	int i, result;
+
+	for (i = 0; i < COLDRECORDS; i++) {
+		snprintf(key, sizeof key, "k%d", i);
+		fail_unless(set_value(COLDTABLE, key, "name c,year 1") == 0, "Error setting a record.");
+	}
+
+	for (i = 0; i < COLDRECORDS; i++) {
+		snprintf(key, sizeof key, "k%d", i);
+		fail_unless(storage_apply(COLDTABLE, key, "year", STORAGE_INCR, i, &result, test_conn) == 0,
+			"Error changing a record.");
+		fail_unless(result == i + 1, "Got the wrong result.");
+	}
+
+	for (i = 0; i < COLDRECORDS; i++) {
+		snprintf(key, sizeof key, "k%d", i);
+		snprintf(value, sizeof value, "name c,year %d", i + 1);
+		fail_unless(storage_get(COLDTABLE, key, &r, test_conn) == 0, "Error getting a record.");
+		fail_unless(strcmp(r.value, value) == 0, "Got the wrong value.");
+		fail_unless(r.metadata[0] == 2, "Got the wrong version.");
+	}
+}
+END_TEST
+
+
+/*
+ * Index tests:
+ * 	a range of an int column is read from its ordered index (pass)
+ * 	an equality on a char column is read from its hash index (pass)
+ * 	equalities on bitmap columns are read by intersecting the bitmaps (pass)
+ * 	changed and deleted records leave the indexes (pass)
+ */
+
+/**
+ * @brief Fill the indexed table. Record i is in year 1900 + i, has one of
+ * ten names, one of three provinces, and one of two kinds.
+ */
+void fill_census()
+{
+	char key[MAX_KEY_LEN], value[MAX_VALUE_LEN];
+	int i;
+
+	for (i = 0; i < INDEXRECORDS; i++) {
+		snprintf(key, sizeof key, "k%d", i);
+		snprintf(value, sizeof value, "name n%d,year %d,province p%d,kind t%d",
+			i % 10, 1900 + i, i % 3, i % 2);
+		fail_unless(set_value(INDEXTABLE, key, value) == 0, "Error setting a record.");
+	}
+}
+
+/**
+ * @brief Query the indexed table, and check that the plan reads it the
+ * expected way and that the matching keys are those of some records.
+ *
+ * @param predicates The predicates of the query.
+ * @param access How the plan should read the table, like "index year",
+ * or NULL for any way.
+ * @param match Whether record i should match.
+ */
+void check_census_query(const char *predicates, const char *access, int (*match)(int))
+{
+	char plan[MAX_VALUE_LEN];
+	char buffers[INDEXRECORDS][MAX_KEY_LEN];
+	char *keys[INDEXRECORDS];
+	int found[INDEXRECORDS];
+	int i, n, expected = 0;
+
+	for (i = 0; i < INDEXRECORDS; i++) {
+		keys[i] = buffers[i];
+		found[i] = 0;
+		if (match(i))
+			expected++;
+	}
+
+	if (access != NULL) {
+		fail_unless(storage_explain(INDEXTABLE, predicates, plan, sizeof plan, test_conn) == 0,
+			"Error explaining the query.");
+		fail_unless(strncmp(plan, access, strlen(access)) == 0,
+			"The query should use %s, not %s.", access, plan);
+	}
+
+	n = storage_query(INDEXTABLE, predicates, keys, INDEXRECORDS, test_conn);
+	fail_unless(n == expected, "Found %d records instead of %d.", n, expected);
+	for (i = 0; i < n; i++) {
+		int k = atoi(keys[i] + 1);
+		fail_unless(keys[i][0] == 'k' && k >= 0 && k < INDEXRECORDS && match(k),
+			"Found a record that does not match.");
+		fail_if(found[k], "Found a record twice.");
+		found[k] = 1;
+	}
+}
+
+int in_eighties(int i) { return i >= 80 && i < 90; }
+int after_ninety(int i) { return i > 90; }
+int after_eighty_nine(int i) { return i > 89; }
+int named_n3(int i) { return i % 10 == 3; }
+int in_p1_of_t0(int i) { return i % 3 == 1 && i % 2 == 0; }
+int in_eighties_but_two(int i) { return in_eighties(i) && i != 85 && i != 86; }
+
+START_TEST (test_index_range)
+{
+	fill_census();
+	check_census_query("year > 1979, year < 1990", "index year", in_eighties);
+	check_census_query("year > 1990", "index year", after_ninety);
+}
+END_TEST
+
+START_TEST (test_index_equality)
+{
+	fill_census();
+	check_census_query("name = n3", "index name", named_n3);
+}
+END_TEST
+
+START_TEST (test_index_bitmap)
+{
+	fill_census();
+	check_census_query("province = p1, kind = t0", "bitmap", in_p1_of_t0);
+}
+END_TEST
+
+START_TEST (test_index_change)
+{
+	fill_census();
+	fail_unless(storage_update(INDEXTABLE, "k85", "year 2085", 0, test_conn) == 0,
+		"Error updating a record.");
+	fail_unless(storage_set(INDEXTABLE, "k86", NULL, test_conn) == 0, "Error deleting a record.");
+	check_census_query("year > 1979, year < 1990", "index year", in_eighties_but_two);
+}
+END_TEST
+
+
+/*
+ * Cursor tests:
+ * 	a cursor returns every match once, a page at a time (pass)
+ * 	a cursor returns the values of the matches (pass)
+ * 	a connection can not open more than CONNCURSORS cursors (fail)
+ * 	a cursor not fetched from for CURSORTIMEOUT seconds is closed (fail)
+ */
+
+/**
+ * @brief Read a cursor over the indexed table to its end, and check that
+ * it returns each record matching once.
+ */
+void check_census_cursor(int cursor, int (*match)(int))
+{
+	char buffers[PAGE][MAX_KEY_LEN];
+	char *keys[PAGE];
+	struct storage_record records[PAGE];
+	char value[MAX_VALUE_LEN];
+	int found[INDEXRECORDS];
+	int i, n, total = 0, expected = 0;
+
+	for (i = 0; i < PAGE; i++)
+		keys[i] = buffers[i];
+	for (i = 0; i < INDEXRECORDS; i++) {
+		found[i] = 0;
+		if (match(i))
+			expected++;
+	}
+
+	do {
+		n = storage_query_next(cursor, keys, records, PAGE, test_conn);
+		fail_unless(n >= 0, "Error fetching from the cursor.");
+		for (i = 0; i < n; i++) {
+			int k = atoi(keys[i] + 1);
+			fail_unless(keys[i][0] == 'k' && k >= 0 && k < INDEXRECORDS && match(k),
+				"Fetched a record that does not match.");
+			fail_if(found[k], "Fetched a record twice.");
+			found[k] = 1;
+
+			snprintf(value, sizeof value, "name n%d,year %d,province p%d,kind t%d",
+				k % 10, 1900 + k, k % 3, k % 2);
+			fail_unless(strcmp(records[i].value, value) == 0, "Fetched the wrong value.");
+		}
+		total += n;
+	} while (n == PAGE);
+
+	fail_unless(total == expected, "Fetched %d records instead of %d.", total, expected);
+	fail_unless(storage_query_close(cursor, test_conn) == 0, "Error closing the cursor.");
+}
+
+int in_second_half(int i) { return i >= INDEXRECORDS / 2; }
+
+START_TEST (test_cursor_paging)
+{
+	int cursor;
+
+	fill_census();
+	cursor = storage_query_open(INDEXTABLE, "year > 1949", 1, test_conn);
+	fail_unless(cursor > 0, "Error opening a cursor.");
+	check_census_cursor(cursor, in_second_half);
+}
+END_TEST
+
+START_TEST (test_cursor_limit)
+{
+	void *conn;
+	int i, cursor;
+
+	fill_census();
+	for (i = 0; i < CONNCURSORS; i++)
+		fail_unless(storage_query_open(INDEXTABLE, "year > 1949", 1, test_conn) > 0,
+			"Error opening a cursor.");
+	fail_unless(storage_query_open(INDEXTABLE, "year > 1949", 1, test_conn) == -1,
+		"A connection opened too many cursors.");
+
+	// the other connections are not limited by this one
+	conn = connect_auth();
+	fail_unless(conn != NULL, "Couldn't connect to server.");
+	cursor = storage_query_open(INDEXTABLE, "year > 1949", 1, conn);
+	fail_unless(cursor > 0, "Error opening a cursor on another connection.");
+	fail_unless(storage_query_close(cursor, conn) == 0, "Error closing the cursor.");
+	storage_disconnect(conn);
+}
+END_TEST
+
+START_TEST (test_cursor_timeout)
+{
+	int i, cursor, first = -1;
+
+	fill_census();
+	for (i = 0; i < CONNCURSORS; i++) {
+		cursor = storage_query_open(INDEXTABLE, "year > 1949", 1, test_conn);
+		fail_unless(cursor > 0, "Error opening a cursor.");
+		if (first < 0)
+			first = cursor;
+	}
+
+	sleep(3 * CURSORTIMEOUT);
+	fail_unless(storage_query_next(first, NULL, NULL, PAGE, test_conn) == -1 &&
+		errno == ERR_INVALID_PARAM, "An idle cursor was not closed.");
+
+	// the cursors closed free their slots
+	cursor = storage_query_open(INDEXTABLE, "year > 1949", 1, test_conn);
+	fail_unless(cursor > 0, "Error opening a cursor after the others were closed.");
+	check_census_cursor(cursor, in_second_half);
+}
+END_TEST
+
+
+/*
+ * Group tests:
+ * 	each group of one column has the count, sum, min and max of its records (pass)
+ * 	the groups of two columns are each pair of values (pass)
+ * 	only the records matching the predicates are grouped (pass)
+ */
+
+/**
+ * @brief Group the indexed table by province, and check the aggregates
+ * of each group against those of the records matching.
+ */
+void check_census_group(const char *predicates, int (*match)(int))
+{
+	struct storage_record groups[3];
+	double results[3 * 4];
+	int g, i, n;
+
+	n = storage_group(INDEXTABLE, "province", "count, sum year, min year, max year",
+		predicates, groups, results, 3, 4, test_conn);
+	fail_unless(n == 3, "Found %d groups instead of 3.", n);
+
+	for (g = 0; g < n; g++) {
+		double count = 0, sum = 0, min = 1e9, max = -1e9;
+		int province;
+
+		fail_unless(sscanf(groups[g].value, "p%d", &province) == 1 &&
+			province >= 0 && province < 3, "Found a wrong group.");
+		for (i = 0; i < INDEXRECORDS; i++) {
+			if (i % 3 != province || !match(i))
+				continue;
+			count++;
+			sum += 1900 + i;
+			if (1900 + i < min)
+				min = 1900 + i;
+			if (1900 + i > max)
+				max = 1900 + i;
+		}
+
+		fail_unless(results[g * 4] == count, "Got the wrong count.");
+		fail_unless(results[g * 4 + 1] == sum, "Got the wrong sum.");
+		fail_unless(results[g * 4 + 2] == min, "Got the wrong min.");
+		fail_unless(results[g * 4 + 3] == max, "Got the wrong max.");
+	}
+}
+
+int any_record(int i) { return 1; }
+
+START_TEST (test_group_column)
+{
+	fill_census();
+	check_census_group(NULL, any_record);
+}
+END_TEST
+
+START_TEST (test_group_columns)
+{
+	struct storage_record groups[6];
+	double results[6];
+	int found[3][2];
+	int g, i, n, count, province, kind;
+
+	memset(found, 0, sizeof found);
+	fill_census();
+	n = storage_group(INDEXTABLE, "province, kind", "count", NULL, groups, results, 6, 1,
+		test_conn);
+	fail_unless(n == 6, "Found %d groups instead of 6.", n);
+
+	for (g = 0; g < n; g++) {
+		fail_unless(sscanf(groups[g].value, "p%d,t%d", &province, &kind) == 2 &&
+			province >= 0 && province < 3 && kind >= 0 && kind < 2, "Found a wrong group.");
+		fail_if(found[province][kind], "Found a group twice.");
+		found[province][kind] = 1;
+
+		for (i = 0, count = 0; i < INDEXRECORDS; i++)
+			if (i % 3 == province && i % 2 == kind)
+				count++;
+		fail_unless(results[g] == count, "Got the wrong count.");
+	}
+}
+END_TEST
+
+START_TEST (test_group_predicates)
+{
+	fill_census();
+	check_census_group("year > 1949", in_second_half);
+}
+END_TEST
+
+
+/*
+ * Join tests:
+ * 	the records of two tables are paired on equal columns (pass)
+ * 	the columns asked for are returned with each pair (pass)
+ * 	a larger build side pairs every record with every match (pass)
+ */
+
+/**
+ * @brief Fill the joined table. Record j is in province j % 5, of which
+ * only the first three are in the indexed table.
+ */
+void fill_regions()
+{
+	char key[MAX_KEY_LEN], value[MAX_VALUE_LEN];
+	int j;
+
+	for (j = 0; j < JOINRECORDS; j++) {
+		snprintf(key, sizeof key, "r%d", j);
+		snprintf(value, sizeof value, "name p%d,capital c%d", j % 5, j);
+		fail_unless(set_value(JOINTABLE, key, value) == 0, "Error setting a record.");
+	}
+}
+
+/**
+ * @brief Join the indexed table with the joined table on the provinces,
+ * and check that the pairs are exactly the records matching.
+ */
+void check_join(const char *predicates, int (*match)(int))
+{
+	static char left[MAXPAIRS][MAX_KEY_LEN], right[MAXPAIRS][MAX_KEY_LEN];
+	static char *left_keys[MAXPAIRS], *right_keys[MAXPAIRS];
+	static char found[INDEXRECORDS][JOINRECORDS];
+	int i, j, n, expected = 0;
+
+	memset(found, 0, sizeof found);
+	for (i = 0; i < MAXPAIRS; i++) {
+		left_keys[i] = left[i];
+		right_keys[i] = right[i];
+	}
+	for (i = 0; i < INDEXRECORDS; i++)
+		for (j = 0; j < JOINRECORDS; j++)
+			if (match(i) && i % 3 == j % 5)
+				expected++;
+
+	n = storage_join(INDEXTABLE, JOINTABLE, "province = name", predicates, NULL,
+		left_keys, right_keys, NULL, MAXPAIRS, test_conn);
+	fail_unless(n == expected, "Found %d pairs instead of %d.", n, expected);
+
+	for (n--; n >= 0; n--) {
+		fail_unless(sscanf(left_keys[n], "k%d", &i) == 1 && sscanf(right_keys[n], "r%d", &j) == 1 &&
+			i >= 0 && i < INDEXRECORDS && j >= 0 && j < JOINRECORDS, "Found a wrong pair.");
+		fail_unless(match(i) && i % 3 == j % 5, "Found a pair that does not match.");
+		fail_if(found[i][j], "Found a pair twice.");
+		found[i][j] = 1;
+	}
+}
+
+START_TEST (test_join_pairs)
+{
+	fill_census();
+	fill_regions();
+	check_join("census.year > 1989", after_eighty_nine);
+}
+END_TEST
+
+START_TEST (test_join_columns)
+{
+	char left[JOINRECORDS][MAX_KEY_LEN], right[JOINRECORDS][MAX_KEY_LEN];
+	char *left_keys[JOINRECORDS], *right_keys[JOINRECORDS];
+	struct storage_record records[JOINRECORDS];
+	char value[MAX_VALUE_LEN];
+	int i, j, n;
+
+	for (i = 0; i < JOINRECORDS; i++) {
+		left_keys[i] = left[i];
+		right_keys[i] = right[i];
+	}
+
+	fill_census();
+	fill_regions();
+	n = storage_join(INDEXTABLE, JOINTABLE, "province = name", "census.year = 1950",
+		"census.year, regions.capital", left_keys, right_keys, records, JOINRECORDS, test_conn);
+
+	// k50 is in province p2, like every fifth region from r2
+	fail_unless(n == JOINRECORDS / 5, "Found %d pairs instead of %d.", n, JOINRECORDS / 5);
+	for (i = 0; i < n; i++) {
+		fail_unless(strcmp(left_keys[i], "k50") == 0 && sscanf(right_keys[i], "r%d", &j) == 1 &&
+			j % 5 == 2, "Found a wrong pair.");
+		snprintf(value, sizeof value, "census.year 1950,regions.capital c%d", j);
+		fail_unless(strcmp(records[i].value, value) == 0, "Got the wrong columns.");
+	}
+}
+END_TEST
+
+START_TEST (test_join_large)
+{
+	// with no predicates the hash is built from the indexed table, whose
+	// rows outgrow the first buckets
+	fill_census();
+	fill_regions();
+	check_join(NULL, any_record);
+}
+END_TEST
+
+
+/*
+ * Bulk change tests:
+ * 	DELETE WHERE deletes the records matching, and counts them (pass)
+ * 	UPDATE WHERE changes the records matching, and counts them (pass)
+ * 	a bulk change matching nothing counts 0 (pass)
+ * 	the LSM and lock-free engines do not take bulk changes (fail)
+ */
+
+int before_ninety(int i) { return i <= 89; }
+int in_p1(int i) { return i % 3 == 1; }
+int not_in_p1_of_t0(int i) { return i % 3 != 1 && i % 2 == 0; }
+
+START_TEST (test_bulk_delete)
+{
+	fill_census();
+	fail_unless(storage_delete_where(INDEXTABLE, "year > 1989", test_conn) == 10,
+		"Deleted the wrong number of records.");
+	check_census_query("year > 1899", NULL, before_ninety);
+	fail_unless(storage_delete_where(INDEXTABLE, "year > 1989", test_conn) == 0,
+		"Deleted records already deleted.");
+}
+END_TEST
+
+START_TEST (test_bulk_update)
+{
+	struct storage_record r;
+
+	fill_census();
+	fail_unless(storage_update_where(INDEXTABLE, "province = p1", "kind t9", test_conn) == 33,
+		"Changed the wrong number of records.");
+	check_census_query("kind = t9", NULL, in_p1);
+	check_census_query("kind = t0", NULL, not_in_p1_of_t0);
+
+	fail_unless(storage_get(INDEXTABLE, "k1", &r, test_conn) == 0, "Error getting a record.");
+	fail_unless(strcmp(r.value, "name n1,year 1901,province p1,kind t9") == 0,
+		"Changed the wrong columns.");
+	fail_unless(r.metadata[0] == 2, "A change should be a new version.");
+
+	fail_unless(storage_update_where(INDEXTABLE, "province = p9", "kind t9", test_conn) == 0,
+		"Changed records that do not match.");
+}
+END_TEST
+
+START_TEST (test_bulk_engines)
+{
+	fail_unless(set_value(LSMTABLE, KEY, "name c,year 1") == 0, "Error setting a record.");
+	fail_unless(set_value(LOCKFREETABLE, KEY, "name c,year 1") == 0, "Error setting a record.");
+
+	fail_unless(storage_delete_where(LSMTABLE, "year = 1", test_conn) == -1 &&
+		errno == ERR_INVALID_PARAM, "The LSM engine took a DELETE WHERE.");
+	fail_unless(storage_update_where(LOCKFREETABLE, "year = 1", "year 2", test_conn) == -1 &&
+		errno == ERR_INVALID_PARAM, "The lock-free engine took an UPDATE WHERE.");
+}
+END_TEST
+
+
+/*
+ * Concurrent read-modify-write tests, on the LSM and lock-free engines:
+ * 	concurrent INCRs of a key lose no increment (pass)
+ * 	a key deleted and set again is not lost to a concurrent INCR (pass)
+ * 	a key deleted is not brought back by a concurrent UPDATE (pass)
+ */
+
+/**
+ * @brief What each client of a concurrent test does.
+ *
+ * The client library keeps whether it is connected and authenticated for
+ * all connections, so the connections are opened before the clients start,
+ * and closed after the results are checked.
+ */
+struct client {
+	const char *table;
+	void *conn;
+	/// Set if a command failed.
+	int failed;
+	/// Set by the test to stop the client.
+	volatile int stop;
+};
+
+/**
+ * @brief Connect the clients of a concurrent test to a table.
+ */
+void start_clients(struct client *clients, const char *table)
+{
+	int i;
+
+	for (i = 0; i < THREADS; i++) {
+		clients[i].table = table;
+		clients[i].conn = connect_auth();
+		clients[i].failed = 0;
+		clients[i].stop = 0;
+		fail_unless(clients[i].conn != NULL, "Couldn't connect a client.");
+	}
+}
+
+/**
+ * @brief Disconnect the clients of a concurrent test.
+ */
+void stop_clients(struct client *clients)
+{
+	int i;
+
+	for (i = 0; i < THREADS; i++)
+		storage_disconnect(clients[i].conn);
+}
+
+/**
+ * @brief Increment the year of the key ROUNDS times.
+ */
+void *incr_main(void *arg)
+{
+	struct client *c = arg;
+	void *conn = c->conn;
+	int i, result;
+
+	for (i = 0; i < ROUNDS; i++)
+		if (storage_apply(c->table, KEY, "year", STORAGE_INCR, 1, &result, conn) != 0)
+			c->failed = 1;
+
+	return NULL;
+}
+
+/**
+ * @brief Increment or update the key until stopped, whether it exists or not.
+ */
+void *change_main(void *arg)
+{
+	struct client *c = arg;
+	void *conn = c->conn;
+	int i, result;
+
+	for (i = 0; !c->stop; i++) {
+		if (i % 2 == 0)
+			storage_apply(c->table, KEY, "year", STORAGE_INCR, 1, &result, conn);
+		else
+			storage_update(c->table, KEY, "name changed", 0, conn);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Run THREADS clients that INCR one key, and check the sum.
+ */
+void check_concurrent_incr(const char *table)
+{
+	struct client clients[THREADS];
+	pthread_t threads[THREADS];
+	struct storage_record r;
+	char value[MAX_VALUE_LEN];
+	int i;
+
+	fail_unless(set_value(table, KEY, "name c,year 0") == 0, "Error setting a record.");
+
+	start_clients(clients, table);
+	for (i = 0; i < THREADS; i++)
+		fail_unless(pthread_create(&threads[i], NULL, incr_main, &clients[i]) == 0,
+			"Error starting a client.");
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < THREADS; i++)
+		fail_unless(clients[i].failed == 0, "An INCR failed.");
+
+	snprintf(value, sizeof value, "name c,year %d", THREADS * ROUNDS);
+	fail_unless(storage_get(table, KEY, &r, test_conn) == 0, "Error getting the record.");
+	fail_unless(strcmp(r.value, value) == 0, "An increment was lost.");
+	fail_unless(r.metadata[0] == 1 + THREADS * ROUNDS, "Every increment should be a new version.");
+
+	stop_clients(clients);
+}
+
+/**
+ * @brief Delete the key and set it again while other clients INCR and
+ * UPDATE it, and check that it is never brought back or lost.
+ */
+void check_concurrent_delete(const char *table)
+{
+	struct client clients[THREADS];
+	pthread_t threads[THREADS];
+	struct storage_record r;
+	int i, lost = 0, back = 0;
+
+	fail_unless(set_value(table, KEY, "name c,year 0") == 0, "Error setting a record.");
+
+	start_clients(clients, table);
+	for (i = 0; i < THREADS; i++)
+		fail_unless(pthread_create(&threads[i], NULL, change_main, &clients[i]) == 0,
+			"Error starting a client.");
+
+	for (i = 0; i < ROUNDS; i++) {
+		fail_unless(storage_set(table, KEY, NULL, test_conn) == 0, "Error deleting the record.");
+		if (storage_get(table, KEY, &r, test_conn) == 0)
+			back++;
+		fail_unless(set_value(table, KEY, "name c,year 0") == 0, "Error setting the record again.");
+		if (storage_get(table, KEY, &r, test_conn) != 0)
+			lost++;
+	}
+
+	for (i = 0; i < THREADS; i++)
+		clients[i].stop = 1;
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	fail_unless(back == 0, "A deleted key was brought back by a change.");
+	fail_unless(lost == 0, "A key set again was deleted by a change.");
+
+	stop_clients(clients);
+}
+
+START_TEST (test_concurrent_incr_lsm)
+{
+	check_concurrent_incr(LSMTABLE);
+}
+END_TEST
+
+START_TEST (test_concurrent_incr_lockfree)
+{
+	check_concurrent_incr(LOCKFREETABLE);
+}
+END_TEST
+
+START_TEST (test_concurrent_delete_lsm)
+{
+	check_concurrent_delete(LSMTABLE);
+}
+END_TEST
+
+START_TEST (test_concurrent_delete_lockfree)
+{
+	check_concurrent_delete(LOCKFREETABLE);
+}
+END_TEST
+
+
+/*
+ * Truncate and drop tests:
+ * 	a truncated hash table has no records, and takes new ones (pass)
+ * 	truncating a table empties its spill file (pass)
+ * 	truncated LSM and lock-free tables have no records, and take new ones (pass)
+ * 	a version read before a TRUNCATE matches no record after it (fail)
+ * 	a table truncated while clients change it stays usable (pass)
+ * 	a dropped table is not found (fail)
+ * 	a dropped LSM table has its files deleted (pass)
+ */
+
+/**
+ * @brief Get the size of a file.
+ *
+ * @return Returns the size, or -1 if the file does not exist.
+ */
+long file_size(const char *path)
+{
+	struct stat st;
+
+	return stat(path, &st) == 0 ? (long) st.st_size : -1;
+}
+
+START_TEST (test_truncate_hash)
+{
+	struct storage_record r;
+
+	fill_census();
+	fail_unless(storage_truncate(INDEXTABLE, test_conn) == 0, "Error truncating the table.");
+
+	fail_unless(storage_query(INDEXTABLE, "year > 1899", NULL, 0, test_conn) == 0,
+		"A truncated table has records.");
+	fail_unless(storage_get(INDEXTABLE, "k1", &r, test_conn) == -1 && errno == ERR_KEY_NOT_FOUND,
+		"Got a record of a truncated table.");
+
+	fail_unless(set_value(INDEXTABLE, "k1", "name n1,year 1995,province p1,kind t1") == 0,
+		"Error setting a record again.");
+	fail_unless(storage_query(INDEXTABLE, "year > 1990", NULL, 0, test_conn) == 1,
+		"The index of a truncated table is wrong.");
+	fail_unless(storage_get(INDEXTABLE, "k1", &r, test_conn) == 0, "Error getting the record.");
+	fail_unless(r.metadata[0] > 1, "A version was given out again.");
+}
+END_TEST
+
+START_TEST (test_truncate_spill)
+{
+	struct storage_stats stats;
+	struct storage_record r;
+	char key[MAX_KEY_LEN], value[MAX_VALUE_LEN];
+	int i;
+
+	for (i = 0; i < COLDRECORDS; i++) {
+		snprintf(key, sizeof key, "k%d", i);
+		fail_unless(set_value(COLDTABLE, key, "name old,year 1") == 0, "Error setting a record.");
+	}
+	fail_unless(file_size(COLDFILE) > 0, "No record was spilled.");
+
+	fail_unless(storage_truncate(COLDTABLE, test_conn) == 0, "Error truncating the table.");
+	fail_unless(file_size(COLDFILE) == 0, "The spill file was not emptied.");
+	fail_unless(storage_stats(COLDTABLE, &stats, test_conn) == 0, "Error getting the stats.");
+	fail_unless(stats.resident == 0 && stats.spilled == 0, "A truncated table has records.");
+
+	// the values spilled again are written where the old ones were
+	for (i = 0; i < COLDRECORDS; i++) {
+		snprintf(key, sizeof key, "k%d", i);
+		snprintf(value, sizeof value, "name c%d,year %d", i, i);
+		fail_unless(set_value(COLDTABLE, key, value) == 0, "Error setting a record again.");
+	}
+	fail_unless(storage_stats(COLDTABLE, &stats, test_conn) == 0, "Error getting the stats.");
+	fail_unless(stats.spilled > 0, "No record was spilled again.");
+
+	for (i = 0; i < COLDRECORDS; i++) {
+		snprintf(key, sizeof key, "k%d", i);
+		snprintf(value, sizeof value, "name c%d,year %d", i, i);
+		fail_unless(storage_get(COLDTABLE, key, &r, test_conn) == 0, "Error getting a record.");
+		fail_unless(strcmp(r.value, value) == 0, "Got the wrong value.");
+	}
+}
+END_TEST
+
+/**
+ * @brief Truncate a table on the LSM or lock-free engine, and check that
+ * its records and versions are gone.
+ */
+void check_truncate_storage(const char *table)
+{
+	struct storage_record r;
+	int i;
+
+	fail_unless(set_value(table, KEY, "name c,year 0") == 0, "Error setting a record.");
+	for (i = 0; i < 2; i++)
+		fail_unless(storage_update(table, KEY, "name changed", 0, test_conn) == 0,
+			"Error updating the record.");
+	fail_unless(set_value(table, "other", "name c,year 0") == 0, "Error setting a record.");
+
+	fail_unless(storage_truncate(table, test_conn) == 0, "Error truncating the table.");
+	fail_unless(storage_get(table, KEY, &r, test_conn) == -1 && errno == ERR_KEY_NOT_FOUND,
+		"Got a record of a truncated table.");
+	fail_unless(storage_query(table, "year = 0", NULL, 0, test_conn) == 0,
+		"A truncated table has records.");
+
+	// the record is set again, and then changed with the version read
+	// before the TRUNCATE
+	fail_unless(set_value(table, KEY, "name new,year 1") == 0, "Error setting the record again.");
+	fail_unless(storage_get(table, KEY, &r, test_conn) == 0, "Error getting the record.");
+	fail_unless(r.metadata[0] > 3, "A version was given out again.");
+
+	strncpy(r.value, "name stale,year 2", sizeof r.value);
+	r.metadata[0] = 3;
+	fail_unless(storage_set(table, KEY, &r, test_conn) == -1 && errno == ERR_TRANSACTION_ABORT,
+		"A version read before the TRUNCATE matched.");
+}
+
+START_TEST (test_truncate_lsm)
+{
+	struct storage_stats stats;
+
+	check_truncate_storage(LSMTABLE);
+	fail_unless(storage_stats(LSMTABLE, &stats, test_conn) == 0, "Error getting the stats.");
+	fail_unless(stats.resident == 1 && stats.spilled == 0, "The old records are still stored.");
+}
+END_TEST
+
+START_TEST (test_truncate_lockfree)
+{
+	check_truncate_storage(LOCKFREETABLE);
+}
+END_TEST
+
+/**
+ * @brief Truncate a table again and again while clients INCR and UPDATE
+ * a key of it, and check that it is still usable.
+ */
+void check_truncate_concurrent(const char *table)
+{
+	struct client clients[THREADS];
+	pthread_t threads[THREADS];
+	struct storage_record r;
+	int i;
+
+	start_clients(clients, table);
+	for (i = 0; i < THREADS; i++)
+		fail_unless(pthread_create(&threads[i], NULL, change_main, &clients[i]) == 0,
+			"Error starting a client.");
+
+	for (i = 0; i < TRUNCATES; i++) {
+		fail_unless(set_value(table, KEY, "name c,year 0") == 0, "Error setting the record.");
+		fail_unless(storage_truncate(table, test_conn) == 0, "Error truncating the table.");
+	}
+
+	for (i = 0; i < THREADS; i++)
+		clients[i].stop = 1;
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	fail_unless(set_value(table, KEY, "name c,year 0") == 0, "Error setting the record.");
+	fail_unless(storage_get(table, KEY, &r, test_conn) == 0 && strcmp(r.value, "name c,year 0") == 0,
+		"Error getting the record.");
+
+	stop_clients(clients);
+}
+
+START_TEST (test_truncate_concurrent_lsm)
+{
+	check_truncate_concurrent(LSMTABLE);
+}
+END_TEST
+
+START_TEST (test_truncate_concurrent_lockfree)
+{
+	check_truncate_concurrent(LOCKFREETABLE);
+}
+END_TEST
+
+START_TEST (test_drop)
+{
+	struct storage_record r;
+
+	fill_census();
+	fail_unless(set_value(LSMTABLE, KEY, "name c,year 0") == 0, "Error setting a record.");
+	fail_unless(set_value(LOCKFREETABLE, KEY, "name c,year 0") == 0, "Error setting a record.");
+	fail_unless(file_size(LSMDIR) >= 0, "The LSM table has no directory.");
+
+	fail_unless(storage_drop(INDEXTABLE, test_conn) == 0, "Error dropping a table.");
+	fail_unless(storage_drop(LSMTABLE, test_conn) == 0, "Error dropping a table.");
+	fail_unless(storage_drop(LOCKFREETABLE, test_conn) == 0, "Error dropping a table.");
+
+	fail_unless(storage_get(INDEXTABLE, "k1", &r, test_conn) == -1 && errno == ERR_TABLE_NOT_FOUND,
+		"Found a dropped table.");
+	fail_unless(storage_query(INDEXTABLE, "year > 1899", NULL, 0, test_conn) == -1 &&
+		errno == ERR_TABLE_NOT_FOUND, "Queried a dropped table.");
+	fail_unless(storage_get(LSMTABLE, KEY, &r, test_conn) == -1 && errno == ERR_TABLE_NOT_FOUND,
+		"Found a dropped table.");
+	fail_unless(storage_get(LOCKFREETABLE, KEY, &r, test_conn) == -1 && errno == ERR_TABLE_NOT_FOUND,
+		"Found a dropped table.");
+	fail_unless(set_value(LOCKFREETABLE, KEY, "name c,year 0") == -1 && errno == ERR_TABLE_NOT_FOUND,
+		"Set a record of a dropped table.");
+
+	fail_unless(file_size(LSMDIR) == -1, "The files of a dropped LSM table were kept.");
+}
+END_TEST
+
+
+/**
+ * @brief This runs the tests of the server's storage and commands.
+ */
+int main(int argc, char *argv[])
+{
+	if(argc == 2)
+		server_port = atoi(argv[1]);
+	else
+		server_port = SERVERPORT;
+	printf("Using server port: %d.\n", server_port);
+	Suite *s = suite_create("server");
+	TCase *tc;
+	int failed;
+
+	// Spill tests
+	tc = tcase_create("spill");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_checked_fixture(tc, test_setup, test_teardown);
+	tcase_add_test(tc, test_spill_readback);
+	tcase_add_test(tc, test_spill_change);
+	suite_add_tcase(s, tc);
+
+	// Index tests
+	tc = tcase_create("index");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_checked_fixture(tc, test_setup, test_teardown);
+	tcase_add_test(tc, test_index_range);
+	tcase_add_test(tc, test_index_equality);
+	tcase_add_test(tc, test_index_bitmap);
+	tcase_add_test(tc, test_index_change);
+	suite_add_tcase(s, tc);
+
+	// Cursor tests
+	tc = tcase_create("cursor");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_checked_fixture(tc, test_setup, test_teardown);
+	tcase_add_test(tc, test_cursor_paging);
+	tcase_add_test(tc, test_cursor_limit);
+	tcase_add_test(tc, test_cursor_timeout);
+	suite_add_tcase(s, tc);
+
+	// Group tests
+	tc = tcase_create("group");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_checked_fixture(tc, test_setup, test_teardown);
+	tcase_add_test(tc, test_group_column);
+	tcase_add_test(tc, test_group_columns);
+	tcase_add_test(tc, test_group_predicates);
+	suite_add_tcase(s, tc);
+
+	// Join tests
+	tc = tcase_create("join");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_checked_fixture(tc, test_setup, test_teardown);
+	tcase_add_test(tc, test_join_pairs);
+	tcase_add_test(tc, test_join_columns);
+	tcase_add_test(tc, test_join_large);
+	suite_add_tcase(s, tc);
+
+	// Bulk change tests
+	tc = tcase_create("bulk");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_checked_fixture(tc, test_setup, test_teardown);
+	tcase_add_test(tc, test_bulk_delete);
+	tcase_add_test(tc, test_bulk_update);
+	tcase_add_test(tc, test_bulk_engines);
+	suite_add_tcase(s, tc);
+
+	// Concurrent read-modify-write tests
+	tc = tcase_create("concurrent");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_checked_fixture(tc, test_setup, test_teardown);
+	tcase_add_test(tc, test_concurrent_incr_lsm);
+	tcase_add_test(tc, test_concurrent_incr_lockfree);
+	tcase_add_test(tc, test_concurrent_delete_lsm);
+	tcase_add_test(tc, test_concurrent_delete_lockfree);
+	suite_add_tcase(s, tc);
+
+	// Truncate and drop tests
+	tc = tcase_create("truncate");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_checked_fixture(tc, test_setup, test_teardown);
+	tcase_add_test(tc, test_truncate_hash);
+	tcase_add_test(tc, test_truncate_spill);
+	tcase_add_test(tc, test_truncate_lsm);
+	tcase_add_test(tc, test_truncate_lockfree);
+	tcase_add_test(tc, test_truncate_concurrent_lsm);
+	tcase_add_test(tc, test_truncate_concurrent_lockfree);
+	tcase_add_test(tc, test_drop);
+	suite_add_tcase(s, tc);
+
+	SRunner *sr = srunner_create(s);
+	srunner_set_log(sr, "results.log");
+	srunner_run_all(sr, CK_ENV);
+	failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}